@@ -110,18 +110,22 @@ void Control::run()
 	mAutomaton->save("genetic.neuron");
 }
 
+// The synapses are replaced in one edit, so that each is compiled once and
+// the spike trains are only recalculated at the end.
 void Control::applyDna()
 {
+	Automaton::Edit edit(*mAutomaton);
+	auto layers = mAutomaton->layers();
 	for (int lnum = 0; lnum < NUM_LAYERS; ++lnum)
 	{
-		auto layer = mAutomaton->layers()[lnum];
+		auto layer = layers[lnum];
 		layer->setConfig(mCurrent.layers[lnum].config);
 		layer->setSpike(Spike::SHAPE_SQUARE, mCurrent.layers[lnum].spikeDuration);
 	}
 
-	while (!mAutomaton->synapses().empty())
+	for (auto & synapses : mAutomaton->synapses())
 	{
-		mAutomaton->removeSynapse(mAutomaton->synapses().back());
+		mAutomaton->removeSynapse(synapses);
 	}
 
 	// Make synapses
@@ -133,12 +137,13 @@ void Control::applyDna()
 			auto synapses = mAutomaton->createSynapse();
 			synapses->setSize(SYNAPSE_WIDTH, SYNAPSE_HEIGHT);
 			synapses->setDelay(SynapseMatrix::DELAY_NONE);
-			synapses->setSource(mAutomaton->layers()[l1]);
-			synapses->setTarget(mAutomaton->layers()[l2]);
+			synapses->setSource(layers[l1]);
+			synapses->setTarget(layers[l2]);
 			synapses->loadImage(&data->pixels[0], SYNAPSE_WIDTH, SYNAPSE_HEIGHT, data->weight);
 			++data;
 		}
 	}
+	edit.commit();
 }
 
 void Control::evaluate()
@@ -44,6 +44,7 @@ SynapseConfig::SynapseConfig(shared_ptr<Automaton> automaton, shared_ptr<Synapse
 	ui.cmbDelays->setCurrentText(QString::number(mSynapses->delay()));
 	ui.spinWeight->setValue(mSynapses->weight());
 	ui.cmbType->setCurrentIndex(mSynapses->isShunt() ? 1 : 0);
+	updatePruned();
 
 	connect(this, &QGroupBox::toggled, this, [this]() { ui.panel->setVisible(isChecked()); });
 	connect(ui.cmbSynapse, &QComboBox::currentTextChanged, this, [this]() { synapseChanged(true); });
@@ -100,6 +101,7 @@ void SynapseConfig::synapseChanged(bool update)
 		{
 			uint32_t * pixels = reinterpret_cast<uint32_t *>(image.bits());
 			mSynapses->loadImage(pixels, image.width(), image.height(), weight, ui.cmbSynapse->currentText().toStdString());
+			updatePruned();
 		}
 		ui.cmbDelays->setEnabled(true);
 		ui.spinWeight->setEnabled(true);
@@ -129,6 +131,17 @@ void SynapseConfig::delaysChanged()
 	}
 }
 
+// Synapses with zero weights are pruned when the matrix is compiled, and
+// only the rest cost anything to fire.
+void SynapseConfig::updatePruned()
+{
+	auto & stencil = mSynapses->stencil();
+	ui.lblPruned->setText(QString("%1% (%2 of %3 synapses active)")
+		.arg(double(stencil.prunedFraction()) * 100.0, 0, 'f', 1)
+		.arg(stencil.activeSynapses())
+		.arg(stencil.synapseCount()));
+}
+
 void SynapseConfig::typeChanged()
 {
 	if (ui.cmbType->currentText() == "Shunting")
@@ -22,6 +22,7 @@ public:
 	void targetChanged();
 	void typeChanged();
 	void delaysChanged();
+	void updatePruned();
 	std::shared_ptr<SynapseMatrix> synapses() { return mSynapses; }
 
 private:
@@ -1,6 +1,8 @@
 #ifndef VEC3F_H
 #define VEC3F_H
 
+#include <cmath>
+
 #include "NeuronSim/Constants.h"
 
 class Vec3f
@@ -0,0 +1,38 @@
+#include <iostream>
+
+#include "NeuronSim/Log.h"
+#include "Runner.h"
+
+// Main entry point
+// Runs one saved automaton with the options given on the command line and
+// exits. Returns non zero if the arguments are wrong or the run fails, so
+// that batch scripts can tell.
+int main(int argc, char ** argv)
+{
+	RunOptions options;
+	try
+	{
+		options = Runner::parse(argc, argv);
+	}
+	catch (const std::runtime_error & re)
+	{
+		std::cerr << re.what() << "\n\n" << Runner::usage();
+		return 2;
+	}
+
+	try
+	{
+		Log::to(options.log.string());
+		Runner runner(options);
+		runner.run();
+	}
+	catch (const std::runtime_error & re)
+	{
+		LOG("Run failed with [" << re.what() << "]");
+		std::cerr << "Run failed with [" << re.what() << "]\n";
+		return 1;
+	}
+	Log::finish();
+
+	return 0;
+}
@@ -0,0 +1,467 @@
+#include "Runner.h"
+
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+
+#include "NeuronSim/Exception.h"
+#include "NeuronSim/Layer.h"
+#include "NeuronSim/Log.h"
+
+using namespace std;
+
+RunOptions::RunOptions() :
+	ticks(100),
+	threads(0),
+	scheduler(Automaton::SCHEDULER_POOL),
+	propagation(Automaton::PROPAGATION_SCATTER),
+	accumulation(Automaton::ACCUMULATE_PER_PAIR),
+	balancing(Automaton::BALANCE_BY_ROWS),
+	precision(PRECISION_FLOAT),
+	neuronPrecision(PRECISION_FLOAT),
+	encoding(SynapseMatrix::ENCODING_FLOAT),
+	fft(Automaton::FFT_NEVER),
+	log("NeuronCli.log"),
+	quiet(false)
+{
+
+}
+
+Runner::Runner(const RunOptions & options) :
+	mOptions(options)
+{
+
+}
+
+Runner::~Runner()
+{
+
+}
+
+// Convert an argument to an int, insisting that the whole of it is a number.
+static int parseInt(const string & name, const string & value)
+{
+	char * end = nullptr;
+	long result = strtol(value.c_str(), &end, 10);
+	if (value.empty() || *end != '\0' || result < 0)
+	{
+		NEURONTHROW("Expected a whole number for [" << name << "] but got [" << value << "]");
+	}
+	return int(result);
+}
+
+// Convert an argument to one of the precisions.
+static Precision parsePrecision(const string & value)
+{
+	if (value == "float")
+	{
+		return PRECISION_FLOAT;
+	}
+	else if (value == "half")
+	{
+		return PRECISION_HALF;
+	}
+	else if (value == "bfloat16")
+	{
+		return PRECISION_BFLOAT16;
+	}
+	else if (value == "fixed16")
+	{
+		return PRECISION_FIXED16;
+	}
+	NEURONTHROW("Unknown precision [" << value << "]");
+}
+
+RunOptions Runner::parse(int argc, char ** argv)
+{
+	RunOptions options;
+	for (int index = 1; index < argc; ++index)
+	{
+		string arg = argv[index];
+		if (arg.size() < 2 || arg.substr(0, 2) != "--")
+		{
+			if (!options.automaton.empty())
+			{
+				NEURONTHROW("Only one automaton can be run, but got [" << options.automaton << "] and [" << arg << "]");
+			}
+			options.automaton = arg;
+			continue;
+		}
+		if (arg == "--quiet")
+		{
+			options.quiet = true;
+			continue;
+		}
+		if (index + 1 >= argc)
+		{
+			NEURONTHROW("Missing value for [" << arg << "]");
+		}
+		string value = argv[++index];
+		if (arg == "--ticks")
+		{
+			options.ticks = parseInt(arg, value);
+		}
+		else if (arg == "--threads")
+		{
+			options.threads = parseInt(arg, value);
+		}
+		else if (arg == "--scheduler")
+		{
+			if (value == "thread")
+			{
+				options.scheduler = Automaton::SCHEDULER_THREAD_PER_LAYER;
+			}
+			else if (value == "pool")
+			{
+				options.scheduler = Automaton::SCHEDULER_POOL;
+			}
+			else if (value == "fused")
+			{
+				options.scheduler = Automaton::SCHEDULER_FUSED;
+			}
+			else
+			{
+				NEURONTHROW("Unknown scheduler [" << value << "]");
+			}
+		}
+		else if (arg == "--propagation")
+		{
+			if (value == "scatter")
+			{
+				options.propagation = Automaton::PROPAGATION_SCATTER;
+			}
+			else if (value == "gather")
+			{
+				options.propagation = Automaton::PROPAGATION_GATHER;
+			}
+			else
+			{
+				NEURONTHROW("Unknown propagation [" << value << "]");
+			}
+		}
+		else if (arg == "--accumulation")
+		{
+			if (value == "pair")
+			{
+				options.accumulation = Automaton::ACCUMULATE_PER_PAIR;
+			}
+			else if (value == "target")
+			{
+				options.accumulation = Automaton::ACCUMULATE_PER_TARGET;
+			}
+			else if (value == "history")
+			{
+				options.accumulation = Automaton::ACCUMULATE_HISTORY;
+			}
+			else
+			{
+				NEURONTHROW("Unknown accumulation [" << value << "]");
+			}
+		}
+		else if (arg == "--balancing")
+		{
+			if (value == "rows")
+			{
+				options.balancing = Automaton::BALANCE_BY_ROWS;
+			}
+			else if (value == "activity")
+			{
+				options.balancing = Automaton::BALANCE_BY_ACTIVITY;
+			}
+			else
+			{
+				NEURONTHROW("Unknown balancing [" << value << "]");
+			}
+		}
+		else if (arg == "--precision")
+		{
+			options.precision = parsePrecision(value);
+		}
+		else if (arg == "--neuron-precision")
+		{
+			options.neuronPrecision = parsePrecision(value);
+		}
+		else if (arg == "--synapses")
+		{
+			if (value == "float")
+			{
+				options.encoding = SynapseMatrix::ENCODING_FLOAT;
+			}
+			else if (value == "compact")
+			{
+				options.encoding = SynapseMatrix::ENCODING_COMPACT;
+			}
+			else
+			{
+				NEURONTHROW("Unknown synapse encoding [" << value << "]");
+			}
+		}
+		else if (arg == "--fft")
+		{
+			if (value == "never")
+			{
+				options.fft = Automaton::FFT_NEVER;
+			}
+			else if (value == "auto")
+			{
+				options.fft = Automaton::FFT_AUTO;
+			}
+			else if (value == "always")
+			{
+				options.fft = Automaton::FFT_ALWAYS;
+			}
+			else
+			{
+				NEURONTHROW("Unknown fft policy [" << value << "]");
+			}
+		}
+		else if (arg == "--input")
+		{
+			options.input = value;
+		}
+		else if (arg == "--spikes")
+		{
+			options.spikes = value;
+		}
+		else if (arg == "--stats")
+		{
+			options.stats = value;
+		}
+		else if (arg == "--save")
+		{
+			options.save = value;
+		}
+		else if (arg == "--log")
+		{
+			options.log = value;
+		}
+		else
+		{
+			NEURONTHROW("Unknown option [" << arg << "]");
+		}
+	}
+	if (options.automaton.empty())
+	{
+		NEURONTHROW("No automaton given");
+	}
+	return options;
+}
+
+string Runner::usage()
+{
+	return
+		"Usage: NeuronCli <automaton.neuron> [options]\n"
+		"  --ticks <n>              number of ticks to run (default 100)\n"
+		"  --threads <n>            number of threads, 0 for one per hardware thread (default 0)\n"
+		"  --scheduler <s>          thread, pool or fused (default pool)\n"
+		"  --propagation <p>        scatter or gather (default scatter)\n"
+		"  --accumulation <a>       pair, target or history (default pair)\n"
+		"  --balancing <b>          rows or activity (default rows)\n"
+		"  --precision <p>          spike frame storage: float, half, bfloat16 or fixed16 (default float)\n"
+		"  --neuron-precision <p>   neuron state storage: float, half, bfloat16 or fixed16 (default float)\n"
+		"  --synapses <e>           synapse storage: float or compact, firing 8 bit weights (default float)\n"
+		"  --fft <f>                convolve synapse matrices using FFTs: never, auto or always (default never)\n"
+		"  --input <file>           inject spikes from lines of <tick> <col> <row> <weight> <layer>\n"
+		"  --spikes <file>          write a line of <tick> <col> <row> <layer> for every spike fired\n"
+		"  --stats <file>           write a csv of the time, thread imbalance and firing count of each layer per tick\n"
+		"  --save <file.neuron>     save the final state of the automaton\n"
+		"  --log <file>             log file (default NeuronCli.log)\n"
+		"  --quiet                  do not print a summary when finished\n";
+}
+
+void Runner::run()
+{
+	mAutomaton = make_unique<Automaton>();
+	mAutomaton->load(mOptions.automaton);
+	mAutomaton->setThreadCount(mOptions.threads);
+	mAutomaton->setScheduler(mOptions.scheduler);
+	mAutomaton->setPropagation(mOptions.propagation);
+	mAutomaton->setAccumulation(mOptions.accumulation);
+	mAutomaton->setBalancing(mOptions.balancing);
+	mAutomaton->setPrecision(mOptions.precision);
+	mAutomaton->setNeuronPrecision(mOptions.neuronPrecision);
+	mAutomaton->setSynapseEncoding(mOptions.encoding);
+	mAutomaton->setFftPolicy(mOptions.fft);
+	readInput();
+
+	if (!mOptions.spikes.empty())
+	{
+		mSpikes.open(mOptions.spikes);
+		if (!mSpikes)
+		{
+			NEURONTHROW("Unable to write spikes to [" << mOptions.spikes << "]");
+		}
+	}
+	if (!mOptions.stats.empty())
+	{
+		mStats.open(mOptions.stats);
+		if (!mStats)
+		{
+			NEURONTHROW("Unable to write stats to [" << mOptions.stats << "]");
+		}
+		mStats << "tick,ms,imbalance";
+		for (auto & layer : mAutomaton->layers())
+		{
+			mStats << ",\"" << layer->name() << "\"";
+		}
+		mStats << "\n";
+	}
+
+	int64_t neurons = 0;
+	for (auto & layer : mAutomaton->layers())
+	{
+		neurons += int64_t(layer->width()) * layer->height();
+	}
+	int64_t fired = 0;
+	double totalMs = 0.0;
+	double totalImbalance = 0.0;
+	for (int tick = 0; tick < mOptions.ticks; ++tick)
+	{
+		inject(tick);
+		auto start = chrono::steady_clock::now();
+		mAutomaton->tick();
+		double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		totalMs += ms;
+		totalImbalance += mAutomaton->imbalance();
+		for (auto & layer : mAutomaton->layers())
+		{
+			fired += layer->firingCount();
+		}
+		writeSpikes(tick);
+		writeStats(tick, ms);
+	}
+
+	if (!mOptions.save.empty())
+	{
+		mAutomaton->save(mOptions.save);
+	}
+
+	LOG("Ran [" << mOptions.automaton << "] for " << mOptions.ticks << " ticks in " << totalMs << "ms");
+	if (!mOptions.quiet)
+	{
+		double seconds = totalMs / 1000.0;
+		cout << "Automaton  : " << mOptions.automaton.string() << "\n";
+		cout << "Layers     : " << mAutomaton->layers().size() << " (" << neurons << " neurons)\n";
+		cout << "Threads    : " << mAutomaton->threadCount() << "\n";
+		cout << "Ticks      : " << mOptions.ticks << "\n";
+		cout << "Time       : " << totalMs << " ms (" << (mOptions.ticks ? totalMs / mOptions.ticks : 0.0) << " ms per tick)\n";
+		cout << "Spikes     : " << fired << "\n";
+		cout << "In transit : " << mAutomaton->transitBytes() / 1024 << " KB\n";
+		if (mOptions.ticks > 0 && mOptions.scheduler != Automaton::SCHEDULER_THREAD_PER_LAYER)
+		{
+			cout << "Imbalance  : " << totalImbalance / mOptions.ticks << " (busiest thread / mean thread time per tick)\n";
+		}
+		if (seconds > 0.0)
+		{
+			cout << "Throughput : " << double(neurons) * mOptions.ticks / seconds / 1.0e6 << " million neuron updates per second\n";
+		}
+		for (auto & synapses : mAutomaton->synapses())
+		{
+			auto & stencil = synapses->stencil();
+			cout << "Synapses   : " << synapses->sourceName() << " -> " << synapses->targetName() << ", "
+				<< synapses->width() << "x" << synapses->height() << ", " << stencil.activeSynapses() << " active ("
+				<< stencil.prunedFraction() * 100.0f << "% pruned)\n";
+		}
+	}
+}
+
+void Runner::readInput()
+{
+	if (mOptions.input.empty())
+	{
+		return;
+	}
+	ifstream ifs(mOptions.input);
+	if (!ifs)
+	{
+		NEURONTHROW("Unable to read input from [" << mOptions.input << "]");
+	}
+	string line;
+	int lineNumber = 0;
+	while (getline(ifs, line))
+	{
+		++lineNumber;
+		stringstream str(line);
+		string first;
+		if (!(str >> first) || first[0] == '#')
+		{
+			continue;
+		}
+		int tick = parseInt("tick", first);
+		Injection injection;
+		string name;
+		if (!(str >> injection.col >> injection.row >> injection.weight))
+		{
+			NEURONTHROW("Unable to read line " << lineNumber << " of [" << mOptions.input << "]");
+		}
+		getline(str >> ws, name);
+		while (!name.empty() && isspace((unsigned char)name.back()))
+		{
+			name.pop_back();
+		}
+		auto layer = mAutomaton->findLayer(name);
+		if (!layer)
+		{
+			NEURONTHROW("Line " << lineNumber << " of [" << mOptions.input << "] refers to unknown layer [" << name << "]");
+		}
+		if (injection.col < 0 || injection.col >= layer->width() || injection.row < 0 || injection.row >= layer->height())
+		{
+			NEURONTHROW("Line " << lineNumber << " of [" << mOptions.input << "] is outside layer [" << name << "]");
+		}
+		injection.layer = layer.get();
+		mInjections.insert({ tick, injection });
+	}
+	LOG("Read " << mInjections.size() << " spikes to inject from [" << mOptions.input << "]");
+}
+
+void Runner::inject(int tick)
+{
+	auto range = mInjections.equal_range(tick);
+	for (auto it = range.first; it != range.second; ++it)
+	{
+		it->second.layer->inject(it->second.col, it->second.row, it->second.weight);
+	}
+}
+
+// Layers only report their spikes as an image, in which firing neurons are
+// painted white.
+void Runner::writeSpikes(int tick)
+{
+	if (!mSpikes.is_open())
+	{
+		return;
+	}
+	for (auto & layer : mAutomaton->layers())
+	{
+		if (!layer->firingCount())
+		{
+			continue;
+		}
+		int width = layer->width();
+		mImage.resize(size_t(width) * layer->height());
+		layer->paintSpikes(mImage.data());
+		for (int index = 0; index < int(mImage.size()); ++index)
+		{
+			if (mImage[index] == 0xFFFFFFFF)
+			{
+				mSpikes << tick << " " << index % width << " " << index / width << " " << layer->name() << "\n";
+			}
+		}
+	}
+}
+
+void Runner::writeStats(int tick, double ms)
+{
+	if (!mStats.is_open())
+	{
+		return;
+	}
+	mStats << tick << "," << ms << "," << mAutomaton->imbalance();
+	for (auto & layer : mAutomaton->layers())
+	{
+		mStats << "," << layer->firingCount();
+	}
+	mStats << "\n";
+}
@@ -0,0 +1,105 @@
+#ifndef RUNNER_H
+#define RUNNER_H
+
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "NeuronSim/Automaton.h"
+
+// The settings for one headless run, normally read from the command line
+// by Runner::parse.
+struct RunOptions
+{
+	RunOptions();
+
+	std::filesystem::path automaton;      //< The saved automaton to load
+	int ticks;                            //< The number of ticks to run
+	int threads;                          //< The number of threads, 0 for one per hardware thread
+	Automaton::Scheduler scheduler;       //< The way ticks are spread over threads
+	Automaton::Propagation propagation;   //< The way spikes are sent along synapses
+	Automaton::Accumulation accumulation; //< How the spikes in transit are stored
+	Automaton::Balancing balancing;       //< How the pooled schedulers split layers into bands
+	Precision precision;                  //< The precision of the dense spike frames
+	Precision neuronPrecision;            //< The precision of the state of the neurons
+	SynapseMatrix::Encoding encoding;     //< How the synapse matrices are stored
+	Automaton::FftPolicy fft;             //< When synapse matrices are convolved using FFTs
+	std::filesystem::path input;          //< Optional text file of spikes to inject
+	std::filesystem::path spikes;         //< Optional text file to write every spike fired to
+	std::filesystem::path stats;          //< Optional csv file of statistics for each tick
+	std::filesystem::path save;           //< Optional path to save the final state to
+	std::filesystem::path log;            //< The log file
+	bool quiet;                           //< Suppress the summary on stdout
+};
+
+// Runner loads a saved automaton and ticks it without any user interface,
+// so that saved models can be run in batches on machines without a display.
+//
+// Input files are plain text with one injected spike per line, in the form
+//   <tick> <col> <row> <weight> <layer name>
+// The spike is injected just before the given tick, counting from 0. The
+// layer name is the rest of the line, since names may contain spaces. Blank
+// lines and lines starting with # are ignored.
+//
+// Spike files are written in the same form, without the weight, with one line
+// for each neuron that fired on each tick.
+//
+// Stats files are csv, with one row per tick giving the time taken, the
+// imbalance between the threads (see Automaton::imbalance) and the number of
+// neurons that fired in each layer.
+class Runner
+{
+public:
+	// Constructor
+	// options - the settings for the run
+	explicit Runner(const RunOptions & options);
+	// Destructor
+	~Runner();
+
+	// Read a set of options from command line arguments. Throws if the
+	// arguments do not make sense.
+	static RunOptions parse(int argc, char ** argv);
+	// Return a description of the command line arguments
+	static std::string usage();
+
+	// Load the automaton, run it, and write out the results
+	void run();
+
+private:
+	// A spike to inject from the input file
+	struct Injection
+	{
+		int col;        //< The column of the neuron
+		int row;        //< The row of the neuron
+		float weight;   //< The weight of the spike
+		Layer * layer;  //< The layer the neuron is in
+	};
+
+	// Read the input file, if there is one, into mInjections
+	void readInput();
+	// Inject the spikes for a tick
+	void inject(int tick);
+	// Write the spikes fired on a tick to the spike file
+	void writeSpikes(int tick);
+	// Write the statistics for a tick to the stats file
+	void writeStats(int tick, double ms);
+
+private:
+	// The settings for the run
+	RunOptions mOptions;
+	// The automaton being run
+	std::unique_ptr<Automaton> mAutomaton;
+	// The spikes to inject, keyed by the tick to inject them before
+	std::multimap<int, Injection> mInjections;
+	// The output file for spikes
+	std::ofstream mSpikes;
+	// The output file for statistics
+	std::ofstream mStats;
+	// A scratch image for reading the spikes from a layer
+	std::vector<uint32_t> mImage;
+};
+
+#endif
@@ -1,18 +1,25 @@
 #include "Automaton.h"
 
+#include <algorithm>
 #include <cassert>
 #include <filesystem>
 #include <fstream>
+#include <map>
 #include <thread>
+#include <tuple>
 
 #include "Constants.h"
 #include "Exception.h"
+#include "Fft.h"
+#include "FftConvolution.h"
+#include "FiringHistory.h"
 #include "Layer.h"
 #include "Log.h"
 #include "LayerFactory.h"
 #include "SpikeTrain.h"
 #include "StreamHelpers.h"
 #include "SynapseMatrix.h"
+#include "ThreadPool.h"
 
 using namespace std;
 
@@ -24,58 +31,968 @@ const uint8_t TAG_HEIGHT('h');
 const uint8_t TAG_SPIKE('s');
 const uint8_t TAG_END('E');
 
+// The pooled scheduler aims for this many bands of rows per layer per thread,
+// so that threads that finish early have something else to pick up.
+const int BANDS_PER_THREAD(4);
+// Bands are never made smaller than this, to keep the per task overhead low.
+const int MIN_BAND_ROWS(8);
+// The fused scheduler works through each band this many rows at a time,
+// which keeps the neurons and spike frames for a tile in cache between
+// delivering, ticking and firing them.
+const int TILE_ROWS(16);
+
 Automaton::Automaton() :
 	mType("Life"),
 	mMode(MODE_NORMAL),
+	mScheduler(SCHEDULER_POOL),
+	mPropagation(PROPAGATION_SCATTER),
+	mAccumulation(ACCUMULATE_PER_PAIR),
+	mBalancing(BALANCE_BY_ROWS),
+	mPrecision(PRECISION_FLOAT),
+	mNeuronPrecision(PRECISION_FLOAT),
+	mSynapseEncoding(SynapseMatrix::ENCODING_FLOAT),
+	mImbalance(0.0f),
+	mPlanChanged(true),
+	mPlanThreads(0),
+	mWaves(1),
+	mFftPolicy(FFT_NEVER),
 	mWidth(DEFAULT_NET_SIZE),
-	mHeight(DEFAULT_NET_SIZE)
+	mHeight(DEFAULT_NET_SIZE),
+	mSpikeTrainsChanged(false),
+	mEditDepth(0)
 {
 	LOG("Creating automaton");
 	mLayerFactory = std::make_unique<LayerFactory>();
+	mPool = std::make_unique<ThreadPool>();
+}
+
+Automaton::~Automaton()
+{
+	LOG("Destroying automaton");
+}
+
+void Automaton::tick()
+{
+	if (mEditDepth > 0)
+	{
+		NEURONTHROW("Invalid use of automaton - ticked during an edit");
+	}
+	if (mAccumulation == ACCUMULATE_HISTORY && any_of(mSpikeTrains.begin(), mSpikeTrains.end(), [](auto & spikeTrain) { return spikeTrain->empty(); }))
+	{
+		mSpikeTrainsChanged = true;
+	}
+	if (mSpikeTrainsChanged)
+	{
+		recalculateSpikeTrains();
+	}
+	if (isPlanStale())
+	{
+		compilePlan();
+	}
+	else if (mBalancing == BALANCE_BY_ACTIVITY && mPlanThreads > 1)
+	{
+		measureCosts();
+		if (isUnbalanced())
+		{
+			planBands();
+			planGraph();
+		}
+	}
+	planConvolutions();
+	mPool->resetBusyTimes();
+	if (mMode == MODE_DEPRESSED)
+	{
+		for (auto & history : mHistories)
+		{
+			history->clear();
+		}
+	}
+	switch (mScheduler)
+	{
+	case SCHEDULER_THREAD_PER_LAYER:
+		tickThreadPerLayer();
+		break;
+	case SCHEDULER_POOL:
+		tickPool();
+		break;
+	default:
+		tickFused();
+		break;
+	}
+	for (auto & history : mHistories)
+	{
+		history->advance();
+	}
+
+	mImbalance = 0.0f;
+	if (mScheduler != SCHEDULER_THREAD_PER_LAYER)
+	{
+		auto times = mPool->busyTimes();
+		double total = 0.0;
+		double busiest = 0.0;
+		for (auto time : times)
+		{
+			total += time;
+			busiest = max(busiest, time);
+		}
+		mImbalance = total > 0.0 ? float(busiest * times.size() / total) : 1.0f;
+	}
+}
+
+void Automaton::tickN(int count)
+{
+	for (int num = 0; num < count; ++num)
+	{
+		tick();
+	}
+}
+
+void Automaton::setThreadCount(int threads)
+{
+	if (threads != mPool->threadCount())
+	{
+		mPool->setThreadCount(threads);
+	}
+}
+
+int Automaton::threadCount() const
+{
+	return mPool->threadCount();
+}
+
+// The original scheduler, retained for comparison. Every phase of every tick
+// creates one thread per layer and then joins them all.
+void Automaton::tickThreadPerLayer()
+{
+	vector<thread> threads;
+
+	if (mMode != MODE_DEPRESSED)
+	{
+		for (size_t index = 0; index < mLayers.size(); ++index)
+		{
+			threads.push_back(thread(&Automaton::tickTargetLayer, this, int(index)));
+		}
+		for (auto & tt : threads)
+		{
+			tt.join();
+		}
+		threads.clear();
+	}
+	else
+	{
+		for (auto spikeTrain : mSpikeTrains)
+		{
+			spikeTrain->clear();
+		}
+	}
+
+	if (mPropagation == PROPAGATION_SCATTER)
+	{
+		for (int wave = 0; wave < mWaves; ++wave)
+		{
+			for (size_t index = 0; index < mLayers.size(); ++index)
+			{
+				if (mLinks[index].wave == wave)
+				{
+					threads.push_back(thread(&Automaton::tickSourceLayer, this, int(index)));
+				}
+			}
+			for (auto & tt : threads)
+			{
+				tt.join();
+			}
+			threads.clear();
+		}
+	}
+	else
+	{
+		// Gathering reads the firing state of every source layer, so all
+		// layers must finish ticking before any of them gathers.
+		for (auto layer : mLayers)
+		{
+			threads.push_back(thread(&Layer::tick, layer.get()));
+		}
+		for (auto & tt : threads)
+		{
+			tt.join();
+		}
+		threads.clear();
+		for (size_t index = 0; index < mLayers.size(); ++index)
+		{
+			recordRows(int(index), 0, mLayers[index]->height());
+		}
+		for (size_t index = 0; index < mLayers.size(); ++index)
+		{
+			threads.push_back(thread(&Automaton::gatherRows, this, int(index), 0, mLayers[index]->height()));
+		}
+		for (auto & tt : threads)
+		{
+			tt.join();
+		}
+		threads.clear();
+	}
+	fireConvolutions();
+}
+
+// The same two phases as tickThreadPerLayer, but executed by the pool on
+// bands of rows rather than whole layers, so that a single large layer can
+// still use every thread. Each call to ThreadPool::run returns only when all
+// of its bands have finished, which is the barrier between the phases.
+// With scatter propagation the second phase is split in two so that bands of
+// the same layer which are next to each other never fire spikes at the same
+// time (see planBands). With gather propagation every band writes only to its
+// own rows, so all layers are ticked and then all bands gather at once.
+void Automaton::tickPool()
+{
+	if (mMode != MODE_DEPRESSED)
+	{
+		mPool->run(int(mBands.size()), [this](int index)
+		{
+			const Band & band = mBands[index];
+			deliverRows(band.links, band.rowBegin, band.rowEnd);
+		});
+		for (auto & spikeTrain : mSpikeTrains)
+		{
+			spikeTrain->advance();
+		}
+	}
+	else
+	{
+		for (auto spikeTrain : mSpikeTrains)
+		{
+			spikeTrain->clear();
+		}
+	}
+
+	if (mPropagation == PROPAGATION_GATHER)
+	{
+		mPool->run(int(mBands.size()), [this](int index)
+		{
+			const Band & band = mBands[index];
+			band.layer->tickRows(band.rowBegin, band.rowEnd);
+			recordRows(band.links, band.rowBegin, band.rowEnd);
+		});
+		mPool->run(int(mBands.size()), [this](int index)
+		{
+			const Band & band = mBands[index];
+			gatherRows(band.links, band.rowBegin, band.rowEnd);
+		});
+		fireConvolutions();
+		return;
+	}
+
+	mPool->run(int(mBands.size()), [this](int index)
+	{
+		const Band & band = mBands[index];
+		band.layer->tickRows(band.rowBegin, band.rowEnd);
+		recordRows(band.links, band.rowBegin, band.rowEnd);
+		if (!band.odd && mLinks[band.links].wave == 0)
+		{
+			fireRows(band.links, band.rowBegin, band.rowEnd);
+		}
+	});
+	for (auto & pass : mFirePasses)
+	{
+		mPool->run(int(pass.size()), [this, &pass](int index)
+		{
+			const Band & band = mBands[pass[index]];
+			fireRows(band.links, band.rowBegin, band.rowEnd);
+		});
+	}
+	fireConvolutions();
+}
+
+// The phases of tickPool, fused so that each band delivers, ticks and fires
+// its rows a tile at a time. This reads and writes the neurons and spike
+// frames once per tick instead of once per phase.
+// The spike trains fire ahead (see SpikeTrain::fireAhead) so that a band can
+// fire into rows of its neighbours which they have not delivered yet, and
+// they all advance at the end. Rather than waiting for every layer to finish
+// each phase, the bands are run as a graph of tasks (see planGraph), so a
+// band which fires or gathers after ticking starts as soon as the bands it
+// depends on have finished, whatever the rest of the layers are doing.
+void Automaton::tickFused()
+{
+	bool deliver = (mMode != MODE_DEPRESSED);
+	bool gather = (mPropagation == PROPAGATION_GATHER);
+	for (auto & spikeTrain : mSpikeTrains)
+	{
+		if (!deliver)
+		{
+			spikeTrain->clear();
+		}
+		spikeTrain->fireAhead();
+	}
+
+	int bands = int(mBands.size());
+	mPool->run(mGraph, [this, deliver, gather, bands](int index)
+	{
+		if (index >= bands)
+		{
+			const Band & band = mBands[mGraphBands[index - bands]];
+			if (gather)
+			{
+				gatherRows(band.links, band.rowBegin, band.rowEnd);
+			}
+			else
+			{
+				fireRows(band.links, band.rowBegin, band.rowEnd);
+			}
+			return;
+		}
+		const Band & band = mBands[index];
+		const Links & links = mLinks[band.links];
+		for (int tileBegin = band.rowBegin; tileBegin < band.rowEnd; tileBegin += TILE_ROWS)
+		{
+			int tileEnd = min(tileBegin + TILE_ROWS, band.rowEnd);
+			if (deliver)
+			{
+				for (auto spikeTrain : links.deliver)
+				{
+					spikeTrain->deliver(tileBegin, tileEnd);
+				}
+				deliverHistory(band.links, tileBegin, tileEnd);
+			}
+			band.layer->tickRows(tileBegin, tileEnd);
+			recordRows(band.links, tileBegin, tileEnd);
+			if (!gather && !band.odd && links.wave == 0)
+			{
+				fireRows(band.links, tileBegin, tileEnd);
+			}
+		}
+	});
+	fireConvolutions();
+
+	for (auto & spikeTrain : mSpikeTrains)
+	{
+		spikeTrain->advance();
+	}
+}
+
+// The plan is kept until a layer, synapse matrix or spike train is added,
+// removed or changed, or the threads or the size of a layer change.
+bool Automaton::isPlanStale() const
+{
+	if (mPlanChanged || mPlanThreads != mPool->threadCount() || mLinks.size() != mLayers.size())
+	{
+		return true;
+	}
+	for (auto & links : mLinks)
+	{
+		if (links.width != links.layer->width() || links.height != links.layer->height())
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void Automaton::compilePlan()
+{
+	mPlanChanged = false;
+	mPlanThreads = mPool->threadCount();
+	planRoutes();
+	planLinks();
+	measureCosts();
+	planBands();
+	planGraph();
+}
+
+// The spike trains are found for each synapse matrix once, rather than for
+// every band that fires along it. A matrix fires into the train for its
+// kind of input, or into the shunt channel of a merged train if it is
+// shunting, and is left with no train at all if there is no channel for it.
+// Compiling a matrix prepares it again for the same size, so preparing only
+// does any work when a layer has been resized or a matrix moved to a
+// different layer. Each history is made deep enough for every matrix routed
+// from it, and fitted to its layer once all of the routes are known.
+void Automaton::planRoutes()
+{
+	mRoutes.clear();
+	map<FiringHistory *, int> depths;
+	for (auto & synapses : mSynapses)
+	{
+		auto source = synapses->source();
+		auto target = synapses->target();
+		if (!source || !target)
+		{
+			continue;
+		}
+		synapses->prepare(source->width(), source->height());
+		Route route{ synapses.get(), source.get(), target.get(), -1, -1, {}, nullptr };
+		for (auto & history : mHistories)
+		{
+			if (history->layer() == source)
+			{
+				route.history = history.get();
+				int & depth = depths.try_emplace(history.get(), history->depth()).first->second;
+				depth = max(depth, int(synapses->maximumDelay()) + source->spikeDuration());
+			}
+		}
+		for (auto & spikeTrain : mSpikeTrains)
+		{
+			if (spikeTrain->target() != target || route.history)
+			{
+				continue;
+			}
+			if (mAccumulation == ACCUMULATE_PER_TARGET)
+			{
+				if (!spikeTrain->source())
+				{
+					Spiker * spiker = synapses->isShunt() ? spikeTrain->shunts() : spikeTrain.get();
+					if (spiker)
+					{
+						route.spikers.push_back(spiker);
+					}
+				}
+			}
+			else if (spikeTrain->source() == source && spikeTrain->shunting() == synapses->isShunt())
+			{
+				route.spikers.push_back(spikeTrain.get());
+			}
+		}
+		mRoutes.push_back(move(route));
+	}
+	for (auto & history : mHistories)
+	{
+		auto found = depths.find(history.get());
+		if (found != depths.end())
+		{
+			history->setDepth(found->second);
+		}
+		history->fit();
+	}
+}
+
+void Automaton::planLinks()
+{
+	mLinks.assign(mLayers.size(), Links());
+	bool waves = (mAccumulation == ACCUMULATE_PER_TARGET && mPropagation == PROPAGATION_SCATTER);
+	vector<vector<Layer *>> waveTargets(1);
+	for (size_t index = 0; index < mLayers.size(); ++index)
+	{
+		auto & layer = mLayers[index];
+		Links & links = mLinks[index];
+		links.layer = layer.get();
+		links.width = layer->width();
+		links.height = layer->height();
+		links.history = nullptr;
+		for (auto & history : mHistories)
+		{
+			if (history->layer() == layer)
+			{
+				links.history = history.get();
+			}
+		}
+		for (auto & spikeTrain : mSpikeTrains)
+		{
+			if (spikeTrain->target() == layer)
+			{
+				links.deliver.push_back(spikeTrain.get());
+			}
+		}
+		vector<Layer *> targets;
+		links.reach = 0;
+		for (size_t route = 0; route < mRoutes.size(); ++route)
+		{
+			if (mRoutes[route].source == layer.get())
+			{
+				links.fire.push_back(int(route));
+				mRoutes[route].sourceLinks = int(index);
+				targets.push_back(mRoutes[route].target);
+				links.reach = max(links.reach, mRoutes[route].synapses->height() / 2);
+			}
+			if (mRoutes[route].target == layer.get())
+			{
+				links.gather.push_back(int(route));
+				mRoutes[route].targetLinks = int(index);
+			}
+		}
+
+		// The first wave which fires into none of the same targets
+		links.wave = 0;
+		while (waves && links.wave < int(waveTargets.size()) && any_of(targets.begin(), targets.end(), [&](Layer * target)
+		{
+			return find(waveTargets[links.wave].begin(), waveTargets[links.wave].end(), target) != waveTargets[links.wave].end();
+		}))
+		{
+			++links.wave;
+		}
+		if (links.wave == int(waveTargets.size()))
+		{
+			waveTargets.emplace_back();
+		}
+		waveTargets[links.wave].insert(waveTargets[links.wave].end(), targets.begin(), targets.end());
+	}
+	mWaves = int(waveTargets.size());
+}
+
+// Every neuron costs about the same to deliver to and tick, and every
+// synapse along which a spike is fired or gathered costs about the same as
+// a neuron. Scattered spikes are a cost of the source layer, since its bands
+// fire them, and gathered spikes a cost of the target layer. Layers which
+// fire spikes from outside of the automaton are not counted.
+void Automaton::measureCosts()
+{
+	for (auto & links : mLinks)
+	{
+		links.cost = double(links.width) * links.height;
+	}
+	if (mBalancing != BALANCE_BY_ACTIVITY)
+	{
+		return;
+	}
+	for (auto & links : mLinks)
+	{
+		double firing = links.layer->firingCount();
+		for (auto index : links.fire)
+		{
+			const Route & route = mRoutes[index];
+			bool gathered = mPropagation == PROPAGATION_GATHER || route.history;
+			int layer = gathered ? route.targetLinks : route.sourceLinks;
+			if (layer >= 0)
+			{
+				mLinks[layer].cost += firing * route.synapses->stencil().activeSynapses();
+			}
+		}
+	}
+}
+
+// The bands are only split again once a layer would ideally have at least
+// twice, or at most half, as many bands as when they were last split, so
+// that layers which hover around a boundary do not have their bands split
+// again on every tick.
+bool Automaton::isUnbalanced() const
+{
+	for (size_t index = 0; index < mLinks.size(); ++index)
+	{
+		double bands = idealBands(int(index));
+		if (bands >= 2.0 * mLinks[index].bands || 2.0 * bands <= mLinks[index].bands)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// Every layer gets BANDS_PER_THREAD bands per thread when balancing by rows.
+// When balancing by activity the same number of bands in total are shared
+// out in proportion to the costs of the layers. Either way a layer is never
+// split into bands smaller than MIN_BAND_ROWS, or than twice the reach of
+// its synapses (see planBands).
+double Automaton::idealBands(int layer) const
+{
+	const Links & links = mLinks[layer];
+	double bands = double(BANDS_PER_THREAD) * mPlanThreads;
+	if (mBalancing == BALANCE_BY_ACTIVITY)
+	{
+		double total = 0.0;
+		for (auto & other : mLinks)
+		{
+			total += other.cost;
+		}
+		if (total > 0.0)
+		{
+			bands *= links.cost * mLinks.size() / total;
+		}
+	}
+	double most = max(1, links.height / max(MIN_BAND_ROWS, 2 * links.reach));
+	return min(max(bands, 1.0), most);
+}
+
+// Spikes fired from a band of rows can land up to half a synapse matrix
+// height above or below it. If every band is at least twice that height then
+// a band can only ever write to rows belonging to itself and its immediate
+// neighbours, so all the even bands can fire at once, followed by all the odd
+// bands. There must be an even number of bands (or just one) so that the
+// first and last bands, which are neighbours across the wrap around, are not
+// both even.
+// Merged spike trains are written by every layer which fires into their
+// target, so with scatter propagation the layers are split into waves which
+// share no targets (see planLinks), and each wave fires in turn. Otherwise
+// there is only one wave.
+// When balancing by activity the bands of the costliest layers come first,
+// so that they are handed out first and the bands of the cheapest layers
+// fill in around them at the end.
+void Automaton::planBands()
+{
+	mBands.clear();
+	mFirePasses.clear();
+	vector<int> order(mLinks.size());
+	for (size_t index = 0; index < order.size(); ++index)
+	{
+		order[index] = int(index);
+	}
+	if (mBalancing == BALANCE_BY_ACTIVITY)
+	{
+		stable_sort(order.begin(), order.end(), [this](int one, int two) { return mLinks[one].cost > mLinks[two].cost; });
+	}
+	for (auto index : order)
+	{
+		Links & links = mLinks[index];
+		links.bands = idealBands(index);
+		int count = 1;
+		if (mPlanThreads > 1)
+		{
+			count = max(1, int(links.bands) & ~1);
+		}
+		links.bandBegin = int(mBands.size());
+		for (int band = 0; band < count; ++band)
+		{
+			mBands.push_back({ links.layer, band * links.height / count, (band + 1) * links.height / count, (band & 1) != 0, index });
+		}
+		links.bandEnd = int(mBands.size());
+	}
+
+	// The even bands of the first wave fire as they tick
+	mFirePasses.resize(2 * mWaves - 1);
+	for (size_t index = 0; index < mBands.size(); ++index)
+	{
+		int pass = 2 * mLinks[mBands[index].links].wave + (mBands[index].odd ? 1 : 0) - 1;
+		if (pass >= 0)
+		{
+			mFirePasses[pass].push_back(int(index));
+		}
+	}
+}
+
+// The same ordering as the passes of tickPool, but between the bands which
+// really do depend on each other rather than between whole passes. With
+// scatter propagation the even bands of the first wave fire as they tick,
+// and every other band of a layer which fires anything has a second task to
+// fire it once it has ticked. An odd band fires after the even bands either
+// side of it, and a layer fires after every layer in an earlier wave which
+// shares a target with it. With gather propagation each band of a layer
+// which gathers anything has a second task to gather once every band of
+// each layer it gathers from has ticked, since its synapses can reach rows
+// of those layers anywhere.
+void Automaton::planGraph()
+{
+	int bands = int(mBands.size());
+	mGraph.waits.assign(bands, 0);
+	mGraph.successors.assign(bands, {});
+	mGraphBands.clear();
+	auto addTask = [this, bands](int band)
+	{
+		mGraphBands.push_back(band);
+		mGraph.waits.push_back(0);
+		mGraph.successors.emplace_back();
+		return bands + int(mGraphBands.size()) - 1;
+	};
+	auto depend = [this](int task, int on)
+	{
+		mGraph.successors[on].push_back(task);
+		++mGraph.waits[task];
+	};
+
+	// Histories are only read from the ticks before, so every band delivers,
+	// ticks and records its rows without waiting for any other
+	if (mAccumulation == ACCUMULATE_HISTORY)
+	{
+		return;
+	}
+	if (mPropagation == PROPAGATION_GATHER)
+	{
+		for (auto & links : mLinks)
+		{
+			vector<int> sources;
+			for (auto route : links.gather)
+			{
+				int source = mRoutes[route].sourceLinks;
+				if (source >= 0 && find(sources.begin(), sources.end(), source) == sources.end())
+				{
+					sources.push_back(source);
+				}
+			}
+			if (sources.empty())
+			{
+				continue;
+			}
+			for (int band = links.bandBegin; band < links.bandEnd; ++band)
+			{
+				int task = addTask(band);
+				for (auto source : sources)
+				{
+					for (int other = mLinks[source].bandBegin; other < mLinks[source].bandEnd; ++other)
+					{
+						depend(task, other);
+					}
+				}
+			}
+		}
+		return;
+	}
+
+	// The task which fires each band, or -1 if its layer fires nothing
+	vector<int> fireTasks(bands, -1);
+	for (auto & links : mLinks)
+	{
+		if (links.fire.empty())
+		{
+			continue;
+		}
+		for (int band = links.bandBegin; band < links.bandEnd; ++band)
+		{
+			if (mBands[band].odd || links.wave > 0)
+			{
+				fireTasks[band] = addTask(band);
+				depend(fireTasks[band], band);
+			}
+			else
+			{
+				fireTasks[band] = band;
+			}
+		}
+	}
+	for (auto & links : mLinks)
+	{
+		if (links.fire.empty())
+		{
+			continue;
+		}
+		for (int band = links.bandBegin; band < links.bandEnd; ++band)
+		{
+			if (mBands[band].odd)
+			{
+				int before = (band == links.bandBegin ? links.bandEnd : band) - 1;
+				int after = (band + 1 == links.bandEnd ? links.bandBegin : band + 1);
+				depend(fireTasks[band], fireTasks[before]);
+				if (after != before)
+				{
+					depend(fireTasks[band], fireTasks[after]);
+				}
+			}
+		}
+		for (auto & earlier : mLinks)
+		{
+			if (earlier.wave >= links.wave || !any_of(links.fire.begin(), links.fire.end(), [&](int route)
+			{
+				return any_of(earlier.fire.begin(), earlier.fire.end(), [&](int other) { return mRoutes[other].target == mRoutes[route].target; });
+			}))
+			{
+				continue;
+			}
+			for (int band = links.bandBegin; band < links.bandEnd; ++band)
+			{
+				for (int other = earlier.bandBegin; other < earlier.bandEnd; ++other)
+				{
+					depend(fireTasks[band], fireTasks[other]);
+				}
+			}
+		}
+	}
+}
+
+// The decision for FFT_AUTO uses the number of neurons that fired on the tick
+// before, since the spikes of the fused scheduler are fired before the rest
+// of the layer has ticked. Activity rarely changes much in one tick, and
+// getting it wrong only costs time.
+// Convolutions are kept for every synapse matrix, used or not, so that a
+// matrix which moves back and forth does not have its weights transformed
+// again every time.
+void Automaton::planConvolutions()
+{
+	mConvolved.clear();
+	mFftSources.clear();
+	mConvolving.assign(mRoutes.size(), 0);
+	if (mFftPolicy == FFT_NEVER)
+	{
+		mConvolutions.clear();
+		return;
+	}
+
+	map<SynapseMatrix *, unique_ptr<FftConvolution>> convolutions;
+	for (size_t index = 0; index < mRoutes.size(); ++index)
+	{
+		const Route & route = mRoutes[index];
+		if (route.spikers.empty())
+		{
+			continue;
+		}
+		auto & convolution = convolutions[route.synapses];
+		auto existing = mConvolutions.find(route.synapses);
+		if (existing != mConvolutions.end())
+		{
+			convolution = move(existing->second);
+		}
+		else
+		{
+			convolution = make_unique<FftConvolution>();
+		}
+		if (!convolution->setSynapses(route.synapses, route.source->width(), route.source->height()))
+		{
+			continue;
+		}
+		if (mFftPolicy == FFT_AUTO && !convolution->cheaper(route.source->firingCount()))
+		{
+			continue;
+		}
+
+		Convolved convolved{ route.synapses, convolution.get(), route.source, route.target, 0, route.spikers };
+		auto firing = find(mFftSources.begin(), mFftSources.end(), route.source);
+		convolved.firing = int(firing - mFftSources.begin());
+		if (firing == mFftSources.end())
+		{
+			mFftSources.push_back(route.source);
+		}
+		mConvolved.push_back(move(convolved));
+		mConvolving[index] = 1;
+	}
+	mConvolutions.swap(convolutions);
+
+	if (!mConvolved.empty() && (!mFft || mFft->width() != mWidth || mFft->height() != mHeight))
+	{
+		mFft = make_unique<Fft2d>(mWidth, mHeight);
+	}
+}
+
+// Three passes: transform the firing neurons of each source layer, convolve
+// them with the weights of each pair of delays, and fire the results. The
+// last pass writes only to the rows of each band, like gatherRows.
+void Automaton::fireConvolutions()
+{
+	if (mConvolved.empty())
+	{
+		return;
+	}
+
+	mFftFiring.resize(mFftSources.size());
+	mPool->run(int(mFftSources.size()), [this](int index)
+	{
+		FftConvolution::transformFiring(*mFft, mFftSources[index], mFftFiring[index]);
+	});
+
+	mFftJobs.clear();
+	for (int index = 0; index < int(mConvolved.size()); ++index)
+	{
+		for (int job = 0; job < mConvolved[index].convolution->jobCount(); ++job)
+		{
+			mFftJobs.push_back({ index, job });
+		}
+	}
+	mPool->run(int(mFftJobs.size()), [this](int index)
+	{
+		const Convolved & convolved = mConvolved[mFftJobs[index].first];
+		convolved.convolution->convolve(*mFft, mFftFiring[convolved.firing].data(), mFftJobs[index].second);
+	});
+
+	mPool->run(int(mBands.size()), [this](int index)
+	{
+		const Band & band = mBands[index];
+		for (auto & convolved : mConvolved)
+		{
+			if (convolved.target == band.layer)
+			{
+				for (auto spikeTrain : convolved.trains)
+				{
+					convolved.convolution->fireRows(convolved.source->spike(), spikeTrain, band.rowBegin, band.rowEnd);
+				}
+			}
+		}
+	});
 }
 
-Automaton::~Automaton()
+// This function executes within a thread and is responsible for writing data
+// associated with some rows of one layer only. During this function the rows
+// of the current frame of a spike train belong to the layer it targets.
+void Automaton::deliverRows(int layer, int rowBegin, int rowEnd)
 {
-	LOG("Destroying automaton");
+	for (auto spikeTrain : mLinks[layer].deliver)
+	{
+		spikeTrain->deliver(rowBegin, rowEnd);
+	}
+	deliverHistory(layer, rowBegin, rowEnd);
 }
 
-void Automaton::tick()
+// This function executes within a thread and writes only to the given rows
+// of the layer. It reads the earlier ticks of the histories of any layer,
+// which are not written during a tick. The potentials from every history
+// are added up in a scratch frame covering the whole layer, one for inputs
+// and one for shunts, and delivered once.
+void Automaton::deliverHistory(int layer, int rowBegin, int rowEnd)
 {
-	vector<thread> threads;
+	// Per thread working space, reused between calls.
+	thread_local vector<float> inputs;
+	thread_local vector<float> shunts;
 
-	if (mSpikeTrains.empty())
-	{
-		recalculateSpikeTrains();
-	}
-	if (mMode != MODE_DEPRESSED)
+	const Links & links = mLinks[layer];
+	size_t begin = size_t(rowBegin) * links.width;
+	size_t end = size_t(rowEnd) * links.width;
+	bool anyInputs = false;
+	bool anyShunts = false;
+	for (auto index : links.gather)
 	{
-		for (auto layer : mLayers)
+		const Route & route = mRoutes[index];
+		if (!route.history)
 		{
-			threads.push_back(thread(&Automaton::tickTargetLayer, this, layer.get()));
+			continue;
 		}
-		for (auto & tt : threads)
+		bool shunt = route.synapses->isShunt();
+		bool & any = shunt ? anyShunts : anyInputs;
+		vector<float> & potentials = shunt ? shunts : inputs;
+		if (!any)
 		{
-			tt.join();
+			potentials.resize(size_t(links.width) * links.height);
+			fill(potentials.begin() + begin, potentials.begin() + end, 0.0f);
+			any = true;
 		}
-		threads.clear();
+		route.history->gather(route.synapses, potentials.data(), rowBegin, rowEnd);
 	}
-	else
+	if (anyInputs)
 	{
-		for (auto spikeTrain : mSpikeTrains)
-		{
-			spikeTrain->clear();
-		}
+		links.layer->receiveSpikes(inputs.data(), rowBegin, rowEnd);
+	}
+	if (anyShunts)
+	{
+		links.layer->receiveShunts(shunts.data(), rowBegin, rowEnd);
 	}
+}
 
-	for (auto layer : mLayers)
+// This function executes within a thread and writes only to the given rows
+// of the current tick of the history of the layer.
+void Automaton::recordRows(int layer, int rowBegin, int rowEnd)
+{
+	if (mLinks[layer].history)
+	{
+		mLinks[layer].history->record(rowBegin, rowEnd);
+	}
+}
+
+// This function executes within a thread and may only read the rows given of
+// the source layer. It writes to the future frames of spike trains sourced
+// from the layer, within the reach of the synapses of those rows.
+void Automaton::fireRows(int layer, int rowBegin, int rowEnd)
+{
+	const Links & links = mLinks[layer];
+	for (auto index : links.fire)
 	{
-		threads.push_back(thread(&Automaton::tickSourceLayer, this, layer.get()));
+		if (!mConvolving[index])
+		{
+			const Route & route = mRoutes[index];
+			for (auto spiker : route.spikers)
+			{
+				links.layer->fireSpikes(route.synapses, spiker, rowBegin, rowEnd);
+			}
+		}
 	}
-	for (auto & tt : threads)
+}
+
+// This function executes within a thread and may read any rows of any source
+// layer, which must all have finished ticking. It writes only to the given
+// rows of the future frames of spike trains targetting the layer.
+void Automaton::gatherRows(int layer, int rowBegin, int rowEnd)
+{
+	for (auto index : mLinks[layer].gather)
 	{
-		tt.join();
+		if (!mConvolving[index])
+		{
+			const Route & route = mRoutes[index];
+			for (auto spiker : route.spikers)
+			{
+				route.source->gatherSpikes(route.synapses, spiker, rowBegin, rowEnd);
+			}
+		}
 	}
-	threads.clear();
 }
 
 // This function executes within a thread and is responsible for writing data
@@ -83,15 +1000,13 @@ void Automaton::tick()
 // associated with any other layer.
 // During this function, the data in a spike train is considered to be belonging
 // to the layer it is targetted to.
-void Automaton::tickTargetLayer(Layer * target)
+void Automaton::tickTargetLayer(int layer)
 {
-	for (auto & spikeTrain : mSpikeTrains)
+	for (auto spikeTrain : mLinks[layer].deliver)
 	{
-		if (spikeTrain->target().get() == target)
-		{
-			spikeTrain->tick();
-		}
+		spikeTrain->tick();
 	}
+	deliverHistory(layer, 0, mLinks[layer].height);
 }
 
 // This function executes within a thread and is responsible for writing data
@@ -99,37 +1014,22 @@ void Automaton::tickTargetLayer(Layer * target)
 // associated with any other layer.
 // During this function, the data in a spike train is consider to be belonging
 // to the layer it is sourced from.
-void Automaton::tickSourceLayer(Layer * source)
+void Automaton::tickSourceLayer(int layer)
 {
-	source->tick();
-
-	for (auto synapses : mSynapses)
-	{
-		if (synapses->source().get() == source)
-		{
-			for (auto spikeTrain : mSpikeTrains)
-			{
-				if (spikeTrain->source() == synapses->source() &&
-					spikeTrain->target() == synapses->target())
-				{
-					spikeTrain->source()->fireSpikes(synapses.get(), spikeTrain.get());
-				}
-			}
-		}
-	}
+	mLinks[layer].layer->tick();
+	recordRows(layer, 0, mLinks[layer].height);
+	fireRows(layer, 0, mLinks[layer].height);
 }
 
 void Automaton::reset()
 {
 	mSynapses.clear();
 	mSpikeTrains.clear();
-	Lock lock;
+	mHistories.clear();
+	mSpikeTrainsChanged = true;
 	for (auto layer : mLayers)
 	{
-		for (auto listener : mListeners)
-		{
-			listener->automatonLayerRemoved(layer);
-		}
+		notify({ Change::LAYER_REMOVED, layer, nullptr });
 	}
 	mLayers.clear();
 }
@@ -199,7 +1099,10 @@ void Automaton::save(const std::filesystem::path & path)
 void Automaton::load(const std::filesystem::path & path)
 {
 	LOG("Loading automaton from [" << path << "]");
+	Edit edit(*this);
 	mSpikeTrains.clear();
+	mHistories.clear();
+	mSpikeTrainsChanged = true;
 	while (!mLayers.empty())
 	{
 		removeLayer(mLayers.back());
@@ -277,16 +1180,17 @@ void Automaton::load(const std::filesystem::path & path)
 		const filesystem::path file = spikefile;
 		if (file.extension() == SPIKE_EXTENSION || file.extension() == SHUNT_EXTENSION)
 		{
+			// Merged trains have no source layer
 			stringstream str(file.stem().string());
 			string source;
 			getline(str, source, '_');
-			auto sourceLayer = findLayer(source);
+			auto sourceLayer = source.empty() ? nullptr : findLayer(source);
 			string target;
 			getline(str, target, '_');
 			auto targetLayer = findLayer(target);
-			if (sourceLayer && targetLayer)
+			if ((sourceLayer || source.empty()) && targetLayer)
 			{
-				auto spikeTrain = make_shared<SpikeTrain>(sourceLayer, targetLayer, 0, false);
+				auto spikeTrain = sourceLayer ? make_shared<SpikeTrain>(sourceLayer, targetLayer, 0, false) : make_shared<SpikeTrain>(targetLayer, 0, false);
 				spikeTrain->load(file);
 				mSpikeTrains.push_back(spikeTrain);
 			}
@@ -296,51 +1200,218 @@ void Automaton::load(const std::filesystem::path & path)
 			}
 		}
 	}
+	edit.commit();
 }
 
 // If a synapse matrix changes we need to make sure our spike trains are able
-// to accomodate the delays it now uses
+// to accomodate the delays it now uses, which is done before the next tick.
 void Automaton::synapseMatrixChanged(SynapseMatrix * matrix)
 {
-	mSpikeTrains.clear();
+	mSpikeTrainsChanged = true;
 }
 
+// There is a train for each source, target and kind of input which any
+// synapse matrix connects, long enough for the longest delay into it. The
+// longest delays are found in one pass over the synapses, and trains which
+// already exist are resized in place, keeping their spikes, rather than
+// being made again. Trains are kept in the same order as ever, since that is
+// the order in which they deliver to their targets.
+// Merged trains have one train per target instead, long enough for the
+// longest delay from any source, and take in the spikes of any other trains
+// into the same target, so none are lost when trains are first merged.
+// Histories replace all of the trains, with one history for each layer which
+// fires along any synapse matrix, long enough for the longest delay from it.
+// Trains from before the change to histories are kept, with nothing fired
+// into them, until they have delivered all of their spikes.
 void Automaton::recalculateSpikeTrains()
 {
-	LOG("Regenerating spike trains");
-	mSpikeTrains.clear();
-	for (auto source : mLayers)
+	mSpikeTrainsChanged = false;
+	map<tuple<Layer *, Layer *, bool>, int> delays;
+	for (auto & synapses : mSynapses)
+	{
+		auto source = synapses->source();
+		auto target = synapses->target();
+		if (source && target)
+		{
+			auto & delay = delays.try_emplace({ source.get(), target.get(), synapses->isShunt() }, -1).first->second;
+			delay = max(delay, int(synapses->maximumDelay()));
+		}
+	}
+
+	vector<shared_ptr<SpikeTrain>> spikeTrains;
+	vector<shared_ptr<FiringHistory>> histories;
+	int created = 0;
+	if (mAccumulation == ACCUMULATE_HISTORY)
+	{
+		copy_if(mSpikeTrains.begin(), mSpikeTrains.end(), back_inserter(spikeTrains), [this](auto & spikeTrain)
+		{
+			return find(mLayers.begin(), mLayers.end(), spikeTrain->target()) != mLayers.end() && !spikeTrain->empty();
+		});
+		for (auto source : mLayers)
+		{
+			int delay = -1;
+			for (auto & found : delays)
+			{
+				if (get<0>(found.first) == source.get())
+				{
+					delay = max(delay, found.second);
+				}
+			}
+			if (delay < 0)
+			{
+				continue;
+			}
+			int depth = delay + source->spikeDuration();
+			auto existing = find_if(mHistories.begin(), mHistories.end(), [&](auto & history) { return history->layer() == source; });
+			if (existing != mHistories.end())
+			{
+				(*existing)->setDepth(depth);
+				histories.push_back(*existing);
+			}
+			else
+			{
+				histories.push_back(make_shared<FiringHistory>(source, depth));
+				++created;
+			}
+		}
+	}
+	else if (mAccumulation == ACCUMULATE_PER_TARGET)
 	{
 		for (auto target : mLayers)
 		{
-			int maxDelaySpike = -1;
-			int maxDelayShunt = -1;
-			for (auto synapse : mSynapses)
+			int delay = -1;
+			bool shunts = false;
+			for (auto & found : delays)
+			{
+				if (get<1>(found.first) == target.get())
+				{
+					delay = max(delay, found.second + get<0>(found.first)->spikeDuration() - 1);
+					shunts = shunts || get<2>(found.first);
+				}
+			}
+			if (delay < 0)
+			{
+				continue;
+			}
+			auto existing = find_if(mSpikeTrains.begin(), mSpikeTrains.end(), [&](auto & spikeTrain)
+			{
+				return !spikeTrain->source() && spikeTrain->target() == target && spikeTrain->channels() == (shunts ? 2 : 1);
+			});
+			shared_ptr<SpikeTrain> merged;
+			if (existing != mSpikeTrains.end())
+			{
+				merged = *existing;
+				merged->setDelay(delay);
+			}
+			else
+			{
+				merged = make_shared<SpikeTrain>(target, delay, shunts);
+				++created;
+			}
+			for (auto & spikeTrain : mSpikeTrains)
+			{
+				if (spikeTrain != merged && spikeTrain->target() == target)
+				{
+					merged->absorb(*spikeTrain);
+				}
+			}
+			spikeTrains.push_back(merged);
+		}
+	}
+	else
+	{
+		for (auto source : mLayers)
+		{
+			for (auto target : mLayers)
 			{
-				if (synapse->source() == source && synapse->target() == target)
+				for (bool shunting : { true, false })
 				{
-					if (synapse->isShunt())
+					auto found = delays.find({ source.get(), target.get(), shunting });
+					if (found == delays.end())
+					{
+						continue;
+					}
+					int delay = found->second + source->spikeDuration() - 1;
+					auto existing = find_if(mSpikeTrains.begin(), mSpikeTrains.end(), [&](auto & spikeTrain)
+					{
+						return spikeTrain->source() == source && spikeTrain->target() == target && spikeTrain->shunting() == shunting;
+					});
+					if (existing != mSpikeTrains.end())
 					{
-						maxDelayShunt = max(maxDelayShunt, int(synapse->maximumDelay()));
+						(*existing)->setDelay(delay);
+						spikeTrains.push_back(*existing);
 					}
 					else
 					{
-						maxDelaySpike = max(maxDelaySpike, int(synapse->maximumDelay()));
+						spikeTrains.push_back(make_shared<SpikeTrain>(source, target, delay, shunting));
+						++created;
 					}
 				}
 			}
-			if (maxDelayShunt != -1)
-			{
-				maxDelayShunt += source->spikeDuration() - 1;
-				mSpikeTrains.push_back(make_shared<SpikeTrain>(source, target, maxDelayShunt, true));
-			}
-			if (maxDelaySpike != -1)
-			{
-				maxDelaySpike += source->spikeDuration() - 1;
-				mSpikeTrains.push_back(make_shared<SpikeTrain>(source, target, maxDelaySpike, false));
-			}
 		}
 	}
+	for (auto & spikeTrain : spikeTrains)
+	{
+		spikeTrain->setPrecision(mPrecision);
+	}
+	LOG("Recalculated spike trains, keeping " << spikeTrains.size() + histories.size() - created << " and creating " << created);
+	mSpikeTrains.swap(spikeTrains);
+	mHistories.swap(histories);
+	mPlanChanged = true;
+}
+
+void Automaton::setAccumulation(Accumulation accumulation)
+{
+	if (accumulation != mAccumulation)
+	{
+		mAccumulation = accumulation;
+		mSpikeTrainsChanged = true;
+	}
+}
+
+void Automaton::setBalancing(Balancing balancing)
+{
+	if (balancing != mBalancing)
+	{
+		mBalancing = balancing;
+		mPlanChanged = true;
+	}
+}
+
+void Automaton::setPrecision(Precision precision)
+{
+	if (precision != mPrecision)
+	{
+		mPrecision = precision;
+		mSpikeTrainsChanged = true;
+	}
+}
+
+void Automaton::setNeuronPrecision(Precision precision)
+{
+	mNeuronPrecision = precision;
+	for (auto & layer : mLayers)
+	{
+		layer->setPrecision(precision);
+	}
+}
+
+void Automaton::setSynapseEncoding(SynapseMatrix::Encoding encoding)
+{
+	mSynapseEncoding = encoding;
+	for (auto & synapses : mSynapses)
+	{
+		synapses->setEncoding(encoding);
+	}
+}
+
+void Automaton::setPropagation(Propagation propagation)
+{
+	if (propagation != mPropagation)
+	{
+		mPropagation = propagation;
+		mPlanChanged = true;
+	}
 }
 
 void Automaton::clearLayers()
@@ -353,6 +1424,10 @@ void Automaton::clearLayers()
 	{
 		spikes->clear();
 	}
+	for (auto & history : mHistories)
+	{
+		history->clear();
+	}
 }
 
 void Automaton::addListener(Listener * listener)
@@ -374,16 +1449,14 @@ void Automaton::setNetworkType(const std::string & type)
 		LOG("Changing network type to [" << type << "]");
 		reset();
 		mType = type;
-		for (auto listener : mListeners)
-		{
-			listener->automatonTypeChanged();
-		}
+		notify({ Change::TYPE_CHANGED, nullptr, nullptr });
 	}
 }
 
 std::shared_ptr<Layer> Automaton::createDetachedLayer()
 {
 	auto layer = mLayerFactory->create(mType, mWidth, mHeight);
+	layer->setPrecision(mNeuronPrecision);
 	while (findLayer(layer->name()))
 	{
 		layer->regenerateName();
@@ -395,12 +1468,8 @@ void Automaton::attachLayer(std::shared_ptr<Layer> layer)
 {
 	auto pos = upper_bound(mLayers.begin(), mLayers.end(), layer, [](auto one, auto two) { return one->name() < two->name(); });
 	mLayers.insert(pos, layer);
-
-	Lock lock;
-	for (auto listener : mListeners)
-	{
-		listener->automatonLayerCreated(layer);
-	}
+	mPlanChanged = true;
+	notify({ Change::LAYER_CREATED, layer, nullptr });
 }
 
 std::shared_ptr<Layer> Automaton::createLayer()
@@ -419,36 +1488,32 @@ void Automaton::removeLayer(const std::string & name)
 
 void Automaton::removeLayer(std::shared_ptr<Layer> layer)
 {
-	// Repeatedly search for synapses referencing this layer and remove them
-	bool keepTrying = true;
-	while (keepTrying && !mSynapses.empty())
+	// Take out every synapse matrix referencing this layer in one pass, then
+	// finish removing each of them in their original order
+	auto zombies = std::stable_partition(mSynapses.begin(), mSynapses.end(), [&layer](auto & synapses)
 	{
-		keepTrying = false;
-		auto zombie = std::find_if(mSynapses.begin(), mSynapses.end(), [layer](auto synapses)
-		{
-			return (synapses->source() == layer || synapses->target() == layer);
-		});
-		if (zombie != mSynapses.end())
-		{
-			removeSynapse(*zombie);
-			keepTrying = true;
-		}
+		return synapses->source() != layer && synapses->target() != layer;
+	});
+	std::vector<std::shared_ptr<SynapseMatrix>> removed(zombies, mSynapses.end());
+	mSynapses.erase(zombies, mSynapses.end());
+	for (auto & synapses : removed)
+	{
+		synapsesRemoved(synapses);
 	}
 
 	// Remove the layer
 	mLayers.erase(std::remove(mLayers.begin(), mLayers.end(), layer), mLayers.end());
+	mPlanChanged = true;
 
 	// Tell listeners about the removed layer
-	Lock lock;
-	for (auto listener : mListeners)
-	{
-		listener->automatonLayerRemoved(layer);
-	}
+	notify({ Change::LAYER_REMOVED, layer, nullptr });
 }
 
 std::shared_ptr<SynapseMatrix> Automaton::createDetachedSynapses()
 {
 	auto synapses = make_shared<SynapseMatrix>(this);
+	synapses->deferCompile(mEditDepth > 0);
+	synapses->setEncoding(mSynapseEncoding);
 	return synapses;
 }
 
@@ -456,11 +1521,7 @@ void Automaton::attachSynapses(std::shared_ptr<SynapseMatrix> synapses)
 {
 	mSynapses.push_back(synapses);
 	synapseMatrixChanged(synapses.get());
-	Lock lock;
-	for (auto listener : mListeners)
-	{
-		listener->automatonSynapsesCreated(synapses);
-	}
+	notify({ Change::SYNAPSES_CREATED, nullptr, synapses });
 }
 
 std::shared_ptr<SynapseMatrix> Automaton::createSynapse()
@@ -476,11 +1537,16 @@ std::shared_ptr<SynapseMatrix> Automaton::createSynapse()
 void Automaton::removeSynapse(std::shared_ptr<SynapseMatrix> synapses)
 {
 	mSynapses.erase(std::remove(mSynapses.begin(), mSynapses.end(), synapses), mSynapses.end());
-	Lock lock;
-	for (auto listener : mListeners)
-	{
-		listener->automatonSynapsesRemoved(synapses);
-	}
+	synapsesRemoved(synapses);
+}
+
+// A synapse matrix leaving the automaton is compiled, if an edit left it
+// needing it, since it is nolonger compiled at the end of the edit.
+void Automaton::synapsesRemoved(std::shared_ptr<SynapseMatrix> synapses)
+{
+	synapses->deferCompile(false);
+	mSpikeTrainsChanged = true;
+	notify({ Change::SYNAPSES_REMOVED, nullptr, synapses });
 }
 
 void Automaton::setSize(int width, int height)
@@ -495,11 +1561,122 @@ void Automaton::setSize(int width, int height)
 			layer->resize(mWidth, mHeight);
 		}
 		mSpikeTrains.clear();
+		mHistories.clear();
+		mSpikeTrainsChanged = true;
+		notify({ Change::SIZE_CHANGED, nullptr, nullptr });
+	}
+}
+
+Automaton::Edit::~Edit() noexcept
+{
+	try
+	{
+		commit();
+	}
+	catch (const exception & e)
+	{
+		LOG("Failed to commit an automaton edit: " << e.what());
+	}
+	catch (...)
+	{
+		LOG("Failed to commit an automaton edit");
+	}
+}
+
+// The edit counts as committed before commitEdit runs, since commitEdit ends
+// the batch even if applying its changes throws.
+void Automaton::Edit::commit()
+{
+	if (!mCommitted)
+	{
+		mCommitted = true;
+		mAutomaton.commitEdit();
+	}
+}
+
+void Automaton::beginEdit()
+{
+	if (mEditDepth++ == 0)
+	{
+		for (auto & synapses : mSynapses)
+		{
+			synapses->deferCompile(true);
+		}
+	}
+}
+
+void Automaton::commitEdit()
+{
+	if (mEditDepth == 0)
+	{
+		NEURONTHROW("Invalid use of automaton - committed an edit which was not begun");
+	}
+	if (--mEditDepth > 0)
+	{
+		return;
+	}
+	for (auto & synapses : mSynapses)
+	{
+		synapses->deferCompile(false);
+	}
+	if (mSpikeTrainsChanged)
+	{
+		recalculateSpikeTrains();
+	}
+	vector<Change> changes;
+	changes.swap(mChanges);
+	for (auto & change : changes)
+	{
+		notify(change);
+	}
+}
+
+// A layer or synapse matrix removed during the edit which created it is left
+// out altogether, so listeners never see it.
+void Automaton::notify(const Change & change)
+{
+	if (mEditDepth > 0)
+	{
+		if (change.kind == Change::LAYER_REMOVED || change.kind == Change::SYNAPSES_REMOVED)
+		{
+			auto created = change.kind == Change::LAYER_REMOVED ? Change::LAYER_CREATED : Change::SYNAPSES_CREATED;
+			auto found = find_if(mChanges.begin(), mChanges.end(), [&](auto & other)
+			{
+				return other.kind == created && other.layer == change.layer && other.synapses == change.synapses;
+			});
+			if (found != mChanges.end())
+			{
+				mChanges.erase(found);
+				return;
+			}
+		}
+		mChanges.push_back(change);
+		return;
+	}
 
-		Lock lock;
-		for (auto listener : mListeners)
+	Lock lock;
+	for (auto listener : mListeners)
+	{
+		switch (change.kind)
 		{
-			listener->automatonSizeChanged(width, height);
+		case Change::TYPE_CHANGED:
+			listener->automatonTypeChanged();
+			break;
+		case Change::SIZE_CHANGED:
+			listener->automatonSizeChanged(mWidth, mHeight);
+			break;
+		case Change::LAYER_CREATED:
+			listener->automatonLayerCreated(change.layer);
+			break;
+		case Change::LAYER_REMOVED:
+			listener->automatonLayerRemoved(change.layer);
+			break;
+		case Change::SYNAPSES_CREATED:
+			listener->automatonSynapsesCreated(change.synapses);
+			break;
+		case Change::SYNAPSES_REMOVED:
+			listener->automatonSynapsesRemoved(change.synapses);
+			break;
 		}
 	}
 }
@@ -523,12 +1700,65 @@ shared_ptr<Layer> Automaton::findLayer(const std::string & name)
 
 float Automaton::currentSpikeDensity()
 {
-	float density = 0.0f;
-	for (auto train : mSpikeTrains)
+	int firing = 0;
+	int neurons = 0;
+	for (auto & layer : mLayers)
+	{
+		firing += layer->firingCount();
+		neurons += layer->width() * layer->height();
+	}
+	return neurons ? float(firing) / float(neurons) : 0.0f;
+}
+
+int Automaton::sparseSpikeTrainCount()
+{
+	return int(count_if(mSpikeTrains.begin(), mSpikeTrains.end(), [](auto & train) { return train->mode() == SpikeTrain::MODE_SPARSE; }));
+}
+
+uint64_t Automaton::tickStateBytes()
+{
+	uint64_t bytes = 0;
+	for (auto & layer : mLayers)
+	{
+		uint64_t cells = uint64_t(layer->width()) * uint64_t(layer->height());
+		bytes += cells * layer->neuronBytes() + cells / 8;
+	}
+	for (auto & spikeTrain : mSpikeTrains)
+	{
+		if (spikeTrain->mode() == SpikeTrain::MODE_DENSE)
+		{
+			bytes += uint64_t(spikeTrain->target()->width()) * uint64_t(spikeTrain->target()->height()) * precisionBytes(spikeTrain->precision());
+		}
+	}
+	for (auto & history : mHistories)
+	{
+		bytes += uint64_t(history->layer()->width()) * uint64_t(history->layer()->height()) / 8;
+	}
+	return bytes;
+}
+
+uint64_t Automaton::transitBytes()
+{
+	uint64_t bytes = 0;
+	for (auto & spikeTrain : mSpikeTrains)
+	{
+		bytes += spikeTrain->bytes();
+	}
+	for (auto & history : mHistories)
+	{
+		bytes += history->bytes();
+	}
+	return bytes;
+}
+
+int Automaton::spikeTrainModeSwitches()
+{
+	int switches = 0;
+	for (auto & train : mSpikeTrains)
 	{
-		density += train->currentSpikeDensity();
+		switches += train->modeSwitches();
 	}
-	return density / float(mSpikeTrains.size());
+	return switches;
 }
 
 inline Automaton::Lock::Lock()
@@ -1,15 +1,23 @@
 #ifndef AUTOMATON_H
 #define AUTOMATON_H
 
+#include <complex>
+#include <map>
 #include <memory>
 #include <vector>
 
 #include "ConfigSet.h"
+#include "Precision.h"
 #include "SynapseMatrix.h"
+#include "ThreadPool.h"
 
+class Fft2d;
+class FftConvolution;
+class FiringHistory;
 class Layer;
 class LayerFactory;
 class SpikeTrain;
+class Spiker;
 
 // An automaton is a collection of Layer objects connected by SynapseMatrix objects.
 // It also maintains SpikeTrain objects to handle the spikes in transit from one
@@ -25,6 +33,41 @@ public:
 		MODE_NORMAL,   //< Normal mode
 		MODE_DEPRESSED //< Depressed mode - no spikes are fired while depressed
 	};
+	// The way in which the work of a tick is spread over threads.
+	enum Scheduler
+	{
+		SCHEDULER_THREAD_PER_LAYER, //< Start and join a new thread per layer for each phase of a tick
+		SCHEDULER_POOL,             //< Hand the layers to a persistent pool of worker threads
+		SCHEDULER_FUSED             //< The pool, with every phase done a tile of rows at a time, and each band of rows started as soon as the bands it depends on are done
+	};
+	// The way in which spikes are sent along synapses.
+	enum Propagation
+	{
+		PROPAGATION_SCATTER, //< Each firing neuron pushes spikes out to its targets
+		PROPAGATION_GATHER   //< Each target neuron pulls spikes in from its sources
+	};
+	// How the spikes in transit to each layer are stored.
+	enum Accumulation
+	{
+		ACCUMULATE_PER_PAIR,   //< A spike train for each source, target and kind of input
+		ACCUMULATE_PER_TARGET, //< One merged spike train per target, with a channel for its shunts
+		ACCUMULATE_HISTORY     //< No spike trains, but a history of the firing of each source, which its targets gather from
+	};
+	// How the pooled schedulers split the layers into bands of rows.
+	enum Balancing
+	{
+		BALANCE_BY_ROWS,    //< The same number of bands for every layer
+		BALANCE_BY_ACTIVITY //< Bands in proportion to the work each layer did on the tick before
+	};
+	// When spikes are sent along a synapse matrix by convolving it with the
+	// firing neurons using FFTs (see FftConvolution), instead of by the
+	// propagation above.
+	enum FftPolicy
+	{
+		FFT_NEVER, //< Always use the propagation
+		FFT_AUTO,  //< Convolve each synapse matrix when it is estimated to be cheaper
+		FFT_ALWAYS //< Convolve every synapse matrix which fits within its layers
+	};
 	// Observer interface for an automaton. Useful for external code that needs
 	// to track the lifespan of layer and synapse components.
 	class Listener
@@ -43,6 +86,25 @@ public:
 		// Callback for a synapse matrix being removed from the automaton
 		virtual void automatonSynapsesRemoved(std::shared_ptr<SynapseMatrix> synapses) {};
 	};
+	// Makes the edits to an automaton during its lifetime one batch, by
+	// calling beginEdit when constructed and commitEdit from commit(). An
+	// edit which is destroyed without being committed, for instance while an
+	// exception unwinds, is committed then, and any failure is logged rather
+	// than thrown.
+	class Edit
+	{
+	public:
+		explicit Edit(Automaton & automaton) : mAutomaton(automaton), mCommitted(false) { mAutomaton.beginEdit(); }
+		~Edit() noexcept;
+		Edit(const Edit &) = delete;
+		Edit & operator=(const Edit &) = delete;
+		// End the batch, throwing if the changes could not be applied. Does
+		// nothing if already committed.
+		void commit();
+	private:
+		Automaton & mAutomaton;
+		bool mCommitted;
+	};
 private:
 	// The lock is to detect (and throw exceptions when) a user of
 	// this class attempts to add or remove a listener while the listeners
@@ -57,6 +119,74 @@ private:
 	private:
 		static bool mLocked;
 	};
+	// A change to report to the listeners, which is held back until the end
+	// of an edit
+	struct Change
+	{
+		enum Kind
+		{
+			TYPE_CHANGED,
+			SIZE_CHANGED,
+			LAYER_CREATED,
+			LAYER_REMOVED,
+			SYNAPSES_CREATED,
+			SYNAPSES_REMOVED
+		};
+		Kind kind;                               //< What changed
+		std::shared_ptr<Layer> layer;            //< The layer created or removed
+		std::shared_ptr<SynapseMatrix> synapses; //< The synapse matrix created or removed
+	};
+	// A range of rows within one layer, which is the unit of work the pooled
+	// scheduler hands to its threads.
+	struct Band
+	{
+		Layer * layer; //< The layer the rows belong to
+		int rowBegin;  //< The first row in the band
+		int rowEnd;    //< One past the last row in the band
+		bool odd;      //< Odd bands fire spikes after the even bands of their layer
+		int links;     //< Index into mLinks for the layer
+	};
+	// A synapse matrix connecting two layers, with the spike trains it fires
+	// into.
+	struct Route
+	{
+		SynapseMatrix * synapses;      //< The synapse matrix
+		Layer * source;                //< The layer the matrix fires from
+		Layer * target;                //< The layer the matrix fires to
+		int sourceLinks;               //< Index into mLinks of the source layer, or -1 if it is not in the automaton
+		int targetLinks;               //< Index into mLinks of the target layer, or -1 if it is not in the automaton
+		std::vector<Spiker *> spikers; //< The trains the matrix fires into
+		FiringHistory * history;       //< The history the target gathers from, or nullptr if there are trains
+	};
+	// The spike trains a layer receives from and the synapses it fires
+	// along or gathers through, found when the plan is compiled so that a
+	// tick never searches for them.
+	struct Links
+	{
+		Layer * layer;                     //< The layer
+		int width;                         //< The width of the layer when the plan was compiled
+		int height;                        //< The height of the layer when the plan was compiled
+		std::vector<SpikeTrain *> deliver; //< Trains targetting the layer
+		std::vector<int> fire;             //< Indices into mRoutes of the synapses from the layer
+		std::vector<int> gather;           //< Indices into mRoutes of the synapses to the layer
+		FiringHistory * history;           //< The history the firing of the layer is recorded into, or nullptr
+		int wave;                          //< Layers in the same wave share no merged trains, so fire together
+		int reach;                         //< The most rows above or below a neuron its synapses reach
+		double cost;                       //< The estimated cost of ticking the layer, see measureCosts
+		double bands;                      //< The number of bands the layer would ideally have been split into
+		int bandBegin;                     //< Index into mBands of the first band of the layer
+		int bandEnd;                       //< Index into mBands after the last band of the layer
+	};
+	// A synapse matrix whose spikes are fired by convolution this tick
+	struct Convolved
+	{
+		SynapseMatrix * synapses;         //< The synapse matrix
+		FftConvolution * convolution;     //< The convolution for the matrix
+		Layer * source;                   //< The layer the matrix fires from
+		Layer * target;                   //< The layer the matrix fires to
+		int firing;                       //< Index into mFftSources of the source layer
+		std::vector<Spiker *> trains;     //< The trains the matrix fires into
+	};
 public:
 	// Default constructor
 	Automaton();
@@ -87,7 +217,8 @@ public:
 	// Remove a layer. All synapses connected to this layer as
 	// either a source or target will also be removed.
 	void removeLayer(const std::string & name);
-	// Returns the set of all layers in this automaton.
+	// Returns a copy of the set of all layers in this automaton, so that
+	// layers can be removed while iterating over it.
 	const std::vector<std::shared_ptr<Layer> > layers() { return mLayers; }
 	// Find a layer by name. Returns an empty pointer if no layer
 	// with the give name could be found.
@@ -99,7 +230,8 @@ public:
 	std::shared_ptr<SynapseMatrix> createSynapse();
 	// Remove a synapse.
 	void removeSynapse(std::shared_ptr<SynapseMatrix> synapses);
-	// Return a list of all synapses in this automaton.
+	// Return a copy of the list of all synapses in this automaton, so that
+	// synapses can be removed while iterating over it.
 	const std::vector<std::shared_ptr<SynapseMatrix>> synapses() { return mSynapses; }
 	// Add a listener. The listener will be informed of changes to the automaton.
 	// The caller is responsible for calling removeListener
@@ -107,9 +239,107 @@ public:
 	void addListener(Listener * listener);
 	// Remove a listener.
 	void removeListener(Listener * listener);
+	// Begin a batch of edits to the layers and synapses. Until the matching
+	// commitEdit the listeners are not told of any changes, synapse matrices
+	// are not compiled and the spike trains are not recalculated. Edits may
+	// be nested, in which case only the outermost commitEdit takes effect.
+	// The automaton must not be ticked during an edit.
+	void beginEdit();
+	// End a batch of edits. Each synapse matrix which changed is compiled
+	// once, the spike trains are recalculated once, and the listeners are
+	// told of the changes in the order they were made, leaving out layers
+	// and synapse matrices which were both created and removed.
+	void commitEdit();
+	// Return true during a batch of edits
+	bool isEditing() const { return mEditDepth > 0; }
 	// Tick this automaton, which moves every layer withing it one iteration forwards,
 	// and processes 1 time step of spikes.
 	void tick();
+	// Tick this automaton a number of times in succession.
+	void tickN(int count);
+	// Set the way in which ticks are spread over threads. The default is
+	// SCHEDULER_POOL.
+	void setScheduler(Scheduler scheduler) { mScheduler = scheduler; }
+	// Get the way in which ticks are spread over threads.
+	Scheduler scheduler() const { return mScheduler; }
+	// Set the way in which spikes are sent along synapses. Both produce the
+	// same spikes, but gather needs no ordering between bands of rows and so
+	// scales better with threads when synapse matrices are large.
+	void setPropagation(Propagation propagation);
+	// Get the way in which spikes are sent along synapses.
+	Propagation propagation() const { return mPropagation; }
+	// Set how the spikes in transit are stored. Merging them per target
+	// delivers each layer in one pass, and the memory used grows with the
+	// number of layers instead of the number of pairs of connected layers.
+	// With scatter propagation, layers which fire into the same target take
+	// turns to fire. The potentials are added up in a different order, so
+	// the spikes are the same only up to rounding. Spikes in transit are kept
+	// when trains are merged, but lost when they are split again.
+	// Firing histories (see FiringHistory) keep one bit per neuron per tick
+	// for each source layer, however many synapse matrices it fires along,
+	// instead of the frames of each train, and are gathered from by every
+	// target as it is delivered. This saves most of the memory of the spikes
+	// in transit, for more work delivering them. Nothing is fired, so the
+	// propagation makes no difference, and matrices are never convolved. The
+	// potentials are added up in a different order. Spikes in transit are
+	// delivered by the trains they were in when changing to histories, but
+	// lost when changing back.
+	void setAccumulation(Accumulation accumulation);
+	// Get how the spikes in transit are stored.
+	Accumulation accumulation() const { return mAccumulation; }
+	// Set how the pooled schedulers split the layers into bands of rows.
+	// Balancing by activity gives the layers which fire the most spikes
+	// along the largest synapse matrices more, smaller bands, and the
+	// quietest layers one band each, and hands out the bands of the busiest
+	// layers first. The bands are only split again when the activity of a
+	// layer changes by a factor of two or more. The default is
+	// BALANCE_BY_ROWS.
+	void setBalancing(Balancing balancing);
+	// Get how the pooled schedulers split the layers into bands of rows.
+	Balancing balancing() const { return mBalancing; }
+	// Set the precision the dense frames of the spike trains are stored at.
+	// Reduced precisions halve the memory the frames take, and the bandwidth
+	// spent firing and delivering spikes while trains are dense, but round
+	// each potential every time a spike is fired into it, so the spikes
+	// drift away from those at full precision. The spikes in transit are
+	// rounded to the new precision.
+	void setPrecision(Precision precision);
+	// Get the precision the dense frames of the spike trains are stored at.
+	Precision precision() const { return mPrecision; }
+	// Set the precision the state of the neurons is stored at, for every
+	// layer and the layers created from now on. Only the fields each type
+	// of neuron allows are packed, and the inputs never are, so spikes are
+	// received at full precision, but the state is rounded once per tick and
+	// drifts away from that at full precision. See Net::setPrecision.
+	void setNeuronPrecision(Precision precision);
+	// Get the precision the state of the neurons is stored at.
+	Precision neuronPrecision() const { return mNeuronPrecision; }
+	// Set how every synapse matrix is stored, and how matrices created from
+	// now on are stored. Matrices loaded from files which say how they are
+	// stored keep to that. See SynapseMatrix::setEncoding.
+	void setSynapseEncoding(SynapseMatrix::Encoding encoding);
+	// Get how new synapse matrices are stored.
+	SynapseMatrix::Encoding synapseEncoding() const { return mSynapseEncoding; }
+	// Set when synapse matrices are convolved using FFTs instead. With
+	// FFT_AUTO the choice is made for each matrix on every tick, from the
+	// number of neurons which fired in its source layer on the tick before.
+	// Convolution gives the same spikes only up to rounding, so the default
+	// is FFT_NEVER.
+	void setFftPolicy(FftPolicy policy) { mFftPolicy = policy; }
+	// Get when synapse matrices are convolved using FFTs.
+	FftPolicy fftPolicy() const { return mFftPolicy; }
+	// Returns the time spent working by the busiest thread of the pool on the
+	// last tick divided by the mean over every thread, so 1 is perfectly
+	// balanced and the thread count is as bad as it can be. Returns 0 for
+	// SCHEDULER_THREAD_PER_LAYER, which does not use the pool.
+	float imbalance() const { return mImbalance; }
+	// Returns the number of synapse matrices convolved on the last tick.
+	int convolvedSynapseCount() const { return int(mConvolved.size()); }
+	// Set the number of threads used by the pooled scheduler, including the
+	// thread calling tick. 0 selects the number of hardware threads.
+	void setThreadCount(int threads);
+	// Get the number of threads used by the pooled scheduler.
+	int threadCount() const;
 	// Reset the state of all neurons and remove all active spikes.
 	// There is no guarantee that this will make the automaton go quiet, since some
 	// neurons could be self activating from their reset state.
@@ -121,16 +351,39 @@ public:
 	// Returns a layer factory that can be used to obtain information
 	// about the layer types and configurations available.
 	LayerFactory * layerFactory() { return mLayerFactory.get(); }
-	// Returns the average number of spikes per neuron this time step.
+	// Returns the proportion of the neurons in all layers which fired this
+	// time step, counted from their packed firing flags.
 	float currentSpikeDensity();
+	// Returns the number of spike trains carrying spikes between layers.
+	int spikeTrainCount() const { return int(mSpikeTrains.size()); }
+	// Returns the number of spike trains storing their spikes as sparse
+	// events rather than dense frames.
+	int sparseSpikeTrainCount();
+	// Returns the total number of times the spike trains have changed
+	// between sparse and dense storage.
+	int spikeTrainModeSwitches();
+	// Returns the number of bytes of neuron state, firing flags, dense
+	// spike frames and the tick recorded into each firing history, which a
+	// tick must read and write at least once. Sparse spike trains are not
+	// included.
+	uint64_t tickStateBytes();
+	// Returns the number of bytes held for the spikes in transit, which is
+	// every frame or event of every spike train, or every firing history.
+	uint64_t transitBytes();
 
 private: // From SynapseMatrix::Listener
 	void synapseMatrixChanged(SynapseMatrix * matrix) override;
 
 private:
 	// Called after changes to the layers or synapses that might mean
-	// new connections between layers need handling
+	// new connections between layers need handling. Trains which are still
+	// needed are kept, with the spikes in transit along them.
 	void recalculateSpikeTrains();
+	// Tell the listeners of a change, or hold it back until the end of the
+	// edit if there is one
+	void notify(const Change & change);
+	// Finish removing a synapse matrix which has been taken out of mSynapses
+	void synapsesRemoved(std::shared_ptr<SynapseMatrix> synapses);
 	// Create a layer without inserting it into the automaton.
 	std::shared_ptr<Layer> createDetachedLayer();
 	// Attach an existing layer to the automaton.
@@ -139,10 +392,68 @@ private:
 	std::shared_ptr<SynapseMatrix> createDetachedSynapses();
 	// Attach an existing synapse matrix to the automaton.
 	void attachSynapses(std::shared_ptr<SynapseMatrix> synapses);
+	// Implementation of tick() for SCHEDULER_THREAD_PER_LAYER
+	void tickThreadPerLayer();
+	// Implementation of tick() for SCHEDULER_POOL
+	void tickPool();
+	// Implementation of tick() for SCHEDULER_FUSED
+	void tickFused();
 	// Threaded implementation detail of Tick()
-	void tickTargetLayer(Layer * target);
+	// layer - index into mLayers of the target layer
+	void tickTargetLayer(int layer);
 	// Threaded implementation detail of Tick()
-	void tickSourceLayer(Layer * source);
+	// layer - index into mLayers of the source layer
+	void tickSourceLayer(int layer);
+	// Return true if the plan needs compiling again before the next tick
+	bool isPlanStale() const;
+	// Compile the routes, links, bands and task graph used to tick
+	void compilePlan();
+	// Find the spike trains each synapse matrix fires into, preparing each
+	// matrix for the size of its source layer
+	void planRoutes();
+	// Find the links of each layer
+	void planLinks();
+	// Estimate the cost of ticking each layer from the neurons which fired on
+	// the tick before
+	void measureCosts();
+	// Return true if the costs have changed enough since the layers were
+	// split into bands to split them again
+	bool isUnbalanced() const;
+	// Return the number of bands a layer would ideally be split into
+	// layer - index into mLinks
+	double idealBands(int layer) const;
+	// Split the layers into bands of rows
+	void planBands();
+	// Find the dependencies between the tasks of the fused scheduler
+	void planGraph();
+	// Choose the synapse matrices to convolve this tick
+	void planConvolutions();
+	// Fire the spikes of every synapse matrix being convolved. All of the
+	// layers must have finished ticking, and no other spikes may be fired at
+	// the same time.
+	void fireConvolutions();
+	// Threaded implementation detail of tickPool(). Delivers the current
+	// spikes from every spike train targetting the given rows of a layer.
+	// layer - index into mLayers of the target layer
+	void deliverRows(int layer, int rowBegin, int rowEnd);
+	// Threaded implementation detail of tick() for ACCUMULATE_HISTORY.
+	// Delivers the spikes arriving at the given rows of a layer from the
+	// history of every layer it receives from.
+	// layer - index into mLayers of the target layer
+	void deliverHistory(int layer, int rowBegin, int rowEnd);
+	// Threaded implementation detail of tick(). Records the firing of the
+	// given rows of a layer into its history, if it has one.
+	// layer - index into mLayers of the layer
+	void recordRows(int layer, int rowBegin, int rowEnd);
+	// Threaded implementation detail of tickPool(). Fires spikes from the
+	// given rows of a layer along every synapse sourced from it.
+	// layer - index into mLayers of the source layer
+	void fireRows(int layer, int rowBegin, int rowEnd);
+	// Threaded implementation detail of tick() for PROPAGATION_GATHER.
+	// Gathers spikes for the given rows of a layer along every synapse
+	// targetting it.
+	// layer - index into mLayers of the target layer
+	void gatherRows(int layer, int rowBegin, int rowEnd);
 
 private:
 	// All listeners to this automaton
@@ -151,6 +462,66 @@ private:
 	std::string mType;
 	// The current operating mode
 	OperatingMode mMode;
+	// The way ticks are spread over threads
+	Scheduler mScheduler;
+	// The way spikes are sent along synapses
+	Propagation mPropagation;
+	// The worker threads used by SCHEDULER_POOL
+	std::unique_ptr<ThreadPool> mPool;
+	// How the spikes in transit are stored
+	Accumulation mAccumulation;
+	// How the layers are split into bands
+	Balancing mBalancing;
+	// The precision of the dense spike frames
+	Precision mPrecision;
+	// The precision of the state of the neurons
+	Precision mNeuronPrecision;
+	// How new synapse matrices are stored
+	SynapseMatrix::Encoding mSynapseEncoding;
+	// The imbalance between the threads of the pool on the last tick
+	float mImbalance;
+	// True if the layers, synapses or spike trains have changed since the
+	// plan was compiled
+	bool mPlanChanged;
+	// The number of threads the plan was compiled for
+	int mPlanThreads;
+	// The bands of rows ticked by the pool, in order of layer
+	std::vector<Band> mBands;
+	// Indices into mBands of the bands which fire spikes after ticking,
+	// for each pass in turn. These are the odd bands of the first wave of
+	// layers, followed by the even and then the odd bands of each later
+	// wave.
+	std::vector<std::vector<int>> mFirePasses;
+	// The number of waves of layers which fire in turn
+	int mWaves;
+	// The links of each layer, by index into mLayers
+	std::vector<Links> mLinks;
+	// Every synapse matrix which connects two layers, in the order of
+	// mSynapses
+	std::vector<Route> mRoutes;
+	// The tasks run by SCHEDULER_FUSED. There is one task for each band,
+	// which delivers and ticks it, followed by the tasks which fire or
+	// gather the spikes of the bands that do not fire as they tick.
+	ThreadPool::Graph mGraph;
+	// The band of each task in mGraph after the first one per band
+	std::vector<int> mGraphBands;
+	// Non zero for each route in mRoutes which is being convolved this tick
+	std::vector<char> mConvolving;
+	// When synapse matrices are convolved
+	FftPolicy mFftPolicy;
+	// The transform used for convolutions, which matches the automaton size
+	std::unique_ptr<Fft2d> mFft;
+	// The convolution for each synapse matrix, kept between ticks so that
+	// the transforms of the weights are only calculated once
+	std::map<SynapseMatrix *, std::unique_ptr<FftConvolution>> mConvolutions;
+	// The synapse matrices convolved this tick
+	std::vector<Convolved> mConvolved;
+	// The source layers of the convolved synapse matrices
+	std::vector<Layer *> mFftSources;
+	// The transform of the firing neurons of each layer in mFftSources
+	std::vector<std::vector<std::complex<double>>> mFftFiring;
+	// Each job of each convolution, as an index into mConvolved and a job
+	std::vector<std::pair<int, int>> mFftJobs;
 	// The width, in neurons, of the automaton
 	int mWidth;
 	// The height, in neurons, of the automaton
@@ -165,6 +536,16 @@ private:
 	// The spike trains for spikes passing along synapses. These are
 	// data storage objects rather than logic processing blocks.
 	std::vector<std::shared_ptr<SpikeTrain>> mSpikeTrains;
+	// The firing histories of the source layers, instead of the spike trains
+	// for ACCUMULATE_HISTORY
+	std::vector<std::shared_ptr<FiringHistory>> mHistories;
+	// True if the synapses have changed since the spike trains were last
+	// recalculated
+	bool mSpikeTrainsChanged;
+	// The number of edits begun and not yet committed
+	int mEditDepth;
+	// The changes held back during an edit
+	std::vector<Change> mChanges;
 };
 
 #endif
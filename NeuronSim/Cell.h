@@ -10,7 +10,7 @@ struct Cell
 	Cell() : input(0.0f), shunt(1.0f), firing(false) {}
 	float input;  //< Incoming spikes are summed into the input field
 	float shunt;  //< Incoming shunts are summed into the shunt field
-	bool firing;  //< If this is true, the tick function will fire spikes
+	bool firing;  //< True if the neuron fired, filled in when copied out of a Net
 };
 
 #endif
@@ -39,6 +39,8 @@ struct ConfigItem
 		case ENUM:
 			mInt = other.mInt;
 			break;
+		case INVALID:
+			break;
 		}
 	}
 	// Assignment operator
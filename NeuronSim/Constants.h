@@ -23,14 +23,14 @@ const int DEFAULT_NET_SIZE(64);
 #endif
 
 // File extension for saved layers
-static const char * LAYER_EXTENSION(".layer");
+const char * const LAYER_EXTENSION(".layer");
 // File extension for saved synapse matrices
-static const char * SYNAPSE_EXTENSION(".synapse");
+const char * const SYNAPSE_EXTENSION(".synapse");
 // File extension for saved spike trains going to inputs
-static const char * SPIKE_EXTENSION(".spike");
+const char * const SPIKE_EXTENSION(".spike");
 // File extension for saved spike trains going to shunts
-static const char * SHUNT_EXTENSION(".shunt");
+const char * const SHUNT_EXTENSION(".shunt");
 // File extension for saved configurations
-static const char * CONFIG_EXTENSION(".cfg");
+const char * const CONFIG_EXTENSION(".cfg");
 
 #endif
@@ -0,0 +1,170 @@
+#include "Fft.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "Constants.h"
+#include "Exception.h"
+
+using namespace std;
+
+// std::complex multiplication checks for infinities and NaNs in a library
+// call unless the compiler is allowed to ignore them, which makes it several
+// times slower than the four multiplications it needs.
+static inline complex<double> multiply(const complex<double> & a, const complex<double> & b)
+{
+	return complex<double>(a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real());
+}
+
+Fft::Fft(int size) :
+	mSize(size),
+	mPow2Size(1)
+{
+	if (size < 1)
+	{
+		NEURONTHROW("Unable to create a transform of size [" << size << "]");
+	}
+	bool pow2 = (size & (size - 1)) == 0;
+	int minimum = pow2 ? size : 2 * size - 1;
+	int bits = 0;
+	while (mPow2Size < minimum)
+	{
+		mPow2Size *= 2;
+		++bits;
+	}
+
+	mTwiddles.resize(mPow2Size / 2);
+	for (int k = 0; k < mPow2Size / 2; ++k)
+	{
+		double angle = -2.0 * PI * k / mPow2Size;
+		mTwiddles[k] = complex<double>(cos(angle), sin(angle));
+	}
+	mReversed.resize(mPow2Size);
+	for (int k = 0; k < mPow2Size; ++k)
+	{
+		int reversed = 0;
+		for (int bit = 0; bit < bits; ++bit)
+		{
+			reversed |= ((k >> bit) & 1) << (bits - 1 - bit);
+		}
+		mReversed[k] = reversed;
+	}
+
+	if (!pow2)
+	{
+		// k^2 is reduced modulo 2n before scaling, since the angle only matters
+		// modulo 2 pi and large angles lose precision.
+		mChirp.resize(size);
+		for (int k = 0; k < size; ++k)
+		{
+			double angle = -PI * double((int64_t(k) * k) % (2 * int64_t(size))) / size;
+			mChirp[k] = complex<double>(cos(angle), sin(angle));
+		}
+		vector<complex<double>> chirp(mPow2Size);
+		chirp[0] = conj(mChirp[0]);
+		for (int k = 1; k < size; ++k)
+		{
+			chirp[k] = conj(mChirp[k]);
+			chirp[mPow2Size - k] = conj(mChirp[k]);
+		}
+		mChirpSpectrum.resize(mPow2Size);
+		for (int k = 0; k < mPow2Size; ++k)
+		{
+			mChirpSpectrum[mReversed[k]] = chirp[k];
+		}
+		radix2(mChirpSpectrum.data(), false);
+	}
+}
+
+void Fft::transform(complex<double> * data, bool inverse, int stride) const
+{
+	thread_local vector<complex<double>> scratch;
+	scratch.resize(mPow2Size);
+
+	if (mChirp.empty())
+	{
+		for (int k = 0; k < mSize; ++k)
+		{
+			scratch[mReversed[k]] = data[k * stride];
+		}
+		radix2(scratch.data(), inverse);
+		for (int k = 0; k < mSize; ++k)
+		{
+			data[k * stride] = scratch[k];
+		}
+		return;
+	}
+
+	// Bluestein's algorithm rewrites jk as (j^2 + k^2 - (k - j)^2) / 2, which
+	// turns the transform into a convolution with a chirp, done here with the
+	// radix 2 transform. The inverse is the conjugate of the forward
+	// transform of the conjugate.
+	thread_local vector<complex<double>> product;
+	product.resize(mPow2Size);
+	fill(scratch.begin(), scratch.end(), complex<double>());
+	for (int k = 0; k < mSize; ++k)
+	{
+		complex<double> value = inverse ? conj(data[k * stride]) : data[k * stride];
+		scratch[mReversed[k]] = multiply(value, mChirp[k]);
+	}
+	radix2(scratch.data(), false);
+	for (int k = 0; k < mPow2Size; ++k)
+	{
+		product[mReversed[k]] = multiply(scratch[k], mChirpSpectrum[k]);
+	}
+	radix2(product.data(), true);
+	double scale = 1.0 / mPow2Size;
+	for (int k = 0; k < mSize; ++k)
+	{
+		complex<double> value = multiply(product[k], mChirp[k]) * scale;
+		data[k * stride] = inverse ? conj(value) : value;
+	}
+}
+
+// The input must already be in bit reversed order.
+void Fft::radix2(complex<double> * data, bool inverse) const
+{
+	for (int length = 2; length <= mPow2Size; length *= 2)
+	{
+		int half = length / 2;
+		int step = mPow2Size / length;
+		for (int begin = 0; begin < mPow2Size; begin += length)
+		{
+			complex<double> * low = data + begin;
+			complex<double> * high = low + half;
+			for (int k = 0; k < half; ++k)
+			{
+				complex<double> twiddle = mTwiddles[k * step];
+				if (inverse)
+				{
+					twiddle = conj(twiddle);
+				}
+				complex<double> odd = multiply(high[k], twiddle);
+				high[k] = low[k] - odd;
+				low[k] += odd;
+			}
+		}
+	}
+}
+
+Fft2d::Fft2d(int width, int height) :
+	mRows(width),
+	mColumns(height)
+{
+
+}
+
+void Fft2d::transform(complex<double> * data, bool inverse) const
+{
+	int width = mRows.size();
+	int height = mColumns.size();
+	for (int row = 0; row < height; ++row)
+	{
+		mRows.transform(data + row * width, inverse);
+	}
+	for (int col = 0; col < width; ++col)
+	{
+		mColumns.transform(data + col, inverse, width);
+	}
+}
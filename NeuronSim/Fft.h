@@ -0,0 +1,74 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <complex>
+#include <vector>
+
+// A one dimensional discrete Fourier transform of a fixed size, calculated
+// with the fast Fourier transform.
+// Powers of two use an iterative radix 2 transform. Any other size is turned
+// into a convolution of twice the size rounded up to a power of two
+// (Bluestein's algorithm), which is a few times slower but works for every
+// size, including primes.
+// The forward transform uses exp(-2 pi i jk / n) and neither direction is
+// scaled, so a forward and inverse transform multiply the data by the size.
+// Transforms are const and use per thread scratch space, so one Fft can be
+// used by many threads at once.
+class Fft
+{
+public:
+	// Constructor
+	// size - the number of points in each transform, at least 1
+	explicit Fft(int size);
+
+	// Return the number of points in each transform
+	int size() const { return mSize; }
+	// Transform size points in place, reading and writing every stride points.
+	void transform(std::complex<double> * data, bool inverse, int stride = 1) const;
+
+private:
+	// Transform mPow2Size contiguous points in place with the radix 2 transform
+	void radix2(std::complex<double> * data, bool inverse) const;
+
+private:
+	// The size of the transform
+	int mSize;
+	// The size of the radix 2 transform used, which is mSize for powers of two
+	int mPow2Size;
+	// exp(-2 pi i k / mPow2Size) for k in [0, mPow2Size / 2)
+	std::vector<std::complex<double>> mTwiddles;
+	// The bit reversed index of each point of the radix 2 transform
+	std::vector<int> mReversed;
+	// exp(-pi i k^2 / mSize) for k in [0, mSize), empty for powers of two
+	std::vector<std::complex<double>> mChirp;
+	// The forward transform of the conjugate chirp, wrapped around to
+	// mPow2Size points, empty for powers of two
+	std::vector<std::complex<double>> mChirpSpectrum;
+};
+
+// A two dimensional discrete Fourier transform of a row major array, made of
+// one dimensional transforms of every row and then every column. Like Fft it
+// is unscaled and can be used by many threads at once.
+class Fft2d
+{
+public:
+	// Constructor
+	// width - the number of points in each row
+	// height - the number of rows
+	Fft2d(int width, int height);
+
+	// Return the number of points in each row
+	int width() const { return mRows.size(); }
+	// Return the number of rows
+	int height() const { return mColumns.size(); }
+	// Transform width * height points in place
+	void transform(std::complex<double> * data, bool inverse) const;
+
+private:
+	// The transform of each row
+	Fft mRows;
+	// The transform of each column
+	Fft mColumns;
+};
+
+#endif
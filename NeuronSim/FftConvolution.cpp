@@ -0,0 +1,221 @@
+#include "FftConvolution.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "Fft.h"
+#include "Layer.h"
+#include "Spiker.h"
+#include "SynapseMatrix.h"
+
+using namespace std;
+
+// The cost of a transform of N points, divided by N log2 N, relative to the
+// cost of firing one spike directly along one synapse. Measured on a single
+// thread with Life layers from 64x64 to 256x256 and matrices from 7x7 to
+// 31x31.
+static const double TRANSFORM_COST(0.5);
+// How many times slower a transform is along a dimension which is not a
+// power of two, and so goes through Bluestein's algorithm.
+static const double BLUESTEIN_COST(4.0);
+// The cost of scanning one total of the results for firing, relative to the
+// cost of firing one spike directly along one synapse.
+static const double SCAN_COST(0.25);
+// Totals are rounded to zero if they are smaller than this proportion of the
+// total weight of the synapses with their delay. Errors in the transforms are
+// around 1e-16 of that, and nothing smaller than 1e-7 of it survives being
+// added up in single precision anyway.
+static const double ZERO_THRESHOLD(1e-9);
+
+FftConvolution::FftConvolution() :
+	mWidth(0),
+	mHeight(0),
+	mMatrixWidth(0),
+	mMatrixHeight(0),
+	mActiveSynapses(0)
+{
+
+}
+
+FftConvolution::~FftConvolution()
+{
+
+}
+
+bool FftConvolution::setSynapses(SynapseMatrix * synapses, int width, int height)
+{
+	if (synapses->width() > width || synapses->height() > height)
+	{
+		return false;
+	}
+	const Synapse * begin = synapses->firedSynapses();
+	const Synapse * end = begin + synapses->width() * synapses->height();
+	bool same = width == mWidth && height == mHeight &&
+		synapses->width() == mMatrixWidth && synapses->height() == mMatrixHeight &&
+		equal(begin, end, mSynapses.begin(), mSynapses.end(), [](const Synapse & one, const Synapse & two)
+		{
+			return one.weight == two.weight && one.delay == two.delay;
+		});
+	if (same)
+	{
+		return true;
+	}
+
+	mWidth = width;
+	mHeight = height;
+	mMatrixWidth = synapses->width();
+	mMatrixHeight = synapses->height();
+	mSynapses.assign(begin, end);
+	mActiveSynapses = 0;
+	mDelays.clear();
+	for (auto & synapse : mSynapses)
+	{
+		if (synapse.weight != 0.0f)
+		{
+			++mActiveSynapses;
+			mDelays.push_back(synapse.delay);
+		}
+	}
+	sort(mDelays.begin(), mDelays.end());
+	mDelays.erase(unique(mDelays.begin(), mDelays.end()), mDelays.end());
+
+	mThresholds.assign(mDelays.size(), 0.0);
+	for (auto & synapse : mSynapses)
+	{
+		if (synapse.weight != 0.0f)
+		{
+			size_t index = lower_bound(mDelays.begin(), mDelays.end(), synapse.delay) - mDelays.begin();
+			mThresholds[index] += fabs(synapse.weight) * ZERO_THRESHOLD;
+		}
+	}
+	mSpectra.assign(jobCount(), vector<complex<double>>());
+	mResults.assign(mDelays.size(), vector<float>());
+	return true;
+}
+
+bool FftConvolution::cheaper(int firing) const
+{
+	double points = double(mWidth) * mHeight;
+	double transforms = jobCount() + 1.0;
+	auto dimensionCost = [](int size) { return (size & (size - 1)) == 0 ? 1.0 : BLUESTEIN_COST; };
+	double transformCost = TRANSFORM_COST * (dimensionCost(mWidth) + dimensionCost(mHeight)) / 2.0;
+	double fftCost = transformCost * transforms * points * log2(max(2.0, points)) + SCAN_COST * points * delayCount();
+	double directCost = double(firing) * mActiveSynapses;
+	return fftCost < directCost;
+}
+
+// The synapse at column sc and row sr of the matrix connects each neuron to
+// the one (sc - width / 2) columns and (sr - height / 2) rows further on, so
+// its weight goes at that offset, wrapped, in the convolution kernel.
+void FftConvolution::calculateSpectrum(const Fft2d & fft, int job)
+{
+	auto & spectrum = mSpectra[job];
+	spectrum.assign(size_t(mWidth) * mHeight, complex<double>());
+	for (int part = 0; part < 2; ++part)
+	{
+		size_t delay = size_t(job) * 2 + part;
+		if (delay >= mDelays.size())
+		{
+			break;
+		}
+		complex<double> unit = part ? complex<double>(0.0, 1.0) : complex<double>(1.0, 0.0);
+		for (int sr = 0; sr < mMatrixHeight; ++sr)
+		{
+			int row = (sr - mMatrixHeight / 2 + mHeight) % mHeight;
+			for (int sc = 0; sc < mMatrixWidth; ++sc)
+			{
+				const Synapse & synapse = mSynapses[sr * mMatrixWidth + sc];
+				if (synapse.weight != 0.0f && synapse.delay == mDelays[delay])
+				{
+					int col = (sc - mMatrixWidth / 2 + mWidth) % mWidth;
+					spectrum[size_t(row) * mWidth + col] += unit * double(synapse.weight);
+				}
+			}
+		}
+	}
+	fft.transform(spectrum.data(), false);
+	double scale = 1.0 / (double(mWidth) * mHeight);
+	for (auto & value : spectrum)
+	{
+		value *= scale;
+	}
+}
+
+void FftConvolution::convolve(const Fft2d & fft, const complex<double> * firing, int job)
+{
+	if (mSpectra[job].empty())
+	{
+		calculateSpectrum(fft, job);
+	}
+	thread_local vector<complex<double>> product;
+	size_t points = size_t(mWidth) * mHeight;
+	product.resize(points);
+	const complex<double> * spectrum = mSpectra[job].data();
+	for (size_t index = 0; index < points; ++index)
+	{
+		const complex<double> & a = firing[index];
+		const complex<double> & b = spectrum[index];
+		product[index] = complex<double>(a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real());
+	}
+	fft.transform(product.data(), true);
+
+	// Both convolutions are real, so the first delay comes back as the real
+	// part and the second as the imaginary part.
+	for (int part = 0; part < 2; ++part)
+	{
+		size_t delay = size_t(job) * 2 + part;
+		if (delay >= mDelays.size())
+		{
+			break;
+		}
+		mResults[delay].resize(points);
+		float * result = mResults[delay].data();
+		double threshold = mThresholds[delay];
+		for (size_t index = 0; index < points; ++index)
+		{
+			double value = part ? product[index].imag() : product[index].real();
+			result[index] = fabs(value) < threshold ? 0.0f : float(value);
+		}
+	}
+}
+
+void FftConvolution::fireRows(const Spike & spike, Spiker * spiker, int rowBegin, int rowEnd) const
+{
+	for (size_t delay = 0; delay < mDelays.size(); ++delay)
+	{
+		for (int row = rowBegin; row < rowEnd; ++row)
+		{
+			const float * total = &mResults[delay][size_t(row) * mWidth];
+			int col = 0;
+			while (col < mWidth)
+			{
+				if (total[col] == 0.0f)
+				{
+					++col;
+					continue;
+				}
+				int runEnd = col + 1;
+				while (runEnd < mWidth && total[runEnd] != 0.0f)
+				{
+					++runEnd;
+				}
+				spiker->fireWeights(spike, row * mWidth + col, runEnd - col, total + col, int(mDelays[delay]));
+				col = runEnd;
+			}
+		}
+	}
+}
+
+void FftConvolution::transformFiring(const Fft2d & fft, Layer * layer, vector<complex<double>> & firing)
+{
+	thread_local vector<float> values;
+	size_t points = size_t(layer->width()) * layer->height();
+	values.resize(points);
+	layer->firingValues(values.data());
+	firing.resize(points);
+	for (size_t index = 0; index < points; ++index)
+	{
+		firing[index] = complex<double>(values[index], 0.0);
+	}
+	fft.transform(firing.data(), false);
+}
@@ -0,0 +1,92 @@
+#ifndef FFT_CONVOLUTION_H
+#define FFT_CONVOLUTION_H
+
+#include <complex>
+#include <vector>
+
+#include "Synapse.h"
+
+class Fft2d;
+class Layer;
+class Spike;
+class Spiker;
+class SynapseMatrix;
+
+// FftConvolution fires the spikes of a synapse matrix for a whole layer at
+// once. Because fireSpikes wraps around the edges of the layer, the total
+// weight each neuron receives through the synapses with a given delay is
+// exactly the circular convolution of the firing neurons with those synapses,
+// which is a pointwise product of their Fourier transforms.
+// The cost is O(N log N) per pair of delays for a layer of N neurons,
+// whatever the size of the matrix and however many neurons fire, so it is
+// only worth using for large matrices and busy layers (see cheaper).
+// The work for a tick is done in three steps, each of which can be spread
+// over threads:
+// - transformFiring, once per source layer
+// - convolve, once per job (pair of delays)
+// - fireRows, for any split of the target rows
+class FftConvolution
+{
+public:
+	// Constructor
+	FftConvolution();
+	// Destructor
+	~FftConvolution();
+
+	// Take a copy of the synapses for layers of the given size. Nothing is
+	// recalculated if they are the same as last time. Returns false if the
+	// synapse matrix is larger than the layers, which fireSpikes does not
+	// wrap around more than once, and so cannot be convolved.
+	bool setSynapses(SynapseMatrix * synapses, int width, int height);
+	// Return the number of distinct delays of the synapses with non zero weights
+	int delayCount() const { return int(mDelays.size()); }
+	// Return the number of synapses with non zero weights
+	int activeSynapses() const { return mActiveSynapses; }
+	// Return true if convolving is estimated to be cheaper than firing the
+	// given number of neurons directly through every active synapse.
+	bool cheaper(int firing) const;
+	// Return the number of jobs that convolve is split into. Each job
+	// transforms back the results for two delays at once.
+	int jobCount() const { return (delayCount() + 1) / 2; }
+	// Calculate the results for one job from the transform of the firing
+	// neurons of the source layer. Jobs may run concurrently.
+	void convolve(const Fft2d & fft, const std::complex<double> * firing, int job);
+	// Fire the results for rows [rowBegin, rowEnd) of the target layer. Only
+	// runs of neurons with non zero totals are fired, one batch per delay.
+	void fireRows(const Spike & spike, Spiker * spiker, int rowBegin, int rowEnd) const;
+
+	// Calculate the transform of the firing neurons of a layer
+	static void transformFiring(const Fft2d & fft, Layer * layer, std::vector<std::complex<double>> & firing);
+
+private:
+	// Calculate the transform of the weights for one job
+	void calculateSpectrum(const Fft2d & fft, int job);
+
+private:
+	// The width of the layers
+	int mWidth;
+	// The height of the layers
+	int mHeight;
+	// The width of the synapse matrix
+	int mMatrixWidth;
+	// The height of the synapse matrix
+	int mMatrixHeight;
+	// A copy of the synapses, to tell when they change
+	std::vector<Synapse> mSynapses;
+	// The number of synapses with non zero weights
+	int mActiveSynapses;
+	// The distinct delays, in ascending order
+	std::vector<uint32_t> mDelays;
+	// Totals smaller than this, for each delay, are rounding errors and are
+	// treated as zero
+	std::vector<double> mThresholds;
+	// For each job, the transform of the weights of its first delay plus i
+	// times those of its second delay, scaled to undo the unscaled inverse
+	// transform. Calculated the first time each job runs.
+	std::vector<std::vector<std::complex<double>>> mSpectra;
+	// The total weight received by every neuron, for each delay. Allocated
+	// the first time each job runs.
+	std::vector<std::vector<float>> mResults;
+};
+
+#endif
@@ -0,0 +1,194 @@
+#include "FiringHistory.h"
+
+#include <algorithm>
+#include <climits>
+
+#include "Layer.h"
+#include "Spike.h"
+#include "Spiker.h"
+#include "SynapseMatrix.h"
+
+using namespace std;
+
+// Adds the potential that each spike delivers on the current tick, having
+// been fired a given number of ticks ago, into a frame of the target.
+class HistorySpiker : public Spiker
+{
+public:
+	HistorySpiker(float * potentials, int age) : mPotentials(potentials), mAge(age) {}
+	void fire(const Spike & spike, int index, float weight, int delay) override
+	{
+		fireWeights(spike, index, 1, &weight, delay);
+	}
+	void fireWeights(const Spike & spike, int index, int count, const float * weights, int delay) override
+	{
+		int offset = mAge - 1 - delay;
+		if (offset < 0 || offset >= spike.duration())
+		{
+			return;
+		}
+		float potential = spike.potential(offset);
+		float * __restrict potentials = mPotentials + index;
+		for (int ii = 0; ii < count; ++ii)
+		{
+			potentials[ii] += weights[ii] * potential;
+		}
+	}
+private:
+	float * mPotentials; //< The frame of the target
+	int mAge;            //< The number of ticks since the spikes were fired
+};
+
+FiringHistory::FiringHistory(std::shared_ptr<Layer> layer, int depth) :
+	mLayer(layer),
+	mWidth(0),
+	mHeight(0),
+	mWords(0),
+	mCurrent(0)
+{
+	mFired.resize(depth + 1);
+	fit();
+}
+
+FiringHistory::~FiringHistory()
+{
+}
+
+// The entries are copied out in order of age, with the current tick moved
+// to the first entry.
+void FiringHistory::setDepth(int depth)
+{
+	if (depth == this->depth())
+	{
+		return;
+	}
+	size_t entrySize = size_t(mWords) * mHeight;
+	int entries = depth + 1;
+	vector<uint64_t> firing(entrySize * entries);
+	vector<char> rowsFired(size_t(mHeight) * entries);
+	vector<char> fired(entries);
+	for (int age = 1; age <= min(depth, this->depth()); ++age)
+	{
+		int from = entry(age);
+		int to = entries - age;
+		copy(mFiring.begin() + from * entrySize, mFiring.begin() + (from + 1) * entrySize, firing.begin() + to * entrySize);
+		copy(mRowsFired.begin() + from * mHeight, mRowsFired.begin() + (from + 1) * mHeight, rowsFired.begin() + to * mHeight);
+		fired[to] = mFired[from];
+	}
+	mFiring.swap(firing);
+	mRowsFired.swap(rowsFired);
+	mFired.swap(fired);
+	mCurrent = 0;
+}
+
+void FiringHistory::fit()
+{
+	if (mWidth == mLayer->width() && mHeight == mLayer->height())
+	{
+		return;
+	}
+	mWidth = mLayer->width();
+	mHeight = mLayer->height();
+	mWords = (mWidth + 63) / 64;
+	mFiring.assign(size_t(mWords) * mHeight * mFired.size(), 0);
+	mRowsFired.assign(size_t(mHeight) * mFired.size(), 0);
+	clear();
+}
+
+void FiringHistory::record(int rowBegin, int rowEnd)
+{
+	const uint64_t * flags = mLayer->firingBits();
+	uint64_t * current = &mFiring[size_t(mCurrent) * mWords * mHeight];
+	char * rowsFired = &mRowsFired[size_t(mCurrent) * mHeight];
+	for (int row = rowBegin; row < rowEnd; ++row)
+	{
+		const uint64_t * from = flags + size_t(row) * mWords;
+		uint64_t any = 0;
+		for (int ww = 0; ww < mWords; ++ww)
+		{
+			current[size_t(row) * mWords + ww] = from[ww];
+			any |= from[ww];
+		}
+		rowsFired[row] = any != 0;
+	}
+}
+
+void FiringHistory::advance()
+{
+	const char * rowsFired = &mRowsFired[size_t(mCurrent) * mHeight];
+	mFired[mCurrent] = any_of(rowsFired, rowsFired + mHeight, [](char fired) { return fired != 0; });
+	mCurrent = (mCurrent + 1) % int(mFired.size());
+}
+
+void FiringHistory::clear()
+{
+	fill(mFired.begin(), mFired.end(), 0);
+}
+
+// Only the ticks whose spikes can still be arriving through some synapse
+// of the matrix are gathered, and only if anything fired on them. The
+// compiled forms of the matrix are used in the same way as by
+// Net::gatherSpikes, each tick of the history standing in for the firing
+// flags of the layer, except that the separable decomposition is only used
+// when every synapse has the same delay. Otherwise only the synapses whose
+// delays bring the spikes of each tick to the targets now are gathered from
+// the stencil.
+void FiringHistory::gather(SynapseMatrix * synapses, float * potentials, int rowBegin, int rowEnd) const
+{
+	const Spike & spike = mLayer->spike();
+	int matrixHeight = synapses->height();
+	bool compiled = synapses->width() <= mWidth && matrixHeight <= mHeight && synapses->isCompiled();
+	int delayMin = INT_MAX;
+	int delayMax = -1;
+	if (compiled)
+	{
+		auto & buckets = synapses->stencil().buckets();
+		if (!buckets.empty())
+		{
+			delayMin = buckets.front().delay;
+			delayMax = buckets.back().delay;
+		}
+	}
+	else
+	{
+		const Synapse * synapse = synapses->firedSynapses();
+		for (int index = 0; index < synapses->width() * matrixHeight; ++index)
+		{
+			if (synapse[index].weight != 0.0f)
+			{
+				delayMin = min(delayMin, int(synapse[index].delay));
+				delayMax = max(delayMax, int(synapse[index].delay));
+			}
+		}
+	}
+	if (delayMax < 0)
+	{
+		return;
+	}
+
+	int ageEnd = min(depth(), delayMax + spike.duration());
+	for (int age = delayMin + 1; age <= ageEnd; ++age)
+	{
+		int index = entry(age);
+		if (!mFired[index])
+		{
+			continue;
+		}
+		HistorySpiker spiker(potentials, age);
+		const uint64_t * flags = firing(index);
+		if (!compiled)
+		{
+			synapses->gather(spike, &spiker, flags, mWidth, mHeight, rowBegin, rowEnd);
+		}
+		else if (delayMin != delayMax || !synapses->separable().fire(spike, &spiker, flags, mWidth, mHeight,
+			rowBegin - (matrixHeight - 1) + matrixHeight / 2, rowEnd + matrixHeight / 2, rowBegin, rowEnd))
+		{
+			synapses->stencil().gather(spike, &spiker, flags, mWidth, mHeight, rowBegin, rowEnd, age - spike.duration(), age);
+		}
+	}
+}
+
+uint64_t FiringHistory::bytes() const
+{
+	return mFiring.size() * sizeof(uint64_t) + mRowsFired.size() + mFired.size();
+}
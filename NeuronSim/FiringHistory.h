@@ -0,0 +1,80 @@
+#ifndef FIRING_HISTORY_H
+#define FIRING_HISTORY_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class Layer;
+class SynapseMatrix;
+
+// A firing history keeps the packed firing flags of a layer for each of the
+// last few ticks, as an alternative to spike trains (see
+// Automaton::ACCUMULATE_HISTORY). Nothing is fired into anything when
+// neurons fire. Instead each target works out what arrives at its neurons
+// on each tick from the history of every layer it receives from: the spike
+// fired a ticks ago through a synapse with delay d contributes the
+// (a - 1 - d)th potential of its shape, if it has not ended.
+// One bit per neuron per tick is kept, however many synapse matrices the
+// layer fires along, so this takes a small fraction of the memory of the
+// frames of spike trains, at the cost of gathering each matrix once for every
+// tick of the history that can still be arriving through it.
+// A history is a circular buffer with a spare entry, which the current tick
+// is recorded into, so that rows can be recorded by one thread while others
+// gather from the earlier entries.
+class FiringHistory
+{
+public:
+	// Constructor
+	// layer - the layer whose firing is recorded
+	// depth - the number of ticks to keep, which is the longest delay of any
+	// synapse matrix from the layer plus the duration of its spikes
+	FiringHistory(std::shared_ptr<Layer> layer, int depth);
+	// Destructor
+	~FiringHistory();
+
+	// The layer whose firing is recorded
+	std::shared_ptr<Layer> layer() { return mLayer; }
+	// The number of ticks kept
+	int depth() const { return int(mFired.size()) - 1; }
+	// Change the number of ticks kept, keeping the most recent ones. Must not
+	// be called during a tick.
+	void setDepth(int depth);
+	// Clear the history if the layer has changed size since it was last
+	// called, or the history was made. Must not be called during a tick.
+	void fit();
+	// Copy the firing flags of rows [rowBegin, rowEnd) of the layer into the
+	// current tick. Every row must be recorded on every tick, and disjoint
+	// row ranges can be recorded concurrently.
+	void record(int rowBegin, int rowEnd);
+	// Move on to the next tick, once every row has been recorded
+	void advance();
+	// Forget every tick before the current one
+	void clear();
+	// Add the potentials arriving on the current tick through a synapse matrix
+	// from the layer to rows [rowBegin, rowEnd) of potentials, which covers
+	// the whole of the target, in row major order. Only the earlier ticks are
+	// read, so this may run concurrently with record, and for disjoint row
+	// ranges with itself.
+	void gather(SynapseMatrix * synapses, float * potentials, int rowBegin, int rowEnd) const;
+	// Returns the number of bytes the history takes
+	uint64_t bytes() const;
+
+private:
+	// The index of the entry of the tick age ticks before the current one
+	int entry(int age) const { return (mCurrent + int(mFired.size()) - age) % int(mFired.size()); }
+	// The firing flags of an entry
+	const uint64_t * firing(int entry) const { return &mFiring[size_t(entry) * mWords * mHeight]; }
+
+private:
+	std::shared_ptr<Layer> mLayer;  //< The layer whose firing is recorded
+	int mWidth;                     //< The width of the layer
+	int mHeight;                    //< The height of the layer
+	int mWords;                     //< The number of words of flags in each row
+	int mCurrent;                   //< The entry the current tick is recorded into
+	std::vector<uint64_t> mFiring;  //< The firing flags of every entry
+	std::vector<char> mRowsFired;   //< Non zero for each row of each entry in which any neuron fired
+	std::vector<char> mFired;       //< Non zero for each entry in which any neuron fired
+};
+
+#endif
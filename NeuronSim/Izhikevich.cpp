@@ -21,6 +21,8 @@ Izhikevich::Izhikevich(int width, int height) :
 	mC(-65.0f),
 	mD(2.0f)
 {
+	packField(&NeuronIzhikevich::v);
+	packField(&NeuronIzhikevich::u);
 	clear();
 }
 
@@ -79,49 +81,131 @@ const ConfigPresets & Izhikevich::getPresets()
 void Izhikevich::clear()
 {
 	Net<NeuronIzhikevich>::clear();
-	for (auto neuron = mNeurons.begin(); neuron != mNeurons.end(); ++neuron)
+	forTiles(0, mHeight, [&](int rowBegin, int rowEnd)
 	{
-		// This is one of the two solutions for a stable state
-		// The alternative is +sqrtf(val)
-		// We expect the lower value to be the properly stable point, and the
-		// higher value to be an unstable excited state
-		// It doesn't work very well and we have abandoned it for now.
-		//float val = fabs((mV1 + mB) * (mV1 + mB) - 4.0f * mV2 * mV0);
-		//neuron->v = mB - mV1 - sqrtf(val);
-
-		neuron->v = mC;
-		neuron->u = mB * mC;
-	}
+		auto v = field(&NeuronIzhikevich::v);
+		auto u = field(&NeuronIzhikevich::u);
+		for (int index = rowBegin * mWidth; index < rowEnd * mWidth; ++index)
+		{
+			// This is one of the two solutions for a stable state
+			// The alternative is +sqrtf(val)
+			// We expect the lower value to be the properly stable point, and the
+			// higher value to be an unstable excited state
+			// It doesn't work very well and we have abandoned it for now.
+			//float val = fabs((mV1 + mB) * (mV1 + mB) - 4.0f * mV2 * mV0);
+			//neuron->v = mB - mV1 - sqrtf(val);
+
+			v[index] = mC;
+			u[index] = mB * mC;
+		}
+	});
 }
 
-void Izhikevich::tick()
+#ifdef NEURON_SIMD
+namespace
 {
-	processDendrites();
+	// The explicitly vectorised version of Izhikevich::tickRows, which also
+	// processes the dendrites as it goes. The arithmetic is done in the same
+	// order as the scalar version, so that the results are identical.
+	struct IzhikevichKernel
+	{
+		float * input;
+		float * shunt;
+		float * v;
+		float * u;
+		float a;
+		float b;
+		float c;
+		float d;
+
+		SIMD_TARGET_AVX512 __mmask16 operator()(int index, __mmask16 active) const
+		{
+			const __m512 one = _mm512_set1_ps(1.0f);
+			__m512 in = _mm512_maskz_loadu_ps(active, input + index);
+			__m512 sh = _mm512_mask_loadu_ps(one, active, shunt + index);
+			__m512 oldV = _mm512_maskz_loadu_ps(active, v + index);
+			__m512 oldU = _mm512_maskz_loadu_ps(active, u + index);
+			in = _mm512_div_ps(in, sh);
+			__m512 dv = mulAvx512(mulAvx512(_mm512_set1_ps(V2), oldV), oldV);
+			dv = _mm512_add_ps(dv, mulAvx512(_mm512_set1_ps(V1), oldV));
+			dv = _mm512_add_ps(dv, _mm512_set1_ps(V0));
+			dv = _mm512_sub_ps(dv, oldU);
+			dv = _mm512_add_ps(dv, in);
+			__m512 newV = _mm512_add_ps(oldV, dv);
+			__m512 du = _mm512_sub_ps(mulAvx512(_mm512_set1_ps(b), newV), oldU);
+			__m512 newU = _mm512_add_ps(oldU, mulAvx512(_mm512_set1_ps(a), du));
+			__mmask16 firing = _mm512_mask_cmp_ps_mask(active, newV, _mm512_set1_ps(30.0f), _CMP_GE_OQ);
+			newV = _mm512_mask_blend_ps(firing, newV, _mm512_set1_ps(c));
+			newU = _mm512_mask_add_ps(newU, firing, newU, _mm512_set1_ps(d));
+			_mm512_mask_storeu_ps(v + index, active, newV);
+			_mm512_mask_storeu_ps(u + index, active, newU);
+			_mm512_mask_storeu_ps(input + index, active, _mm512_setzero_ps());
+			_mm512_mask_storeu_ps(shunt + index, active, one);
+			return firing;
+		}
 
-	NeuronIzhikevich * cell = &mNeurons[0];
-	for (int rr = 0; rr < mHeight; ++rr)
+		SIMD_TARGET_AVX2 int operator()(int index, __m256i active) const
+		{
+			const __m256 one = _mm256_set1_ps(1.0f);
+			__m256 in = _mm256_maskload_ps(input + index, active);
+			__m256 sh = _mm256_blendv_ps(one, _mm256_maskload_ps(shunt + index, active), _mm256_castsi256_ps(active));
+			__m256 oldV = _mm256_maskload_ps(v + index, active);
+			__m256 oldU = _mm256_maskload_ps(u + index, active);
+			in = _mm256_div_ps(in, sh);
+			__m256 dv = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(V2), oldV), oldV);
+			dv = _mm256_add_ps(dv, _mm256_mul_ps(_mm256_set1_ps(V1), oldV));
+			dv = _mm256_add_ps(dv, _mm256_set1_ps(V0));
+			dv = _mm256_sub_ps(dv, oldU);
+			dv = _mm256_add_ps(dv, in);
+			__m256 newV = _mm256_add_ps(oldV, dv);
+			__m256 du = _mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(b), newV), oldU);
+			__m256 newU = _mm256_add_ps(oldU, _mm256_mul_ps(_mm256_set1_ps(a), du));
+			__m256 firing = _mm256_cmp_ps(newV, _mm256_set1_ps(30.0f), _CMP_GE_OQ);
+			newV = _mm256_blendv_ps(newV, _mm256_set1_ps(c), firing);
+			newU = _mm256_blendv_ps(newU, _mm256_add_ps(newU, _mm256_set1_ps(d)), firing);
+			_mm256_maskstore_ps(v + index, active, newV);
+			_mm256_maskstore_ps(u + index, active, newU);
+			_mm256_maskstore_ps(input + index, active, _mm256_setzero_ps());
+			_mm256_maskstore_ps(shunt + index, active, one);
+			return _mm256_movemask_ps(firing);
+		}
+	};
+}
+#endif
+
+void Izhikevich::tickRows(int rowBegin, int rowEnd)
+{
+	forTiles(rowBegin, rowEnd, [&](int tileBegin, int tileEnd)
 	{
-		for (int cc = 0; cc < mWidth; ++cc)
+		auto input = field(&NeuronIzhikevich::input);
+		auto v = field(&NeuronIzhikevich::v);
+		auto u = field(&NeuronIzhikevich::u);
+#ifdef NEURON_SIMD
+		IzhikevichKernel kernel = { input.data(), field(&NeuronIzhikevich::shunt).data(), v.data(), u.data(),
+			mA, mB, mC, mD };
+		if (updateRowsSimd(tileBegin, tileEnd, kernel))
 		{
-			float v = cell->v;
-			float u = cell->u;
-			cell->v += V2 * v * v + V1 * v + V0 - u + cell->input;
-			cell->u += mA * (mB * cell->v - u); // use of new version of V intentional
-			cell->input = 0.0f;
-			if (cell->v >= 30)
-			{
-				cell->v = mC;
-				cell->u = cell->u + mD;
-				cell->firing = true;
-			}
-			else
+			return;
+		}
+#endif
+		processDendrites(tileBegin, tileEnd);
+
+		updateRows(tileBegin, tileEnd, [&](int index)
+		{
+			float oldV = v[index];
+			float oldU = u[index];
+			v[index] += V2 * oldV * oldV + V1 * oldV + V0 - oldU + input[index];
+			u[index] += mA * (mB * v[index] - oldU); // use of new version of V intentional
+			input[index] = 0.0f;
+			if (v[index] >= 30)
 			{
-				cell->firing = false;
+				v[index] = mC;
+				u[index] = u[index] + mD;
+				return true;
 			}
-
-			++cell;
-		}
-	}
+			return false;
+		});
+	});
 }
 
 void Izhikevich::paintState(uint32_t * image)
@@ -129,10 +213,14 @@ void Izhikevich::paintState(uint32_t * image)
 	// We draw the reset variable instead of the potential here.
 	// The potential tends to a lot more short lived and less indicative of
 	// a contiuously changing state than u.
-	for (auto cell = begin(); cell != end(); ++cell)
+	forTiles(0, mHeight, [&](int rowBegin, int rowEnd)
 	{
-		uint32_t col = uint32_t(clamp((128.0f + 2.0f * cell->v), 0.0f, 255.0f));
-		*image++ = 0xFF000000 | col | (col << 8) | (col << 16);
-	}
+		auto v = field(&NeuronIzhikevich::v);
+		for (int index = rowBegin * mWidth; index < rowEnd * mWidth; ++index)
+		{
+			uint32_t col = uint32_t(clamp((128.0f + 2.0f * v[index]), 0.0f, 255.0f));
+			*image++ = 0xFF000000 | col | (col << 8) | (col << 16);
+		}
+	});
 }
 
@@ -42,8 +42,9 @@ public:
 	// Reset all cells in this layer to a state which is hopefully
 	// queiscent and stable (v = mC, u = mC * mB)
 	void clear();
-	// Perform the logical processing specific to Izhikevich neurons
-	void tick();
+	// Perform the logical processing specific to Izhikevich neurons, for the
+	// neurons in rows [rowBegin, rowEnd)
+	void tickRows(int rowBegin, int rowEnd) override;
 
 private:
 	float mA;  //< Recovery time scale
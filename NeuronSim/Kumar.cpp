@@ -19,6 +19,8 @@ Kumar::Kumar(int width, int height) :
 	mC(0.0f),
 	mD(2.0f)
 {
+	packField(&NeuronKumar::u);
+	packField(&NeuronKumar::v);
 	clear();
 }
 
@@ -70,49 +72,121 @@ const ConfigPresets & Kumar::getPresets()
 void Kumar::clear()
 {
 	Net<NeuronKumar>::clear();
-	for (auto neuron = mNeurons.begin(); neuron != mNeurons.end(); ++neuron)
+	forTiles(0, mHeight, [&](int rowBegin, int rowEnd)
 	{
-		neuron->v = mC;
-		neuron->u = mB * neuron->v;
-	}
+		auto v = field(&NeuronKumar::v);
+		auto u = field(&NeuronKumar::u);
+		for (int index = rowBegin * mWidth; index < rowEnd * mWidth; ++index)
+		{
+			v[index] = mC;
+			u[index] = mB * v[index];
+		}
+	});
 }
 
-void Kumar::tick()
+#ifdef NEURON_SIMD
+namespace
 {
-	NeuronKumar * cell = &mNeurons[0];
-	for (int rr = 0; rr < mHeight; ++rr)
+	// The explicitly vectorised version of Kumar::tickRows. This uses a
+	// vector exp, so it is close to but not exactly the same as the scalar
+	// version.
+	struct KumarKernel
 	{
-		for (int cc = 0; cc < mWidth; ++cc)
+		float * input;
+		float * v;
+		float * u;
+		float vScale;
+		float a;
+		float b;
+		float c;
+		float d;
+
+		SIMD_TARGET_AVX512 __mmask16 operator()(int index, __mmask16 active) const
 		{
-			float v = cell->v;
-			float u = cell->u;
-			cell->v += exp(v * v) + mV * v - u + cell->input;
-			cell->u += mA * (mB * v - u);
-			cell->input = 0.0f;
-			if (cell->v >= 3)
-			{
-				cell->v = mC;
-				cell->u = cell->u + mD;
-				cell->firing = true;
-			}
-			else
-			{
-				cell->firing = false;
-			}
+			__m512 in = _mm512_maskz_loadu_ps(active, input + index);
+			__m512 oldV = _mm512_maskz_loadu_ps(active, v + index);
+			__m512 oldU = _mm512_maskz_loadu_ps(active, u + index);
+			__m512 dv = expAvx512(mulAvx512(oldV, oldV));
+			dv = _mm512_add_ps(dv, mulAvx512(_mm512_set1_ps(vScale), oldV));
+			dv = _mm512_sub_ps(dv, oldU);
+			dv = _mm512_add_ps(dv, in);
+			__m512 newV = _mm512_add_ps(oldV, dv);
+			__m512 du = _mm512_sub_ps(mulAvx512(_mm512_set1_ps(b), oldV), oldU);
+			__m512 newU = _mm512_add_ps(oldU, mulAvx512(_mm512_set1_ps(a), du));
+			__mmask16 firing = _mm512_mask_cmp_ps_mask(active, newV, _mm512_set1_ps(3.0f), _CMP_GE_OQ);
+			newV = _mm512_mask_blend_ps(firing, newV, _mm512_set1_ps(c));
+			newU = _mm512_mask_add_ps(newU, firing, newU, _mm512_set1_ps(d));
+			_mm512_mask_storeu_ps(v + index, active, newV);
+			_mm512_mask_storeu_ps(u + index, active, newU);
+			_mm512_mask_storeu_ps(input + index, active, _mm512_setzero_ps());
+			return firing;
+		}
 
-			++cell;
+		SIMD_TARGET_AVX2 int operator()(int index, __m256i active) const
+		{
+			__m256 in = _mm256_maskload_ps(input + index, active);
+			__m256 oldV = _mm256_maskload_ps(v + index, active);
+			__m256 oldU = _mm256_maskload_ps(u + index, active);
+			__m256 dv = expAvx2(_mm256_mul_ps(oldV, oldV));
+			dv = _mm256_add_ps(dv, _mm256_mul_ps(_mm256_set1_ps(vScale), oldV));
+			dv = _mm256_sub_ps(dv, oldU);
+			dv = _mm256_add_ps(dv, in);
+			__m256 newV = _mm256_add_ps(oldV, dv);
+			__m256 du = _mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(b), oldV), oldU);
+			__m256 newU = _mm256_add_ps(oldU, _mm256_mul_ps(_mm256_set1_ps(a), du));
+			__m256 firing = _mm256_cmp_ps(newV, _mm256_set1_ps(3.0f), _CMP_GE_OQ);
+			newV = _mm256_blendv_ps(newV, _mm256_set1_ps(c), firing);
+			newU = _mm256_blendv_ps(newU, _mm256_add_ps(newU, _mm256_set1_ps(d)), firing);
+			_mm256_maskstore_ps(v + index, active, newV);
+			_mm256_maskstore_ps(u + index, active, newU);
+			_mm256_maskstore_ps(input + index, active, _mm256_setzero_ps());
+			return _mm256_movemask_ps(firing);
 		}
-	}
+	};
+}
+#endif
+
+void Kumar::tickRows(int rowBegin, int rowEnd)
+{
+	forTiles(rowBegin, rowEnd, [&](int tileBegin, int tileEnd)
+	{
+		auto input = field(&NeuronKumar::input);
+		auto v = field(&NeuronKumar::v);
+		auto u = field(&NeuronKumar::u);
+#ifdef NEURON_SIMD
+		if (updateRowsSimd(tileBegin, tileEnd, KumarKernel{ input.data(), v.data(), u.data(), mV, mA, mB, mC, mD }))
+		{
+			return;
+		}
+#endif
+		updateRows(tileBegin, tileEnd, [&](int index)
+		{
+			float oldV = v[index];
+			float oldU = u[index];
+			v[index] += exp(oldV * oldV) + mV * oldV - oldU + input[index];
+			u[index] += mA * (mB * oldV - oldU);
+			input[index] = 0.0f;
+			if (v[index] >= 3)
+			{
+				v[index] = mC;
+				u[index] = u[index] + mD;
+				return true;
+			}
+			return false;
+		});
+	});
 }
 
 void Kumar::paintState(uint32_t * image)
 {
-	auto * cell = &mNeurons[0];
 	uint32_t * pixel = image;
-	for (int count = mHeight * mWidth; count != 0; count--)
+	forTiles(0, mHeight, [&](int rowBegin, int rowEnd)
 	{
-		uint32_t col = uint32_t(clamp((128.0f + 8.0f * cell->v), 0.0f, 255.0f));
-		*pixel++ = 0xFF000000 | col | (col << 8) | (col << 16);
-		++cell;
-	}
+		auto v = field(&NeuronKumar::v);
+		for (int index = rowBegin * mWidth; index < rowEnd * mWidth; ++index)
+		{
+			uint32_t col = uint32_t(clamp((128.0f + 8.0f * v[index]), 0.0f, 255.0f));
+			*pixel++ = 0xFF000000 | col | (col << 8) | (col << 16);
+		}
+	});
 }
\ No newline at end of file
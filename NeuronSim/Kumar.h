@@ -37,8 +37,9 @@ public:
 	// Reset all cells in this layer to a state which is hopefully
 	// queiscent and stable (v = mC, u = mC * mB)
 	void clear();
-	// Perform the logical processing specific to Izhikevich neurons
-	void tick();
+	// Perform the logical processing specific to Kumar neurons, for the
+	// neurons in rows [rowBegin, rowEnd)
+	void tickRows(int rowBegin, int rowEnd) override;
 
 private:
 	float mV;  //< The V term
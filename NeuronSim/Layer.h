@@ -6,8 +6,10 @@
 #include <string>
 
 #include "ConfigSet.h"
+#include "Precision.h"
 #include "SynapseMatrix.h"
 #include "Spike.h"
+#include "SpikeEvent.h"
 #include "Spiker.h"
 
 class SpikeProcessor;
@@ -21,6 +23,11 @@ class ConfigPresets;
 // - fireSpikes()  - once per synapse sourced from this layer
 // - paintState()  - zero or one times per frame
 // - paintSpikes() - zero or one times per frame
+// The automaton may split tick() and fireSpikes() into bands of rows and call
+// the row range versions of them concurrently for different bands. Neurons in
+// different rows must therefore never depend on each other while ticking.
+// gatherSpikes() is an alternative to fireSpikes() which produces the same
+// spikes, but is organised around the neurons receiving them.
 class Layer
 {
 public:
@@ -30,10 +37,13 @@ public:
 
 	virtual void save(const std::filesystem::path & path) = 0;
 	virtual void load(const std::filesystem::path & path) = 0;
-	virtual void receiveSpikes(float * spikes) = 0;
-	virtual void receiveShunts(float * shunts) = 0;
-	virtual void tick() = 0;
-	virtual void fireSpikes(SynapseMatrix * synapses, Spiker * spiker) = 0;
+	virtual void receiveSpikes(float * spikes, int rowBegin, int rowEnd) = 0;
+	virtual void receiveShunts(float * shunts, int rowBegin, int rowEnd) = 0;
+	virtual void receiveSpikes(const SpikeEvent * events, int count) = 0;
+	virtual void receiveShunts(const SpikeEvent * events, int count) = 0;
+	virtual void tickRows(int rowBegin, int rowEnd) = 0;
+	virtual void fireSpikes(SynapseMatrix * synapses, Spiker * spiker, int rowBegin, int rowEnd) = 0;
+	virtual void gatherSpikes(SynapseMatrix * synapses, Spiker * spiker, int rowBegin, int rowEnd) = 0;
 	virtual std::string typeName() = 0;
 	virtual void paintState(uint32_t * image) = 0;
 	virtual void paintSpikes(uint32_t * image) = 0;
@@ -42,6 +52,15 @@ public:
 	virtual const ConfigPresets & getPresets() = 0;
 	virtual void clear() = 0;
 	virtual void inject(int col, int row, float weight) = 0;
+	virtual int firingCount() = 0;
+	virtual const uint64_t * firingBits() = 0;
+	virtual void firingValues(float * values) = 0;
+	virtual int neuronBytes() = 0;
+	virtual void setPrecision(Precision precision) = 0;
+	virtual Precision precision() = 0;
+
+	void tick() { tickRows(0, mHeight); }
+	void fireSpikes(SynapseMatrix * synapses, Spiker * spiker) { fireSpikes(synapses, spiker, 0, mHeight); }
 
 	const std::string & name() const { return mName; }
 	void setName(const std::string & name) { mName = name; }
@@ -51,6 +70,7 @@ public:
 	void setSpike(Spike::Shape shape, int duration) { mSpike.setSpike(shape, duration); }
 	Spike::Shape spikeShape() { return mSpike.shape();}
 	int spikeDuration() { return mSpike.duration(); }
+	const Spike & spike() const { return mSpike; }
 	void selectPreset(const std::string & name);
 	void regenerateName();
 	uint32_t color() const { return mColor; }
@@ -58,16 +58,64 @@ const ConfigPresets & Life::presets()
 	return presets;
 }
 
-void Life::tick()
+#ifdef NEURON_SIMD
+namespace
 {
-	auto * cell = &mNeurons[0];
-	for (int num = (int)mNeurons.size(); num; --num)
+	// The explicitly vectorised version of Life::tickRows
+	struct LifeKernel
 	{
-		assert(cell->input != neuronLifeCheck);
-		cell->input /= cell->shunt;
-		cell->shunt = 1.0f;
-		cell->firing = cell->input > mLow && cell->input < mHigh;
-		cell->input = 0.0f;
-		++cell;
+		float * input;
+		float * shunt;
+		float low;
+		float high;
+
+		SIMD_TARGET_AVX512 __mmask16 operator()(int index, __mmask16 active) const
+		{
+			const __m512 one = _mm512_set1_ps(1.0f);
+			__m512 in = _mm512_maskz_loadu_ps(active, input + index);
+			__m512 sh = _mm512_mask_loadu_ps(one, active, shunt + index);
+			in = _mm512_div_ps(in, sh);
+			__mmask16 firing = _mm512_mask_cmp_ps_mask(active, in, _mm512_set1_ps(low), _CMP_GT_OQ);
+			firing = _mm512_mask_cmp_ps_mask(firing, in, _mm512_set1_ps(high), _CMP_LT_OQ);
+			_mm512_mask_storeu_ps(input + index, active, _mm512_setzero_ps());
+			_mm512_mask_storeu_ps(shunt + index, active, one);
+			return firing;
+		}
+
+		SIMD_TARGET_AVX2 int operator()(int index, __m256i active) const
+		{
+			const __m256 one = _mm256_set1_ps(1.0f);
+			__m256 in = _mm256_maskload_ps(input + index, active);
+			__m256 sh = _mm256_blendv_ps(one, _mm256_maskload_ps(shunt + index, active), _mm256_castsi256_ps(active));
+			in = _mm256_div_ps(in, sh);
+			__m256 firing = _mm256_and_ps(
+				_mm256_cmp_ps(in, _mm256_set1_ps(low), _CMP_GT_OQ),
+				_mm256_cmp_ps(in, _mm256_set1_ps(high), _CMP_LT_OQ));
+			_mm256_maskstore_ps(input + index, active, _mm256_setzero_ps());
+			_mm256_maskstore_ps(shunt + index, active, one);
+			return _mm256_movemask_ps(firing);
+		}
+	};
+}
+#endif
+
+void Life::tickRows(int rowBegin, int rowEnd)
+{
+	auto input = field(&NeuronLife::input);
+	auto shunt = field(&NeuronLife::shunt);
+#ifdef NEURON_SIMD
+	if (updateRowsSimd(rowBegin, rowEnd, LifeKernel{ input.data(), shunt.data(), mLow, mHigh }))
+	{
+		return;
 	}
+#endif
+	updateRows(rowBegin, rowEnd, [&](int index)
+	{
+		assert(input[index] != neuronLifeCheck);
+		input[index] /= shunt[index];
+		shunt[index] = 1.0f;
+		bool firing = input[index] > mLow && input[index] < mHigh;
+		input[index] = 0.0f;
+		return firing;
+	});
 }
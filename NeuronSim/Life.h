@@ -34,8 +34,9 @@ public:
 	// Life has no internal state - it exists entirely within the spikes -
 	// and consequently paintState here simply calls paintSpikes.
 	void paintState(uint32_t * image) override { paintSpikes(image); }
-	// Perform the logical processing specific to Izhikevich neurons
-	void tick();
+	// Perform the logical processing specific to Life neurons, for the
+	// neurons in rows [rowBegin, rowEnd)
+	void tickRows(int rowBegin, int rowEnd) override;
 
 private:
 	// Low theshold - below this incoming spike density we don't fire
@@ -20,6 +20,7 @@ LinearLif::LinearLif(int width, int height) :
 	mReset(0.0f),
 	mLowerLimit(0.0f)
 {
+	packField(&NeuronLif::potential);
 }
 
 LinearLif::~LinearLif()
@@ -65,28 +66,91 @@ const ConfigPresets & LinearLif::presets()
 	return presets;
 }
 
-void LinearLif::tick()
+#ifdef NEURON_SIMD
+namespace
 {
-	processDendrites();
+	// The explicitly vectorised version of LinearLif::tickRows, which also
+	// processes the dendrites as it goes.
+	struct LinearLifKernel
+	{
+		float * input;
+		float * shunt;
+		float * potential;
+		float leak;
+		float threshold;
+		float reset;
+		float lowerLimit;
+
+		SIMD_TARGET_AVX512 __mmask16 operator()(int index, __mmask16 active) const
+		{
+			const __m512 one = _mm512_set1_ps(1.0f);
+			__m512 in = _mm512_maskz_loadu_ps(active, input + index);
+			__m512 sh = _mm512_mask_loadu_ps(one, active, shunt + index);
+			__m512 p = _mm512_maskz_loadu_ps(active, potential + index);
+			in = _mm512_div_ps(in, sh);
+			p = mulAvx512(p, _mm512_set1_ps(leak));
+			p = _mm512_add_ps(p, in);
+			// The operands are this way round to match std::max for NaN. The
+			// zero masked form avoids the undefined vector of the unmasked one.
+			p = _mm512_maskz_max_ps(__mmask16(0xFFFF), _mm512_set1_ps(lowerLimit), p);
+			__mmask16 firing = _mm512_mask_cmp_ps_mask(active, p, _mm512_set1_ps(threshold), _CMP_GT_OQ);
+			p = _mm512_mask_blend_ps(firing, p, _mm512_set1_ps(reset));
+			_mm512_mask_storeu_ps(potential + index, active, p);
+			_mm512_mask_storeu_ps(input + index, active, _mm512_setzero_ps());
+			_mm512_mask_storeu_ps(shunt + index, active, one);
+			return firing;
+		}
+
+		SIMD_TARGET_AVX2 int operator()(int index, __m256i active) const
+		{
+			const __m256 one = _mm256_set1_ps(1.0f);
+			__m256 in = _mm256_maskload_ps(input + index, active);
+			__m256 sh = _mm256_blendv_ps(one, _mm256_maskload_ps(shunt + index, active), _mm256_castsi256_ps(active));
+			__m256 p = _mm256_maskload_ps(potential + index, active);
+			in = _mm256_div_ps(in, sh);
+			p = _mm256_mul_ps(p, _mm256_set1_ps(leak));
+			p = _mm256_add_ps(p, in);
+			p = _mm256_max_ps(_mm256_set1_ps(lowerLimit), p);
+			__m256 firing = _mm256_cmp_ps(p, _mm256_set1_ps(threshold), _CMP_GT_OQ);
+			p = _mm256_blendv_ps(p, _mm256_set1_ps(reset), firing);
+			_mm256_maskstore_ps(potential + index, active, p);
+			_mm256_maskstore_ps(input + index, active, _mm256_setzero_ps());
+			_mm256_maskstore_ps(shunt + index, active, one);
+			return _mm256_movemask_ps(firing);
+		}
+	};
+}
+#endif
 
-	NeuronLif * cell = &mNeurons[0];
-	for (int rr = 0; rr < mHeight; ++rr)
+void LinearLif::tickRows(int rowBegin, int rowEnd)
+{
+	forTiles(rowBegin, rowEnd, [&](int tileBegin, int tileEnd)
 	{
-		for (int cc = 0; cc < mWidth; ++cc)
+		auto input = field(&NeuronLif::input);
+		auto potential = field(&NeuronLif::potential);
+#ifdef NEURON_SIMD
+		LinearLifKernel kernel = { input.data(), field(&NeuronLif::shunt).data(), potential.data(),
+			mLeak, mThreshold, mReset, mLowerLimit };
+		if (updateRowsSimd(tileBegin, tileEnd, kernel))
 		{
-			cell->potential *= mLeak;
-			cell->potential += cell->input;
-			cell->potential = max(cell->potential, mLowerLimit);
-			cell->firing = (cell->potential > mThreshold);
-			if (cell->firing)
+			return;
+		}
+#endif
+		processDendrites(tileBegin, tileEnd);
+		updateRows(tileBegin, tileEnd, [&](int index)
+		{
+			potential[index] *= mLeak;
+			potential[index] += input[index];
+			potential[index] = max(potential[index], mLowerLimit);
+			bool firing = (potential[index] > mThreshold);
+			if (firing)
 			{
-				cell->potential = mReset;
+				potential[index] = mReset;
 			}
-			cell->input = 0.0f;
-
-			++cell;
-		}
-	}
+			input[index] = 0.0f;
+			return firing;
+		});
+	});
 }
 
 // We overload the Net implementation because we really want
@@ -94,9 +158,13 @@ void LinearLif::tick()
 void LinearLif::paintState(uint32_t * image)
 {
 	float range = mThreshold - mLowerLimit;
-	for (auto neuron = begin(); neuron != end(); neuron++)
+	forTiles(0, mHeight, [&](int rowBegin, int rowEnd)
 	{
-		uint32_t lum = uint32_t(255.0f * (neuron->potential - mLowerLimit) / range);
-		*image++ = 0xFF000000 | lum | (lum << 8) | (lum << 16);
-	}
+		auto potential = field(&NeuronLif::potential);
+		for (int index = rowBegin * mWidth; index < rowEnd * mWidth; ++index)
+		{
+			uint32_t lum = uint32_t(255.0f * (potential[index] - mLowerLimit) / range);
+			*image++ = 0xFF000000 | lum | (lum << 8) | (lum << 16);
+		}
+	});
 }
@@ -34,8 +34,9 @@ public:
 	// Pixels will be greyscale shaded proportionally to their potential,
 	// with black for the lower limit and white for the threshold.
 	void paintState(uint32_t * image) override;
-	// Perform the logical processing specific to Izhikevich neurons
-	void tick();
+	// Perform the logical processing specific to LIF neurons, for the
+	// neurons in rows [rowBegin, rowEnd)
+	void tickRows(int rowBegin, int rowEnd) override;
 
 private:
 	// The amount of potential that persists between iterations.
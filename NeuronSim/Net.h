@@ -4,6 +4,7 @@
 #include "Layer.h"
 
 #include <algorithm>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <string>
@@ -12,6 +13,9 @@
 #include "Constants.h"
 #include "Exception.h"
 #include "Log.h"
+#include "NeuronStorage.h"
+#include "Precision.h"
+#include "Simd.h"
 #include "StreamHelpers.h"
 
 const uint8_t TAG_WIDTH('w');
@@ -32,10 +36,25 @@ const uint8_t TAG_END('E');
 // the save and load functions will need to be overridden.
 // The main responsibility of specializations of this class is to implement the
 // tick function from Layer, and provide any config information required.
+// Neurons are not accessed directly, since they may be stored as a structure
+// of arrays (see NeuronStorage.h). Specializations use field() to get at one
+// field of every neuron, and updateRows() to record which neurons fire. Every
+// field of the Neuron type must be 4 bytes, except for the bool firing flag.
+// Specializations can let float fields be stored at reduced precision with
+// packField(), in which case the loops using them must run inside forTiles().
 template <typename Neuron>
 class Net : public Layer
 {
 public:
+	// The number of 4 byte fields in each neuron, including the firing flag
+	static const int FIELDS = int(sizeof(Neuron) / sizeof(uint32_t));
+	// A pointer to one field of every neuron
+	template <typename T>
+	using Field = FieldPointer<T, NEURON_STORAGE_SOA ? 1 : FIELDS>;
+	// The number of neurons forTiles() widens from packed fields at a time,
+	// which is small enough for every widened field to stay in the cache.
+	static const int TILE_CELLS = 4096;
+
 	// Construct a Net with a given width and height
 	Net(int width, int height);
 	// Copy constructor
@@ -47,24 +66,40 @@ public:
 	void save(const std::filesystem::path & path);
 	// Load a previously saved Net
 	void load(const std::filesystem::path & path);
-	// Feeds spikes from a SpikeTrain into neuron inputs
-	void receiveSpikes(float * spikes) override;
-	// Feeds spikes from a SpikeTrain into neuron shunts
-	void receiveShunts(float * shunts) override;
-	// Loop though all neurons and fire spikes along synapses from
-	// all neurons that are firing.
-	void fireSpikes(SynapseMatrix * synapses, Spiker * spiker) override;
+	// Feeds spikes from a SpikeTrain into the inputs of neurons in the
+	// given rows. The spikes array covers the whole layer.
+	void receiveSpikes(float * spikes, int rowBegin, int rowEnd) override;
+	// Feeds spikes from a SpikeTrain into the shunts of neurons in the
+	// given rows. The shunts array covers the whole layer.
+	void receiveShunts(float * shunts, int rowBegin, int rowEnd) override;
+	// Feeds a list of spikes, each for a single neuron, into the inputs of
+	// neurons.
+	void receiveSpikes(const SpikeEvent * events, int count) override;
+	// Feeds a list of spikes, each for a single neuron, into the shunts of
+	// neurons.
+	void receiveShunts(const SpikeEvent * events, int count) override;
+	// Loop though the neurons in the given rows and fire spikes along
+	// synapses from all neurons that are firing.
+	void fireSpikes(SynapseMatrix * synapses, Spiker * spiker, int rowBegin, int rowEnd) override;
+	using Layer::fireSpikes;
+	// Fire the same spikes as fireSpikes, but only those which land in rows
+	// [rowBegin, rowEnd) of the target, by looping over the target neurons and
+	// gathering from the firing neurons of this layer.
+	void gatherSpikes(SynapseMatrix * synapses, Spiker * spiker, int rowBegin, int rowEnd) override;
 	// Resize this Net to a new width and height.
 	void resize(int width, int height);
-	// Return a pointer to the first neuron. Neurons are stored in a single
-	// contiguous block of memory in row major order.
-	inline Neuron * begin() { return &mNeurons[0]; }
-	// Return a pointer to the first neuron. Neurons are stored in a single
-	// contiguous block of memory in row major order.
-	inline Neuron * end() { return &mNeurons.back() + 1; }
-	// Return a pointer to the first neuron. Neurons are stored in a single
-	// contiguous block of memory in row major order.
-	inline const Neuron * begin() const { return &mNeurons[0]; }
+	// Return one field of every neuron, such as field(&Neuron::input).
+	// Neurons are indexed in row major order.
+	template <typename T, typename Owner>
+	inline Field<T> field(T Owner::* member);
+	// Return whether the neuron at the given column and row is firing.
+	inline bool firing(int col, int row) const;
+	// Return a copy of the neuron at the given index. This is slow, and
+	// intended for tests and debugging.
+	Neuron neuron(int index) const;
+	// Replace the neuron at the given index. This is slow, and intended for
+	// tests and debugging.
+	void setNeuron(int index, const Neuron & neuron);
 	// Take a pointer to the start of an array of pixels and populate them
 	// with the spiking information about each neuron. The pixels should be
 	// in ABGR order.
@@ -74,25 +109,120 @@ public:
 	// Inject a spike into a chosen neuron, with the given weight.
 	// This is always an excitatory spike, not a shunting input.
 	void inject(int col, int row, float weight) override;
+	// Return the number of neurons which are firing
+	int firingCount() override;
+	// Return the packed firing flags, one bit per neuron and (width + 63) / 64
+	// words per row
+	const uint64_t * firingBits() override { return mFiring.data(); }
+	// Write 1.0 for every neuron which is firing and 0.0 for every other
+	// neuron into an array of width * height values, in row major order
+	void firingValues(float * values) override;
+	// Return the number of bytes of state held for each neuron
+	int neuronBytes() override;
+	// Set the precision the fields registered with packField() are stored
+	// at. Reduced precisions halve the memory those fields take, and the
+	// bandwidth spent ticking them, but round them once per tick. The
+	// neurons are rounded to the new precision. This is ignored when the
+	// neurons are stored as an array of structures.
+	void setPrecision(Precision precision) override;
+	// Get the precision the fields registered with packField() are stored at.
+	Precision precision() override { return mPrecision; }
 protected:
+	// Allow a float field of every neuron to be stored at reduced precision.
+	// Fields which spikes are received into, such as input and shunt, must
+	// not be packed, since they are added to outside of tickRows().
+	template <typename Owner>
+	void packField(float Owner::* member);
+	// Call function(tileBegin, tileEnd) for bands of rows which together
+	// cover [rowBegin, rowEnd), with the packed fields of the neurons in the
+	// band widened to floats, and pack them again afterwards. field() of a
+	// packed member may only be used inside the function, and indexes the
+	// band by the same global indices as any other field. When no fields are
+	// packed the function is called once for all of the rows.
+	template <typename Function>
+	inline void forTiles(int rowBegin, int rowEnd, Function function);
 	// Perform the default input behaviour for incoming spikes. The inputs
 	// are divided by the shunt and then added to the potential of the neuron.
 	// It is not required to call this function for neurons which work in other
 	// ways. For those that do it would normally be called as the first step in
-	// the implementation of tick.
-	void processDendrites();
+	// the implementation of tickRows, for the same rows.
+	void processDendrites(int rowBegin, int rowEnd);
+	// Call update(index) for every neuron in rows [rowBegin, rowEnd), in
+	// order, and record that the neuron is firing if update returns true.
+	template <typename Update>
+	inline void updateRows(int rowBegin, int rowEnd, Update update);
+#ifdef NEURON_SIMD
+	// Apply a kernel to every neuron in rows [rowBegin, rowEnd) with the
+	// instruction set chosen by simdLevel(), and record which neurons fire.
+	// The kernel provides an operator() for each of simdRowsAvx2 and
+	// simdRowsAvx512. Returns false without doing anything if the scalar
+	// implementation has been chosen, which the caller must then run.
+	template <typename Kernel>
+	bool updateRowsSimd(int rowBegin, int rowEnd, const Kernel & kernel);
+#endif
 private:
 	// Internal implementation detail of the fireSpikes function
-	inline Synapse * fireSynapseSegment(Spiker * spiker, int cs, int ce, int dst, Synapse * synapse);
-protected:
-	// The block of data that stores the neurons.
+	inline const Synapse * fireSynapseSegment(Spiker * spiker, int cs, int ce, int dst, const Synapse * synapse);
+	// Return true if spikes can be fired through the compiled forms of a
+	// synapse matrix, which is when it has not been changed since it was
+	// compiled and it is no larger than this layer, so wraps at most once.
+	bool canUseCompiled(SynapseMatrix * synapses);
+	// Return the index of a field within each neuron, in 4 byte units
+	template <typename T, typename Owner>
+	static int fieldIndex(T Owner::* member);
+	// Work out where each field is stored for the current precision
+	void assignSlots();
+	// Round a float to the current precision, and widen it again
+	uint16_t pack(float value) const;
+	float unpack(uint16_t packed) const;
+	// Copy every neuron out of storage, for saving and resizing
+	std::vector<Neuron> records() const;
+	// Replace every neuron in storage, for loading and resizing
+	void setRecords(const std::vector<Neuron> & records);
+	// The number of 64 bit words of firing flags in each row. Every row
+	// starts on a new word, so that bands of rows never share a word.
+	int firingWords() const { return (mWidth + 63) / 64; }
+	// The packed fields of the neurons in the band of rows forTiles() is
+	// working on in this thread, widened to floats. Packed field p of the
+	// neuron at index i is values[p * cells + i - rowBegin * width].
+	struct Tile
+	{
+		const Net * net = nullptr;
+		int rowBegin = 0;
+		int cells = 0;
+		std::vector<float> values;
+	};
+	static Tile & tile();
+private:
+	// The neurons, when stored as an array of structures.
 	std::vector<Neuron> mNeurons;
+	// The neurons, when stored as a structure of arrays. Field f of the
+	// neuron at index i is mFields[mSlots[f] * width * height + i], or
+	// mPacked[mPackedSlots[f] * width * height + i] when it is packed.
+	std::vector<uint32_t> mFields;
+	std::vector<uint16_t> mPacked;
+	std::vector<int> mSlots;
+	std::vector<int> mPackedSlots;
+	// The fields registered with packField(), which are packed unless the
+	// precision is PRECISION_FLOAT, and the number of them which are packed
+	std::vector<int> mPackable;
+	int mPackedFields;
+	// The precision the packed fields are stored at
+	Precision mPrecision;
+	// The firing flags, one bit per neuron and firingWords() words per row.
+	// These are kept separately from the neurons however they are stored,
+	// and the firing flag in the neurons themselves is only filled in when
+	// they are copied out.
+	std::vector<uint64_t> mFiring;
 };
 
 template <typename Neuron>
 Net<Neuron>::Net(int width, int height) :
-	Layer(width, height)
+	Layer(width, height),
+	mPackedFields(0),
+	mPrecision(PRECISION_FLOAT)
 {
+	assignSlots();
 	LOG("Creating layer [" << mName << "] size: " << mWidth << " x " << mHeight);
 	// We have to call this explicitly - the v-table wasn't set up yet when the layer constructor
 	// was called so it can't call it for us.
@@ -104,6 +234,14 @@ Net<Neuron>::Net(const Net & other) :
 	Layer(other)
 {
 	mNeurons = other.mNeurons;
+	mFields = other.mFields;
+	mPacked = other.mPacked;
+	mSlots = other.mSlots;
+	mPackedSlots = other.mPackedSlots;
+	mPackable = other.mPackable;
+	mPackedFields = other.mPackedFields;
+	mPrecision = other.mPrecision;
+	mFiring = other.mFiring;
 }
 
 template <typename Neuron>
@@ -134,8 +272,10 @@ void Net<Neuron>::save(const std::filesystem::path & path)
 		writePod(mSpike.duration(), ofs);
 		writePod(TAG_COLOR, ofs);
 		writePod(mColor, ofs);
+		// Files always hold an array of structures
 		writePod(TAG_DATA, ofs);
-		ofs.write(reinterpret_cast<char *>(&mNeurons[0]), mWidth * mHeight * sizeof(Neuron));
+		auto neurons = records();
+		ofs.write(reinterpret_cast<char *>(&neurons[0]), mWidth * mHeight * sizeof(Neuron));
 		writePod(TAG_END, ofs);
 	}
 	else
@@ -174,9 +314,13 @@ void Net<Neuron>::load(const std::filesystem::path & path)
 			{
 				NEURONTHROW("Corrupt layer file [" << path << "]");
 			}
+		{
 			resize(width, height);
-			ifs.read(reinterpret_cast<char *>(&mNeurons[0]), mWidth * mHeight * sizeof(Neuron));
+			std::vector<Neuron> neurons(mWidth * mHeight);
+			ifs.read(reinterpret_cast<char *>(&neurons[0]), mWidth * mHeight * sizeof(Neuron));
+			setRecords(neurons);
 			break;
+		}
 		case TAG_SPIKE_SHAPE:
 			readPod(shape, ifs);
 			break;
@@ -203,20 +347,42 @@ void Net<Neuron>::load(const std::filesystem::path & path)
 }
 
 template <typename Neuron>
-void Net<Neuron>::receiveSpikes(float * spikes)
+void Net<Neuron>::receiveSpikes(float * spikes, int rowBegin, int rowEnd)
+{
+	auto input = field(&Neuron::input);
+	for (int index = rowBegin * mWidth; index < rowEnd * mWidth; ++index)
+	{
+		input[index] += spikes[index];
+	}
+}
+
+template <typename Neuron>
+void Net<Neuron>::receiveShunts(float * shunts, int rowBegin, int rowEnd)
 {
-	for (Neuron * cell = begin(); cell != end(); cell++)
+	auto shunt = field(&Neuron::shunt);
+	for (int index = rowBegin * mWidth; index < rowEnd * mWidth; ++index)
 	{
-		cell->input += *spikes++;
+		shunt[index] += shunts[index];
 	}
 }
 
 template <typename Neuron>
-void Net<Neuron>::receiveShunts(float * shunts)
+void Net<Neuron>::receiveSpikes(const SpikeEvent * events, int count)
 {
-	for (Neuron * cell = begin(); cell != end(); cell++)
+	auto input = field(&Neuron::input);
+	for (const SpikeEvent * event = events; event != events + count; ++event)
 	{
-		cell->shunt += *shunts++;
+		input[event->index] += event->weight;
+	}
+}
+
+template <typename Neuron>
+void Net<Neuron>::receiveShunts(const SpikeEvent * events, int count)
+{
+	auto shunt = field(&Neuron::shunt);
+	for (const SpikeEvent * event = events; event != events + count; ++event)
+	{
+		shunt[event->index] += event->weight;
 	}
 }
 
@@ -224,43 +390,351 @@ void Net<Neuron>::receiveShunts(float * shunts)
 // sophisticated manner. This is essentially a 100% leaky integrator, and
 // I do not know if that is good or not, or what happens if we change it.
 template <typename Neuron>
-void Net<Neuron>::processDendrites()
+void Net<Neuron>::processDendrites(int rowBegin, int rowEnd)
+{
+	auto input = field(&Neuron::input);
+	auto shunt = field(&Neuron::shunt);
+	for (int index = rowBegin * mWidth; index < rowEnd * mWidth; ++index)
+	{
+		input[index] /= shunt[index];
+		shunt[index] = 1.0f;
+	}
+}
+
+// The firing flags are built up 64 at a time, so that each word of flags is
+// written once, by the thread ticking its row.
+template <typename Neuron>
+template <typename Update>
+inline void Net<Neuron>::updateRows(int rowBegin, int rowEnd, Update update)
+{
+	for (int rr = rowBegin; rr < rowEnd; ++rr)
+	{
+		int index = rr * mWidth;
+		uint64_t * word = &mFiring[rr * firingWords()];
+		for (int cc = 0; cc < mWidth; cc += 64)
+		{
+			int count = std::min(64, mWidth - cc);
+			uint64_t bits = 0;
+			for (int bit = 0; bit < count; ++bit, ++index)
+			{
+				bits |= uint64_t(update(index)) << bit;
+			}
+			*word++ = bits;
+		}
+	}
+}
+
+#ifdef NEURON_SIMD
+template <typename Neuron>
+template <typename Kernel>
+bool Net<Neuron>::updateRowsSimd(int rowBegin, int rowEnd, const Kernel & kernel)
+{
+	switch (simdLevel())
+	{
+	case SIMD_AVX512:
+		simdRowsAvx512(kernel, rowBegin, rowEnd, mWidth, mFiring.data());
+		return true;
+	case SIMD_AVX2:
+		simdRowsAvx2(kernel, rowBegin, rowEnd, mWidth, mFiring.data());
+		return true;
+	default:
+		return false;
+	}
+}
+#endif
+
+template <typename Neuron>
+template <typename T, typename Owner>
+inline typename Net<Neuron>::template Field<T> Net<Neuron>::field(T Owner::* member)
+{
+	static_assert(sizeof(T) == sizeof(uint32_t), "Neuron fields must be 4 bytes");
+	if constexpr (NEURON_STORAGE_SOA)
+	{
+		int index = fieldIndex(member);
+		if (mSlots[index] >= 0)
+		{
+			return Field<T>(reinterpret_cast<T *>(&mFields[mSlots[index] * mWidth * mHeight]));
+		}
+		Tile & current = tile();
+		if (current.net != this)
+		{
+			NEURONTHROW("Packed neuron fields of layer [" << mName << "] used outside of forTiles");
+		}
+		float * values = current.values.data() + mPackedSlots[index] * current.cells;
+		return Field<T>(reinterpret_cast<T *>(values - current.rowBegin * mWidth));
+	}
+	else
+	{
+		return Field<T>(&(mNeurons[0].*member));
+	}
+}
+
+// The offset of a member is found from a sample neuron, since pointers to
+// members cannot be converted to offsets directly.
+template <typename Neuron>
+template <typename T, typename Owner>
+int Net<Neuron>::fieldIndex(T Owner::* member)
+{
+	static const Neuron sample = Neuron();
+	auto offset = reinterpret_cast<const char *>(&(sample.*member)) - reinterpret_cast<const char *>(&sample);
+	return int(offset / sizeof(uint32_t));
+}
+
+template <typename Neuron>
+void Net<Neuron>::assignSlots()
+{
+	mSlots.assign(FIELDS, -1);
+	mPackedSlots.assign(FIELDS, -1);
+	int slot = 0;
+	mPackedFields = 0;
+	for (int ff = 0; ff < FIELDS; ++ff)
+	{
+		bool packed = mPrecision != PRECISION_FLOAT && std::find(mPackable.begin(), mPackable.end(), ff) != mPackable.end();
+		if (packed)
+		{
+			mPackedSlots[ff] = mPackedFields++;
+		}
+		else
+		{
+			mSlots[ff] = slot++;
+		}
+	}
+}
+
+template <typename Neuron>
+uint16_t Net<Neuron>::pack(float value) const
+{
+	uint16_t packed = 0;
+	withPacking(mPrecision, [&](auto packing) { packed = packing.pack(value); });
+	return packed;
+}
+
+template <typename Neuron>
+float Net<Neuron>::unpack(uint16_t packed) const
+{
+	float value = 0.0f;
+	withPacking(mPrecision, [&](auto packing) { value = packing.unpack(packed); });
+	return value;
+}
+
+template <typename Neuron>
+template <typename Owner>
+void Net<Neuron>::packField(float Owner::* member)
+{
+	int index = fieldIndex(member);
+	if (std::find(mPackable.begin(), mPackable.end(), index) == mPackable.end())
+	{
+		auto neurons = records();
+		mPackable.push_back(index);
+		assignSlots();
+		setRecords(neurons);
+	}
+}
+
+template <typename Neuron>
+void Net<Neuron>::setPrecision(Precision precision)
+{
+	if constexpr (NEURON_STORAGE_SOA)
+	{
+		if (precision != mPrecision)
+		{
+			auto neurons = records();
+			mPrecision = precision;
+			assignSlots();
+			setRecords(neurons);
+		}
+	}
+}
+
+template <typename Neuron>
+int Net<Neuron>::neuronBytes()
+{
+	return int(sizeof(Neuron)) - mPackedFields * int(sizeof(float) - sizeof(uint16_t));
+}
+
+template <typename Neuron>
+typename Net<Neuron>::Tile & Net<Neuron>::tile()
+{
+	static thread_local Tile current;
+	return current;
+}
+
+// Every thread ticking a band of rows has its own tile, and the tiles never
+// share a row, so the packed fields need no synchronisation. The fields are
+// widened and packed in the same pass over the tile as the model works on
+// it, so only the packed bytes are streamed from memory.
+template <typename Neuron>
+template <typename Function>
+inline void Net<Neuron>::forTiles(int rowBegin, int rowEnd, Function function)
 {
-	for (Neuron * iter = begin(); iter != end(); iter++)
+	if (!mPackedFields)
 	{
-		iter->input /= iter->shunt;
-		iter->shunt = 1.0f;
+		function(rowBegin, rowEnd);
+		return;
 	}
+	Tile & current = tile();
+	int cells = mWidth * mHeight;
+	int rows = std::max(1, TILE_CELLS / mWidth);
+	for (int tileBegin = rowBegin; tileBegin < rowEnd; tileBegin += rows)
+	{
+		int tileEnd = std::min(rowEnd, tileBegin + rows);
+		current.rowBegin = tileBegin;
+		current.cells = (tileEnd - tileBegin) * mWidth;
+		current.values.resize(mPackedFields * current.cells);
+		for (int pp = 0; pp < mPackedFields; ++pp)
+		{
+			unpackArray(mPrecision, &mPacked[pp * cells + tileBegin * mWidth], &current.values[pp * current.cells], current.cells);
+		}
+		current.net = this;
+		function(tileBegin, tileEnd);
+		current.net = nullptr;
+		for (int pp = 0; pp < mPackedFields; ++pp)
+		{
+			packArray(mPrecision, &current.values[pp * current.cells], &mPacked[pp * cells + tileBegin * mWidth], current.cells);
+		}
+	}
+}
+
+template <typename Neuron>
+inline bool Net<Neuron>::firing(int col, int row) const
+{
+	return (mFiring[row * firingWords() + col / 64] >> (col % 64)) & 1;
 }
 
 template <typename Neuron>
-inline Synapse * Net<Neuron>::fireSynapseSegment(Spiker * spiker, int cs, int ce, int dst, Synapse * synapse)
+Neuron Net<Neuron>::neuron(int index) const
 {
-	dst += cs;
-	for (int tc = cs; tc < ce; tc++)
+	if constexpr (NEURON_STORAGE_SOA)
 	{
-		spiker->fire(mSpike, dst++, synapse->weight, synapse->delay);
-		synapse++;
+		Neuron neuron;
+		uint32_t * fields = reinterpret_cast<uint32_t *>(&neuron);
+		for (int ff = 0; ff < FIELDS; ++ff)
+		{
+			if (mSlots[ff] >= 0)
+			{
+				fields[ff] = mFields[mSlots[ff] * mWidth * mHeight + index];
+			}
+			else
+			{
+				float value = unpack(mPacked[mPackedSlots[ff] * mWidth * mHeight + index]);
+				memcpy(&fields[ff], &value, sizeof(value));
+			}
+		}
+		neuron.firing = firing(index % mWidth, index / mWidth);
+		return neuron;
+	}
+	else
+	{
+		Neuron neuron = mNeurons[index];
+		neuron.firing = firing(index % mWidth, index / mWidth);
+		return neuron;
 	}
-	return synapse;
+}
+
+template <typename Neuron>
+void Net<Neuron>::setNeuron(int index, const Neuron & neuron)
+{
+	if constexpr (NEURON_STORAGE_SOA)
+	{
+		const uint32_t * fields = reinterpret_cast<const uint32_t *>(&neuron);
+		for (int ff = 0; ff < FIELDS; ++ff)
+		{
+			if (mSlots[ff] >= 0)
+			{
+				mFields[mSlots[ff] * mWidth * mHeight + index] = fields[ff];
+			}
+			else
+			{
+				float value;
+				memcpy(&value, &fields[ff], sizeof(value));
+				mPacked[mPackedSlots[ff] * mWidth * mHeight + index] = pack(value);
+			}
+		}
+	}
+	else
+	{
+		mNeurons[index] = neuron;
+	}
+	uint64_t & word = mFiring[(index / mWidth) * firingWords() + (index % mWidth) / 64];
+	uint64_t bit = uint64_t(1) << ((index % mWidth) % 64);
+	word = neuron.firing ? (word | bit) : (word & ~bit);
+}
+
+template <typename Neuron>
+std::vector<Neuron> Net<Neuron>::records() const
+{
+	// The firing flags are only empty before the first resize
+	std::vector<Neuron> neurons(NEURON_STORAGE_SOA ? (mFiring.empty() ? 0 : mWidth * mHeight) : mNeurons.size());
+	for (int index = 0; index < int(neurons.size()); ++index)
+	{
+		neurons[index] = neuron(index);
+	}
+	return neurons;
+}
+
+template <typename Neuron>
+void Net<Neuron>::setRecords(const std::vector<Neuron> & neurons)
+{
+	if constexpr (NEURON_STORAGE_SOA)
+	{
+		mFields.resize((FIELDS - mPackedFields) * neurons.size());
+		mPacked.resize(mPackedFields * neurons.size());
+	}
+	else
+	{
+		mNeurons.resize(neurons.size());
+	}
+	mFiring.assign(firingWords() * mHeight, 0);
+	for (int index = 0; index < int(neurons.size()); ++index)
+	{
+		setNeuron(index, neurons[index]);
+	}
+}
+
+template <typename Neuron>
+inline const Synapse * Net<Neuron>::fireSynapseSegment(Spiker * spiker, int cs, int ce, int dst, const Synapse * synapse)
+{
+	if (ce <= cs)
+	{
+		return synapse;
+	}
+	spiker->fireSegment(mSpike, dst + cs, ce - cs, synapse);
+	return synapse + (ce - cs);
 }
 
 // Default implementation of fireSpikes from Layer.
 // It is expected that all types of layer/neuron will derive from
 // net and not override this, but it is not required.
-// This function works on the assumption that the Neuron template
-// type has a public "firing" member variable that can be evaluated
-// to true or false.
+// Only the set bits of the packed firing flags are visited, so the cost
+// depends on the number of neurons firing rather than the size of the layer.
 // This implementation wraps around at the edges of the array of neurons,
 // which it does by dividing the synapse matrix into 9 sections and looping
 // over each.
 // An optimization _might_ be special casing the neurons near the edge,
 // but has not been tested.
+// Only neurons in rows [rowBegin, rowEnd) fire, but their spikes can land
+// up to half the synapse matrix height outside of those rows.
+// Matrices are normally fired through their compiled Stencil instead, which
+// skips the synapses with zero weights, or through their separable
+// decomposition when enough neurons are firing for it to be cheaper (see
+// Separable). The loops here are only used for matrices which have been
+// changed since they were compiled, or which are larger than the layer,
+// which fire the same weights as their compiled forms would.
 template <typename Neuron>
-void Net<Neuron>::fireSpikes(SynapseMatrix * synapses, Spiker * spiker)
+void Net<Neuron>::fireSpikes(SynapseMatrix * synapses, Spiker * spiker, int rowBegin, int rowEnd)
 {
-	Neuron * cell = begin();
-	for (int rr = 0; rr < mHeight; rr++)
+	if (canUseCompiled(synapses))
+	{
+		int matrixHeight = synapses->height();
+		if (!synapses->separable().fire(mSpike, spiker, mFiring.data(), mWidth, mHeight,
+			rowBegin, rowEnd, rowBegin - matrixHeight / 2, rowEnd + matrixHeight - 1 - matrixHeight / 2))
+		{
+			synapses->stencil().fire(mSpike, spiker, mFiring.data(), mWidth, mHeight, rowBegin, rowEnd);
+		}
+		return;
+	}
+	const Synapse * first = synapses->firedSynapses();
+	for (int rr = rowBegin; rr < rowEnd; rr++)
 	{
 		// For each row we have 3 sets of rows available to the synapsess:
 		// those wrapping upwards, wrapping downwards, and not wrapping.
@@ -272,10 +746,12 @@ void Net<Neuron>::fireSpikes(SynapseMatrix * synapses, Spiker * spiker)
 		int highRowEnd = synapses->highWrapRowEnd(rr, mHeight);
 
 		int dst;
-		for (int cc = 0; cc < mWidth; cc++)
+		const uint64_t * words = &mFiring[rr * firingWords()];
+		for (int ww = 0; ww < firingWords(); ++ww)
 		{
-			if (cell->firing)
+			for (uint64_t bits = words[ww]; bits; bits &= bits - 1)
 			{
+				int cc = ww * 64 + lowestBit(bits);
 				// For each column we have 3 sets of columns available to the
 				// synapses: those wrapping left, wrapping right, and not wrapping.
 				int lowColBegin = synapses->lowWrapColBegin(cc, mWidth);
@@ -287,7 +763,7 @@ void Net<Neuron>::fireSpikes(SynapseMatrix * synapses, Spiker * spiker)
 
 				// The following loops have been manually unrolled. This is the innermost loop
 				// of the entire system and some sacrifices towards optimization are justified.
-				Synapse * synapse = synapses->begin();
+				const Synapse * synapse = first;
 				for (int tr = lowRowBegin; tr < lowRowEnd; tr++)
 				{
 					dst = mWidth * (rr + tr) + cc;
@@ -310,56 +786,117 @@ void Net<Neuron>::fireSpikes(SynapseMatrix * synapses, Spiker * spiker)
 					synapse = fireSynapseSegment(spiker, highColBegin, highColEnd, dst, synapse);
 				}
 			}
-			cell++;
 		}
 	}
 }
 
+// Gather is the transpose of fireSpikes (see SynapseMatrix::gather).
+// Every target row is written only by the thread which owns it, so
+// concurrent calls for different rows need no synchronisation at all. The
+// same is true of the compiled forms of the matrix, which are used instead
+// unless it has changed since it was compiled: the separable decomposition
+// when it is cheaper, and otherwise the Stencil, which only visits the
+// synapses with non zero weights.
+template <typename Neuron>
+void Net<Neuron>::gatherSpikes(SynapseMatrix * synapses, Spiker * spiker, int rowBegin, int rowEnd)
+{
+	int matrixHeight = synapses->height();
+	if (canUseCompiled(synapses))
+	{
+		if (!synapses->separable().fire(mSpike, spiker, mFiring.data(), mWidth, mHeight,
+			rowBegin - (matrixHeight - 1) + matrixHeight / 2, rowEnd + matrixHeight / 2, rowBegin, rowEnd))
+		{
+			synapses->stencil().gather(mSpike, spiker, mFiring.data(), mWidth, mHeight, rowBegin, rowEnd);
+		}
+		return;
+	}
+	synapses->gather(mSpike, spiker, mFiring.data(), mWidth, mHeight, rowBegin, rowEnd);
+}
+
+template <typename Neuron>
+bool Net<Neuron>::canUseCompiled(SynapseMatrix * synapses)
+{
+	return synapses->width() <= mWidth && synapses->height() <= mHeight && synapses->isCompiled();
+}
+
 template <typename Neuron>
 void Net<Neuron>::resize(int width, int height)
 {
-	if (!mNeurons.empty())
+	if (!mNeurons.empty() || !mFields.empty())
+	{
 		clear();
+	}
+	auto neurons = records();
 	Layer::resize(width, height);
-	int size = mWidth * mHeight;
-	mNeurons.resize(size);
+	neurons.resize(mWidth * mHeight);
+	setRecords(neurons);
 }
 
 template <typename Neuron>
 void Net<Neuron>::paintSpikes(uint32_t * image)
 {
-	uint32_t * pixel = image;
-	for (Neuron * neuron = begin(); neuron != end(); neuron++)
+	std::fill(image, image + mWidth * mHeight, 0xFF000000);
+	for (int rr = 0; rr < mHeight; ++rr)
 	{
-		*pixel++ = 0xFF000000 | (neuron->firing * 0xFFFFFFFF);
+		const uint64_t * words = &mFiring[rr * firingWords()];
+		for (int ww = 0; ww < firingWords(); ++ww)
+		{
+			for (uint64_t bits = words[ww]; bits; bits &= bits - 1)
+			{
+				image[rr * mWidth + ww * 64 + lowestBit(bits)] = 0xFFFFFFFF;
+			}
+		}
 	}
 }
 
 template <typename Neuron>
 inline void Net<Neuron>::clear()
 {
-	for (auto neuron = begin(); neuron != end(); neuron++)
+	setRecords(std::vector<Neuron>(mWidth * mHeight));
+}
+
+template <typename Neuron>
+void Net<Neuron>::inject(int col, int row, float weight)
+{
+	field(&Neuron::input)[row * mWidth + col] += weight;
+}
+
+template <typename Neuron>
+int Net<Neuron>::firingCount()
+{
+	int count = 0;
+	for (uint64_t word : mFiring)
 	{
-		new (&*neuron) Neuron;
+		count += bitCount(word);
 	}
+	return count;
 }
 
 template <typename Neuron>
-void Net<Neuron>::inject(int col, int row, float weight)
+void Net<Neuron>::firingValues(float * values)
 {
-	mNeurons[row * mWidth + col].input += weight;
+	std::fill(values, values + mWidth * mHeight, 0.0f);
+	for (int rr = 0; rr < mHeight; ++rr)
+	{
+		const uint64_t * words = &mFiring[rr * firingWords()];
+		for (int ww = 0; ww < firingWords(); ++ww)
+		{
+			for (uint64_t bits = words[ww]; bits; bits &= bits - 1)
+			{
+				values[rr * mWidth + ww * 64 + lowestBit(bits)] = 1.0f;
+			}
+		}
+	}
 }
 
 template <typename Neuron>
 std::ostream & operator<<(std::ostream & os, const Net<Neuron> & net)
 {
-	const Neuron * neuron = net.begin();
 	for (int rr = 0; rr < net.height(); rr++)
 	{
 		for (int cc = 0; cc < net.width(); cc++)
 		{
-			os << neuron->input << (neuron->firing?"*":" ") << "   ";
-			++neuron;
+			os << net.neuron(rr * net.width() + cc).input << (net.firing(cc, rr)?"*":" ") << "   ";
 		}
 		os << "\n";
 	}
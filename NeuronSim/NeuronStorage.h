@@ -0,0 +1,63 @@
+#ifndef NEURON_STORAGE_H
+#define NEURON_STORAGE_H
+
+#include <cstdint>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// The neurons in a Net can be stored as an array of structures, with all of
+// the fields of each neuron together, or as a structure of arrays, with each
+// field of every neuron together. Either way the firing flags are packed into
+// bits, so that the few neurons which fire can be found quickly.
+// The structure of arrays layout is the default, since it only streams the
+// fields a loop actually uses and lets the compiler vectorise the tick loops.
+// Define NEURON_STORAGE_AOS when building to use the array of structures.
+#ifdef NEURON_STORAGE_AOS
+const bool NEURON_STORAGE_SOA(false);
+#else
+const bool NEURON_STORAGE_SOA(true);
+#endif
+
+// A pointer to one field of a block of neurons, which steps over the other
+// fields of each neuron when they are stored together.
+template <typename T, int Stride>
+class FieldPointer
+{
+public:
+	// Constructor
+	// data - the field of the first neuron
+	explicit FieldPointer(T * data) : mData(data) {}
+	// Return the field of the neuron at the given index
+	T & operator[](int index) const { return mData[index * Stride]; }
+	// Return the field of the first neuron, for code which steps over the
+	// neurons itself
+	T * data() const { return mData; }
+
+private:
+	T * mData;
+};
+
+// Return the index of the lowest set bit of a word, which must not be zero
+inline int lowestBit(uint64_t word)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, word);
+	return int(index);
+#else
+	return __builtin_ctzll(word);
+#endif
+}
+
+// Return the number of set bits in a word
+inline int bitCount(uint64_t word)
+{
+#ifdef _MSC_VER
+	return int(__popcnt64(word));
+#else
+	return __builtin_popcountll(word);
+#endif
+}
+
+#endif
@@ -0,0 +1,306 @@
+#ifndef PRECISION_H
+#define PRECISION_H
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "Simd.h"
+
+// Spike potentials in transit can be stored at reduced precision, which
+// halves the memory a dense SpikeTrain frame takes and the bandwidth spent
+// firing into and delivering it. Potentials are always added up in single
+// precision, and only rounded when they are stored back into a frame, so the
+// rounding error grows with the number of times a potential is fired into
+// rather than with the number of synapses firing into it at once.
+// The state of the neurons can be stored at reduced precision too (see
+// Net::setPrecision), in which case it is rounded once per tick.
+enum Precision
+{
+	PRECISION_FLOAT,    //< 32 bit IEEE floats, which are exact
+	PRECISION_HALF,     //< 16 bit IEEE floats, with 11 bits of precision and a range of +/-65504
+	PRECISION_BFLOAT16, //< The top 16 bits of a float, with 8 bits of precision and the full range
+	PRECISION_FIXED16   //< 16 bit integers in units of 1/256, with a range of +/-128
+};
+
+// Return the number of bytes used to store each potential
+inline int precisionBytes(Precision precision)
+{
+	return precision == PRECISION_FLOAT ? int(sizeof(float)) : int(sizeof(uint16_t));
+}
+
+// Return a if condition is true and b otherwise, by masking rather than
+// branching. Compilers keep a choice between two results as a branch when
+// either is worked out with floating point arithmetic, which stops the loop
+// around it being vectorised.
+inline uint32_t selectBits(bool condition, uint32_t a, uint32_t b)
+{
+	uint32_t mask = 0u - uint32_t(condition);
+	return (a & mask) | (b & ~mask);
+}
+
+// The conversions to and from each of the 16 bit precisions. Each has
+// static pack and unpack functions, and values are rounded to nearest even
+// when packed. They are written without branches, so that the loops in
+// SpikeTrain and Net which use them can be vectorised.
+template <Precision P>
+struct Packing;
+
+// Every case is worked out and the right one chosen, rather than branching,
+// which lets the compiler vectorise loops that pack and unpack halves.
+template <>
+struct Packing<PRECISION_HALF>
+{
+	static uint16_t pack(float value)
+	{
+		// Denormals are rounded into place by adding a magic number
+		const uint32_t magicBits = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+		float magic;
+		memcpy(&magic, &magicBits, sizeof(magic));
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		uint32_t sign = bits & 0x80000000u;
+		bits ^= sign;
+		float absolute;
+		memcpy(&absolute, &bits, sizeof(absolute));
+		float shifted = absolute + magic;
+		uint32_t denormal;
+		memcpy(&denormal, &shifted, sizeof(denormal));
+		denormal -= magicBits;
+		uint32_t normal = (bits + ((15u - 127u) << 23) + 0xfffu + ((bits >> 13) & 1u)) >> 13;
+		uint32_t overflow = selectBits(bits > 0x7f800000u, 0x7e00u, 0x7c00u);
+		uint32_t packed = selectBits(bits < (127u - 14u) << 23, denormal, normal);
+		packed = selectBits(bits >= (127u + 16u) << 23, overflow, packed);
+		return uint16_t(packed | (sign >> 16));
+	}
+	static float unpack(uint16_t packed)
+	{
+		// Denormals are normalised by subtracting a magic number
+		const uint32_t magicBits = 113u << 23;
+		float magic;
+		memcpy(&magic, &magicBits, sizeof(magic));
+		const uint32_t exponentMask = 0x7c00u << 13;
+		uint32_t bits = uint32_t(packed & 0x7fff) << 13;
+		uint32_t exponent = bits & exponentMask;
+		uint32_t normal = bits + ((127u - 15u) << 23);
+		uint32_t infinite = normal + ((128u - 16u) << 23);
+		uint32_t small = normal + (1u << 23);
+		float denormal;
+		memcpy(&denormal, &small, sizeof(denormal));
+		denormal -= magic;
+		uint32_t denormalBits;
+		memcpy(&denormalBits, &denormal, sizeof(denormalBits));
+		bits = selectBits(exponent == exponentMask, infinite, selectBits(exponent == 0, denormalBits, normal));
+		bits |= uint32_t(packed & 0x8000) << 16;
+		float value;
+		memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+};
+
+template <>
+struct Packing<PRECISION_BFLOAT16>
+{
+	static uint16_t pack(float value)
+	{
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		// Not a number is kept from rounding into infinity
+		uint32_t rounded = (bits + 0x7fffu + ((bits >> 16) & 1u)) >> 16;
+		uint32_t quiet = (bits >> 16) | 0x40u;
+		return uint16_t((bits & 0x7fffffffu) > 0x7f800000u ? quiet : rounded);
+	}
+	static float unpack(uint16_t packed)
+	{
+		uint32_t bits = uint32_t(packed) << 16;
+		float value;
+		memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+};
+
+// Values outside of the range are clamped to it, comparing the bits of the
+// magnitude with those of the limit for its sign, and not a number is
+// clamped to the upper limit. Adding and subtracting 1.5 * 2^23 rounds a
+// float of less than 2^22 to the nearest integer, even on ties, without the
+// call to the maths library that nearbyint can need. This relies on the
+// compiler not reassociating floating point arithmetic.
+template <>
+struct Packing<PRECISION_FIXED16>
+{
+	static const int SCALE = 256;
+	static uint16_t pack(float value)
+	{
+		const float round = 12582912.0f;
+		// The bits of 32768.0f and 32767.0f
+		const uint32_t lowerBits = 0x47000000u;
+		const uint32_t upperBits = 0x46fffe00u;
+		float scaled = value * float(SCALE);
+		uint32_t bits;
+		memcpy(&bits, &scaled, sizeof(bits));
+		uint32_t sign = bits & 0x80000000u;
+		uint32_t limit = selectBits(sign != 0, lowerBits, upperBits);
+		bits = selectBits((bits ^ sign) > limit, limit | sign, bits);
+		memcpy(&scaled, &bits, sizeof(scaled));
+		return uint16_t(int16_t(int32_t((scaled + round) - round)));
+	}
+	static float unpack(uint16_t packed)
+	{
+		return float(int16_t(packed)) * (1.0f / float(SCALE));
+	}
+};
+
+// Call function with a Packing for the given precision, which must not be
+// PRECISION_FLOAT, so that a loop can be compiled once for each of them.
+template <typename Function>
+inline void withPacking(Precision precision, Function function)
+{
+	switch (precision)
+	{
+	case PRECISION_HALF:
+		function(Packing<PRECISION_HALF>());
+		break;
+	case PRECISION_BFLOAT16:
+		function(Packing<PRECISION_BFLOAT16>());
+		break;
+	case PRECISION_FIXED16:
+	default:
+		function(Packing<PRECISION_FIXED16>());
+		break;
+	}
+}
+
+#ifdef NEURON_SIMD
+// Convert arrays of values compiled for AVX2 and AVX-512, so that the
+// compiler vectorises the conversions above across the widest registers.
+// Half precision is converted by the instructions built in for it instead,
+// with AVX-512 through the zero masked forms, since GCC warns that the
+// unmasked forms use an uninitialised register.
+template <typename P>
+SIMD_TARGET_AVX2_F16C void unpackArrayAvx2(const uint16_t * packed, float * values, int count)
+{
+	int index = 0;
+	if constexpr (std::is_same_v<P, Packing<PRECISION_HALF>>)
+	{
+		for (; index + 8 <= count; index += 8)
+		{
+			__m128i halves = _mm_loadu_si128(reinterpret_cast<const __m128i *>(packed + index));
+			_mm256_storeu_ps(values + index, _mm256_cvtph_ps(halves));
+		}
+	}
+	for (; index < count; ++index)
+	{
+		values[index] = P::unpack(packed[index]);
+	}
+}
+
+template <typename P>
+SIMD_TARGET_AVX2_F16C void packArrayAvx2(const float * values, uint16_t * packed, int count)
+{
+	int index = 0;
+	if constexpr (std::is_same_v<P, Packing<PRECISION_HALF>>)
+	{
+		for (; index + 8 <= count; index += 8)
+		{
+			__m128i halves = _mm256_cvtps_ph(_mm256_loadu_ps(values + index), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(packed + index), halves);
+		}
+	}
+	for (; index < count; ++index)
+	{
+		packed[index] = P::pack(values[index]);
+	}
+}
+
+template <typename P>
+SIMD_TARGET_AVX512 void unpackArrayAvx512(const uint16_t * packed, float * values, int count)
+{
+	int index = 0;
+	if constexpr (std::is_same_v<P, Packing<PRECISION_HALF>>)
+	{
+		for (; index + 16 <= count; index += 16)
+		{
+			__m256i halves = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(packed + index));
+			_mm512_storeu_ps(values + index, _mm512_maskz_cvtph_ps(0xffff, halves));
+		}
+	}
+	for (; index < count; ++index)
+	{
+		values[index] = P::unpack(packed[index]);
+	}
+}
+
+template <typename P>
+SIMD_TARGET_AVX512 void packArrayAvx512(const float * values, uint16_t * packed, int count)
+{
+	int index = 0;
+	if constexpr (std::is_same_v<P, Packing<PRECISION_HALF>>)
+	{
+		for (; index + 16 <= count; index += 16)
+		{
+			__m256i halves = _mm512_maskz_cvtps_ph(0xffff, _mm512_loadu_ps(values + index), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(packed + index), halves);
+		}
+	}
+	for (; index < count; ++index)
+	{
+		packed[index] = P::pack(values[index]);
+	}
+}
+#endif
+
+// Widen count values of the given precision, which must not be
+// PRECISION_FLOAT, with the widest instructions simdLevel() allows.
+inline void unpackArray(Precision precision, const uint16_t * packed, float * values, int count)
+{
+	withPacking(precision, [&](auto packing)
+	{
+		typedef decltype(packing) P;
+#ifdef NEURON_SIMD
+		switch (simdLevel())
+		{
+		case SIMD_AVX512:
+			unpackArrayAvx512<P>(packed, values, count);
+			return;
+		case SIMD_AVX2:
+			unpackArrayAvx2<P>(packed, values, count);
+			return;
+		default:
+			break;
+		}
+#endif
+		for (int index = 0; index < count; ++index)
+		{
+			values[index] = P::unpack(packed[index]);
+		}
+	});
+}
+
+// Pack count values to the given precision, which must not be
+// PRECISION_FLOAT, with the widest instructions simdLevel() allows.
+inline void packArray(Precision precision, const float * values, uint16_t * packed, int count)
+{
+	withPacking(precision, [&](auto packing)
+	{
+		typedef decltype(packing) P;
+#ifdef NEURON_SIMD
+		switch (simdLevel())
+		{
+		case SIMD_AVX512:
+			packArrayAvx512<P>(values, packed, count);
+			return;
+		case SIMD_AVX2:
+			packArrayAvx2<P>(values, packed, count);
+			return;
+		default:
+			break;
+		}
+#endif
+		for (int index = 0; index < count; ++index)
+		{
+			packed[index] = P::pack(values[index]);
+		}
+	});
+}
+
+#endif
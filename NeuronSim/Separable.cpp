@@ -0,0 +1,354 @@
+#include "Separable.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "NeuronStorage.h"
+#include "Spiker.h"
+
+using namespace std;
+
+// The most power iterations spent finding each term. They usually converge
+// in a handful, and a term which has not converged is still a valid term,
+// it just removes less of the error.
+static const int MAX_ITERATIONS(100);
+// Totals are rounded to zero if they are smaller than this proportion of the
+// total weight of the synapses with their delay, which is around the
+// rounding error of adding them up in single precision.
+static const float ZERO_THRESHOLD(1e-6f);
+
+Separable::Separable() :
+	mWidth(0),
+	mHeight(0),
+	mActiveSynapses(0),
+	mError(0.0f)
+{
+
+}
+
+Separable::~Separable()
+{
+
+}
+
+// Every term costs width + height per firing neuron, so there can be fewer
+// terms in total than active synapses divided by that.
+bool Separable::decompose(const Synapse * synapses, int width, int height, float tolerance)
+{
+	mWidth = width;
+	mHeight = height;
+	mTerms.clear();
+	mThresholds.clear();
+	mError = 0.0f;
+
+	vector<uint32_t> delays;
+	mActiveSynapses = 0;
+	for (int index = 0; index < width * height; ++index)
+	{
+		if (synapses[index].weight != 0.0f)
+		{
+			++mActiveSynapses;
+			delays.push_back(synapses[index].delay);
+		}
+	}
+	sort(delays.begin(), delays.end());
+	delays.erase(unique(delays.begin(), delays.end()), delays.end());
+	int maxTerms = (mActiveSynapses - 1) / (width + height);
+	if (tolerance <= 0.0f || int(delays.size()) > maxTerms)
+	{
+		return false;
+	}
+
+	double squaredWeights = 0.0;
+	double squaredError = 0.0;
+	for (auto delay : delays)
+	{
+		if (!decomposeDelay(synapses, delay, tolerance, maxTerms - int(mTerms.size()), squaredWeights, squaredError))
+		{
+			mTerms.clear();
+			mThresholds.clear();
+			return false;
+		}
+	}
+	mError = float(sqrt(squaredError / squaredWeights));
+	return !mTerms.empty();
+}
+
+// Terms are found one at a time by power iteration on what is left of the
+// weights, which converges on the largest singular value and its vectors.
+// The error is measured against the terms as they are stored, in single
+// precision, so the tolerance holds for the weights that are really fired.
+bool Separable::decomposeDelay(const Synapse * synapses, uint32_t delay, float tolerance, int maxTerms,
+	double & squaredWeights, double & squaredError)
+{
+	vector<double> residual(size_t(mWidth) * mHeight);
+	double squared = 0.0;
+	double total = 0.0;
+	for (size_t index = 0; index < residual.size(); ++index)
+	{
+		if (synapses[index].delay == delay)
+		{
+			residual[index] = synapses[index].weight;
+			squared += residual[index] * residual[index];
+			total += fabs(residual[index]);
+		}
+	}
+	squaredWeights += squared;
+
+	double limit = double(tolerance) * tolerance * squared;
+	double remaining = squared;
+	size_t firstTerm = mTerms.size();
+	vector<double> u(mHeight);
+	vector<double> v(mWidth);
+	while (remaining > limit)
+	{
+		if (maxTerms-- <= 0)
+		{
+			return false;
+		}
+
+		// Start from the row with the most weight left in it
+		int start = 0;
+		double startNorm = -1.0;
+		for (int row = 0; row < mHeight; ++row)
+		{
+			double norm = 0.0;
+			for (int col = 0; col < mWidth; ++col)
+			{
+				norm += residual[row * mWidth + col] * residual[row * mWidth + col];
+			}
+			if (norm > startNorm)
+			{
+				start = row;
+				startNorm = norm;
+			}
+		}
+		for (int col = 0; col < mWidth; ++col)
+		{
+			v[col] = residual[start * mWidth + col] / sqrt(startNorm);
+		}
+		double sigma = 0.0;
+		for (int iteration = 0; iteration < MAX_ITERATIONS; ++iteration)
+		{
+			double uNorm = 0.0;
+			for (int row = 0; row < mHeight; ++row)
+			{
+				u[row] = 0.0;
+				for (int col = 0; col < mWidth; ++col)
+				{
+					u[row] += residual[row * mWidth + col] * v[col];
+				}
+				uNorm += u[row] * u[row];
+			}
+			uNorm = sqrt(uNorm);
+			for (auto & value : u)
+			{
+				value /= uNorm;
+			}
+			double vNorm = 0.0;
+			for (int col = 0; col < mWidth; ++col)
+			{
+				v[col] = 0.0;
+				for (int row = 0; row < mHeight; ++row)
+				{
+					v[col] += residual[row * mWidth + col] * u[row];
+				}
+				vNorm += v[col] * v[col];
+			}
+			vNorm = sqrt(vNorm);
+			for (auto & value : v)
+			{
+				value /= vNorm;
+			}
+			bool converged = fabs(vNorm - sigma) <= 1e-12 * vNorm;
+			sigma = vNorm;
+			if (converged)
+			{
+				break;
+			}
+		}
+
+		// The column is scaled so that its largest weight is exactly 1, which
+		// keeps exactly separable weights such as a block of ones exact.
+		double largest = 0.0;
+		for (auto value : u)
+		{
+			largest = fabs(value) > fabs(largest) ? value : largest;
+		}
+		Term term;
+		term.delay = delay;
+		for (auto value : u)
+		{
+			term.column.push_back(float(value / largest));
+		}
+		for (auto value : v)
+		{
+			term.row.push_back(float(value * sigma * largest));
+		}
+
+		remaining = 0.0;
+		for (int row = 0; row < mHeight; ++row)
+		{
+			for (int col = 0; col < mWidth; ++col)
+			{
+				double & value = residual[row * mWidth + col];
+				value -= double(term.column[row]) * term.row[col];
+				remaining += value * value;
+			}
+		}
+		mTerms.push_back(move(term));
+	}
+	squaredError += remaining;
+	if (mTerms.size() > firstTerm)
+	{
+		mThresholds.push_back(float(total) * ZERO_THRESHOLD);
+	}
+	return true;
+}
+
+// The first pass costs the width of the matrix per term for each firing
+// neuron, and the second the height of the matrix per term for every
+// neuron of each target row, plus firing the totals once per delay.
+bool Separable::cheaper(int firing, int targetRows, int width) const
+{
+	double cells = double(targetRows) * width;
+	double cost = double(mTerms.size()) * (double(firing) * mWidth + cells * mHeight) + cells * mThresholds.size();
+	return cost < double(firing) * mActiveSynapses;
+}
+
+bool Separable::fire(const Spike & spike, Spiker * spiker, const uint64_t * firing, int width, int height,
+	int sourceBegin, int sourceEnd, int targetBegin, int targetEnd) const
+{
+	// Per thread working space, reused between calls.
+	thread_local vector<float> spread;
+	thread_local vector<char> rowFiring;
+	thread_local vector<float> totals;
+
+	// The target at row t receives from row t - (sr - height / 2) through
+	// the synapses in row sr, so only these sources matter.
+	if (mTerms.empty())
+	{
+		return false;
+	}
+	int words = (width + 63) / 64;
+	auto wrap = [](int index, int size) { return index < 0 ? index + size : (index >= size ? index - size : index); };
+	int lowest = max(sourceBegin, targetBegin - (mHeight - 1) + mHeight / 2);
+	int highest = min(sourceEnd, targetEnd + mHeight / 2);
+	if (lowest >= highest)
+	{
+		return true;
+	}
+	int count = 0;
+	for (int row = lowest; row < highest; ++row)
+	{
+		const uint64_t * rowWords = firing + size_t(wrap(row, height)) * words;
+		for (int ww = 0; ww < words; ++ww)
+		{
+			count += bitCount(rowWords[ww]);
+		}
+	}
+	if (count == 0)
+	{
+		return true;
+	}
+	if (!cheaper(count, targetEnd - targetBegin, width))
+	{
+		return false;
+	}
+
+	// Spread the firing neurons along their rows by the row weights of each
+	// term, wrapping around the ends of the row.
+	int terms = int(mTerms.size());
+	spread.resize(size_t(highest - lowest) * terms * width);
+	rowFiring.assign(highest - lowest, 0);
+	for (int row = lowest; row < highest; ++row)
+	{
+		const uint64_t * rowWords = firing + size_t(wrap(row, height)) * words;
+		float * rowSpread = &spread[size_t(row - lowest) * terms * width];
+		for (int ww = 0; ww < words; ++ww)
+		{
+			for (uint64_t bits = rowWords[ww]; bits; bits &= bits - 1)
+			{
+				if (!rowFiring[row - lowest])
+				{
+					fill(rowSpread, rowSpread + size_t(terms) * width, 0.0f);
+					rowFiring[row - lowest] = 1;
+				}
+				int start = ww * 64 + lowestBit(bits) - mWidth / 2;
+				for (int term = 0; term < terms; ++term)
+				{
+					float * __restrict dst = rowSpread + term * width;
+					const float * weights = mTerms[term].row.data();
+					int sc = 0;
+					while (sc < mWidth)
+					{
+						int tc = wrap(start + sc, width);
+						int run = min(mWidth - sc, width - tc);
+						for (int ii = 0; ii < run; ++ii)
+						{
+							dst[tc + ii] += weights[sc + ii];
+						}
+						sc += run;
+					}
+				}
+			}
+		}
+	}
+
+	// Spread those rows up and down by the column weights, and fire each
+	// run of non zero totals once per delay.
+	totals.resize(width);
+	for (int tr = targetBegin; tr < targetEnd; ++tr)
+	{
+		int group = 0;
+		for (int term = 0; term < terms; ++group)
+		{
+			uint32_t delay = mTerms[term].delay;
+			fill(totals.begin(), totals.end(), 0.0f);
+			bool any = false;
+			for (; term < terms && mTerms[term].delay == delay; ++term)
+			{
+				const float * column = mTerms[term].column.data();
+				for (int sr = 0; sr < mHeight; ++sr)
+				{
+					int row = tr - (sr - mHeight / 2);
+					if (row < lowest || row >= highest || !rowFiring[row - lowest] || column[sr] == 0.0f)
+					{
+						continue;
+					}
+					any = true;
+					float weight = column[sr];
+					const float * __restrict src = &spread[(size_t(row - lowest) * terms + term) * width];
+					float * __restrict total = totals.data();
+					for (int tc = 0; tc < width; ++tc)
+					{
+						total[tc] += weight * src[tc];
+					}
+				}
+			}
+			if (!any)
+			{
+				continue;
+			}
+			float threshold = mThresholds[group];
+			int first = wrap(tr, height) * width;
+			int tc = 0;
+			while (tc < width)
+			{
+				if (fabs(totals[tc]) <= threshold)
+				{
+					++tc;
+					continue;
+				}
+				int runEnd = tc + 1;
+				while (runEnd < width && fabs(totals[runEnd]) > threshold)
+				{
+					++runEnd;
+				}
+				spiker->fireWeights(spike, first + tc, runEnd - tc, &totals[tc], int(delay));
+				tc = runEnd;
+			}
+		}
+	}
+	return true;
+}
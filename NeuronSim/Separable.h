@@ -0,0 +1,91 @@
+#ifndef SEPARABLE_H
+#define SEPARABLE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "Synapse.h"
+
+class Spike;
+class Spiker;
+
+// Separable holds a low rank decomposition of the weights of a synapse
+// matrix. The synapses with each delay are approximated by a sum of a few
+// terms, each of which is a column of weights multiplied by a row of
+// weights, like the singular value decomposition. Gaussians and bars are
+// exactly rank one, and differences of Gaussians rank two.
+// Spikes can then be fired in two passes: firing neurons are spread along
+// their own row by the row weights of each term, and those rows are spread
+// up and down by the column weights, which costs rank * (width + height)
+// instead of width * height for each neuron. The second pass works on
+// whole rows of the layer, so it only pays off when plenty of neurons fire
+// (see cheaper).
+class Separable
+{
+public:
+	// One term of the decomposition. The weight of the synapse at column sc
+	// and row sr is the sum of column[sr] * row[sc] over the terms with its
+	// delay.
+	struct Term
+	{
+		uint32_t delay;            //< The delay of every synapse in this term
+		std::vector<float> column; //< One weight per row of the matrix, the largest of which is 1
+		std::vector<float> row;    //< One weight per column of the matrix
+	};
+
+	// Constructor for an empty decomposition
+	Separable();
+	// Destructor
+	~Separable();
+
+	// Decompose width x height synapses, stored in row major order. Terms are
+	// added for each delay until the root mean square error is no more than
+	// tolerance times the root mean square weight of the synapses with that
+	// delay. If that takes so many terms that firing the synapses directly
+	// would be as cheap, or tolerance is not positive, the decomposition is
+	// left empty. Returns true if there is a decomposition.
+	bool decompose(const Synapse * synapses, int width, int height, float tolerance);
+	// Return true if there is no decomposition
+	bool empty() const { return mTerms.empty(); }
+	// Return the terms, ordered by delay
+	const std::vector<Term> & terms() const { return mTerms; }
+	// Return the root mean square error of the decomposition relative to the
+	// root mean square weight of all of the synapses
+	float error() const { return mError; }
+	// Fire the spikes from neurons in source rows [sourceBegin, sourceEnd)
+	// which land in target rows [targetBegin, targetEnd), if that is
+	// estimated to be cheaper than firing them directly. Rows outside of the
+	// layer wrap around, like fireSpikes, and the matrix must be no larger
+	// than the layer so that it wraps at most once. Returns false, having
+	// fired nothing, if it is not cheaper.
+	// firing - the packed firing flags of the layer, (width + 63) / 64 words per row
+	bool fire(const Spike & spike, Spiker * spiker, const uint64_t * firing, int width, int height,
+		int sourceBegin, int sourceEnd, int targetBegin, int targetEnd) const;
+
+private:
+	// Return true if firing the given number of neurons through the
+	// decomposition is estimated to be cheaper than firing them directly,
+	// when spikes are needed in targetRows rows of a layer width wide.
+	bool cheaper(int firing, int targetRows, int width) const;
+	// Decompose the synapses with one delay, appending terms. Returns false
+	// if it would take more than maxTerms terms.
+	bool decomposeDelay(const Synapse * synapses, uint32_t delay, float tolerance, int maxTerms,
+		double & squaredWeights, double & squaredError);
+
+private:
+	// The width of the matrix
+	int mWidth;
+	// The height of the matrix
+	int mHeight;
+	// The number of synapses with non zero weights
+	int mActiveSynapses;
+	// The terms
+	std::vector<Term> mTerms;
+	// Totals smaller than this, for each distinct delay, are rounding errors
+	// and are treated as zero
+	std::vector<float> mThresholds;
+	// The relative error of the decomposition
+	float mError;
+};
+
+#endif
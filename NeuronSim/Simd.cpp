@@ -0,0 +1,81 @@
+#include "Simd.h"
+
+#if defined(NEURON_SIMD) && defined(_MSC_VER)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+// Ask the CPU, and for AVX the operating system, which instruction sets are
+// available.
+static SimdLevel detectSimdLevel()
+{
+#if defined(NEURON_SIMD) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+	{
+		return SIMD_SCALAR;
+	}
+	__cpuid(info, 1);
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	if (!osxsave)
+	{
+		return SIMD_SCALAR;
+	}
+	unsigned long long xcr0 = _xgetbv(0);
+	__cpuidex(info, 7, 0);
+	bool avx2 = (info[1] & (1 << 5)) != 0 && (xcr0 & 0x06) == 0x06;
+	bool avx512 = (info[1] & (1 << 16)) != 0 && (xcr0 & 0xE6) == 0xE6;
+	if (avx512)
+	{
+		return SIMD_AVX512;
+	}
+	return avx2 ? SIMD_AVX2 : SIMD_SCALAR;
+#elif defined(NEURON_SIMD)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+	{
+		return SIMD_AVX512;
+	}
+	return __builtin_cpu_supports("avx2") ? SIMD_AVX2 : SIMD_SCALAR;
+#else
+	return SIMD_SCALAR;
+#endif
+}
+
+// The level currently chosen, which starts as the widest one supported.
+static SimdLevel & currentSimdLevel()
+{
+	static SimdLevel level = supportedSimdLevel();
+	return level;
+}
+
+SimdLevel supportedSimdLevel()
+{
+	static const SimdLevel level = detectSimdLevel();
+	return level;
+}
+
+SimdLevel simdLevel()
+{
+	return currentSimdLevel();
+}
+
+void setSimdLevel(SimdLevel level)
+{
+	currentSimdLevel() = min(level, supportedSimdLevel());
+}
+
+const char * simdLevelName(SimdLevel level)
+{
+	switch (level)
+	{
+	case SIMD_AVX512:
+		return "AVX-512";
+	case SIMD_AVX2:
+		return "AVX2";
+	default:
+		return "scalar";
+	}
+}
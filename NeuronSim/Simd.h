@@ -0,0 +1,172 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// Explicit SIMD versions of the neuron models are available on x86 CPUs, as
+// long as the neurons are stored as a structure of arrays (see
+// NeuronStorage.h). Which version runs is decided at run time, so a single
+// build works on any x86 CPU and uses the widest instructions it supports.
+#if (defined(__x86_64__) || defined(_M_X64)) && !defined(NEURON_STORAGE_AOS)
+#define NEURON_SIMD
+#endif
+
+#ifdef NEURON_SIMD
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC allows any intrinsic in any function, so no target is required.
+#define SIMD_TARGET_AVX2
+#define SIMD_TARGET_AVX2_F16C
+#define SIMD_TARGET_AVX512
+#else
+#include <immintrin.h>
+// GCC and clang only allow intrinsics in functions compiled for a target
+// that supports them. FMA is deliberately not enabled, so that the compiler
+// cannot fuse a multiply and add that the scalar code performs separately.
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+// Every CPU with AVX2 also has the F16C half precision conversions.
+#define SIMD_TARGET_AVX2_F16C __attribute__((target("avx2,f16c")))
+#define SIMD_TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+#endif
+
+// The instruction sets the neuron models can use, in increasing order.
+enum SimdLevel
+{
+	SIMD_SCALAR, //< Plain C++, which the compiler may still vectorise
+	SIMD_AVX2,   //< 8 neurons at a time
+	SIMD_AVX512  //< 16 neurons at a time
+};
+
+// Return the widest instruction set supported by this CPU and build.
+SimdLevel supportedSimdLevel();
+// Return the instruction set the neuron models are currently using.
+SimdLevel simdLevel();
+// Choose the instruction set the neuron models use. This is limited to what
+// the CPU supports, and is intended for comparing the implementations.
+// It must not be called while an automaton is ticking.
+void setSimdLevel(SimdLevel level);
+// Return a readable name for an instruction set
+const char * simdLevelName(SimdLevel level);
+
+#ifdef NEURON_SIMD
+
+// Apply a kernel to every neuron in rows [rowBegin, rowEnd) of a layer, 16
+// neurons at a time. kernel(index, active) updates the neurons starting at
+// index for which the bits of active are set, and returns a mask of those
+// which fire. The masks are packed into the firing words of the layer, which
+// hold one bit per neuron with each row starting on a new 64 bit word.
+template <typename Kernel>
+SIMD_TARGET_AVX512 void simdRowsAvx512(const Kernel & kernel, int rowBegin, int rowEnd, int width, uint64_t * firing)
+{
+	int words = (width + 63) / 64;
+	for (int rr = rowBegin; rr < rowEnd; ++rr)
+	{
+		uint64_t * word = firing + rr * words;
+		for (int cc = 0; cc < width; cc += 64)
+		{
+			uint64_t bits = 0;
+			for (int bit = 0; bit < 64 && cc + bit < width; bit += 16)
+			{
+				int count = std::min(16, width - cc - bit);
+				__mmask16 active = __mmask16((1u << count) - 1);
+				bits |= uint64_t(kernel(rr * width + cc + bit, active)) << bit;
+			}
+			*word++ = bits;
+		}
+	}
+}
+
+// The same as simdRowsAvx512, but 8 neurons at a time. The active lanes are
+// given to the kernel as a vector of all ones or all zeroes, which is the
+// form the AVX2 masked loads and stores take, and the kernel returns a mask
+// of the neurons which fire in the low 8 bits.
+template <typename Kernel>
+SIMD_TARGET_AVX2 void simdRowsAvx2(const Kernel & kernel, int rowBegin, int rowEnd, int width, uint64_t * firing)
+{
+	int words = (width + 63) / 64;
+	const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	for (int rr = rowBegin; rr < rowEnd; ++rr)
+	{
+		uint64_t * word = firing + rr * words;
+		for (int cc = 0; cc < width; cc += 64)
+		{
+			uint64_t bits = 0;
+			for (int bit = 0; bit < 64 && cc + bit < width; bit += 8)
+			{
+				int count = std::min(8, width - cc - bit);
+				__m256i active = _mm256_cmpgt_epi32(_mm256_set1_epi32(count), lanes);
+				bits |= uint64_t(kernel(rr * width + cc + bit, active) & ((1 << count) - 1)) << bit;
+			}
+			*word++ = bits;
+		}
+	}
+}
+
+// Multiply 16 floats. GCC would fuse a plain _mm512_mul_ps with a following
+// add, since AVX-512 includes FMA, which rounds differently from the scalar
+// code. The explicit rounding form is opaque to the compiler, so it is not.
+// The zero masked form is used with every lane set, since the unmasked form
+// merges into an undefined vector which GCC warns may be uninitialised.
+SIMD_TARGET_AVX512 inline __m512 mulAvx512(__m512 a, __m512 b)
+{
+	return _mm512_maskz_mul_round_ps(__mmask16(0xFFFF), a, b, _MM_FROUND_CUR_DIRECTION);
+}
+
+// Vector exponential, based on the single precision exp from the Cephes
+// library. This is accurate to a couple of units in the last place, but is
+// not bit for bit the same as the scalar exp. Values too large to represent
+// become infinity, as they do for the scalar exp. Zero masked forms are used
+// with every lane set where GCC would warn about the undefined vector the
+// unmasked forms merge into.
+SIMD_TARGET_AVX512 inline __m512 expAvx512(__m512 x)
+{
+	const __mmask16 all = 0xFFFF;
+	__mmask16 overflow = _mm512_cmp_ps_mask(x, _mm512_set1_ps(88.7228394f), _CMP_GT_OQ);
+	x = _mm512_maskz_min_ps(all, x, _mm512_set1_ps(88.3762626647949f));
+	x = _mm512_maskz_max_ps(all, x, _mm512_set1_ps(-88.3762626647949f));
+	__m512 fx = _mm512_add_ps(_mm512_mul_ps(x, _mm512_set1_ps(1.44269504088896341f)), _mm512_set1_ps(0.5f));
+	fx = _mm512_maskz_roundscale_ps(all, fx, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+	x = _mm512_sub_ps(x, _mm512_mul_ps(fx, _mm512_set1_ps(0.693359375f)));
+	x = _mm512_sub_ps(x, _mm512_mul_ps(fx, _mm512_set1_ps(-2.12194440e-4f)));
+	__m512 z = _mm512_mul_ps(x, x);
+	__m512 y = _mm512_set1_ps(1.9875691500e-4f);
+	y = _mm512_add_ps(_mm512_mul_ps(y, x), _mm512_set1_ps(1.3981999507e-3f));
+	y = _mm512_add_ps(_mm512_mul_ps(y, x), _mm512_set1_ps(8.3334519073e-3f));
+	y = _mm512_add_ps(_mm512_mul_ps(y, x), _mm512_set1_ps(4.1665795894e-2f));
+	y = _mm512_add_ps(_mm512_mul_ps(y, x), _mm512_set1_ps(1.6666665459e-1f));
+	y = _mm512_add_ps(_mm512_mul_ps(y, x), _mm512_set1_ps(5.0000001201e-1f));
+	y = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(y, z), x), _mm512_set1_ps(1.0f));
+	__m512i exponent = _mm512_maskz_slli_epi32(all, _mm512_add_epi32(_mm512_maskz_cvtps_epi32(all, fx), _mm512_set1_epi32(127)), 23);
+	y = _mm512_mul_ps(y, _mm512_castsi512_ps(exponent));
+	return _mm512_mask_blend_ps(overflow, y, _mm512_set1_ps(INFINITY));
+}
+
+// The AVX2 version of expAvx512
+SIMD_TARGET_AVX2 inline __m256 expAvx2(__m256 x)
+{
+	__m256 overflow = _mm256_cmp_ps(x, _mm256_set1_ps(88.7228394f), _CMP_GT_OQ);
+	x = _mm256_min_ps(x, _mm256_set1_ps(88.3762626647949f));
+	x = _mm256_max_ps(x, _mm256_set1_ps(-88.3762626647949f));
+	__m256 fx = _mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504088896341f)), _mm256_set1_ps(0.5f));
+	fx = _mm256_floor_ps(fx);
+	x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _mm256_set1_ps(0.693359375f)));
+	x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _mm256_set1_ps(-2.12194440e-4f)));
+	__m256 z = _mm256_mul_ps(x, x);
+	__m256 y = _mm256_set1_ps(1.9875691500e-4f);
+	y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(1.3981999507e-3f));
+	y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(8.3334519073e-3f));
+	y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(4.1665795894e-2f));
+	y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(1.6666665459e-1f));
+	y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(5.0000001201e-1f));
+	y = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(y, z), x), _mm256_set1_ps(1.0f));
+	__m256i exponent = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(fx), _mm256_set1_epi32(127)), 23);
+	y = _mm256_mul_ps(y, _mm256_castsi256_ps(exponent));
+	return _mm256_blendv_ps(y, _mm256_set1_ps(INFINITY), overflow);
+}
+
+#endif
+
+#endif
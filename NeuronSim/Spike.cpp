@@ -1,6 +1,7 @@
 #include "Spike.h"
 
 #include <cassert>
+#include <cmath>
 #include <fstream>
 
 using namespace std;
@@ -16,6 +17,7 @@ void Spike::setSpike(Shape shape, int duration)
 	mDuration = duration;
 
 	mPotentials.resize(duration);
+	mPieces.clear();
 	switch (shape)
 	{
 	case SHAPE_SQUARE:
@@ -23,6 +25,7 @@ void Spike::setSpike(Shape shape, int duration)
 		{
 			potential = 1.0f;
 		}
+		mPieces.push_back({ 0, duration, 1.0f });
 		break;
 	case SHAPE_TRIANGLE:
 	{
@@ -55,15 +58,21 @@ void Spike::setSpike(Shape shape, int duration)
 		{
 			mPotentials[x] = 1.0f;
 		}
+		if (flat > 0)
+		{
+			mPieces.push_back({ 0, flat, 1.0f });
+		}
 		if (duration > flat)
 		{
-			float val = 1.0f;
+			// Each potential is the nearest float to a power of the decay, as
+			// delivered by a level which decays (see SpikeTrain), rather than
+			// a product of decays rounded again on every step.
 			float decay = pow(0.1f, 1.0f / (duration - flat));
 			for (int x = flat; x < duration; ++x)
 			{
-				mPotentials[x] = val;
-				val *= decay;
+				mPotentials[x] = float(pow(double(decay), x - flat));
 			}
+			mPieces.push_back({ flat, duration, duration - flat > 1 ? decay : 1.0f });
 		}
 		break;
 	}
@@ -83,5 +92,7 @@ void Spike::loadSpike(ifstream & ifs)
 	ifs.read(reinterpret_cast<char *>(&size), sizeof(size));
 	mPotentials.resize(size);
 	ifs.read(reinterpret_cast<char *>(&mPotentials[0]), size * sizeof(float));
+	// The potentials loaded need not follow the shape
+	mPieces.clear();
 }
 
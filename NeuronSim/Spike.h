@@ -18,6 +18,16 @@ public:
 		SHAPE_GAUSS,      //< Symettrical bell-curve wave
 		SHAPE_EXPONENTIAL //< Instant spike with exponential decay
 	};
+	// A run of offsets over which the potential starts at potential(begin)
+	// and is multiplied by decay on each tick. A piece can be delivered from
+	// a running level which decays in the same way, instead of one potential
+	// at a time (see SpikeTrain).
+	struct Piece
+	{
+		int begin;   //< The first offset of the piece
+		int end;     //< One past the last offset of the piece
+		float decay; //< The ratio between the potentials of successive offsets
+	};
 
 	// Constructor
 	Spike();
@@ -30,6 +40,9 @@ public:
 	int duration() const { return mDuration; }
 	// Return the precalculated spike potential at a give time offset
 	float potential(int index) const { return mPotentials[index]; }
+	// Return the pieces which make up the whole of this spike, in order, or
+	// nothing if its shape cannot be split into pieces
+	const std::vector<Piece> & pieces() const { return mPieces; }
 	// Save this spike to an output stream
 	void saveSpike(std::ofstream & ofs);
 	// Load a spike from an input stream
@@ -42,6 +55,8 @@ private:
 	int mDuration;
 	// Precalculated potentials over the duration
 	std::vector<float> mPotentials;
+	// The pieces which make up the spike
+	std::vector<Piece> mPieces;
 };
 
 #endif
@@ -0,0 +1,13 @@
+#ifndef SPIKE_EVENT_H
+#define SPIKE_EVENT_H
+
+// A spike event is a potential arriving at a single neuron in a single time
+// step. This is a data item used by a SpikeTrain while activity is sparse,
+// in place of a whole frame of potentials.
+struct SpikeEvent
+{
+	int index;    //< The index into a layer of neurons of the recipient
+	float weight; //< The potential the recipient receives
+};
+
+#endif
@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <filesystem>
 #include <sstream>
 
@@ -20,7 +21,46 @@ static const uint8_t TAG_FRAME('f');
 static const uint8_t TAG_DATA('D');
 static const uint8_t TAG_END('E');
 
-SpikeTrain::SpikeTrain()
+// A sparse train becomes dense once it holds more events than this
+// proportion of the neurons in all of its frames. Events are twice the size
+// of a potential, and slower to deliver, so there is no point going higher.
+static const float DENSE_THRESHOLD(0.1f);
+// A dense train becomes sparse once the frames it delivers have had fewer
+// than this proportion of non zero potentials for a whole trip around the
+// circular buffer. The gap between the two thresholds stops a train that
+// sits near one of them from changing back and forth every tick.
+static const float SPARSE_THRESHOLD(0.02f);
+// Pieces of spikes shorter than this are written into every frame they
+// span, since a potential or event for each offset is no slower than taking
+// and delivering the steps of a lane while there are few of them.
+static const int LANE_DURATION(8);
+// The number of lanes a train can have, which is one for flat pieces and one
+// for each decay. Spikes of the same shape and duration share a decay, so a
+// train rarely sees more than one or two of them.
+static const int LANE_COUNT(4);
+// The levels of the lane are fixed point with 32 fractional bits. Their sums
+// are exact, so they are the same whatever order the steps are taken in.
+static const double LEVEL_SCALE(4294967296.0);
+
+static int64_t toLevel(float potential)
+{
+	return llround(double(potential) * LEVEL_SCALE);
+}
+
+static float fromLevel(int64_t level)
+{
+	// Multiplying by the inverse of a power of two is exact, and vectorises
+	return float(double(level) * (1.0 / LEVEL_SCALE));
+}
+
+SpikeTrain::SpikeTrain() :
+	mChannels(1),
+	mShuntChannel(this),
+	mMode(MODE_DENSE),
+	mPrecision(PRECISION_FLOAT),
+	mModeSwitches(0),
+	mQuietTicks(0),
+	mLaneCount(0)
 {
 
 }
@@ -28,55 +68,488 @@ SpikeTrain::SpikeTrain()
 SpikeTrain::SpikeTrain(const SpikeTrain & other) :
 	mSource(other.mSource),
 	mTarget(other.mTarget),
+	mChannels(other.mChannels),
+	mShuntChannel(this),
 	mFrames(other.mFrames),
+	mPacked(other.mPacked),
+	mEvents(other.mEvents),
+	mRowCounts(other.mRowCounts),
 	mShunting(other.mShunting),
-	mCurrentFrame(other.mCurrentFrame)
+	mCurrentFrame(other.mCurrentFrame),
+	mFireAhead(other.mFireAhead),
+	mMode(other.mMode),
+	mPrecision(other.mPrecision),
+	mModeSwitches(other.mModeSwitches),
+	mQuietTicks(other.mQuietTicks),
+	mLanes(other.mLanes),
+	mLaneCount(other.laneCount())
 {
 
 }
 
+// A new train is empty, so it starts out sparse.
+// There is one more frame than the delay needs. It is always empty between
+// ticks, and it is what lets spikes be fired ahead of the current frame
+// being delivered (see fireAhead).
 SpikeTrain::SpikeTrain(shared_ptr<Layer> source, shared_ptr<Layer> target, int delay, bool shunting) :
 	mSource(source),
 	mTarget(target),
+	mChannels(1),
+	mShuntChannel(this),
 	mShunting(shunting),
-	mCurrentFrame(0)
+	mCurrentFrame(0),
+	mFireAhead(0),
+	mMode(MODE_SPARSE),
+	mPrecision(PRECISION_FLOAT),
+	mModeSwitches(0),
+	mQuietTicks(0),
+	mLaneCount(0)
 {
-	mFrames.resize(delay + 1);
-	for (auto & frame : mFrames)
-	{
-		frame.resize(source->width() * source->height());
-		std::fill(frame.begin(), frame.end(), 0.0f);
-	}
+	mFrames.resize(delay + 2);
+	mPacked.resize(mFrames.size());
+	mEvents.resize(mFrames.size() * rows());
+	mRowCounts.resize(rows());
+	resetLanes();
+}
+
+SpikeTrain::SpikeTrain(shared_ptr<Layer> target, int delay, bool shunts) :
+	mTarget(target),
+	mChannels(shunts ? 2 : 1),
+	mShuntChannel(this),
+	mShunting(false),
+	mCurrentFrame(0),
+	mFireAhead(0),
+	mMode(MODE_SPARSE),
+	mPrecision(PRECISION_FLOAT),
+	mModeSwitches(0),
+	mQuietTicks(0),
+	mLaneCount(0)
+{
+	mFrames.resize(delay + 2);
+	mPacked.resize(mFrames.size());
+	mEvents.resize(mFrames.size() * rows());
+	mRowCounts.resize(rows());
+	resetLanes();
 }
 
 SpikeTrain::~SpikeTrain()
 {
 }
 
-// There is a possibility of an optimization in here. We are storing an array
-// of all possible spikes which is often very sparse, and processing the
-// entire thing every frame. We could save both time and memory in most cases
-// by storing individual spike objects in a list. The current system takes
-// approximately 33% of our CPU time just adding zeroes to neuron potentials,
-// so it would make a large difference (I have tried it - it works well).
-// Unfortunately, in the case when a system becomes highly excited, the
-// number of active spikes can become unmanageable and we slow to a crawl and
-// then run out of memory. There isn't a sensible fall back for OOM conditions
-// here, other than throwing spikes away and hoping for the best, so I have
-// abandoned that approach.
+// Storing a frame of all possible spikes for every time step is often very
+// sparse, and processing the entire thing every frame took approximately 33%
+// of our CPU time just adding zeroes to neuron potentials. Storing individual
+// spikes in a list saves both time and memory in most cases, but when a
+// system becomes highly excited the number of active spikes can become
+// unmanageable and we slow to a crawl and then run out of memory. There isn't
+// a sensible fall back for OOM conditions other than throwing spikes away, so
+// instead the train changes to full frames when it gets busy (see advance).
 void SpikeTrain::tick()
 {
-	auto & frame = mFrames[mCurrentFrame];
-	if (mShunting)
+	deliver(0, mTarget->height());
+	advance();
+}
+
+// Sparse events are merged before delivery so that each neuron receives the
+// same total, added up in the same order, as it would from a dense frame.
+// Packed frames are unpacked into a scratch frame covering the whole layer,
+// a band of rows at a time. The levels of the lanes are then added to the
+// totals, or to the frame once its rows have been counted, so that they make
+// no difference to whether the train is busy. The rows of each channel are
+// delivered in turn.
+void SpikeTrain::deliver(int rowBegin, int rowEnd)
+{
+	int width = mTarget->width();
+	for (int channel = 0; channel < mChannels; ++channel)
 	{
-		mTarget->receiveShunts(&frame[0]);
+		bool shunts = mShunting || channel > 0;
+		int first = channel * mTarget->height();
+		bool stepping = laneActive(first + rowBegin, first + rowEnd);
+		if (mMode == MODE_SPARSE)
+		{
+			thread_local Events merged;
+			thread_local vector<int> positions;
+			merged.clear();
+			for (int row = rowBegin; row < rowEnd; ++row)
+			{
+				auto & rowEvents = events(mCurrentFrame, first + row);
+				mergeEvents(rowEvents, merged);
+				rowEvents.clear();
+			}
+			for (auto & event : merged)
+			{
+				event.index -= first * width;
+			}
+			if (stepping)
+			{
+				positions.resize(size_t(width) * mTarget->height(), -1);
+				for (int event = 0; event < int(merged.size()); ++event)
+				{
+					positions[merged[event].index] = event;
+				}
+				for (int row = rowBegin; row < rowEnd; ++row)
+				{
+					stepLanes(first + row, [&](const int64_t * levels)
+					{
+						for (int col = 0; col < width; ++col)
+						{
+							if (levels[col] == 0)
+							{
+								continue;
+							}
+							int & position = positions[row * width + col];
+							if (position < 0)
+							{
+								position = int(merged.size());
+								merged.push_back({ row * width + col, fromLevel(levels[col]) });
+							}
+							else
+							{
+								merged[position].weight += fromLevel(levels[col]);
+							}
+						}
+					});
+				}
+				for (auto & event : merged)
+				{
+					positions[event.index] = -1;
+				}
+			}
+			if (shunts)
+			{
+				mTarget->receiveShunts(merged.data(), int(merged.size()));
+			}
+			else
+			{
+				mTarget->receiveSpikes(merged.data(), int(merged.size()));
+			}
+			continue;
+		}
+
+		float * frame;
+		if (packed())
+		{
+			thread_local Frame unpacked;
+			unpacked.resize(size_t(width) * mTarget->height());
+			uint16_t * __restrict source = &mPacked[mCurrentFrame][first * width];
+			float * __restrict destination = unpacked.data();
+			withPacking(mPrecision, [&](auto packing)
+			{
+				for (int index = rowBegin * width; index < rowEnd * width; ++index)
+				{
+					destination[index] = packing.unpack(source[index]);
+					source[index] = 0;
+				}
+			});
+			frame = unpacked.data();
+		}
+		else
+		{
+			frame = &mFrames[mCurrentFrame][first * width];
+		}
+		if (stepping)
+		{
+			for (int row = rowBegin; row < rowEnd; ++row)
+			{
+				float * __restrict cell = &frame[row * width];
+				int count = 0;
+				for (int col = 0; col < width; ++col)
+				{
+					count += (cell[col] != 0.0f);
+				}
+				mRowCounts[first + row] = count;
+				stepLanes(first + row, [cell, width](const int64_t * __restrict levels)
+				{
+					// Adding zero for the neurons without a level changes nothing
+					for (int col = 0; col < width; ++col)
+					{
+						cell[col] += fromLevel(levels[col]);
+					}
+				});
+			}
+		}
+		if (shunts)
+		{
+			mTarget->receiveShunts(frame, rowBegin, rowEnd);
+		}
+		else
+		{
+			mTarget->receiveSpikes(frame, rowBegin, rowEnd);
+		}
+		for (int row = rowBegin; row < rowEnd; ++row)
+		{
+			float * cell = &frame[row * width];
+			int count = 0;
+			for (int col = 0; col < width; ++col)
+			{
+				count += (cell[col] != 0.0f);
+				cell[col] = 0.0f;
+			}
+			if (!stepping)
+			{
+				mRowCounts[first + row] = count;
+			}
+		}
 	}
-	else
+}
+
+bool SpikeTrain::laneActive(int rowBegin, int rowEnd)
+{
+	int lanes = laneCount();
+	for (int index = 0; index < lanes; ++index)
 	{
-		mTarget->receiveSpikes(&frame[0]);
+		auto & lane = mLanes[index];
+		for (int row = rowBegin; row < rowEnd; ++row)
+		{
+			int steps = mCurrentFrame * rows() + row;
+			if (lane.active[row] != 0 || !lane.opens[steps].empty() || !lane.closes[steps].empty())
+			{
+				return true;
+			}
+		}
 	}
-	std::fill(frame.begin(), frame.end(), 0.0f);
+	return false;
+}
+
+// A row of levels is only made once it has a step, and only looked at while
+// some of its levels are not zero. The levels of a lane which decays are
+// multiplied by the decay once they have been delivered, and truncated back
+// to fixed point. The truncation leaves each level up to one unit of the
+// fixed point away from the sum of its pieces for every tick it has decayed,
+// and that is not left behind, since a level is set back to zero as soon as
+// the last piece in it has ended.
+template <typename Deliver>
+void SpikeTrain::stepLanes(int row, Deliver deliver)
+{
+	int width = mTarget->width();
+	int lanes = laneCount();
+	for (int index = 0; index < lanes; ++index)
+	{
+		auto & lane = mLanes[index];
+		bool decays = lane.decay != 1.0f;
+		auto & levels = lane.levels[row];
+		auto & spikes = lane.spikes[row];
+		int & active = lane.active[row];
+		auto take = [&](Steps & steps, int change)
+		{
+			if (levels.empty() && !steps.empty())
+			{
+				levels.assign(width, 0);
+				spikes.assign(decays ? width : 0, 0);
+			}
+			for (auto & step : steps)
+			{
+				int col = step.index - row * width;
+				int64_t & level = levels[col];
+				active -= (level != 0);
+				level += step.delta;
+				if (decays)
+				{
+					spikes[col] += change;
+					level = spikes[col] ? level : 0;
+				}
+				active += (level != 0);
+			}
+			steps.clear();
+		};
+		take(lane.opens[mCurrentFrame * rows() + row], 1);
+		if (active > 0)
+		{
+			deliver(levels.data());
+		}
+		take(lane.closes[mCurrentFrame * rows() + row], -1);
+		if (decays && active > 0)
+		{
+			double decay = lane.decay;
+			active = 0;
+			for (int col = 0; col < width; ++col)
+			{
+				levels[col] = int64_t(double(levels[col]) * decay);
+				active += (levels[col] != 0);
+			}
+		}
+	}
+}
+
+// The mode only changes here, when no other thread is using the train. The
+// lanes are used in either mode, so they are left as they are.
+void SpikeTrain::advance()
+{
 	mCurrentFrame = (mCurrentFrame + 1) % mFrames.size();
+	mFireAhead = 0;
+
+	float cells = float(mTarget->width() * rows());
+	if (mMode == MODE_SPARSE)
+	{
+		size_t total = 0;
+		for (auto & rowEvents : mEvents)
+		{
+			total += rowEvents.size();
+		}
+		// A spike in a lane counts as the events it would have left in the
+		// frames, which is at most one for each tick until it ends
+		int frames = int(mFrames.size());
+		for (int lane = 0; lane < laneCount(); ++lane)
+		{
+			for (int ff = 0; ff < frames; ++ff)
+			{
+				int frame = (mCurrentFrame + ff) % frames;
+				for (int row = 0; row < rows(); ++row)
+				{
+					total += mLanes[lane].closes[frame * rows() + row].size() * (ff + 1);
+				}
+			}
+		}
+		if (total > DENSE_THRESHOLD * cells * depth())
+		{
+			makeDense();
+		}
+	}
+	else
+	{
+		int total = 0;
+		for (auto count : mRowCounts)
+		{
+			total += count;
+		}
+		mQuietTicks = (total < SPARSE_THRESHOLD * cells) ? mQuietTicks + 1 : 0;
+		if (mQuietTicks >= depth())
+		{
+			makeSparse();
+		}
+	}
+}
+
+// The frames spikes are fired into move on by one, which reaches the spare
+// frame at the far end of the buffer, so none of them is the current frame.
+void SpikeTrain::fireAhead()
+{
+	mFireAhead = 1;
+}
+
+// The frames are moved into a new circular buffer starting at the current
+// frame, which leaves every spike the same number of ticks from delivery.
+void SpikeTrain::setDelay(int delay)
+{
+	int frames = int(mFrames.size());
+	int height = rows();
+	int size = max(delay + 2, lastPendingFrame() + 2);
+	if (size == frames)
+	{
+		return;
+	}
+
+	vector<Frame> newFrames(size);
+	vector<PackedFrame> newPacked(size);
+	vector<Events> newEvents(size * height);
+	vector<vector<Steps>> newOpens(laneCount(), vector<Steps>(size * height));
+	vector<vector<Steps>> newCloses(laneCount(), vector<Steps>(size * height));
+	for (int ff = 0; ff < size; ++ff)
+	{
+		if (ff < frames)
+		{
+			int frame = (mCurrentFrame + ff) % frames;
+			newFrames[ff].swap(mFrames[frame]);
+			newPacked[ff].swap(mPacked[frame]);
+			for (int row = 0; row < height; ++row)
+			{
+				newEvents[ff * height + row].swap(events(frame, row));
+				for (int lane = 0; lane < laneCount(); ++lane)
+				{
+					newOpens[lane][ff * height + row].swap(mLanes[lane].opens[frame * height + row]);
+					newCloses[lane][ff * height + row].swap(mLanes[lane].closes[frame * height + row]);
+				}
+			}
+		}
+		else if (mMode == MODE_DENSE && packed())
+		{
+			newPacked[ff].assign(mTarget->width() * height, 0);
+		}
+		else if (mMode == MODE_DENSE)
+		{
+			newFrames[ff].assign(mTarget->width() * height, 0.0f);
+		}
+	}
+	mFrames.swap(newFrames);
+	mPacked.swap(newPacked);
+	mEvents.swap(newEvents);
+	for (int lane = 0; lane < laneCount(); ++lane)
+	{
+		mLanes[lane].opens.swap(newOpens[lane]);
+		mLanes[lane].closes.swap(newCloses[lane]);
+	}
+	mCurrentFrame = 0;
+}
+
+// The train grows first if the other train holds spikes further ahead than
+// this one has frames for. The lanes of the other train are taken in as the
+// potentials they would have delivered.
+void SpikeTrain::absorb(SpikeTrain & other)
+{
+	int last = other.lastPendingFrame();
+	if (last >= depth())
+	{
+		setDelay(last);
+	}
+	int width = mTarget->width();
+	int cells = width * mTarget->height();
+	auto add = [&](int frame, int index, float weight)
+	{
+		int channel = other.mShunting ? 1 : index / cells;
+		if (channel >= mChannels)
+		{
+			return;
+		}
+		index = channel * cells + index % cells;
+		if (mMode == MODE_DENSE)
+		{
+			addPotential(frame, index, weight);
+		}
+		else
+		{
+			events(frame, index / width).push_back({ index, weight });
+		}
+	};
+	Frame frame;
+	for (int ff = 0; ff <= last; ++ff)
+	{
+		int from = (other.mCurrentFrame + ff) % int(other.mFrames.size());
+		int to = (mCurrentFrame + ff) % int(mFrames.size());
+		if (other.mMode == MODE_DENSE)
+		{
+			other.unpackFrame(from, frame);
+			for (int index = 0; index < int(frame.size()); ++index)
+			{
+				if (frame[index] != 0.0f)
+				{
+					add(to, index, frame[index]);
+				}
+			}
+		}
+		else
+		{
+			for (int row = 0; row < other.rows(); ++row)
+			{
+				for (auto & event : other.events(from, row))
+				{
+					add(to, event.index, event.weight);
+				}
+			}
+		}
+	}
+	vector<Frame> lanes(max(0, last + 1), Frame(size_t(other.mTarget->width()) * other.rows(), 0.0f));
+	other.lanePotentials(lanes);
+	for (int ff = 0; ff <= last; ++ff)
+	{
+		int to = (mCurrentFrame + ff) % int(mFrames.size());
+		for (int index = 0; index < int(lanes[ff].size()); ++index)
+		{
+			if (lanes[ff][index] != 0.0f)
+			{
+				add(to, index, lanes[ff][index]);
+			}
+		}
+	}
 }
 
 void SpikeTrain::clear()
@@ -85,14 +558,376 @@ void SpikeTrain::clear()
 	{
 		std::fill(frame.begin(), frame.end(), 0.0f);
 	}
+	for (auto & frame : mPacked)
+	{
+		std::fill(frame.begin(), frame.end(), uint16_t(0));
+	}
+	for (auto & rowEvents : mEvents)
+	{
+		rowEvents.clear();
+	}
+	for (int lane = 0; lane < laneCount(); ++lane)
+	{
+		for (auto & steps : mLanes[lane].opens)
+		{
+			steps.clear();
+		}
+		for (auto & steps : mLanes[lane].closes)
+		{
+			steps.clear();
+		}
+		for (auto & levels : mLanes[lane].levels)
+		{
+			std::fill(levels.begin(), levels.end(), 0);
+		}
+		for (auto & spikes : mLanes[lane].spikes)
+		{
+			std::fill(spikes.begin(), spikes.end(), 0);
+		}
+		std::fill(mLanes[lane].active.begin(), mLanes[lane].active.end(), 0);
+	}
+}
+
+uint64_t SpikeTrain::bytes() const
+{
+	uint64_t bytes = 0;
+	for (auto & frame : mFrames)
+	{
+		bytes += frame.size() * sizeof(float);
+	}
+	for (auto & frame : mPacked)
+	{
+		bytes += frame.size() * sizeof(uint16_t);
+	}
+	for (auto & rowEvents : mEvents)
+	{
+		bytes += rowEvents.size() * sizeof(SpikeEvent);
+	}
+	for (int lane = 0; lane < laneCount(); ++lane)
+	{
+		for (auto & steps : mLanes[lane].opens)
+		{
+			bytes += steps.size() * sizeof(Step);
+		}
+		for (auto & steps : mLanes[lane].closes)
+		{
+			bytes += steps.size() * sizeof(Step);
+		}
+		for (auto & levels : mLanes[lane].levels)
+		{
+			bytes += levels.size() * sizeof(int64_t);
+		}
+		for (auto & spikes : mLanes[lane].spikes)
+		{
+			bytes += spikes.size() * sizeof(int);
+		}
+	}
+	return bytes;
 }
 
 float SpikeTrain::currentSpikeDensity()
 {
-	auto & frame = mFrames[mCurrentFrame];
-	int total = 0;
-	for_each(frame.begin(), frame.end(), [&total](auto val) { total += fabs(val) > 0.01f; });
-	return float(total) / float(mFrames.size());
+	vector<Frame> current(1);
+	if (mMode == MODE_SPARSE)
+	{
+		current[0].assign(size_t(mTarget->width()) * rows(), 0.0f);
+		Events merged;
+		for (int row = 0; row < rows(); ++row)
+		{
+			mergeEvents(events(mCurrentFrame, row), merged);
+		}
+		for_each(merged.begin(), merged.end(), [&current](auto & event) { current[0][event.index] = event.weight; });
+	}
+	else
+	{
+		unpackFrame(mCurrentFrame, current[0]);
+	}
+	lanePotentials(current);
+	int total = int(count_if(current[0].begin(), current[0].end(), [](float val) { return fabs(val) > 0.01f; }));
+	return float(total) / float(depth());
+}
+
+SpikeTrain::Events & SpikeTrain::events(int frame, int row)
+{
+	return mEvents[frame * rows() + row];
+}
+
+int SpikeTrain::rows() const
+{
+	return mTarget->height() * mChannels;
+}
+
+int SpikeTrain::lastPendingFrame()
+{
+	int frames = int(mFrames.size());
+	int last = -1;
+	Frame values;
+	for (int ff = 0; ff < frames; ++ff)
+	{
+		int frame = (mCurrentFrame + ff) % frames;
+		bool pending = false;
+		if (mMode == MODE_DENSE)
+		{
+			unpackFrame(frame, values);
+			pending = any_of(values.begin(), values.end(), [](float value) { return value != 0.0f; });
+		}
+		else
+		{
+			for (int row = 0; row < rows() && !pending; ++row)
+			{
+				pending = !events(frame, row).empty();
+			}
+		}
+		for (int lane = 0; lane < laneCount() && !pending; ++lane)
+		{
+			for (int row = 0; row < rows() && !pending; ++row)
+			{
+				pending = !mLanes[lane].opens[frame * rows() + row].empty() || !mLanes[lane].closes[frame * rows() + row].empty();
+			}
+		}
+		last = pending ? ff : last;
+	}
+	return last;
+}
+
+// The totals are built up in a scratch array covering the whole layer, which
+// is left full of zeroes again afterwards. At reduced precision each total is
+// rounded as every event is added, as it would be in a dense frame.
+void SpikeTrain::mergeEvents(const Events & events, Events & merged)
+{
+	thread_local vector<float> totals;
+	totals.resize(mTarget->width() * rows());
+	if (packed())
+	{
+		withPacking(mPrecision, [&](auto packing)
+		{
+			for (auto & event : events)
+			{
+				totals[event.index] = packing.unpack(packing.pack(totals[event.index] + event.weight));
+			}
+		});
+	}
+	else
+	{
+		for (auto & event : events)
+		{
+			totals[event.index] += event.weight;
+		}
+	}
+	for (auto & event : events)
+	{
+		if (totals[event.index] != 0.0f)
+		{
+			merged.push_back({ event.index, totals[event.index] });
+			totals[event.index] = 0.0f;
+		}
+	}
+}
+
+void SpikeTrain::makeDense()
+{
+	int height = rows();
+	for (int frame = 0; frame < int(mFrames.size()); ++frame)
+	{
+		if (packed())
+		{
+			mPacked[frame].assign(mTarget->width() * height, 0);
+		}
+		else
+		{
+			mFrames[frame].assign(mTarget->width() * height, 0.0f);
+		}
+		for (int row = 0; row < height; ++row)
+		{
+			auto & rowEvents = events(frame, row);
+			for (auto & event : rowEvents)
+			{
+				addPotential(frame, event.index, event.weight);
+			}
+			Events().swap(rowEvents);
+		}
+	}
+	std::fill(mRowCounts.begin(), mRowCounts.end(), 0);
+	mQuietTicks = 0;
+	mMode = MODE_DENSE;
+	++mModeSwitches;
+}
+
+void SpikeTrain::makeSparse()
+{
+	int width = mTarget->width();
+	int height = rows();
+	Frame values;
+	for (int frame = 0; frame < int(mFrames.size()); ++frame)
+	{
+		unpackFrame(frame, values);
+		for (int row = 0; row < height; ++row)
+		{
+			auto & rowEvents = events(frame, row);
+			for (int index = row * width; index < (row + 1) * width; ++index)
+			{
+				if (values[index] != 0.0f)
+				{
+					rowEvents.push_back({ index, values[index] });
+				}
+			}
+		}
+		Frame().swap(mFrames[frame]);
+		PackedFrame().swap(mPacked[frame]);
+	}
+	mMode = MODE_SPARSE;
+	++mModeSwitches;
+}
+
+// Every frame is unpacked before any is packed again, so that the precision
+// they are unpacked from is the old one.
+void SpikeTrain::setPrecision(Precision precision)
+{
+	if (precision == mPrecision)
+	{
+		return;
+	}
+	if (mMode == MODE_SPARSE)
+	{
+		mPrecision = precision;
+		return;
+	}
+	vector<Frame> values(mFrames.size());
+	for (int frame = 0; frame < int(mFrames.size()); ++frame)
+	{
+		unpackFrame(frame, values[frame]);
+	}
+	mPrecision = precision;
+	for (int frame = 0; frame < int(mFrames.size()); ++frame)
+	{
+		packFrame(frame, values[frame]);
+	}
+}
+
+void SpikeTrain::unpackFrame(int frame, Frame & values)
+{
+	if (!packed())
+	{
+		values = mFrames[frame];
+		return;
+	}
+	auto & source = mPacked[frame];
+	values.resize(source.size());
+	withPacking(mPrecision, [&](auto packing)
+	{
+		for (size_t index = 0; index < source.size(); ++index)
+		{
+			values[index] = packing.unpack(source[index]);
+		}
+	});
+}
+
+// The full precision frame is freed once it has been packed. values may be
+// that frame.
+void SpikeTrain::packFrame(int frame, const Frame & values)
+{
+	if (!packed())
+	{
+		mFrames[frame] = values;
+		PackedFrame().swap(mPacked[frame]);
+		return;
+	}
+	auto & destination = mPacked[frame];
+	destination.resize(values.size());
+	withPacking(mPrecision, [&](auto packing)
+	{
+		for (size_t index = 0; index < values.size(); ++index)
+		{
+			destination[index] = packing.pack(values[index]);
+		}
+	});
+	Frame().swap(mFrames[frame]);
+}
+
+void SpikeTrain::addPotential(int frame, int index, float weight)
+{
+	if (!packed())
+	{
+		mFrames[frame][index] += weight;
+		return;
+	}
+	uint16_t & potential = mPacked[frame][index];
+	withPacking(mPrecision, [&](auto packing)
+	{
+		potential = packing.pack(packing.unpack(potential) + weight);
+	});
+}
+
+void SpikeTrain::fitLane(Lane & lane)
+{
+	lane.opens.resize(mFrames.size() * rows());
+	lane.closes.resize(mFrames.size() * rows());
+	lane.levels.resize(rows());
+	lane.spikes.resize(rows());
+	lane.active.resize(rows());
+}
+
+void SpikeTrain::resetLanes()
+{
+	mLanes.assign(LANE_COUNT, Lane());
+	mLanes[0].decay = 1.0f;
+	fitLane(mLanes[0]);
+	mLaneCount.store(1, memory_order_release);
+}
+
+// The lanes are stepped in the same way as by stepLanes, on a copy of their
+// levels.
+void SpikeTrain::lanePotentials(vector<Frame> & values)
+{
+	int width = mTarget->width();
+	int frames = int(mFrames.size());
+	for (int index = 0; index < laneCount(); ++index)
+	{
+		auto & lane = mLanes[index];
+		bool decays = lane.decay != 1.0f;
+		vector<int64_t> levels(size_t(width) * rows(), 0);
+		vector<int> spikes(decays ? levels.size() : 0, 0);
+		for (int row = 0; row < rows(); ++row)
+		{
+			copy(lane.levels[row].begin(), lane.levels[row].end(), levels.begin() + size_t(row) * width);
+			copy(lane.spikes[row].begin(), lane.spikes[row].end(), spikes.begin() + size_t(row) * width);
+		}
+		auto take = [&](const Steps & steps, int change)
+		{
+			for (auto & step : steps)
+			{
+				levels[step.index] += step.delta;
+				if (decays)
+				{
+					spikes[step.index] += change;
+					levels[step.index] = spikes[step.index] ? levels[step.index] : 0;
+				}
+			}
+		};
+		for (int ahead = 0; ahead < int(values.size()); ++ahead)
+		{
+			int frame = (mCurrentFrame + ahead) % frames;
+			for (int row = 0; row < rows(); ++row)
+			{
+				take(lane.opens[frame * rows() + row], 1);
+			}
+			for (size_t cell = 0; cell < levels.size(); ++cell)
+			{
+				if (levels[cell] != 0)
+				{
+					values[ahead][cell] += fromLevel(levels[cell]);
+				}
+			}
+			for (int row = 0; row < rows(); ++row)
+			{
+				take(lane.closes[frame * rows() + row], -1);
+			}
+			for (size_t cell = 0; decays && cell < levels.size(); ++cell)
+			{
+				levels[cell] = int64_t(double(levels[cell]) * double(lane.decay));
+			}
+		}
+	}
 }
 
 // Fire a spike to a specified cell.
@@ -102,9 +937,15 @@ float SpikeTrain::currentSpikeDensity()
 // @param delay the time before the destination should start receiving the spike.
 void SpikeTrain::fire(const Spike & spike, int index, float weight, int delay)
 {
+	if (mMode == MODE_SPARSE || !spike.pieces().empty())
+	{
+		fireWeights(spike, index, 1, &weight, delay);
+		return;
+	}
+
 	int begin[2];
 	int end[2];
-	begin[0] = mCurrentFrame + delay;
+	begin[0] = mCurrentFrame + mFireAhead + delay;
 	end[0] = begin[0] + int(spike.duration());
 	begin[1] = begin[0] - int(mFrames.size());
 	end[1] = begin[1] + int(spike.duration());
@@ -115,16 +956,278 @@ void SpikeTrain::fire(const Spike & spike, int index, float weight, int delay)
 	{
 		for (int frame = begin[ii]; frame < end[ii]; ++frame)
 		{
-			mFrames[frame][index] += weight * spike.potential(offset);
+			addPotential(frame, index, weight * spike.potential(offset));
 			++offset;
 		}
 	}
 }
 
+// Synapses in a segment usually share a delay (always for the default delay
+// functions within a row), so the segment is split into runs of equal delay,
+// each of which is a single call to fireWeights.
+void SpikeTrain::fireSegment(const Spike & spike, int index, int count, const Synapse * synapses)
+{
+	// Weights are copied out of the synapses so that the inner loop of
+	// fireWeights reads a contiguous array.
+	thread_local vector<float> weights;
+	weights.resize(count);
+	int run = 0;
+	while (run < count)
+	{
+		uint32_t delay = synapses[run].delay;
+		int runEnd = run;
+		while (runEnd < count && synapses[runEnd].delay == delay)
+		{
+			weights[runEnd] = synapses[runEnd].weight;
+			++runEnd;
+		}
+		fireWeights(spike, index + run, runEnd - run, &weights[run], int(delay));
+		run = runEnd;
+	}
+}
+
+// The same as calling fire() for each recipient, but the circular buffer
+// frames are worked out once for the whole run, leaving an inner loop
+// the compiler can vectorise. Each piece of the spike goes into a lane if
+// there is one for it, and otherwise into the frames.
+void SpikeTrain::fireWeights(const Spike & spike, int index, int count, const float * weights, int delay)
+{
+	int start = mCurrentFrame + mFireAhead + delay;
+	if (spike.pieces().empty())
+	{
+		fireFrames(spike, 0, spike.duration(), start, index, count, weights);
+		return;
+	}
+	for (auto & piece : spike.pieces())
+	{
+		int lane = laneOf(piece);
+		if (lane >= 0)
+		{
+			fireLane(lane, spike, piece, start, index, count, [weights](int ii) { return weights[ii]; });
+		}
+		else
+		{
+			fireFrames(spike, piece.begin, piece.end, start, index, count, weights);
+		}
+	}
+}
+
+void SpikeTrain::fireRuns(const Spike & spike, const WeightRun * runs, int count, int delay)
+{
+	fireAllRuns(spike, runs, count, delay, [](const WeightRun & run, int ii) { return run.weights[ii]; });
+}
+
+// Each code is decoded in the inner loop as it is fired, in the same way as
+// CompactScale::weight, so the weights are exactly those of the codes. The
+// scale is copied out so that it can be kept in registers, since the frames
+// written to could otherwise hold it.
+void SpikeTrain::fireCodes(const Spike & spike, const CodeRun * runs, int count, int delay, const CompactScale & scale)
+{
+	float step = scale.scale;
+	int zero = scale.zero;
+	fireAllRuns(spike, runs, count, delay, [step, zero](const CodeRun & run, int ii) { return float(int(run.codes[ii]) - zero) * step; });
+}
+
+// Every run lands in the same frames, which are worked out once for all of
+// them, and the potential of each step of the spike is looked up once.
+template <typename Run, typename Weight>
+void SpikeTrain::fireAllRuns(const Spike & spike, const Run * runs, int count, int delay, Weight weight)
+{
+	int start = mCurrentFrame + mFireAhead + delay;
+	if (spike.pieces().empty())
+	{
+		fireRunFrames(spike, 0, spike.duration(), start, runs, count, weight);
+		return;
+	}
+	for (auto & piece : spike.pieces())
+	{
+		int lane = laneOf(piece);
+		if (lane < 0)
+		{
+			fireRunFrames(spike, piece.begin, piece.end, start, runs, count, weight);
+			continue;
+		}
+		for (int run = 0; run < count; ++run)
+		{
+			const Run & current = runs[run];
+			fireLane(lane, spike, piece, start, current.index, current.count, [&current, &weight](int ii) { return weight(current, ii); });
+		}
+	}
+}
+
+// The recipients are always within a single row, so while sparse all of the
+// events go into the list for that row, which is never written by threads
+// firing spikes into other rows.
+void SpikeTrain::fireFrames(const Spike & spike, int begin, int end, int start, int index, int count, const float * weights)
+{
+	int frame = (start + begin) % int(mFrames.size());
+	int row = index / mTarget->width();
+	for (int offset = begin; offset < end; ++offset)
+	{
+		float potential = spike.potential(offset);
+		if (mMode == MODE_SPARSE)
+		{
+			auto & rowEvents = events(frame, row);
+			for (int ii = 0; ii < count; ++ii)
+			{
+				float weight = weights[ii] * potential;
+				if (weight != 0.0f)
+				{
+					rowEvents.push_back({ index + ii, weight });
+				}
+			}
+		}
+		else if (packed())
+		{
+			uint16_t * __restrict dst = &mPacked[frame][index];
+			withPacking(mPrecision, [&](auto packing)
+			{
+				for (int ii = 0; ii < count; ++ii)
+				{
+					dst[ii] = packing.pack(packing.unpack(dst[ii]) + weights[ii] * potential);
+				}
+			});
+		}
+		else
+		{
+			float * __restrict dst = &mFrames[frame][index];
+			for (int ii = 0; ii < count; ++ii)
+			{
+				dst[ii] += weights[ii] * potential;
+			}
+		}
+		if (++frame == int(mFrames.size()))
+		{
+			frame = 0;
+		}
+	}
+}
+
+template <typename Run, typename Weight>
+void SpikeTrain::fireRunFrames(const Spike & spike, int begin, int end, int start, const Run * runs, int count, Weight weight)
+{
+	int frame = (start + begin) % int(mFrames.size());
+	int width = mTarget->width();
+	for (int offset = begin; offset < end; ++offset)
+	{
+		float potential = spike.potential(offset);
+		if (mMode == MODE_SPARSE)
+		{
+			for (int run = 0; run < count; ++run)
+			{
+				auto & rowEvents = events(frame, runs[run].index / width);
+				for (int ii = 0; ii < runs[run].count; ++ii)
+				{
+					float potentialWeight = weight(runs[run], ii) * potential;
+					if (potentialWeight != 0.0f)
+					{
+						rowEvents.push_back({ runs[run].index + ii, potentialWeight });
+					}
+				}
+			}
+		}
+		else if (packed())
+		{
+			uint16_t * frameData = mPacked[frame].data();
+			withPacking(mPrecision, [&](auto packing)
+			{
+				for (int run = 0; run < count; ++run)
+				{
+					uint16_t * __restrict dst = frameData + runs[run].index;
+					const Run & current = runs[run];
+					for (int ii = 0; ii < current.count; ++ii)
+					{
+						dst[ii] = packing.pack(packing.unpack(dst[ii]) + weight(current, ii) * potential);
+					}
+				}
+			});
+		}
+		else
+		{
+			float * frameData = mFrames[frame].data();
+			for (int run = 0; run < count; ++run)
+			{
+				float * __restrict dst = frameData + runs[run].index;
+				const Run & current = runs[run];
+				for (int ii = 0; ii < current.count; ++ii)
+				{
+					dst[ii] += weight(current, ii) * potential;
+				}
+			}
+		}
+		if (++frame == int(mFrames.size()))
+		{
+			frame = 0;
+		}
+	}
+}
+
+// Dense trains use the lanes too, so that the cost of a long piece does not
+// depend on its duration in either mode. The lanes are searched without the
+// lock, since a lane is only counted once its decay and steps are set up.
+int SpikeTrain::laneOf(const Spike::Piece & piece)
+{
+	if (piece.end - piece.begin < LANE_DURATION)
+	{
+		return -1;
+	}
+	int lanes = laneCount();
+	for (int lane = 0; lane < lanes; ++lane)
+	{
+		if (mLanes[lane].decay == piece.decay)
+		{
+			return lane;
+		}
+	}
+	lock_guard<mutex> lock(mLaneMutex);
+	lanes = laneCount();
+	for (int lane = 0; lane < lanes; ++lane)
+	{
+		if (mLanes[lane].decay == piece.decay)
+		{
+			return lane;
+		}
+	}
+	if (lanes == int(mLanes.size()))
+	{
+		return -1;
+	}
+	mLanes[lanes].decay = piece.decay;
+	fitLane(mLanes[lanes]);
+	mLaneCount.store(lanes + 1, memory_order_release);
+	return lanes;
+}
+
+// The step taken away at the end is the part of the step added at the start
+// which is left on the last offset of the piece, which for a flat piece is
+// all of it. Like the events of a sparse train, the steps go into the lists
+// for the row of the recipients.
+template <typename Weight>
+void SpikeTrain::fireLane(int lane, const Spike & spike, const Spike::Piece & piece, int start, int index, int count, Weight weight)
+{
+	int frames = int(mFrames.size());
+	int row = index / mTarget->width();
+	auto & opens = mLanes[lane].opens[((start + piece.begin) % frames) * rows() + row];
+	auto & closes = mLanes[lane].closes[((start + piece.end - 1) % frames) * rows() + row];
+	float potential = spike.potential(piece.begin);
+	double remaining = pow(double(piece.decay), piece.end - 1 - piece.begin);
+	for (int ii = 0; ii < count; ++ii)
+	{
+		float value = weight(ii);
+		if (value != 0.0f)
+		{
+			int64_t level = toLevel(value * potential);
+			opens.push_back({ index + ii, level });
+			closes.push_back({ index + ii, -llround(double(level) * remaining) });
+		}
+	}
+}
+
 void SpikeTrain::save(const filesystem::path & path)
 {
+	// A merged train has no source, so its name starts with the separator.
 	stringstream name;
-	name << mSource->name() << "_" << mTarget->name();
+	name << (mSource ? mSource->name() : string()) << "_" << mTarget->name();
 	auto filename = path / name.str();
 	if (mShunting)
 		filename.replace_extension(SHUNT_EXTENSION);
@@ -135,16 +1238,43 @@ void SpikeTrain::save(const filesystem::path & path)
 	std::ofstream ofs(filename, std::ios::out | std::ios::binary);
 	if (ofs)
 	{
+		// The spare frame is not saved, and the frames are written starting
+		// from the current one. The lanes are written as the potentials they
+		// will deliver.
 		writePod(TAG_DEPTH, ofs);
-		writePod(uint32_t(mFrames.size()), ofs);
+		writePod(uint32_t(depth()), ofs);
 		writePod(TAG_SIZE, ofs);
-		writePod(uint32_t(mFrames[0].size()), ofs);
+		writePod(uint32_t(mTarget->width() * rows()), ofs);
 		writePod(TAG_FRAME, ofs);
-		writePod(uint32_t(mCurrentFrame), ofs);
+		writePod(uint32_t(0), ofs);
+		// The file format is always dense
 		writePod(TAG_DATA, ofs);
-		for (auto & frame : mFrames)
+		vector<Frame> lanes(depth(), Frame(size_t(mTarget->width()) * rows(), 0.0f));
+		lanePotentials(lanes);
+		for (int step = 0; step < depth(); ++step)
 		{
-			ofs.write(reinterpret_cast<char *>(&frame[0]), frame.size() * sizeof(float));
+			int frame = (mCurrentFrame + step) % int(mFrames.size());
+			Frame dense;
+			if (mMode == MODE_DENSE)
+			{
+				unpackFrame(frame, dense);
+			}
+			else
+			{
+				dense.assign(mTarget->width() * rows(), 0.0f);
+				for (int row = 0; row < rows(); ++row)
+				{
+					for (auto & event : events(frame, row))
+					{
+						dense[event.index] += event.weight;
+					}
+				}
+			}
+			for (size_t index = 0; index < dense.size(); ++index)
+			{
+				dense[index] += lanes[step][index];
+			}
+			ofs.write(reinterpret_cast<char *>(&dense[0]), dense.size() * sizeof(float));
 		}
 		writePod(TAG_END, ofs);
 	}
@@ -159,6 +1289,8 @@ void SpikeTrain::load(const filesystem::path & path)
 {
 	LOG("Loading spike train from [" << path << "]");
 	mFrames.clear();
+	mPacked.clear();
+	mEvents.clear();
 	mShunting = (path.extension() == SHUNT_EXTENSION);
 	stringstream str(path.stem().string());
 	string source;
@@ -185,6 +1317,7 @@ void SpikeTrain::load(const filesystem::path & path)
 		{
 			uint32_t size;
 			readPod(size, ifs);
+			mChannels = max(1, int(size) / (mTarget->width() * mTarget->height()));
 			for (auto & frame : mFrames)
 			{
 				frame.resize(size);
@@ -214,4 +1347,64 @@ void SpikeTrain::load(const filesystem::path & path)
 			break;
 		}
 	}
+
+	// Put the current frame first and add the spare frame after the last
+	rotate(mFrames.begin(), mFrames.begin() + mCurrentFrame, mFrames.end());
+	mCurrentFrame = 0;
+	mFrames.push_back(Frame(mFrames.empty() ? 0 : mFrames[0].size(), 0.0f));
+	mFireAhead = 0;
+
+	// Files are dense, and the train will become sparse again if it is quiet
+	mMode = MODE_DENSE;
+	mQuietTicks = 0;
+	mEvents.resize(mFrames.size() * rows());
+	mRowCounts.assign(rows(), 0);
+	mPacked.resize(mFrames.size());
+	for (int frame = 0; frame < int(mFrames.size()); ++frame)
+	{
+		packFrame(frame, mFrames[frame]);
+	}
+	resetLanes();
+}
+
+void SpikeTrain::ShuntChannel::fire(const Spike & spike, int index, float weight, int delay)
+{
+	int offset = mTrain->mTarget->width() * mTrain->mTarget->height();
+	mTrain->fire(spike, offset + index, weight, delay);
+}
+
+void SpikeTrain::ShuntChannel::fireSegment(const Spike & spike, int index, int count, const Synapse * synapses)
+{
+	int offset = mTrain->mTarget->width() * mTrain->mTarget->height();
+	mTrain->fireSegment(spike, offset + index, count, synapses);
+}
+
+void SpikeTrain::ShuntChannel::fireWeights(const Spike & spike, int index, int count, const float * weights, int delay)
+{
+	int offset = mTrain->mTarget->width() * mTrain->mTarget->height();
+	mTrain->fireWeights(spike, offset + index, count, weights, delay);
+}
+
+void SpikeTrain::ShuntChannel::fireRuns(const Spike & spike, const WeightRun * runs, int count, int delay)
+{
+	thread_local vector<WeightRun> moved;
+	int offset = mTrain->mTarget->width() * mTrain->mTarget->height();
+	moved.assign(runs, runs + count);
+	for (auto & run : moved)
+	{
+		run.index += offset;
+	}
+	mTrain->fireRuns(spike, moved.data(), count, delay);
+}
+
+void SpikeTrain::ShuntChannel::fireCodes(const Spike & spike, const CodeRun * runs, int count, int delay, const CompactScale & scale)
+{
+	thread_local vector<CodeRun> moved;
+	int offset = mTrain->mTarget->width() * mTrain->mTarget->height();
+	moved.assign(runs, runs + count);
+	for (auto & run : moved)
+	{
+		run.index += offset;
+	}
+	mTrain->fireCodes(spike, moved.data(), count, delay, scale);
 }
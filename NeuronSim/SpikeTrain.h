@@ -1,22 +1,19 @@
 #ifndef SPIKE_TRAIN_H
 #define SPIKE_TRAIN_H
 
+#include "Precision.h"
+#include "Spike.h"
+#include "SpikeEvent.h"
 #include "Spiker.h"
 
+#include <atomic>
+#include <filesystem>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 class Layer;
 class SynapseMatrix;
-class Spike;
-
-namespace std
-{
-	namespace filesystem
-	{
-		class path;
-	}
-}
 
 // A spike train handles the set of spikes which are in transit from a source
 // layer to a target layer. These may or may not be the same layer.
@@ -25,13 +22,73 @@ namespace std
 // Not all spikes in a train are necessarily from the same SynapseMatrix,
 // Nor are they always the same shape or length.
 // Spikes are superimposed for arrival time to save memory.
+// Spikes are stored in one of two modes (see Mode) and long pieces of spikes
+// travel in lanes rather than frames, none of which changes what is delivered.
 class SpikeTrain : public Spiker
 {
 private:
+	// Fires into the shunt channel of a merged train, by moving every
+	// recipient into the second half of the frames
+	class ShuntChannel : public Spiker
+	{
+	public:
+		explicit ShuntChannel(SpikeTrain * train) : mTrain(train) {}
+		void fire(const Spike & spike, int index, float weight, int delay) override;
+		void fireSegment(const Spike & spike, int index, int count, const Synapse * synapses) override;
+		void fireWeights(const Spike & spike, int index, int count, const float * weights, int delay) override;
+		void fireRuns(const Spike & spike, const WeightRun * runs, int count, int delay) override;
+		void fireCodes(const Spike & spike, const CodeRun * runs, int count, int delay, const CompactScale & scale) override;
+	private:
+		SpikeTrain * mTrain; //< The train the channel belongs to
+	};
+
 	// Used internally to store all spike potentials for a given timestep
 	// Acts as a circular buffer.
 	typedef std::vector<float> Frame;
+	// Used internally to store the spike potentials for a given timestep at
+	// reduced precision
+	typedef std::vector<uint16_t> PackedFrame;
+	// Used internally to store the spike events for one row of a given
+	// timestep.
+	typedef std::vector<SpikeEvent> Events;
+	// A change to the level of one neuron in the lane, in fixed point. Flat
+	// levels are exact sums, so a level is only rounded once as it is
+	// delivered. A level which decays also loses up to 2^-32 for each tick it
+	// has decayed, far below the rounding of the potentials themselves.
+	struct Step
+	{
+		int index;     //< The index of the neuron
+		int64_t delta; //< The change to its level
+	};
+	// Used internally to store the steps for one row of a given timestep
+	typedef std::vector<Step> Steps;
+	// The levels and steps for the pieces of spikes with one decay. Rather
+	// than being written into every frame it spans, a long piece only adds a
+	// step to the level of its neuron in the frame it starts in, and takes it
+	// away in the frame it ends in, while the level is delivered on every
+	// tick. Decaying levels are multiplied by the decay after every tick, so
+	// square spikes and the whole of exponential ones cost the same to fire,
+	// and take the same memory, whatever their duration, in either mode.
+	struct Lane
+	{
+		float decay;                              //< The decay of every piece in the lane, 1 for flat pieces
+		std::vector<Steps> opens;                 //< Circular buffer of steps by frame then row, taken before delivery
+		std::vector<Steps> closes;                //< Circular buffer of steps by frame then row, taken after delivery
+		std::vector<std::vector<int64_t>> levels; //< The level of each neuron by row in fixed point, empty until stepped
+		std::vector<std::vector<int>> spikes;     //< The number of pieces in each level by row, unused while flat
+		std::vector<int> active;                  //< The number of non zero levels in each row
+	};
 public:
+	// The way in which the spikes in transit are stored. A train switches to
+	// full frames once it fills up past a threshold, so that its size is
+	// fixed however excited the network becomes, and back to events once it
+	// has been quiet for a while. Both modes deliver exactly the same
+	// potentials.
+	enum Mode
+	{
+		MODE_SPARSE, //< Lists of spike events, for low activity
+		MODE_DENSE   //< Frames holding a potential for every neuron, for high activity
+	};
 	// Constrcutor for an uninitialized spike train
 	SpikeTrain();
 	// Copy constructor
@@ -44,10 +101,18 @@ public:
 	// shunting - determines if the spikes will go to the input or shunt
 	// fields of the target neuron.
 	SpikeTrain(std::shared_ptr<Layer> source, std::shared_ptr<Layer> target, int maxDelay, bool shunting);
+	// Constructor for a merged train, which carries the spikes from every
+	// source into its target (see Automaton::ACCUMULATE_PER_TARGET). Each
+	// frame holds the inputs of every neuron followed by their shunts, as if
+	// the target had twice as many rows.
+	// target - the layer this spike train feeds spikes into
+	// maxDelay - as above
+	// shunts - true to add the channel for the shunts of the target
+	SpikeTrain(std::shared_ptr<Layer> target, int maxDelay, bool shunts);
 	// Destructor
 	virtual ~SpikeTrain();
 
-	// The source layer
+	// The source layer, which is empty for a merged train
 	std::shared_ptr<Layer> source() { return mSource; }
 	// The target layer
 	std::shared_ptr<Layer> target() { return mTarget; }
@@ -55,14 +120,60 @@ public:
 	// Push all spike potentials for the current time step onto the 
 	// target layer.
 	void tick();
+	// Push the spike potentials for the current time step onto the
+	// target neurons in rows [rowBegin, rowEnd), and remove them from the
+	// train. Disjoint row ranges can be delivered concurrently.
+	void deliver(int rowBegin, int rowEnd);
+	// Move on to the next time step. Every row must have been delivered
+	// before this is called.
+	void advance();
+	// Treat spikes fired from now until the next advance() as fired after
+	// it, so that the next time step can be fired while rows of the current
+	// one are still being delivered.
+	void fireAhead();
 	// Remove all potentials from the train.
 	void clear();
+	// Change the maximum delay, in the same way as the constructor, keeping
+	// the spikes in transit. Frames which still hold spikes are never
+	// removed, so a shorter delay only takes full effect once they have
+	// been delivered and the delay is set again. Must not be called during
+	// a tick.
+	void setDelay(int delay);
 	// Returns true if this spike train targets the shunt instead of the input
 	// of its target layer
 	bool shunting() { return mShunting; }
+	// Returns the number of channels, which is 2 for a merged train with a
+	// channel for the shunts and otherwise 1
+	int channels() const { return mChannels; }
+	// Returns the spiker which fires into the shunt channel, or nullptr if
+	// there isn't one
+	Spiker * shunts() { return mChannels > 1 ? &mShuntChannel : nullptr; }
+	// Add the spikes in transit along another train into the same target to
+	// this merged train, keeping the time left until each is delivered. The
+	// spikes of a shunting train go to the shunt channel, and are dropped if
+	// there isn't one. Must not be called during a tick.
+	void absorb(SpikeTrain & other);
 	// Returns the proportion of the target layers neurons which are
 	// going to receive a non zero input on the next tick
 	float currentSpikeDensity();
+	// Returns true if there are no spikes in transit
+	bool empty() { return lastPendingFrame() < 0; }
+	// Returns the way the spikes in transit are currently stored
+	Mode mode() const { return mMode; }
+	// Returns the number of times this train has changed between modes
+	int modeSwitches() const { return mModeSwitches; }
+	// Change the precision dense frames are stored at, rounding the spikes
+	// in transit to it. Potentials are rounded each time they are fired into
+	// a packed frame, and unpacked a band of rows at a time to be delivered.
+	// Sparse events stay at full precision, but are rounded in the same way
+	// as they are merged, so the mode still makes no difference. Must not be
+	// called during a tick.
+	void setPrecision(Precision precision);
+	// Returns the precision dense frames are stored at
+	Precision precision() const { return mPrecision; }
+	// Returns the number of bytes held for the spikes in transit, in every
+	// frame, event, step or level of every lane
+	uint64_t bytes() const;
 	// Save this spike train to a file
 	void save(const std::filesystem::path & path);
 	// Load a spike train from file
@@ -70,13 +181,94 @@ public:
 
 public: // From Spiker
 	void fire(const Spike & spike, int index, float weight, int delay) override;
+	void fireSegment(const Spike & spike, int index, int count, const Synapse * synapses) override;
+	void fireWeights(const Spike & spike, int index, int count, const float * weights, int delay) override;
+	void fireRuns(const Spike & spike, const WeightRun * runs, int count, int delay) override;
+	void fireCodes(const Spike & spike, const CodeRun * runs, int count, int delay, const CompactScale & scale) override;
+
+private:
+	// The number of frames spikes can be in, excluding the spare frame
+	int depth() const { return int(mFrames.size()) - 1; }
+	// The number of rows in each frame, over every channel
+	int rows() const;
+	// The last frame still holding spikes, counting from the current frame,
+	// or -1 if the train is empty
+	int lastPendingFrame();
+	// The events for one row of one frame
+	Events & events(int frame, int row);
+	// Add up the events for each neuron, appending one event per neuron
+	// with a non zero total to merged, in the order they first appear.
+	void mergeEvents(const Events & events, Events & merged);
+	// Change to MODE_DENSE, moving all events into frames
+	void makeDense();
+	// Change to MODE_SPARSE, moving all frames into events
+	void makeSparse();
+	// Returns true if the dense frames are stored at reduced precision
+	bool packed() const { return mPrecision != PRECISION_FLOAT; }
+	// Copy the potentials of a dense frame out at full precision
+	void unpackFrame(int frame, Frame & values);
+	// Replace the potentials of a dense frame, rounding them to the precision
+	void packFrame(int frame, const Frame & values);
+	// Add a potential to one neuron of a dense frame
+	void addPotential(int frame, int index, float weight);
+	// Write offsets [begin, end) of a spike starting in frame start into
+	// every frame they span, for each of a run of recipients
+	void fireFrames(const Spike & spike, int begin, int end, int start, int index, int count, const float * weights);
+	// Implementation of fireRuns and fireCodes, where weight(run, ii) returns
+	// the weight of recipient ii of a run
+	template <typename Run, typename Weight>
+	void fireAllRuns(const Spike & spike, const Run * runs, int count, int delay, Weight weight);
+	// The same as fireFrames for several runs of recipients, with weights as
+	// above
+	template <typename Run, typename Weight>
+	void fireRunFrames(const Spike & spike, int begin, int end, int start, const Run * runs, int count, Weight weight);
+	// Returns the lane a piece of a spike goes into, or -1 if it is written
+	// into the frames because it is too short to be worth it, or every lane
+	// has been claimed for other decays. Can be called by several threads at
+	// once.
+	int laneOf(const Spike::Piece & piece);
+	// Returns the number of lanes claimed so far
+	int laneCount() const { return mLaneCount.load(std::memory_order_acquire); }
+	// Add the steps of a piece of a spike starting in frame start to a lane,
+	// for each of a run of recipients, where weight(ii) returns the weight of
+	// recipient ii
+	template <typename Weight>
+	void fireLane(int lane, const Spike & spike, const Spike::Piece & piece, int start, int index, int count, Weight weight);
+	// Size the steps and levels of a lane to the frames
+	void fitLane(Lane & lane);
+	// Returns to the lane for flat pieces alone, with nothing in it
+	void resetLanes();
+	// Returns true if any lane has a level, or a step to take in the current
+	// frame, in rows [rowBegin, rowEnd)
+	bool laneActive(int rowBegin, int rowEnd);
+	// Take the steps of the current frame for one row of every lane, calling
+	// deliver(levels) with the levels of the row of each lane if any of them
+	// are not zero, and then decay the levels of the lanes which decay
+	template <typename Deliver>
+	void stepLanes(int row, Deliver deliver);
+	// Add the potentials the lanes will deliver on each of the next
+	// values.size() ticks to values, without changing them
+	void lanePotentials(std::vector<Frame> & values);
 
 private:
-	std::shared_ptr<Layer> mSource; //< The source of the spikes in this train
-	std::shared_ptr<Layer> mTarget; //< The layer spikes are sent to
-	std::vector<Frame> mFrames;     //< Circular buffer of spike potentials
-	bool mShunting;                 //< True if we target shunts not inputs
-	int mCurrentFrame;              //< Circular buffer management
+	std::shared_ptr<Layer> mSource;   //< The source of the spikes in this train, empty if merged
+	std::shared_ptr<Layer> mTarget;   //< The layer spikes are sent to
+	int mChannels;                    //< The number of channels in each frame
+	ShuntChannel mShuntChannel;       //< Fires into the second channel
+	std::vector<Frame> mFrames;       //< Circular buffer of spike potentials, empty while sparse or packed
+	std::vector<PackedFrame> mPacked; //< The frames at reduced precision, empty unless dense and packed
+	std::vector<Events> mEvents;      //< Circular buffer of spike events by frame then row, empty while dense
+	std::vector<int> mRowCounts;      //< Neurons receiving a potential in each row when last delivered
+	bool mShunting;                   //< True if we target shunts not inputs
+	int mCurrentFrame;                //< Circular buffer management
+	int mFireAhead;                   //< 1 while firing ahead of the current frame, otherwise 0
+	Mode mMode;                       //< The current storage mode
+	Precision mPrecision;             //< The precision dense frames are stored at
+	int mModeSwitches;                //< The number of mode changes so far
+	int mQuietTicks;                  //< Consecutive quiet ticks while dense
+	std::vector<Lane> mLanes;         //< The lanes for long pieces of spikes, the first for flat pieces
+	std::atomic<int> mLaneCount;      //< The number of lanes claimed, which only ever grows until reset
+	std::mutex mLaneMutex;            //< Held while claiming a lane
 };
 
 #endif
@@ -1,8 +1,29 @@
 #ifndef SPIKER_H
 #define SPIKER_H
 
+#include "Synapse.h"
+
+#include <vector>
+
 class Spike;
 
+// A run of neighbouring recipients within one row, for Spiker::fireRuns
+struct WeightRun
+{
+	int index;             //< The index of the first recipient
+	int count;             //< The number of recipients, at index, index + 1, ...
+	const float * weights; //< The weight for each recipient in turn
+};
+
+// A run of neighbouring recipients within one row whose weights are stored
+// as 8 bit codes, for Spiker::fireCodes
+struct CodeRun
+{
+	int index;             //< The index of the first recipient
+	int count;             //< The number of recipients, at index, index + 1, ...
+	const uint8_t * codes; //< The code of the weight for each recipient in turn
+};
+
 // Spiker is an interface class which allows spikes to be fired without introducing
 // a dependency on the things which actually fires the spikes.
 class Spiker
@@ -15,6 +36,69 @@ public:
 	// delay - the delay, in time steps, before the start of the spike reaches
 	// the recipient.
 	virtual void fire(const Spike & spike, int index, float weight, int delay) = 0;
+	// Fire a spike to each of a run of neighbouring recipients
+	// spike - the shape of the spike to fire
+	// index - the index of the first recipient
+	// count - the number of recipients, at index, index + 1, ...
+	// synapses - the weight and delay for each recipient in turn
+	// The default implementation calls fire() for each recipient.
+	virtual void fireSegment(const Spike & spike, int index, int count, const Synapse * synapses)
+	{
+		for (int ii = 0; ii < count; ++ii)
+		{
+			fire(spike, index + ii, synapses[ii].weight, synapses[ii].delay);
+		}
+	}
+	// Fire a spike to each of a run of neighbouring recipients, all with the
+	// same delay
+	// spike - the shape of the spike to fire
+	// index - the index of the first recipient
+	// count - the number of recipients, at index, index + 1, ...
+	// weights - the weight for each recipient in turn
+	// delay - the delay for every recipient
+	// The default implementation calls fire() for each recipient.
+	virtual void fireWeights(const Spike & spike, int index, int count, const float * weights, int delay)
+	{
+		for (int ii = 0; ii < count; ++ii)
+		{
+			fire(spike, index + ii, weights[ii], delay);
+		}
+	}
+	// Fire a spike to each recipient of several runs, all with the same
+	// delay. The runs are fired in order, and a recipient may appear in more
+	// than one of them.
+	// spike - the shape of the spike to fire
+	// runs - the runs of recipients and their weights
+	// count - the number of runs
+	// delay - the delay for every recipient
+	// The default implementation calls fireWeights() for each run.
+	virtual void fireRuns(const Spike & spike, const WeightRun * runs, int count, int delay)
+	{
+		for (int ii = 0; ii < count; ++ii)
+		{
+			fireWeights(spike, runs[ii].index, runs[ii].count, runs[ii].weights, delay);
+		}
+	}
+	// The same as fireRuns, for runs whose weights are codes of a scale
+	// spike - the shape of the spike to fire
+	// runs - the runs of recipients and the codes of their weights
+	// count - the number of runs
+	// delay - the delay for every recipient
+	// scale - the scale of the codes
+	// The default implementation decodes each run and calls fireWeights().
+	virtual void fireCodes(const Spike & spike, const CodeRun * runs, int count, int delay, const CompactScale & scale)
+	{
+		std::vector<float> weights;
+		for (int ii = 0; ii < count; ++ii)
+		{
+			weights.resize(runs[ii].count);
+			for (int jj = 0; jj < runs[ii].count; ++jj)
+			{
+				weights[jj] = scale.weight(runs[ii].codes[jj]);
+			}
+			fireWeights(spike, runs[ii].index, runs[ii].count, weights.data(), delay);
+		}
+	}
 };
 
 #endif
@@ -0,0 +1,579 @@
+#include "Stencil.h"
+
+#include <algorithm>
+
+#include "NeuronStorage.h"
+#include "Spiker.h"
+
+using namespace std;
+
+Stencil::Stencil() :
+	mSynapseCount(0),
+	mRowOffsetMin(0),
+	mRowOffsetMax(0),
+	mFixedSize(0),
+	mCompact(false),
+	mScale({ 1.0f, 0 }),
+	mLayerWidth(0),
+	mLayerHeight(0),
+	mInteriorColBegin(0),
+	mInteriorColEnd(0),
+	mInteriorRowBegin(0),
+	mInteriorRowEnd(0)
+{
+
+}
+
+Stencil::~Stencil()
+{
+
+}
+
+// The synapse at column sc and row sr connects each firing neuron to the
+// neuron (sc - width / 2) columns and (sr - height / 2) rows away.
+// The runs are found in row major order and then sorted by delay, keeping
+// that order within each bucket, and the weights are stored in the same
+// order as the runs.
+void Stencil::build(const Synapse * synapses, int width, int height, const CompactScale * scale)
+{
+	mSynapseCount = width * height;
+	mBuckets.clear();
+	mRuns.clear();
+	mWeights.clear();
+	mCodes.clear();
+	mCompact = scale != nullptr;
+	mScale = scale ? *scale : CompactScale({ 1.0f, 0 });
+	mRowOffsetMin = 0;
+	mRowOffsetMax = 0;
+	vector<pair<int, Run>> runs;
+	for (int sr = 0; sr < height; ++sr)
+	{
+		const Synapse * synapse = synapses + sr * width;
+		int sc = 0;
+		while (sc < width)
+		{
+			if (synapse[sc].weight == 0.0f)
+			{
+				++sc;
+				continue;
+			}
+			int delay = int(synapse[sc].delay);
+			Run run = { sr - height / 2, sc - width / 2, 0, sr * width + sc };
+			while (sc < width && synapse[sc].weight != 0.0f && int(synapse[sc].delay) == delay)
+			{
+				++run.count;
+				++sc;
+			}
+			runs.push_back({ delay, run });
+		}
+	}
+	stable_sort(runs.begin(), runs.end(), [](auto & a, auto & b) { return a.first < b.first; });
+	for (auto & entry : runs)
+	{
+		if (mBuckets.empty() || mBuckets.back().delay != entry.first)
+		{
+			mBuckets.push_back({ entry.first, int(mRuns.size()), int(mRuns.size()) });
+		}
+		Run run = entry.second;
+		run.weights = activeSynapses();
+		for (int ii = 0; ii < run.count; ++ii)
+		{
+			float weight = synapses[entry.second.weights + ii].weight;
+			if (mCompact)
+			{
+				mCodes.push_back(mScale.code(weight));
+			}
+			else
+			{
+				mWeights.push_back(weight);
+			}
+		}
+		mRuns.push_back(run);
+		mBuckets.back().runEnd = int(mRuns.size());
+		mRowOffsetMin = min(mRowOffsetMin, run.rowOffset);
+		mRowOffsetMax = max(mRowOffsetMax, run.rowOffset);
+	}
+	mFixedSize = 0;
+	mFixedWeights.clear();
+	if (width == height && (width == 1 || width == 3 || width == 5) && mBuckets.size() == 1)
+	{
+		mFixedSize = width;
+		for (int index = 0; index < width * height; ++index)
+		{
+			mFixedWeights.push_back(synapses[index].weight);
+		}
+	}
+	if (mLayerWidth)
+	{
+		prepare(mLayerWidth, mLayerHeight);
+	}
+}
+
+// The rows and columns outside of the interior are numbered from zero at
+// the start of the layer, continuing after the interior to the end.
+void Stencil::prepare(int width, int height)
+{
+	mLayerWidth = width;
+	mLayerHeight = height;
+	int colOffsetMin = 0;
+	int colOffsetMax = 0;
+	for (auto & run : mRuns)
+	{
+		colOffsetMin = min(colOffsetMin, run.colOffset);
+		colOffsetMax = max(colOffsetMax, run.colOffset + run.count - 1);
+	}
+	mInteriorColBegin = min(width, -colOffsetMin);
+	mInteriorColEnd = max(mInteriorColBegin, width - colOffsetMax);
+	mInteriorRowBegin = min(height, -mRowOffsetMin);
+	mInteriorRowEnd = max(mInteriorRowBegin, height - mRowOffsetMax);
+
+	int runs = int(mRuns.size());
+	mOffsets.resize(runs);
+	for (int index = 0; index < runs; ++index)
+	{
+		mOffsets[index] = mRuns[index].rowOffset * width + mRuns[index].colOffset;
+	}
+	mEdgeRows.clear();
+	for (int rr = 0; rr < height; ++rr)
+	{
+		if (rr >= mInteriorRowBegin && rr < mInteriorRowEnd)
+		{
+			continue;
+		}
+		for (auto & run : mRuns)
+		{
+			int tr = rr + run.rowOffset;
+			tr = tr < 0 ? tr + height : (tr >= height ? tr - height : tr);
+			mEdgeRows.push_back(tr * width);
+		}
+	}
+	mEdgeColumns.clear();
+	for (int cc = 0; cc < width; ++cc)
+	{
+		if (cc >= mInteriorColBegin && cc < mInteriorColEnd)
+		{
+			continue;
+		}
+		for (auto & run : mRuns)
+		{
+			int tc = cc + run.colOffset;
+			tc = tc < 0 ? tc + width : (tc >= width ? tc - width : tc);
+			mEdgeColumns.push_back({ tc, min(run.count, width - tc) });
+		}
+	}
+}
+
+float Stencil::prunedFraction() const
+{
+	return mSynapseCount ? 1.0f - float(activeSynapses()) / float(mSynapseCount) : 0.0f;
+}
+
+// The runs of codes are passed on as they are, and decoded by the spiker as
+// it fires them. The kernels specialised for their size keep the weights as
+// floats, since there are no more than 25 of them.
+void Stencil::fire(const Spike & spike, Spiker * spiker, const uint64_t * firing, int width, int height, int rowBegin, int rowEnd) const
+{
+	switch (mFixedSize)
+	{
+	case 1:
+		fireFixed<1>(spike, spiker, firing, width, height, rowBegin, rowEnd);
+		return;
+	case 3:
+		fireFixed<3>(spike, spiker, firing, width, height, rowBegin, rowEnd);
+		return;
+	case 5:
+		fireFixed<5>(spike, spiker, firing, width, height, rowBegin, rowEnd);
+		return;
+	}
+	if (mCompact)
+	{
+		fireBuckets<CodeRun>(firing, width, height, rowBegin, rowEnd, mCodes.data(), [&](const CodeRun * targets, int count, int delay)
+		{
+			spiker->fireCodes(spike, targets, count, delay, mScale);
+		});
+	}
+	else
+	{
+		fireBuckets<WeightRun>(firing, width, height, rowBegin, rowEnd, mWeights.data(), [&](const WeightRun * targets, int count, int delay)
+		{
+			spiker->fireRuns(spike, targets, count, delay);
+		});
+	}
+}
+
+// A run which starts before the first column or ends after the last wraps
+// around to the other end of the row, and is fired in two parts. Neurons in
+// the interior of a prepared layer have no such runs.
+template <typename Target, typename Weight, typename FireTargets>
+void Stencil::fireBuckets(const uint64_t * firing, int width, int height, int rowBegin, int rowEnd, const Weight * allWeights,
+	FireTargets fireTargets) const
+{
+	// Per thread working space, reused between calls.
+	thread_local vector<Target> targets;
+
+	int words = (width + 63) / 64;
+	int runs = int(mRuns.size());
+	bool prepared = isPrepared(width, height);
+	targets.resize(2 * mRuns.size());
+	for (int rr = rowBegin; rr < rowEnd; ++rr)
+	{
+		bool interiorRow = prepared && rr >= mInteriorRowBegin && rr < mInteriorRowEnd;
+		const int * edgeRow = nullptr;
+		if (prepared && !interiorRow)
+		{
+			edgeRow = &mEdgeRows[size_t(rr < mInteriorRowBegin ? rr : rr - mInteriorRowEnd + mInteriorRowBegin) * runs];
+		}
+		const uint64_t * rowWords = firing + size_t(rr) * words;
+		for (int ww = 0; ww < words; ++ww)
+		{
+			for (uint64_t bits = rowWords[ww]; bits; bits &= bits - 1)
+			{
+				int cc = ww * 64 + lowestBit(bits);
+				bool interiorCol = prepared && cc >= mInteriorColBegin && cc < mInteriorColEnd;
+				if (interiorRow && interiorCol)
+				{
+					int base = rr * width + cc;
+					for (auto & bucket : mBuckets)
+					{
+						int count = 0;
+						for (int index = bucket.runBegin; index < bucket.runEnd; ++index)
+						{
+							targets[count++] = { base + mOffsets[index], mRuns[index].count, allWeights + mRuns[index].weights };
+						}
+						fireTargets(targets.data(), count, bucket.delay);
+					}
+					continue;
+				}
+
+				const EdgeColumn * edgeColumn = nullptr;
+				if (prepared && !interiorCol)
+				{
+					edgeColumn = &mEdgeColumns[size_t(cc < mInteriorColBegin ? cc : cc - mInteriorColEnd + mInteriorColBegin) * runs];
+				}
+				for (auto & bucket : mBuckets)
+				{
+					int count = 0;
+					for (int index = bucket.runBegin; index < bucket.runEnd; ++index)
+					{
+						const Run & run = mRuns[index];
+						const Weight * weights = allWeights + run.weights;
+						int start;
+						if (edgeRow)
+						{
+							start = edgeRow[index];
+						}
+						else
+						{
+							int tr = rr + run.rowOffset;
+							tr = tr < 0 ? tr + height : (tr >= height ? tr - height : tr);
+							start = tr * width;
+						}
+						int tc;
+						int first;
+						if (edgeColumn)
+						{
+							tc = edgeColumn[index].column;
+							first = edgeColumn[index].first;
+						}
+						else
+						{
+							tc = cc + run.colOffset;
+							tc = tc < 0 ? tc + width : (tc >= width ? tc - width : tc);
+							first = min(run.count, width - tc);
+						}
+						targets[count++] = { start + tc, first, weights };
+						if (first < run.count)
+						{
+							targets[count++] = { start, run.count - first, weights + first };
+						}
+					}
+					fireTargets(targets.data(), count, bucket.delay);
+				}
+			}
+		}
+	}
+}
+
+// The target at column tc receives through the synapse offset columns along
+// from the neuron offset columns back, wrapped around the row. The weights
+// of each bucket are added up in the same order as Net::gatherSpikes adds up
+// the weights with that delay, so the totals are exactly the same.
+void Stencil::gather(const Spike & spike, Spiker * spiker, const uint64_t * firing, int width, int height, int rowBegin, int rowEnd,
+	int delayBegin, int delayEnd) const
+{
+	// Per thread working space, reused between calls.
+	thread_local vector<char> rowFiring;
+	thread_local vector<float> firingValues;
+	thread_local vector<float> totals;
+
+	if (mBuckets.empty() || mBuckets.back().delay < delayBegin || mBuckets.front().delay >= delayEnd)
+	{
+		return;
+	}
+	switch (mFixedSize)
+	{
+	case 1:
+		gatherFixed<1>(spike, spiker, firing, width, height, rowBegin, rowEnd);
+		return;
+	case 3:
+		gatherFixed<3>(spike, spiker, firing, width, height, rowBegin, rowEnd);
+		return;
+	case 5:
+		gatherFixed<5>(spike, spiker, firing, width, height, rowBegin, rowEnd);
+		return;
+	}
+
+	// Unpack the firing flags of the source rows to 0 or 1, so that they can
+	// be multiplied by the weights, noting which rows have any firing at all.
+	int words = (width + 63) / 64;
+	rowFiring.assign(height, 0);
+	firingValues.resize(size_t(width) * height);
+	for (int row = rowBegin - mRowOffsetMax; row < rowEnd - mRowOffsetMin; ++row)
+	{
+		int source = (row % height + height) % height;
+		if (rowFiring[source])
+		{
+			continue;
+		}
+		rowFiring[source] = 1;
+		float * values = &firingValues[size_t(source) * width];
+		fill(values, values + width, 0.0f);
+		const uint64_t * rowWords = firing + size_t(source) * words;
+		for (int ww = 0; ww < words; ++ww)
+		{
+			for (uint64_t bits = rowWords[ww]; bits; bits &= bits - 1)
+			{
+				values[ww * 64 + lowestBit(bits)] = 1.0f;
+				rowFiring[source] = 2;
+			}
+		}
+	}
+
+	totals.resize(width);
+	for (int tr = rowBegin; tr < rowEnd; ++tr)
+	{
+		for (auto & bucket : mBuckets)
+		{
+			if (bucket.delay < delayBegin || bucket.delay >= delayEnd)
+			{
+				continue;
+			}
+			bool any = false;
+			for (int index = bucket.runBegin; index < bucket.runEnd; ++index)
+			{
+				const Run & run = mRuns[index];
+				int row = tr - run.rowOffset;
+				row = row < 0 ? row + height : (row >= height ? row - height : row);
+				if (rowFiring[row] != 2)
+				{
+					continue;
+				}
+				if (!any)
+				{
+					fill(totals.begin(), totals.end(), 0.0f);
+					any = true;
+				}
+				const float * source = &firingValues[size_t(row) * width];
+				for (int ii = 0; ii < run.count; ++ii)
+				{
+					float weight = runWeight(run.weights + ii);
+					int offset = run.colOffset + ii;
+					// The source column is tc - offset, which wraps at the start
+					// of the row for positive offsets and at the end for
+					// negative ones.
+					int wrap = offset > 0 ? offset : width + offset;
+					int before = offset > 0 ? width - offset : -offset;
+					int after = offset > 0 ? -offset : -offset - width;
+					float * __restrict total = totals.data();
+					for (int tc = 0; tc < wrap; ++tc)
+					{
+						total[tc] += weight * source[tc + before];
+					}
+					for (int tc = wrap; tc < width; ++tc)
+					{
+						total[tc] += weight * source[tc + after];
+					}
+				}
+			}
+			if (!any)
+			{
+				continue;
+			}
+			// Only runs of targets with non zero totals are fired
+			int tc = 0;
+			while (tc < width)
+			{
+				if (totals[tc] == 0.0f)
+				{
+					++tc;
+					continue;
+				}
+				int runEnd = tc + 1;
+				while (runEnd < width && totals[runEnd] != 0.0f)
+				{
+					++runEnd;
+				}
+				spiker->fireWeights(spike, tr * width + tc, runEnd - tc, &totals[tc], bucket.delay);
+				tc = runEnd;
+			}
+		}
+	}
+}
+
+// Every firing neuron fires a whole row of the matrix at each of SIZE target
+// rows, zero weights included, which add nothing. The runs of a whole row of
+// firing neurons are fired together, in order, so each target still adds up
+// its spikes in the same order as firing them one neuron at a time.
+template <int SIZE>
+void Stencil::fireFixed(const Spike & spike, Spiker * spiker, const uint64_t * firing, int width, int height, int rowBegin, int rowEnd) const
+{
+	// Per thread working space, reused between calls.
+	thread_local vector<WeightRun> targets;
+
+	const int HALF = SIZE / 2;
+	int words = (width + 63) / 64;
+	int delay = mBuckets[0].delay;
+	const float * weights = mFixedWeights.data();
+	targets.resize(size_t(width) * SIZE * 2);
+	for (int rr = rowBegin; rr < rowEnd; ++rr)
+	{
+		bool interiorRow = rr >= HALF && rr < height - (SIZE - 1 - HALF);
+		const uint64_t * rowWords = firing + size_t(rr) * words;
+		int count = 0;
+		for (int ww = 0; ww < words; ++ww)
+		{
+			for (uint64_t bits = rowWords[ww]; bits; bits &= bits - 1)
+			{
+				int cc = ww * 64 + lowestBit(bits);
+				if (interiorRow && cc >= HALF && cc < width - (SIZE - 1 - HALF))
+				{
+					int first = (rr - HALF) * width + cc - HALF;
+					for (int sr = 0; sr < SIZE; ++sr)
+					{
+						targets[count++] = { first + sr * width, SIZE, weights + sr * SIZE };
+					}
+					continue;
+				}
+				int tc = cc - HALF;
+				tc = tc < 0 ? tc + width : tc;
+				int before = min(SIZE, width - tc);
+				for (int sr = 0; sr < SIZE; ++sr)
+				{
+					int tr = rr + sr - HALF;
+					tr = tr < 0 ? tr + height : (tr >= height ? tr - height : tr);
+					targets[count++] = { tr * width + tc, before, weights + sr * SIZE };
+					if (before < SIZE)
+					{
+						targets[count++] = { tr * width, SIZE - before, weights + sr * SIZE + before };
+					}
+				}
+			}
+		}
+		if (count)
+		{
+			spiker->fireRuns(spike, targets.data(), count, delay);
+		}
+	}
+}
+
+// Each source row is copied with the SIZE - 1 columns it wraps onto either
+// side of it, so that the loop over the targets in a row needs no wrapping,
+// and the weights are copied where the compiler can keep them in registers.
+// The weights are added up for each target in the same order as gather, and
+// the zero weights add nothing, so the totals are exactly the same.
+template <int SIZE>
+void Stencil::gatherFixed(const Spike & spike, Spiker * spiker, const uint64_t * firing, int width, int height, int rowBegin, int rowEnd) const
+{
+	// Per thread working space, reused between calls.
+	thread_local vector<float> padded;
+	thread_local vector<char> rowFiring;
+	thread_local vector<float> totals;
+
+	const int HALF = SIZE / 2;
+	const int PAD = SIZE - 1;
+	int words = (width + 63) / 64;
+	int delay = mBuckets[0].delay;
+	float weights[SIZE * SIZE];
+	copy(mFixedWeights.begin(), mFixedWeights.end(), weights);
+
+	// Source rows from SIZE - 1 rows before the first target row onwards,
+	// where padded column j holds column j - (SIZE - 1 - HALF), wrapped
+	int sourceBegin = rowBegin + HALF - PAD;
+	int sources = rowEnd - rowBegin + PAD;
+	int stride = width + PAD;
+	padded.resize(size_t(sources) * stride);
+	rowFiring.assign(sources, 0);
+	for (int ss = 0; ss < sources; ++ss)
+	{
+		int row = ((sourceBegin + ss) % height + height) % height;
+		float * values = &padded[size_t(ss) * stride];
+		fill(values, values + stride, 0.0f);
+		const uint64_t * rowWords = firing + size_t(row) * words;
+		for (int ww = 0; ww < words; ++ww)
+		{
+			for (uint64_t bits = rowWords[ww]; bits; bits &= bits - 1)
+			{
+				int col = ww * 64 + lowestBit(bits);
+				values[col + PAD - HALF] = 1.0f;
+				rowFiring[ss] = 1;
+			}
+		}
+		for (int jj = 0; jj < PAD - HALF; ++jj)
+		{
+			values[jj] = values[width + jj];
+		}
+		for (int jj = 0; jj < HALF; ++jj)
+		{
+			values[width + PAD - HALF + jj] = values[PAD - HALF + jj];
+		}
+	}
+
+	// Target tr receives through row sr of the matrix from source row
+	// tr - (sr - HALF), and through column sc from padded column
+	// tc + SIZE - 1 - sc.
+	totals.resize(width);
+	for (int tr = rowBegin; tr < rowEnd; ++tr)
+	{
+		const float * rows[SIZE];
+		bool any = false;
+		for (int sr = 0; sr < SIZE; ++sr)
+		{
+			int ss = tr - rowBegin + PAD - sr;
+			rows[sr] = &padded[size_t(ss) * stride + PAD];
+			any = any || rowFiring[ss];
+		}
+		if (!any)
+		{
+			continue;
+		}
+		float * __restrict total = totals.data();
+		for (int tc = 0; tc < width; ++tc)
+		{
+			float sum = 0.0f;
+			for (int sr = 0; sr < SIZE; ++sr)
+			{
+				for (int sc = 0; sc < SIZE; ++sc)
+				{
+					sum += weights[sr * SIZE + sc] * rows[sr][tc - sc];
+				}
+			}
+			total[tc] = sum;
+		}
+		int tc = 0;
+		while (tc < width)
+		{
+			if (totals[tc] == 0.0f)
+			{
+				++tc;
+				continue;
+			}
+			int runEnd = tc + 1;
+			while (runEnd < width && totals[runEnd] != 0.0f)
+			{
+				++runEnd;
+			}
+			spiker->fireWeights(spike, tr * width + tc, runEnd - tc, &totals[tc], delay);
+			tc = runEnd;
+		}
+	}
+}
@@ -0,0 +1,171 @@
+#ifndef STENCIL_H
+#define STENCIL_H
+
+#include <climits>
+#include <cstdint>
+#include <vector>
+
+#include "Synapse.h"
+
+class Spike;
+class Spiker;
+
+// A Stencil is a synapse matrix compiled for firing spikes directly. The
+// synapses with zero weights are pruned, and those left are stored as runs
+// of neighbouring synapses in the same row with the same delay. Synapse
+// images are often mostly black, so this can be a small fraction of the
+// matrix.
+// The runs are grouped into buckets by delay. With DELAY_LINEAR or
+// DELAY_GRID neighbouring synapses rarely share a delay, so the runs are
+// short, but every run in a bucket lands in the same SpikeTrain frame and
+// the whole bucket is fired with a single call to Spiker::fireRuns.
+// A stencil can also be prepared for the size of the layer it fires from.
+// Firing neurons far enough from the edges of the layer for none of their
+// targets to wrap then need no more than an offset added per run, and the
+// wrapped targets of the neurons near the edges are looked up in tables.
+// The 1x1, 3x3 and 5x5 matrices which most networks use, when all of their
+// synapses share one delay, are fired by kernels specialised for their size
+// instead, with every loop over the matrix unrolled.
+// The weights of the runs can be stored as 8 bit codes instead of floats
+// (see SynapseMatrix::ENCODING_COMPACT), which are passed on to
+// Spiker::fireCodes and decoded as they are fired, so firing reads a quarter
+// of the bytes for them.
+class Stencil
+{
+public:
+	// A run of synapses with non zero weights and the same delay, which
+	// connects each firing neuron to the count neurons starting colOffset
+	// columns and rowOffset rows away from it.
+	struct Run
+	{
+		int rowOffset; //< The row of the targets, relative to the firing neuron
+		int colOffset; //< The column of the first target, relative to the firing neuron
+		int count;     //< The number of synapses
+		int weights;   //< The index of the weight of the first synapse in weights()
+	};
+	// The runs with one delay, in order of row and then column
+	struct Bucket
+	{
+		int delay;    //< The delay of every synapse in the bucket
+		int runBegin; //< The index of the first run
+		int runEnd;   //< The index after the last run
+	};
+
+	// Constructor for an empty stencil
+	Stencil();
+	// Destructor
+	~Stencil();
+
+	// Compile width x height synapses, stored in row major order. If the
+	// stencil was prepared for a layer size it is prepared again. If a scale
+	// is given the weights of the runs are stored as codes of that scale,
+	// and should already be values of codes so that nothing is lost.
+	void build(const Synapse * synapses, int width, int height, const CompactScale * scale = nullptr);
+	// Precompute where the runs land when firing from a layer width x height,
+	// which must be no smaller than the matrix.
+	void prepare(int width, int height);
+	// Return true if the stencil has been prepared for a layer width x height
+	bool isPrepared(int width, int height) const { return width == mLayerWidth && height == mLayerHeight; }
+	// Return the number of synapses in the matrix, including pruned ones
+	int synapseCount() const { return mSynapseCount; }
+	// Return the number of synapses with non zero weights
+	int activeSynapses() const { return int(mCompact ? mCodes.size() : mWeights.size()); }
+	// Return the proportion of the synapses which were pruned
+	float prunedFraction() const;
+	// Return the buckets, in order of delay
+	const std::vector<Bucket> & buckets() const { return mBuckets; }
+	// Return the runs, in order of bucket
+	const std::vector<Run> & runs() const { return mRuns; }
+	// Return the weights of the runs, which are empty if they are stored as
+	// codes
+	const std::vector<float> & weights() const { return mWeights; }
+	// Return true if the weights of the runs are stored as codes
+	bool isCompact() const { return mCompact; }
+	// Return the codes of the weights of the runs, which are empty unless
+	// they are stored that way
+	const std::vector<uint8_t> & codes() const { return mCodes; }
+	// Return the scale of the codes
+	const CompactScale & scale() const { return mScale; }
+	// Fire the neurons in rows [rowBegin, rowEnd) of a layer, giving the same
+	// spikes as Net::fireSpikes. Targets outside of the layer wrap around,
+	// and the matrix must be no larger than the layer so that they wrap at
+	// most once. This is quickest if the stencil is prepared for the layer.
+	// firing - the packed firing flags of the layer, (width + 63) / 64 words per row
+	void fire(const Spike & spike, Spiker * spiker, const uint64_t * firing, int width, int height, int rowBegin, int rowEnd) const;
+	// Fire the spikes which land in rows [rowBegin, rowEnd) of a layer,
+	// giving the same spikes as Net::gatherSpikes, by adding up the weights
+	// of each bucket for a whole row of targets and firing every run of non
+	// zero totals once. Only the buckets with delays in [delayBegin, delayEnd)
+	// are gathered.
+	// firing - the packed firing flags of the layer, (width + 63) / 64 words per row
+	void gather(const Spike & spike, Spiker * spiker, const uint64_t * firing, int width, int height, int rowBegin, int rowEnd,
+		int delayBegin = 0, int delayEnd = INT_MAX) const;
+
+private:
+	// Implementation of fire for runs whose weights are stored as Weight,
+	// firing each bucket with fireTargets(targets, count, delay), where the
+	// targets are Target runs of recipients
+	template <typename Target, typename Weight, typename FireTargets>
+	void fireBuckets(const uint64_t * firing, int width, int height, int rowBegin, int rowEnd, const Weight * allWeights,
+		FireTargets fireTargets) const;
+	// Implementations of fire and gather for a SIZE x SIZE matrix whose
+	// synapses all have the same delay
+	template <int SIZE>
+	void fireFixed(const Spike & spike, Spiker * spiker, const uint64_t * firing, int width, int height, int rowBegin, int rowEnd) const;
+	template <int SIZE>
+	void gatherFixed(const Spike & spike, Spiker * spiker, const uint64_t * firing, int width, int height, int rowBegin, int rowEnd) const;
+
+	// Return the weight of a synapse of the runs, however it is stored
+	float runWeight(int index) const { return mCompact ? mScale.weight(mCodes[index]) : mWeights[index]; }
+
+private:
+	// Where a run lands when fired from a column near the edge of the layer
+	struct EdgeColumn
+	{
+		int column; //< The column of the first target, wrapped into the layer
+		int first;  //< The number of targets before the run wraps around
+	};
+
+	// The number of synapses in the matrix
+	int mSynapseCount;
+	// The lowest and highest row offsets of the runs
+	int mRowOffsetMin;
+	int mRowOffsetMax;
+	// The size of the matrix if it has a kernel specialised for its size,
+	// otherwise zero
+	int mFixedSize;
+	// Every weight of such a matrix, including the zero weights, in row
+	// major order
+	std::vector<float> mFixedWeights;
+	// The buckets
+	std::vector<Bucket> mBuckets;
+	// The runs
+	std::vector<Run> mRuns;
+	// The weights of every synapse in every run
+	std::vector<float> mWeights;
+	// True if the weights are stored as codes instead
+	bool mCompact;
+	// The codes of the weights of every synapse in every run
+	std::vector<uint8_t> mCodes;
+	// The scale of the codes
+	CompactScale mScale;
+	// The size of the layer the stencil is prepared for, or zero
+	int mLayerWidth;
+	int mLayerHeight;
+	// Firing neurons in these columns and rows have no targets which wrap
+	int mInteriorColBegin;
+	int mInteriorColEnd;
+	int mInteriorRowBegin;
+	int mInteriorRowEnd;
+	// The distance from a firing neuron to the first target of each run, in
+	// neurons of the layer in row major order
+	std::vector<int> mOffsets;
+	// The index of the first neuron in the target row of each run, for each
+	// row outside of the interior rows in turn
+	std::vector<int> mEdgeRows;
+	// Where each run lands, for each column outside of the interior columns
+	// in turn
+	std::vector<EdgeColumn> mEdgeColumns;
+};
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef SYNAPSE_H
 #define SYNAPSE_H
 
+#include <algorithm>
+#include <cmath>
 #include <cstdint>
 
 // An individual synapse has a weight and a delay. This is a data item
@@ -14,4 +16,33 @@ struct Synapse
 	uint32_t delay;
 };
 
+// A synapse stored in a quarter of the space, with its weight quantised to
+// 8 bits in units of a scale shared by the whole matrix (see CompactScale)
+// and a delay of no more than 255. Used in synapse files.
+struct CompactSynapse
+{
+	uint8_t weight; //< The quantised weight
+	uint8_t delay;  //< The delay
+};
+
+// The scale of weights quantised to 8 bit codes. Matrices with no negative
+// weights use every code for weights from 0 upwards, and others are centred
+// on code 128 instead.
+struct CompactScale
+{
+	float scale; //< The weight of one step of the code
+	int zero;    //< The code of a weight of zero, 0 or 128
+
+	// Return the weight a code stands for
+	float weight(uint8_t code) const { return float(int(code) - zero) * scale; }
+	// Return the nearest code to a weight. A weight of zero is always the
+	// code of zero, and a weight which is already the value of a code comes
+	// back to the same code.
+	uint8_t code(float weight) const
+	{
+		int code = zero + int(std::lround(weight / scale));
+		return uint8_t(std::min(255, std::max(zero ? 1 : 0, code)));
+	}
+};
+
 #endif
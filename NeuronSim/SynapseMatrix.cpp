@@ -1,12 +1,16 @@
 #include "SynapseMatrix.h"
 
 #include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <fstream>
 
 #include "Constants.h"
 #include "Exception.h"
 #include "Layer.h"
 #include "Log.h"
+#include "NeuronStorage.h"
+#include "Spiker.h"
 #include "StreamHelpers.h"
 
 static const uint8_t TAG_WIDTH('w');
@@ -18,23 +22,64 @@ static const uint8_t TAG_TARGET('t');
 static const uint8_t TAG_SHUNT('S');
 static const uint8_t TAG_DATA('d');
 static const uint8_t TAG_NAME('n');
+static const uint8_t TAG_TOLERANCE('T');
+static const uint8_t TAG_ENCODING('e');
+static const uint8_t TAG_COMPACT_DATA('c');
 static const uint8_t TAG_END('E');
 
 using namespace std;
 
+// Relative errors of around 1e-7 are rounding errors in single precision.
+static const float DEFAULT_SEPARABLE_TOLERANCE(1e-6f);
+// The longest delay which fits in a CompactSynapse
+static const uint32_t COMPACT_DELAY_MAX(255);
+
+// The scale which spreads the codes over the range of the weights, from zero
+// to the weight furthest from it.
+static CompactScale fitCompactScale(const vector<Synapse> & synapses)
+{
+	float lowest = 0.0f;
+	float highest = 0.0f;
+	for (auto & synapse : synapses)
+	{
+		lowest = min(lowest, synapse.weight);
+		highest = max(highest, synapse.weight);
+	}
+	float largest = max(-lowest, highest);
+	CompactScale scale = (lowest < 0.0f) ? CompactScale({ largest / 127.0f, 128 }) : CompactScale({ largest / 255.0f, 0 });
+	if (largest == 0.0f)
+	{
+		scale.scale = 1.0f;
+	}
+	return scale;
+}
+
 SynapseMatrix::SynapseMatrix(Listener * listener) :
 	mListener(listener),
 	mWidth(1),
 	mHeight(1),
 	mWeight(1.0f),
 	mDelay(DELAY_NONE),
-	mShunt(false)
+	mShunt(false),
+	mSeparableTolerance(DEFAULT_SEPARABLE_TOLERANCE),
+	mEncoding(ENCODING_FLOAT),
+	mCompileDeferred(false),
+	mCompilePending(false),
+	mCompactScale({ 1.0f, 0 })
 {
 	mSynapses.resize(1);
 }
 
 SynapseMatrix::SynapseMatrix(Listener * listener, int width, int height) :
-	mListener(listener)
+	mListener(listener),
+	mWeight(1.0f),
+	mDelay(DELAY_NONE),
+	mShunt(false),
+	mSeparableTolerance(DEFAULT_SEPARABLE_TOLERANCE),
+	mEncoding(ENCODING_FLOAT),
+	mCompileDeferred(false),
+	mCompilePending(false),
+	mCompactScale({ 1.0f, 0 })
 {
 	setSize(width, height);
 }
@@ -109,6 +154,7 @@ void SynapseMatrix::setDelay(Delay delay)
 		}
 		break;
 	}
+	compile();
 	mListener->synapseMatrixChanged(this);
 }
 
@@ -132,6 +178,7 @@ void SynapseMatrix::loadImage(uint32_t * synapseMap, int width, int height, floa
 			++synapse;
 		}
 	}
+	compile();
 	mListener->synapseMatrixChanged(this);
 }
 
@@ -182,10 +229,38 @@ void SynapseMatrix::load(const std::filesystem::path & path)
 			mShunt = shunt ? true : false;
 			break;
 		}
+		case TAG_TOLERANCE:
+			readPod(mSeparableTolerance, ifs);
+			break;
+		case TAG_ENCODING:
+		{
+			uint8_t encoding;
+			readPod(encoding, ifs);
+			if (encoding >= ENCODING_COUNT)
+				encoding = ENCODING_FLOAT;
+			mEncoding = Encoding(encoding);
+			break;
+		}
 		case TAG_DATA:
 			setSize(width, height);
 			ifs.read(reinterpret_cast<char *>(&mSynapses[0]), mWidth * mHeight * sizeof(Synapse));
 			break;
+		case TAG_COMPACT_DATA:
+		{
+			CompactScale scale;
+			uint8_t zero;
+			readPod(scale.scale, ifs);
+			readPod(zero, ifs);
+			scale.zero = zero;
+			setSize(width, height);
+			vector<CompactSynapse> compact(mWidth * mHeight);
+			ifs.read(reinterpret_cast<char *>(&compact[0]), compact.size() * sizeof(CompactSynapse));
+			for (size_t index = 0; index < compact.size(); ++index)
+			{
+				mSynapses[index] = Synapse(scale.weight(compact[index].weight), compact[index].delay);
+			}
+			break;
+		}
 		case TAG_END:
 			end = true;
 			break;
@@ -194,6 +269,7 @@ void SynapseMatrix::load(const std::filesystem::path & path)
 			break;
 		}
 	}
+	compile();
 }
 
 void SynapseMatrix::save(const std::filesystem::path & path)
@@ -210,8 +286,6 @@ void SynapseMatrix::save(const std::filesystem::path & path)
 		{
 			NEURONTHROW("Invalid state - synapse source or target nolonger exists")
 		}
-		uint32_t sourceSize = uint32_t(source->name().size());
-		uint32_t targetSize = uint32_t(target->name().size());
 		writePod(TAG_WIDTH, ofs);
 		writePod(mWidth, ofs);
 		writePod(TAG_HEIGHT, ofs);
@@ -228,8 +302,31 @@ void SynapseMatrix::save(const std::filesystem::path & path)
 		writeString(target->name(), ofs);
 		writePod(TAG_NAME, ofs);
 		writeString(mImageName, ofs);
-		writePod(TAG_DATA, ofs);
-		ofs.write(reinterpret_cast<char *>(&mSynapses[0]), mWidth * mHeight * sizeof(Synapse));
+		writePod(TAG_TOLERANCE, ofs);
+		writePod(mSeparableTolerance, ofs);
+		if (mEncoding == ENCODING_COMPACT)
+		{
+			writePod(TAG_ENCODING, ofs);
+			writePod(uint8_t(mEncoding), ofs);
+		}
+		if (mEncoding == ENCODING_COMPACT && maximumDelay() <= COMPACT_DELAY_MAX)
+		{
+			CompactScale scale = fitCompactScale(mSynapses);
+			vector<CompactSynapse> compact(mSynapses.size());
+			for (size_t index = 0; index < mSynapses.size(); ++index)
+			{
+				compact[index] = { scale.code(mSynapses[index].weight), uint8_t(mSynapses[index].delay) };
+			}
+			writePod(TAG_COMPACT_DATA, ofs);
+			writePod(scale.scale, ofs);
+			writePod(uint8_t(scale.zero), ofs);
+			ofs.write(reinterpret_cast<const char *>(&compact[0]), compact.size() * sizeof(CompactSynapse));
+		}
+		else
+		{
+			writePod(TAG_DATA, ofs);
+			ofs.write(reinterpret_cast<char *>(&mSynapses[0]), mWidth * mHeight * sizeof(Synapse));
+		}
 		writePod(TAG_END, ofs);
 	}
 	if (!ofs || !ofs.good())
@@ -272,3 +369,210 @@ void SynapseMatrix::setShunt(bool shunt)
 		mListener->synapseMatrixChanged(this);
 	}
 }
+
+void SynapseMatrix::setSeparableTolerance(float tolerance)
+{
+	mSeparableTolerance = tolerance;
+	compile();
+}
+
+void SynapseMatrix::setEncoding(Encoding encoding)
+{
+	if (mEncoding != encoding)
+	{
+		mEncoding = encoding;
+		compile();
+		mListener->synapseMatrixChanged(this);
+	}
+}
+
+void SynapseMatrix::compile()
+{
+	if (mCompileDeferred)
+	{
+		mCompilePending = true;
+		return;
+	}
+	mCompilePending = false;
+	mCompiled = mSynapses;
+	if (mEncoding == ENCODING_COMPACT)
+	{
+		mCompactScale = fitCompactScale(mSynapses);
+		for (auto & synapse : mCompiled)
+		{
+			synapse.weight = mCompactScale.weight(mCompactScale.code(synapse.weight));
+		}
+	}
+	mStencil.build(&mCompiled[0], mWidth, mHeight, mEncoding == ENCODING_COMPACT ? &mCompactScale : nullptr);
+	mSeparable.decompose(&mCompiled[0], mWidth, mHeight, mSeparableTolerance);
+	LOGDEBUG("Compiled synapses into " << mStencil.runs().size() << " runs of " << mStencil.activeSynapses() << " synapses (" << mStencil.prunedFraction() * 100.0f << "% pruned)");
+	if (!mSeparable.empty())
+	{
+		LOGDEBUG("Decomposed synapses into " << mSeparable.terms().size() << " separable terms with relative error " << mSeparable.error());
+	}
+}
+
+// The synapse at column sc and row sr of the matrix connects each firing
+// neuron to the neuron (sc - width / 2) columns and (sr - height / 2) rows
+// away, so the target at (tc, tr) receives through that synapse from the
+// neuron the same distance back, wrapped around the edges of the layer in
+// the same way as Net::fireSpikes.
+// The synapse matrix is treated as a convolution stencil: the weights of every
+// synapse with the same delay are summed for a whole row of targets, and then
+// each run of targets with non zero totals receives one batch of spikes
+// per distinct delay.
+void SynapseMatrix::gather(const Spike & spike, Spiker * spiker, const uint64_t * firing, int width, int height, int rowBegin, int rowEnd)
+{
+	// Per thread working space, reused between calls.
+	thread_local vector<uint32_t> delays;
+	thread_local vector<float> totals;
+	thread_local vector<char> rowFiring;
+	thread_local vector<float> firingValues;
+
+	const Synapse * synapses = firedSynapses();
+	int words = (width + 63) / 64;
+	delays.clear();
+	for (int index = 0; index < mWidth * mHeight; ++index)
+	{
+		delays.push_back(synapses[index].delay);
+	}
+	sort(delays.begin(), delays.end());
+	delays.erase(unique(delays.begin(), delays.end()), delays.end());
+	totals.resize(delays.size() * width);
+
+	// Activity is usually sparse, so whole rows of sources can be skipped.
+	// The firing flags are unpacked to 0 or 1 so that they can be multiplied
+	// by the weights.
+	rowFiring.assign(height, 0);
+	firingValues.assign(width * height, 0.0f);
+	for (int row = 0; row < height; ++row)
+	{
+		const uint64_t * rowWords = firing + size_t(row) * words;
+		for (int ww = 0; ww < words; ++ww)
+		{
+			for (uint64_t bits = rowWords[ww]; bits; bits &= bits - 1)
+			{
+				firingValues[row * width + ww * 64 + lowestBit(bits)] = 1.0f;
+				rowFiring[row] = 1;
+			}
+		}
+	}
+
+	for (int tr = rowBegin; tr < rowEnd; ++tr)
+	{
+		fill(totals.begin(), totals.end(), 0.0f);
+		for (int sr = 0; sr < mHeight; ++sr)
+		{
+			int row = tr - (sr - mHeight / 2);
+			if (row < -height || row >= 2 * height)
+			{
+				continue;
+			}
+			row = (row + height) % height;
+			if (!rowFiring[row])
+			{
+				continue;
+			}
+			const float * source = &firingValues[row * width];
+			const Synapse * synapse = &synapses[sr * mWidth];
+			for (int sc = 0; sc < mWidth; ++sc, ++synapse)
+			{
+				int offset = sc - mWidth / 2;
+				if (synapse->weight == 0.0f || offset <= -width || offset >= width)
+				{
+					continue;
+				}
+				float weight = synapse->weight;
+				float * total = &totals[(lower_bound(delays.begin(), delays.end(), synapse->delay) - delays.begin()) * width];
+				// The source column is tc - offset, which wraps at the start of
+				// the row for positive offsets and at the end for negative ones.
+				int wrap = offset > 0 ? offset : width + offset;
+				int before = offset > 0 ? width - offset : -offset;
+				int after = offset > 0 ? -offset : -offset - width;
+				for (int tc = 0; tc < wrap; ++tc)
+				{
+					total[tc] += weight * source[tc + before];
+				}
+				for (int tc = wrap; tc < width; ++tc)
+				{
+					total[tc] += weight * source[tc + after];
+				}
+			}
+		}
+		for (size_t dd = 0; dd < delays.size(); ++dd)
+		{
+			// Only runs of targets with non zero totals are fired
+			const float * total = &totals[dd * width];
+			int tc = 0;
+			while (tc < width)
+			{
+				if (total[tc] == 0.0f)
+				{
+					++tc;
+					continue;
+				}
+				int runEnd = tc + 1;
+				while (runEnd < width && total[runEnd] != 0.0f)
+				{
+					++runEnd;
+				}
+				spiker->fireWeights(spike, tr * width + tc, runEnd - tc, total + tc, int(delays[dd]));
+				tc = runEnd;
+			}
+		}
+	}
+}
+
+void SynapseMatrix::deferCompile(bool defer)
+{
+	mCompileDeferred = defer;
+	if (!defer && mCompilePending)
+	{
+		compile();
+	}
+}
+
+// Layers smaller than the matrix are fired through the dense loops, so are
+// not prepared for.
+void SynapseMatrix::prepare(int width, int height)
+{
+	if (!mStencil.isPrepared(width, height) && mWidth <= width && mHeight <= height)
+	{
+		mStencil.prepare(width, height);
+	}
+}
+
+// Synapses can be changed directly through synapse() and begin(), so they
+// are compared with the copy taken when they were compiled. A compact copy
+// is the same if compiling the synapses again would quantise them in the
+// same way.
+bool SynapseMatrix::isCompiled() const
+{
+	if (mCompiled.size() != mSynapses.size())
+	{
+		return false;
+	}
+	if (!mStencil.isCompact())
+	{
+		return memcmp(&mCompiled[0], &mSynapses[0], mSynapses.size() * sizeof(Synapse)) == 0;
+	}
+	CompactScale scale = fitCompactScale(mSynapses);
+	if (scale.scale != mCompactScale.scale || scale.zero != mCompactScale.zero)
+	{
+		return false;
+	}
+	for (size_t index = 0; index < mSynapses.size(); ++index)
+	{
+		if (mSynapses[index].delay != mCompiled[index].delay ||
+			scale.weight(scale.code(mSynapses[index].weight)) != mCompiled[index].weight)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+const Synapse * SynapseMatrix::firedSynapses() const
+{
+	return mStencil.isCompact() && isCompiled() ? &mCompiled[0] : &mSynapses[0];
+}
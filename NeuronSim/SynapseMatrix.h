@@ -6,9 +6,13 @@
 #include <memory>
 #include <vector>
 
+#include "Separable.h"
+#include "Stencil.h"
 #include "Synapse.h"
 
 class Layer;
+class Spike;
+class Spiker;
 
 // A SynapseMatrix is a 2D array of Synapse objects, each of which has a weight and
 // a delay. It can be thought of as being overlayed over a Layer with the center of
@@ -42,6 +46,17 @@ public:
 		// The number of available delay functions
 		DELAY_COUNT
 	};
+	// The ways the synapses can be stored
+	enum Encoding
+	{
+		// A float weight and a 32 bit delay for each synapse
+		ENCODING_FLOAT = 0,
+		// An 8 bit weight and delay for each synapse (see CompactSynapse)
+		ENCODING_COMPACT,
+
+		// The number of available encodings
+		ENCODING_COUNT
+	};
 public:
 	// Constrcutor
 	SynapseMatrix(Listener * listener);
@@ -58,13 +73,13 @@ public:
 	// Return the width of the matrix (in columns)
 	inline int width() { return mWidth; }
 	// Set the source layer that this matrix fires spikes from
-	void setSource(std::shared_ptr<Layer> source) { mSource = source; }
+	void setSource(std::shared_ptr<Layer> source) { mSource = source; mListener->synapseMatrixChanged(this); }
 	// Return the source layer that this matrix fires spikes from
 	inline std::shared_ptr<Layer> source() { return mSource.lock(); }
 	// Return the name of the source layer
 	const std::string & sourceName();
 	// Set the target layer that this matrix fires spikes to
-	void setTarget(std::shared_ptr<Layer> target) { mTarget = target; }
+	void setTarget(std::shared_ptr<Layer> target) { mTarget = target; mListener->synapseMatrixChanged(this); }
 	// Return the target layer that this matrix fires spikes to
 	inline std::shared_ptr<Layer> target() { return mTarget.lock(); }
 	// Return the name of the target layer
@@ -95,6 +110,61 @@ public:
 	void setShunt(bool shunt);
 	// Calculate the maximum delay on data coming from spikes fired through this matrix
 	uint32_t maximumDelay();
+	// Set how the synapses are stored. In compact form the weights are
+	// quantised to 8 bits when the matrix is compiled, and the stencil keeps
+	// only their codes, which are decoded as spikes are fired through them.
+	// The synapses themselves keep their full precision so that they can
+	// still be edited, so only firing reads fewer bytes, and every other way of firing spikes through the compiled matrix uses
+	// the quantised weights too, so they all give the same spikes. Compact
+	// matrices are saved with 8 bit weights and delays, unless their delays
+	// are longer than 255.
+	void setEncoding(Encoding encoding);
+	// Return how the synapses have been asked to be stored
+	Encoding encoding() const { return mEncoding; }
+	// Return true if the synapses were compiled in compact form
+	bool isCompact() const { return mStencil.isCompact(); }
+	// Return the scale of the weights when they were compiled in compact form
+	const CompactScale & compactScale() const { return mCompactScale; }
+	// Set the error allowed when decomposing the weights into separable terms,
+	// relative to the root mean square weight. The default only allows for
+	// rounding errors, so only weights which are exactly separable (such as
+	// Gaussians or bars calculated in floating point) are decomposed. Images
+	// loaded from 8 bit pixels need something nearer 1e-2. Zero turns the
+	// decomposition off.
+	void setSeparableTolerance(float tolerance);
+	// Return the error allowed when decomposing the weights
+	float separableTolerance() { return mSeparableTolerance; }
+	// Compile the synapses again, into a stencil and a separable
+	// decomposition. This happens automatically when they are loaded or
+	// resized, and only needs calling after changing synapses directly.
+	void compile();
+	// While deferred, changes which would compile the synapses again only
+	// note that they need it, and they are compiled once, if at all, when
+	// deferral is turned off. Used for batches of edits (see
+	// Automaton::beginEdit).
+	void deferCompile(bool defer);
+	// Prepare the compiled synapses for firing from a layer of the given
+	// size (see Stencil::prepare). This is kept when they are compiled again,
+	// so it only needs repeating when the size of the layer changes.
+	void prepare(int width, int height);
+	// Return true if the synapses are the same as when they were last
+	// compiled. Spikes are only fired through the compiled forms if so.
+	bool isCompiled() const;
+	// Return the synapses spikes are fired through, in row major order:
+	// those last compiled, quantised if compiled in compact form, unless they
+	// have been changed since, in which case the synapses as they are.
+	const Synapse * firedSynapses() const;
+	// Return the synapses compiled into runs with the zero weights pruned
+	const Stencil & stencil() const { return mStencil; }
+	// Return the decomposition of the weights into separable terms, which is
+	// empty if they are not close enough to separable for it to be worthwhile
+	const Separable & separable() const { return mSeparable; }
+	// Fire the spikes which land in rows [rowBegin, rowEnd) of a layer
+	// directly from the synapses, giving the same spikes as
+	// Net::fireSpikes. Used instead of the compiled forms when the synapses
+	// have changed since they were compiled, or are larger than the layer.
+	// firing - the packed firing flags of the layer, (width + 63) / 64 words per row
+	void gather(const Spike & spike, Spiker * spiker, const uint64_t * firing, int width, int height, int rowBegin, int rowEnd);
 
 	// Convenience function for calculating coordinates wrapped around the low column edge
 	inline int lowWrapColBegin(int col, int width) { return std::max(0, col + width - mWidth / 2) - col; }
@@ -135,6 +205,23 @@ private:
 	Delay mDelay;
 	// Whether these synapses target shunting inhibition or input
 	bool mShunt;
+	// The error allowed when decomposing the weights
+	float mSeparableTolerance;
+	// How the synapses are stored
+	Encoding mEncoding;
+	// True while compiling is deferred
+	bool mCompileDeferred;
+	// True if compiling was asked for while deferred
+	bool mCompilePending;
+	// The synapses as they were when last compiled, with their weights
+	// quantised if compiled in compact form
+	std::vector<Synapse> mCompiled;
+	// The scale of the weights when last compiled in compact form
+	CompactScale mCompactScale;
+	// The synapses compiled into runs
+	Stencil mStencil;
+	// The weights decomposed into separable terms
+	Separable mSeparable;
 	// The name given when an image was loaded. This is not used, but is saved
 	// and restored so that users of the class can retain the information.
 	std::string mImageName;
@@ -0,0 +1,323 @@
+#include "ThreadPool.h"
+
+#include <chrono>
+
+#include "Log.h"
+
+using namespace std;
+
+ThreadPool::ThreadPool(int threads) :
+	mTask(nullptr),
+	mCount(0),
+	mGraph(nullptr),
+	mCapacity(0),
+	mReadyCount(0),
+	mSleeping(0),
+	mNext(0),
+	mRemaining(0),
+	mGeneration(0),
+	mStopping(false)
+{
+	start(threads);
+}
+
+ThreadPool::~ThreadPool()
+{
+	stop();
+}
+
+void ThreadPool::setThreadCount(int threads)
+{
+	stop();
+	start(threads);
+}
+
+void ThreadPool::start(int threads)
+{
+	if (threads <= 0)
+	{
+		threads = max(1, int(thread::hardware_concurrency()));
+	}
+	LOG("Starting thread pool with [" << threads << "] threads");
+	mStopping = false;
+	mBusy.assign(threads, Busy{ 0 });
+	for (int tt = 1; tt < threads; ++tt)
+	{
+		mWorkers.push_back(thread(&ThreadPool::work, this, tt));
+	}
+}
+
+void ThreadPool::stop()
+{
+	{
+		lock_guard<mutex> lock(mMutex);
+		mStopping = true;
+	}
+	mWake.notify_all();
+	mReadied.notify_all();
+	for (auto & worker : mWorkers)
+	{
+		worker.join();
+	}
+	mWorkers.clear();
+}
+
+// Batches with a single task, or pools without workers, are executed on the
+// calling thread without touching the synchronisation objects at all.
+void ThreadPool::run(int count, const function<void(int)> & task)
+{
+	if (count <= 0)
+	{
+		return;
+	}
+	if (mWorkers.empty() || count == 1)
+	{
+		auto begin = chrono::steady_clock::now();
+		for (int index = 0; index < count; ++index)
+		{
+			task(index);
+		}
+		mBusy[0].nanoseconds += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - begin).count();
+		return;
+	}
+
+	uint32_t generation;
+	{
+		unique_lock<mutex> lock(mMutex);
+		mTask = &task;
+		mCount = count;
+		mError = nullptr;
+		mRemaining = count;
+		generation = ++mGeneration;
+		mNext = uint64_t(generation) << 32;
+	}
+	mWake.notify_all();
+
+	execute(generation, nullptr, 0);
+
+	exception_ptr error;
+	{
+		unique_lock<mutex> lock(mMutex);
+		mDone.wait(lock, [this] { return mRemaining == 0; });
+		mTask = nullptr;
+		error = mError;
+	}
+	if (error)
+	{
+		rethrow_exception(error);
+	}
+}
+
+// Tasks are handed out in the order they become ready. A thread which finds
+// no task ready waits for one, which it is sure to get since every task
+// which is not finished is either running or waiting for one which is.
+void ThreadPool::run(const Graph & graph, const function<void(int)> & task)
+{
+	int count = int(graph.waits.size());
+	if (count <= 0)
+	{
+		return;
+	}
+	if (mWorkers.empty())
+	{
+		vector<int> waits(graph.waits);
+		vector<int> ready;
+		for (int index = 0; index < count; ++index)
+		{
+			if (waits[index] == 0)
+			{
+				ready.push_back(index);
+			}
+		}
+		auto begin = chrono::steady_clock::now();
+		for (size_t next = 0; next < ready.size(); ++next)
+		{
+			task(ready[next]);
+			for (auto successor : graph.successors[ready[next]])
+			{
+				if (--waits[successor] == 0)
+				{
+					ready.push_back(successor);
+				}
+			}
+		}
+		mBusy[0].nanoseconds += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - begin).count();
+		return;
+	}
+
+	uint32_t generation;
+	{
+		unique_lock<mutex> lock(mMutex);
+		if (count > mCapacity)
+		{
+			mCapacity = count;
+			mWaits = make_unique<atomic<int>[]>(count);
+			mReady = make_unique<atomic<int>[]>(count);
+		}
+		mReadyCount = 0;
+		for (int index = 0; index < count; ++index)
+		{
+			mWaits[index] = graph.waits[index];
+			mReady[index] = -1;
+		}
+		for (int index = 0; index < count; ++index)
+		{
+			if (graph.waits[index] == 0)
+			{
+				mReady[mReadyCount++] = index;
+			}
+		}
+		mGraph = &graph;
+		mTask = &task;
+		mCount = count;
+		mError = nullptr;
+		mRemaining = count;
+		generation = ++mGeneration;
+		mNext = uint64_t(generation) << 32;
+	}
+	mWake.notify_all();
+
+	execute(generation, &graph, 0);
+
+	exception_ptr error;
+	{
+		unique_lock<mutex> lock(mMutex);
+		mDone.wait(lock, [this] { return mRemaining == 0; });
+		mTask = nullptr;
+		mGraph = nullptr;
+		error = mError;
+	}
+	if (error)
+	{
+		rethrow_exception(error);
+	}
+}
+
+void ThreadPool::work(int thread)
+{
+	uint32_t seen = 0;
+	while (true)
+	{
+		const Graph * graph;
+		{
+			unique_lock<mutex> lock(mMutex);
+			mWake.wait(lock, [this, seen] { return mStopping || mGeneration != seen; });
+			if (mStopping)
+			{
+				return;
+			}
+			seen = mGeneration;
+			graph = mGraph;
+		}
+		execute(seen, graph, thread);
+	}
+}
+
+// A task is claimed by advancing the low half of mNext, but only while the
+// high half still matches the batch this thread was woken for. Once a task is
+// claimed the batch cannot finish (and mTask cannot change) until it has run.
+// The tasks of a graph are only claimed once they are ready, and a thread
+// with nothing ready to claim sleeps until something is, or until the batch
+// it was woken for is over.
+void ThreadPool::execute(uint32_t generation, const Graph * graph, int thread)
+{
+	while (true)
+	{
+		uint64_t next = mNext.load();
+		while (true)
+		{
+			int slot = int(next & 0xFFFFFFFF);
+			if (uint32_t(next >> 32) != generation || slot >= mCount)
+			{
+				return;
+			}
+			if (graph && slot >= mReadyCount)
+			{
+				unique_lock<mutex> lock(mMutex);
+				++mSleeping;
+				mReadied.wait(lock, [this, slot, generation] {
+					return mStopping || uint32_t(mNext.load() >> 32) != generation || mReadyCount > slot;
+				});
+				--mSleeping;
+				if (mStopping)
+				{
+					return;
+				}
+				next = mNext.load();
+				continue;
+			}
+			if (mNext.compare_exchange_weak(next, next + 1))
+			{
+				break;
+			}
+		}
+
+		int index = int(next & 0xFFFFFFFF);
+		if (graph)
+		{
+			// The slot is counted before the task is put in it
+			int slot = index;
+			while ((index = mReady[slot].load()) < 0)
+			{
+				this_thread::yield();
+			}
+		}
+		auto begin = chrono::steady_clock::now();
+		try
+		{
+			(*mTask)(index);
+		}
+		catch (...)
+		{
+			lock_guard<mutex> lock(mMutex);
+			if (!mError)
+			{
+				mError = current_exception();
+			}
+		}
+		mBusy[thread].nanoseconds += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - begin).count();
+		if (graph)
+		{
+			for (auto successor : graph->successors[index])
+			{
+				ready(successor);
+			}
+		}
+		if (mRemaining.fetch_sub(1) == 1)
+		{
+			lock_guard<mutex> lock(mMutex);
+			mDone.notify_all();
+		}
+	}
+}
+
+vector<double> ThreadPool::busyTimes() const
+{
+	vector<double> times;
+	for (auto & busy : mBusy)
+	{
+		times.push_back(busy.nanoseconds * 1.0e-6);
+	}
+	return times;
+}
+
+void ThreadPool::resetBusyTimes()
+{
+	for (auto & busy : mBusy)
+	{
+		busy.nanoseconds = 0;
+	}
+}
+
+void ThreadPool::ready(int task)
+{
+	if (mWaits[task].fetch_sub(1) == 1)
+	{
+		mReady[mReadyCount.fetch_add(1)].store(task);
+		if (mSleeping > 0)
+		{
+			lock_guard<mutex> lock(mMutex);
+			mReadied.notify_all();
+		}
+	}
+}
@@ -0,0 +1,131 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A ThreadPool is a fixed set of long lived worker threads which execute
+// batches of tasks on behalf of their owner (usually an Automaton).
+// A batch is submitted with run(), which hands out task indices to the
+// workers and to the calling thread, and only returns once every task in the
+// batch has completed. Each call to run() therefore acts as a barrier, which
+// is what the two phases of Automaton::tick rely on.
+// A batch can also be a graph of tasks which depend on each other, in which
+// case each task is handed out as soon as the tasks it depends on have
+// finished, rather than waiting for the whole of an earlier batch.
+// The pool is not re-entrant: tasks must not call run() on the pool that is
+// executing them, and only one thread may submit work at a time.
+class ThreadPool
+{
+public:
+	// The dependencies between the tasks of a batch
+	struct Graph
+	{
+		std::vector<int> waits;                   //< The number of tasks each task waits for
+		std::vector<std::vector<int>> successors; //< The tasks waiting for each task
+	};
+
+	// Constructor
+	// threads - the total number of threads that execute work, including the
+	// thread calling run(). 0 selects the number of hardware threads.
+	ThreadPool(int threads = 0);
+	// Destructor. Waits for the workers to finish and exit.
+	~ThreadPool();
+
+	// Change the number of threads executing work. Existing workers are
+	// stopped and new ones started, so this should not be called often.
+	void setThreadCount(int threads);
+	// Return the number of threads executing work, including the caller.
+	int threadCount() const { return int(mWorkers.size()) + 1; }
+	// Execute task(index) for every index in [0, count), spread over all of
+	// the threads in the pool. Returns when all tasks have finished.
+	// If a task throws, the first exception is rethrown here once the batch
+	// has finished.
+	void run(int count, const std::function<void(int)> & task);
+	// Execute task(index) for every task in a graph, each as soon as every
+	// task it waits for has finished. The graph must have no cycles. Returns
+	// when all tasks have finished, and rethrows exceptions like run above.
+	// The successors of a task which throws are still executed.
+	void run(const Graph & graph, const std::function<void(int)> & task);
+	// Return the time each thread has spent executing tasks since the last
+	// call to resetBusyTimes, in milliseconds, starting with the thread
+	// calling run(). Must not be called while a batch is running.
+	std::vector<double> busyTimes() const;
+	// Start counting the busy times again from zero
+	void resetBusyTimes();
+
+private:
+	// The time one thread has spent executing tasks, aligned so that the
+	// threads never share a cache line while they count
+	struct alignas(64) Busy
+	{
+		int64_t nanoseconds;
+	};
+
+	// The loop executed by each worker thread
+	// thread - the index of the thread in mBusy
+	void work(int thread);
+	// Take tasks from the given batch until there are none left
+	// graph - the graph of the batch, or nullptr if its tasks are independent
+	void execute(uint32_t generation, const Graph * graph, int thread);
+	// Hand out a task of the graph being executed once it is ready to run
+	void ready(int task);
+	// Start the worker threads
+	void start(int threads);
+	// Stop and join the worker threads
+	void stop();
+
+private:
+	// The worker threads. The thread calling run() is not in this list.
+	std::vector<std::thread> mWorkers;
+	// The busy time of the thread calling run() followed by each worker
+	std::vector<Busy> mBusy;
+	// Protects the batch state and the condition variables
+	std::mutex mMutex;
+	// Signalled when a new batch is available, or the pool is stopping
+	std::condition_variable mWake;
+	// Signalled when the last task of a batch completes
+	std::condition_variable mDone;
+	// The task function for the current batch
+	const std::function<void(int)> * mTask;
+	// The number of tasks in the current batch
+	std::atomic<int> mCount;
+	// The graph of the current batch, or nullptr if its tasks are independent.
+	// Only read under mMutex, by workers when they wake for a batch.
+	const Graph * mGraph;
+	// The number of tasks each task of the graph is still waiting for
+	std::unique_ptr<std::atomic<int>[]> mWaits;
+	// The tasks of the graph in the order they became ready, with -1 in the
+	// slots which are yet to be filled. Task indices handed out are indices
+	// into this.
+	std::unique_ptr<std::atomic<int>[]> mReady;
+	// The number of slots allocated for mWaits and mReady
+	int mCapacity;
+	// The number of slots of mReady filled
+	std::atomic<int> mReadyCount;
+	// The number of threads waiting for a task of the graph to be ready
+	std::atomic<int> mSleeping;
+	// Signalled when a task of the graph becomes ready while threads wait
+	std::condition_variable mReadied;
+	// The generation of the current batch in the high 32 bits and the index
+	// of the next task to be handed out in the low 32 bits. Keeping them in
+	// one word stops a worker that woke late claiming a task from a batch
+	// other than the one it was woken for.
+	std::atomic<uint64_t> mNext;
+	// The number of tasks in the current batch that have not yet finished
+	std::atomic<int> mRemaining;
+	// Incremented for every batch so that sleeping workers can tell a new
+	// batch from a spurious wake up
+	uint32_t mGeneration;
+	// True when the workers should exit
+	bool mStopping;
+	// The first exception thrown by a task in the current batch
+	std::exception_ptr mError;
+};
+
+#endif
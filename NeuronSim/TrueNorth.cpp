@@ -27,6 +27,7 @@ TrueNorth::TrueNorth(int width, int height) :
 	mResetOrSaturate(0),
 	mResetMode(0)
 {
+	packField(&NeuronTrueNorth::v);
 	clear();
 }
 
@@ -89,67 +90,181 @@ inline int sgn(T val)
 	return (T(0) < val) - (val < T(0));
 }
 
-void TrueNorth::tick()
+#ifdef NEURON_SIMD
+namespace
 {
-	auto * cell = &mNeurons[0];
-	for (int num = mWidth * mHeight; num != 0; --num)
+	// The explicitly vectorised version of TrueNorth::tickRows. The reset
+	// modes are applied by blending the reset potential into the lanes which
+	// fired or fell below the negative threshold.
+	struct TrueNorthKernel
 	{
-		cell->v += cell->input;
-		cell->input = 0.0f;
+		float * input;
+		float * potential;
+		int32_t leakReversal;
+		float leakWeight;
+		float positiveThreshold;
+		float negativeThreshold;
+		float resetVoltage;
+		int32_t resetOrSaturate;
+		int32_t resetMode;
 
-		int leakDir = (1 - mLeakReversal) + mLeakReversal * sgn(cell->v);
-		cell->v += mLeakWeight * leakDir;
-
-		cell->firing = cell->v >= mPositiveThreshold;
-		if (cell->firing)
+		SIMD_TARGET_AVX512 __mmask16 operator()(int index, __mmask16 active) const
 		{
-			switch (mResetMode)
+			const __m512 zero = _mm512_setzero_ps();
+			const __m512 one = _mm512_set1_ps(1.0f);
+			__m512 v = _mm512_maskz_loadu_ps(active, potential + index);
+			v = _mm512_add_ps(v, _mm512_maskz_loadu_ps(active, input + index));
+			_mm512_mask_storeu_ps(input + index, active, zero);
+
+			__m512 sign = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(v, zero, _CMP_GT_OQ), zero, one);
+			sign = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(v, zero, _CMP_LT_OQ), sign, _mm512_set1_ps(-1.0f));
+			__m512 leakDir = _mm512_add_ps(_mm512_set1_ps(float(1 - leakReversal)), mulAvx512(_mm512_set1_ps(float(leakReversal)), sign));
+			v = _mm512_add_ps(v, mulAvx512(_mm512_set1_ps(leakWeight), leakDir));
+
+			__mmask16 firing = _mm512_mask_cmp_ps_mask(active, v, _mm512_set1_ps(positiveThreshold), _CMP_GE_OQ);
+			__mmask16 below = _mm512_mask_cmp_ps_mask(active & ~firing, v, _mm512_set1_ps(-negativeThreshold), _CMP_LT_OQ);
+			__m512 fired = v;
+			__m512 reset = v;
+			switch (resetMode)
 			{
 			case 0:
-				cell->v = mResetVoltage;
+				fired = _mm512_set1_ps(resetVoltage);
+				reset = _mm512_set1_ps(-resetVoltage);
 				break;
 			case 1:
-				cell->v -= mPositiveThreshold;
-				break;
-			case 2:
-			default:
+				fired = _mm512_sub_ps(v, _mm512_set1_ps(positiveThreshold));
+				reset = _mm512_add_ps(v, _mm512_set1_ps(negativeThreshold));
 				break;
 			}
+			if (resetOrSaturate)
+			{
+				reset = _mm512_set1_ps(-negativeThreshold);
+			}
+			v = _mm512_mask_blend_ps(firing, v, fired);
+			v = _mm512_mask_blend_ps(below, v, reset);
+			_mm512_mask_storeu_ps(potential + index, active, v);
+			return firing;
 		}
-		else if (cell->v < -mNegativeThreshold)
+
+		SIMD_TARGET_AVX2 int operator()(int index, __m256i active) const
 		{
-			if (mResetOrSaturate)
+			const __m256 zero = _mm256_setzero_ps();
+			const __m256 one = _mm256_set1_ps(1.0f);
+			__m256 v = _mm256_maskload_ps(potential + index, active);
+			v = _mm256_add_ps(v, _mm256_maskload_ps(input + index, active));
+			_mm256_maskstore_ps(input + index, active, zero);
+
+			__m256 sign = _mm256_sub_ps(
+				_mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GT_OQ), one),
+				_mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_LT_OQ), one));
+			__m256 leakDir = _mm256_add_ps(_mm256_set1_ps(float(1 - leakReversal)), _mm256_mul_ps(_mm256_set1_ps(float(leakReversal)), sign));
+			v = _mm256_add_ps(v, _mm256_mul_ps(_mm256_set1_ps(leakWeight), leakDir));
+
+			__m256 firing = _mm256_cmp_ps(v, _mm256_set1_ps(positiveThreshold), _CMP_GE_OQ);
+			__m256 below = _mm256_andnot_ps(firing, _mm256_cmp_ps(v, _mm256_set1_ps(-negativeThreshold), _CMP_LT_OQ));
+			__m256 fired = v;
+			__m256 reset = v;
+			switch (resetMode)
 			{
-				cell->v = -mNegativeThreshold;
+			case 0:
+				fired = _mm256_set1_ps(resetVoltage);
+				reset = _mm256_set1_ps(-resetVoltage);
+				break;
+			case 1:
+				fired = _mm256_sub_ps(v, _mm256_set1_ps(positiveThreshold));
+				reset = _mm256_add_ps(v, _mm256_set1_ps(negativeThreshold));
+				break;
 			}
-			else
+			if (resetOrSaturate)
+			{
+				reset = _mm256_set1_ps(-negativeThreshold);
+			}
+			v = _mm256_blendv_ps(v, fired, firing);
+			v = _mm256_blendv_ps(v, reset, below);
+			_mm256_maskstore_ps(potential + index, active, v);
+			return _mm256_movemask_ps(firing);
+		}
+	};
+}
+#endif
+
+void TrueNorth::tickRows(int rowBegin, int rowEnd)
+{
+	forTiles(rowBegin, rowEnd, [&](int tileBegin, int tileEnd)
+	{
+		auto input = field(&NeuronTrueNorth::input);
+		auto potential = field(&NeuronTrueNorth::v);
+#ifdef NEURON_SIMD
+		TrueNorthKernel kernel = { input.data(), potential.data(), mLeakReversal, mLeakWeight,
+			mPositiveThreshold, mNegativeThreshold, mResetVoltage, mResetOrSaturate, mResetMode };
+		if (updateRowsSimd(tileBegin, tileEnd, kernel))
+		{
+			return;
+		}
+#endif
+		updateRows(tileBegin, tileEnd, [&](int index)
+		{
+			float & v = potential[index];
+			v += input[index];
+			input[index] = 0.0f;
+
+			int leakDir = (1 - mLeakReversal) + mLeakReversal * sgn(v);
+			v += mLeakWeight * leakDir;
+
+			bool firing = v >= mPositiveThreshold;
+			if (firing)
 			{
 				switch (mResetMode)
 				{
 				case 0:
-					cell->v = -mResetVoltage;
+					v = mResetVoltage;
 					break;
 				case 1:
-					cell->v += mNegativeThreshold;
+					v -= mPositiveThreshold;
 					break;
 				case 2:
 				default:
 					break;
 				}
 			}
-		}
-		++cell;
-	}
+			else if (v < -mNegativeThreshold)
+			{
+				if (mResetOrSaturate)
+				{
+					v = -mNegativeThreshold;
+				}
+				else
+				{
+					switch (mResetMode)
+					{
+					case 0:
+						v = -mResetVoltage;
+						break;
+					case 1:
+						v += mNegativeThreshold;
+						break;
+					case 2:
+					default:
+						break;
+					}
+				}
+			}
+			return firing;
+		});
+	});
 }
 
 void TrueNorth::paintState(uint32_t * image)
 {
-	float range = mPositiveThreshold - mNegativeThreshold;
-	for (auto cell = begin(); cell != end(); cell++)
+	forTiles(0, mHeight, [&](int rowBegin, int rowEnd)
 	{
-		uint32_t col = uint32_t(255.0f * (cell->v - mNegativeThreshold) / mPositiveThreshold);
-		*image++ = 0xFF000000 | col | (col << 8) | (col << 16);
-	}
+		auto v = field(&NeuronTrueNorth::v);
+		for (int index = rowBegin * mWidth; index < rowEnd * mWidth; ++index)
+		{
+			uint32_t col = uint32_t(255.0f * (v[index] - mNegativeThreshold) / mPositiveThreshold);
+			*image++ = 0xFF000000 | col | (col << 8) | (col << 16);
+		}
+	});
 }
 
 #include "TrueNorth.h"
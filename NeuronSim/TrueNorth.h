@@ -35,8 +35,9 @@ public:
 	// Take a pointer to the start of an array of pixels and populate them
 	// with the state of the neurons. The pixels should be in ABGR order.
 	void paintState(uint32_t * image) override;
-	// Perform the logical processing specific to Izhikevich neurons
-	void tick();
+	// Perform the logical processing specific to TrueNorth neurons, for the
+	// neurons in rows [rowBegin, rowEnd)
+	void tickRows(int rowBegin, int rowEnd) override;
 
 private:
 	int32_t mLeakReversal;     //< 0, 1
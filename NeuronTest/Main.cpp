@@ -4,7 +4,7 @@
 #include "Tester.h"
 
 // Main entry point
-// Runs through every test and exits
+// Runs through every test and exits, returning non zero if any check failed.
 // Although this catches exceptions it would be very unexpected for it
 // to actually see one.
 int main(int argc, char ** argv)
@@ -14,6 +14,7 @@ int main(int argc, char ** argv)
 		Log::to("NeuronTest.log");
 		Tester tester;
 		tester.run();
+		return tester.passed() ? 0 : 1;
 	}
 	catch (const std::runtime_error & re)
 	{
@@ -24,5 +25,5 @@ int main(int argc, char ** argv)
 		TEST_LOG("Test system failed with inexplicable error");
 	}
 
-	return 0;
+	return 1;
 }
\ No newline at end of file
@@ -1,7 +1,12 @@
 #include "Test.h"
 
+#include <algorithm>
 #include <iostream>
 
+#include "NeuronSim/Layer.h"
+
+using namespace std;
+
 Test::Test() :
 	mPasses(0),
 	mFails(0)
@@ -32,3 +37,57 @@ bool Test::test(const std::string & file, int line, const std::string & expr, bo
 	}
 	return value;
 }
+
+vector<vector<uint32_t>> Test::runLife(const LifeRun & run, Automaton::Scheduler scheduler, Automaton::Propagation propagation)
+{
+	Automaton automaton;
+	automaton.setScheduler(scheduler);
+	automaton.setPropagation(propagation);
+	automaton.setThreadCount(3);
+	automaton.setNetworkType("Life");
+	automaton.setSize(run.width, run.height);
+	run.build(automaton);
+
+	vector<vector<uint32_t>> images;
+	for (int tick = 0; tick < LIFE_TICKS; ++tick)
+	{
+		if (run.before)
+		{
+			run.before(automaton, tick);
+		}
+		automaton.tick();
+		if (run.after)
+		{
+			run.after(automaton, tick);
+		}
+		for (auto layer : automaton.layers())
+		{
+			vector<uint32_t> image(run.width * run.height);
+			layer->paintSpikes(&image[0]);
+			images.push_back(image);
+		}
+	}
+	return images;
+}
+
+vector<vector<uint32_t>> Test::testSchedules(const LifeRun & reference, const vector<LifeRun> & variants)
+{
+	auto expect = runLife(reference, Automaton::SCHEDULER_THREAD_PER_LAYER, Automaton::PROPAGATION_SCATTER);
+	int firing = 0;
+	for (auto & image : expect)
+	{
+		firing += int(count(image.begin(), image.end(), 0xFFFFFFFF));
+	}
+	TEST(firing > 0);
+	for (auto scheduler : { Automaton::SCHEDULER_THREAD_PER_LAYER, Automaton::SCHEDULER_POOL, Automaton::SCHEDULER_FUSED })
+	{
+		for (auto propagation : { Automaton::PROPAGATION_SCATTER, Automaton::PROPAGATION_GATHER })
+		{
+			for (auto & variant : variants)
+			{
+				TEST(runLife(variant, scheduler, propagation) == expect);
+			}
+		}
+	}
+	return expect;
+}
@@ -1,9 +1,13 @@
 #ifndef TEST_H
 #define TEST_H
 
+#include <cmath>
+#include <functional>
 #include <iostream>
 #include <string>
+#include <vector>
 
+#include "NeuronSim/Automaton.h"
 #include "NeuronSim/Constants.h"
 #include "NeuronSim/Log.h"
 
@@ -38,6 +42,28 @@ public:
 	int fails() { return mFails; }
 
 protected:
+	// How runLife builds and drives a Life automaton. build creates its
+	// layers and synapses, and before and after, when they are given, are
+	// called with the number of each tick before and after it runs.
+	struct LifeRun
+	{
+		int width;
+		int height;
+		std::function<void(Automaton & automaton)> build;
+		std::function<void(Automaton & automaton, int tick)> before;
+		std::function<void(Automaton & automaton, int tick)> after;
+	};
+	// The number of ticks runLife runs for
+	static const int LIFE_TICKS = 12;
+
+	// Run a Life automaton on three threads with the given scheduler and
+	// propagation, and return the spikes of every layer on every tick.
+	std::vector<std::vector<uint32_t>> runLife(const LifeRun & run, Automaton::Scheduler scheduler, Automaton::Propagation propagation);
+	// Check that the reference fires at all, on a thread per layer and
+	// scattering, and that every variant fires exactly the same spikes with
+	// every scheduler and propagation. Returns the spikes of the reference.
+	std::vector<std::vector<uint32_t>> testSchedules(const LifeRun & reference, const std::vector<LifeRun> & variants);
+
 	int mPasses;
 	int mFails;
 };
@@ -3,6 +3,8 @@
 #include "NeuronSim/Layer.h"
 #include "NeuronSim/SynapseMatrix.h"
 
+#include <algorithm>
+
 using namespace std;
 
 TestAutomaton::TestAutomaton()
@@ -26,6 +28,11 @@ void TestAutomaton::run()
 	testSynapseCreatedRemovedCallbacks();
 	testAutoSynapseRemoval();
 	testLayerResize();
+	testEditKeepsSpikes();
+	testEditBatch();
+	testAccumulation();
+	testRetarget();
+	testShuntRouting();
 }
 
 void TestAutomaton::testTypeChangeCallback()
@@ -177,3 +184,281 @@ void TestAutomaton::checkNothingChanged()
 	TEST(!mLayerChanged);
 	TEST(!mSynapsesChanged);
 }
+
+// Editing the synapses must not lose the spikes already on their way, so
+// setting a matrix to the delay it already has mid run changes nothing.
+void TestAutomaton::testEditKeepsSpikes()
+{
+	TEST_SUB;
+	const int size = 8;
+	uint32_t syn[] =
+	{
+		0xFF, 0xFF, 0xFF,
+		0xFF, 0x80, 0xFF,
+		0xFF, 0xFF, 0xFF,
+	};
+	vector<uint32_t> images[2];
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		Automaton automaton;
+		automaton.setNetworkType("Life");
+		automaton.setSize(size, size);
+		auto layer = automaton.createLayer();
+		auto synapses = automaton.createSynapse();
+		synapses->setSource(layer);
+		synapses->setTarget(layer);
+		synapses->loadImage(syn, 3, 3, 1.0f);
+		synapses->setDelay(SynapseMatrix::DELAY_ONE);
+		layer->inject(1, 1, 3.0f);
+		layer->inject(2, 1, 3.0f);
+		layer->inject(3, 1, 3.0f);
+		layer->inject(3, 2, 3.0f);
+		layer->inject(2, 3, 3.0f);
+
+		vector<uint32_t> image(size * size);
+		for (int tt = 0; tt < 8; ++tt)
+		{
+			if (pass == 1 && tt == 3)
+			{
+				synapses->setDelay(SynapseMatrix::DELAY_ONE);
+			}
+			automaton.tick();
+			layer->paintState(&image[0]);
+			images[pass].insert(images[pass].end(), image.begin(), image.end());
+		}
+	}
+	TEST(images[0] == images[1]);
+}
+
+// Changes made during an edit must be held back until it is committed, and
+// anything created and removed within the edit never reported at all.
+void TestAutomaton::testEditBatch()
+{
+	TEST_SUB;
+	uint32_t syn[] =
+	{
+		0x00, 0xFF, 0x00,
+		0xFF, 0x00, 0xFF,
+		0x00, 0xFF, 0x00,
+	};
+	mLayer1 = mAutomaton->createLayer();
+	mSynapses1 = mAutomaton->createSynapse();
+	mSynapses1->setSource(mLayer1);
+	mSynapses1->setTarget(mLayer1);
+	resetChanges();
+
+	mAutomaton->beginEdit();
+	mAutomaton->beginEdit();
+	mLayer2 = mAutomaton->createLayer();
+	mSynapses2 = mAutomaton->createSynapse();
+	mSynapses2->setSource(mLayer2);
+	mSynapses2->setTarget(mLayer1);
+	mSynapses2->loadImage(syn, 3, 3, 1.0f);
+	auto temporary = mAutomaton->createSynapse();
+	mAutomaton->removeSynapse(temporary);
+	mAutomaton->removeSynapse(mSynapses1);
+	mAutomaton->commitEdit();
+	TEST(mAutomaton->isEditing());
+	TEST(!mSynapses2->isCompiled());
+	bool threw = false;
+	try
+	{
+		mAutomaton->tick();
+	}
+	catch (...)
+	{
+		threw = true;
+	}
+	TEST(threw);
+	checkNothingChanged();
+
+	mAutomaton->commitEdit();
+	TEST(!mAutomaton->isEditing());
+	TEST(mSynapses2->isCompiled());
+	TEST_EQUAL(mSynapses2->stencil().activeSynapses(), 4);
+	TEST_EQUAL(mLayerChanged, mLayer2);
+	TEST_EQUAL(mSynapsesChanged, mSynapses1);
+	TEST_EQUAL(mAutomaton->spikeTrainCount(), 1);
+
+	mAutomaton->removeLayer(mLayer2);
+	mAutomaton->removeLayer(mLayer1);
+
+	// An edit is committed once, either explicitly or when it is destroyed,
+	// including when an exception unwinds past it
+	resetChanges();
+	{
+		Automaton::Edit edit(*mAutomaton);
+		mLayer1 = mAutomaton->createLayer();
+		TEST(mAutomaton->isEditing());
+		checkNothingChanged();
+		edit.commit();
+		TEST(!mAutomaton->isEditing());
+		TEST_EQUAL(mLayerChanged, mLayer1);
+		edit.commit();
+	}
+	TEST(!mAutomaton->isEditing());
+	try
+	{
+		Automaton::Edit edit(*mAutomaton);
+		mLayer2 = mAutomaton->createLayer();
+		throw runtime_error("abandoned edit");
+	}
+	catch (const runtime_error &)
+	{
+	}
+	TEST(!mAutomaton->isEditing());
+	TEST_EQUAL(mLayerChanged, mLayer2);
+
+	mAutomaton->removeLayer(mLayer2);
+	mAutomaton->removeLayer(mLayer1);
+}
+
+// A small network of three layers, in which two layers fire into each of
+// the others and one of them fires both inputs and shunts into the same
+// target. The accumulation is switched to mode after switchTick
+// ticks, and the number of spike trains is checked on every tick.
+Test::LifeRun TestAutomaton::accumulation(Automaton::Accumulation mode, int switchTick)
+{
+	// The weights are multiples of a quarter so that every total is exact
+	// however it is added up.
+	const int WIDTH = 40;
+	const int HEIGHT = 24;
+	LifeRun run;
+	run.width = WIDTH;
+	run.height = HEIGHT;
+	run.build = [](Automaton & automaton)
+	{
+		auto layer1 = automaton.createLayer();
+		auto layer2 = automaton.createLayer();
+		auto layer3 = automaton.createLayer();
+		layer3->setSpike(Spike::SHAPE_SQUARE, 3);
+
+		struct Connection
+		{
+			shared_ptr<Layer> source;
+			shared_ptr<Layer> target;
+			int size;
+			SynapseMatrix::Delay delay;
+			bool shunt;
+		};
+		for (auto & connection : {
+			Connection{ layer1, layer2, 5, SynapseMatrix::DELAY_LINEAR, false },
+			Connection{ layer3, layer2, 3, SynapseMatrix::DELAY_ONE, false },
+			Connection{ layer2, layer1, 3, SynapseMatrix::DELAY_ONE, true },
+			Connection{ layer2, layer1, 1, SynapseMatrix::DELAY_NONE, false },
+			Connection{ layer1, layer1, 5, SynapseMatrix::DELAY_NONE, false },
+			Connection{ layer2, layer3, 3, SynapseMatrix::DELAY_NONE, false } })
+		{
+			auto synapses = automaton.createSynapse();
+			synapses->setSource(connection.source);
+			synapses->setTarget(connection.target);
+			synapses->setSize(connection.size, connection.size);
+			synapses->setDelay(connection.delay);
+			synapses->setShunt(connection.shunt);
+			for (int row = 0; row < connection.size; ++row)
+			{
+				for (int col = 0; col < connection.size; ++col)
+				{
+					int weight = connection.shunt ? 2 : (col * 3 + row * 5) % 7 - 2;
+					synapses->synapse(col, row)->weight = weight * 0.25f;
+				}
+			}
+		}
+		for (int cell = 0; cell < WIDTH * HEIGHT; cell += 3)
+		{
+			layer1->inject(cell % WIDTH, cell / WIDTH, 3.0f);
+		}
+	};
+	run.before = [mode, switchTick](Automaton & automaton, int tick)
+	{
+		if (tick == switchTick)
+		{
+			automaton.setAccumulation(mode);
+		}
+	};
+	int trains = mode == Automaton::ACCUMULATE_PER_TARGET ? 3 : (mode == Automaton::ACCUMULATE_HISTORY ? 0 : 6);
+	run.after = [this, mode, switchTick, trains](Automaton & automaton, int tick)
+	{
+		// Trains are kept after changing to histories until they are
+		// empty, which they must be by the last tick
+		if (tick < switchTick || mode != Automaton::ACCUMULATE_HISTORY || tick == LIFE_TICKS - 1)
+		{
+			TEST_EQUAL(automaton.spikeTrainCount(), tick < switchTick ? 6 : trains);
+		}
+	};
+	return run;
+}
+
+// Merging the spike trains into each target, or gathering from firing
+// histories, must give exactly the same spikes as a train per pair of
+// layers, with every scheduler and propagation, and switching to merged
+// trains or histories must keep the spikes in transit.
+void TestAutomaton::testAccumulation()
+{
+	TEST_SUB;
+	auto expect = testSchedules(accumulation(Automaton::ACCUMULATE_PER_PAIR, LIFE_TICKS),
+		{ accumulation(Automaton::ACCUMULATE_PER_TARGET, 0), accumulation(Automaton::ACCUMULATE_HISTORY, 0) });
+	TEST(runLife(accumulation(Automaton::ACCUMULATE_PER_TARGET, 5), Automaton::SCHEDULER_POOL, Automaton::PROPAGATION_SCATTER) == expect);
+	TEST(runLife(accumulation(Automaton::ACCUMULATE_HISTORY, 5), Automaton::SCHEDULER_FUSED, Automaton::PROPAGATION_SCATTER) == expect);
+}
+
+// Moving a synapse matrix to another layer between ticks must move its
+// spikes there on the next tick, with nothing else changed in between.
+void TestAutomaton::testRetarget()
+{
+	TEST_SUB;
+	const int size = 8;
+	uint32_t syn = 0xFF;
+	Automaton automaton;
+	automaton.setNetworkType("Life");
+	automaton.setSize(size, size);
+	auto layer1 = automaton.createLayer();
+	auto layer2 = automaton.createLayer();
+	auto layer3 = automaton.createLayer();
+	auto synapses = automaton.createSynapse();
+	synapses->setSource(layer1);
+	synapses->setTarget(layer2);
+	synapses->loadImage(&syn, 1, 1, 3.0f);
+	layer1->inject(3, 3, 3.0f);
+	automaton.tick();
+	automaton.tick();
+	TEST_EQUAL(layer2->firingCount(), 1);
+
+	synapses->setTarget(layer3);
+	layer1->inject(3, 3, 3.0f);
+	automaton.tick();
+	automaton.tick();
+	TEST_EQUAL(layer2->firingCount(), 0);
+	TEST_EQUAL(layer3->firingCount(), 1);
+}
+
+// A pair of layers joined by both an input and a shunt matrix has a spike
+// train for each, and each matrix fires only into the train for its own
+// kind of input.
+void TestAutomaton::testShuntRouting()
+{
+	TEST_SUB;
+	const int size = 8;
+	uint32_t syn = 0xFF;
+	Automaton automaton;
+	automaton.setNetworkType("Life");
+	automaton.setSize(size, size);
+	auto layer1 = automaton.createLayer();
+	auto layer2 = automaton.createLayer();
+	auto input = automaton.createSynapse();
+	input->setSource(layer1);
+	input->setTarget(layer2);
+	input->loadImage(&syn, 1, 1, 3.0f);
+	auto shunt = automaton.createSynapse();
+	shunt->setSource(layer1);
+	shunt->setTarget(layer2);
+	shunt->setShunt(true);
+	shunt->loadImage(&syn, 1, 1, 0.25f);
+	layer1->inject(3, 3, 3.0f);
+	automaton.tick();
+	automaton.tick();
+	TEST_EQUAL(automaton.spikeTrainCount(), 2);
+	// An input of 3 shunted by 1.25 is within the firing range of a Life
+	// neuron, but 3.25 shunted by 4.25 is not
+	TEST_EQUAL(layer2->firingCount(), 1);
+}
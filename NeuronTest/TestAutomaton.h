@@ -21,6 +21,13 @@ private:
 	void testSynapseCreatedRemovedCallbacks();
 	void testAutoSynapseRemoval();
 	void testLayerResize();
+	void testEditKeepsSpikes();
+	void testEditBatch();
+	void testAccumulation();
+	void testRetarget();
+	void testShuntRouting();
+
+	LifeRun accumulation(Automaton::Accumulation mode, int switchTick);
 
 	void resetChanges();
 	void checkNothingChanged();
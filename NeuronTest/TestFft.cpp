@@ -0,0 +1,180 @@
+#include "TestFft.h"
+
+#include <complex>
+#include <random>
+
+#include "NeuronSim/Fft.h"
+#include "NeuronSim/Layer.h"
+#include "NeuronSim/SynapseMatrix.h"
+
+using namespace std;
+
+TestFft::TestFft()
+{
+}
+
+TestFft::~TestFft()
+{
+}
+
+void TestFft::run()
+{
+	Test::run();
+
+	testTransforms();
+	testConvolution();
+	testAutomatic();
+}
+
+// Compare against the definition of the discrete Fourier transform, for
+// powers of two and for the other sizes which go through Bluestein's
+// algorithm, and check that the inverse brings the data back.
+void TestFft::testTransforms()
+{
+	TEST_SUB;
+	mt19937 random(7);
+	uniform_real_distribution<double> value(-1.0, 1.0);
+	for (int size : { 1, 2, 3, 8, 12, 17, 64, 83 })
+	{
+		Fft fft(size);
+		vector<complex<double>> data(size);
+		for (auto & point : data)
+		{
+			point = complex<double>(value(random), value(random));
+		}
+		vector<complex<double>> transformed = data;
+		fft.transform(transformed.data(), false);
+
+		double error = 0.0;
+		for (int k = 0; k < size; ++k)
+		{
+			complex<double> expect;
+			for (int j = 0; j < size; ++j)
+			{
+				double angle = -2.0 * PI * double((int64_t(j) * k) % size) / size;
+				expect += data[j] * complex<double>(cos(angle), sin(angle));
+			}
+			error = max(error, abs(transformed[k] - expect));
+		}
+		TEST(error < 1e-9);
+
+		fft.transform(transformed.data(), true);
+		error = 0.0;
+		for (int k = 0; k < size; ++k)
+		{
+			error = max(error, abs(transformed[k] / double(size) - data[k]));
+		}
+		TEST(error < 1e-12);
+	}
+
+	// A strided two dimensional transform of a single point is flat
+	Fft2d fft2d(6, 4);
+	vector<complex<double>> grid(24);
+	grid[0] = 1.0;
+	fft2d.transform(grid.data(), false);
+	bool flat = true;
+	for (auto & point : grid)
+	{
+		flat = flat && abs(point - complex<double>(1.0)) < 1e-12;
+	}
+	TEST(flat);
+}
+
+Test::LifeRun TestFft::convolution(Automaton::FftPolicy policy)
+{
+	// Neither dimension is a power of two, and the weights are multiples of
+	// a quarter so that every total is exact however it is added up.
+	const int WIDTH = 40;
+	const int HEIGHT = 24;
+	LifeRun run;
+	run.width = WIDTH;
+	run.height = HEIGHT;
+	run.build = [policy](Automaton & automaton)
+	{
+		automaton.setFftPolicy(policy);
+		auto layer1 = automaton.createLayer();
+		auto layer2 = automaton.createLayer();
+
+		struct Connection
+		{
+			shared_ptr<Layer> source;
+			shared_ptr<Layer> target;
+			int width;
+			int height;
+			SynapseMatrix::Delay delay;
+			bool shunt;
+		};
+		for (auto & connection : {
+			Connection{ layer1, layer2, 7, 5, SynapseMatrix::DELAY_LINEAR, false },
+			Connection{ layer2, layer1, 3, 3, SynapseMatrix::DELAY_ONE, true },
+			Connection{ layer1, layer1, 5, 5, SynapseMatrix::DELAY_NONE, false } })
+		{
+			auto synapses = automaton.createSynapse();
+			synapses->setSource(connection.source);
+			synapses->setTarget(connection.target);
+			synapses->setSize(connection.width, connection.height);
+			synapses->setDelay(connection.delay);
+			synapses->setShunt(connection.shunt);
+			for (int row = 0; row < connection.height; ++row)
+			{
+				for (int col = 0; col < connection.width; ++col)
+				{
+					int weight = connection.shunt ? 2 : (col * 3 + row * 5) % 7 - 2;
+					synapses->synapse(col, row)->weight = weight * 0.25f;
+				}
+			}
+		}
+		for (int cell = 0; cell < WIDTH * HEIGHT; cell += 3)
+		{
+			layer1->inject(cell % WIDTH, cell / WIDTH, 3.0f);
+		}
+	};
+	run.after = [this, policy](Automaton & automaton, int)
+	{
+		TEST_EQUAL(automaton.convolvedSynapseCount(), policy == Automaton::FFT_ALWAYS ? 3 : 0);
+	};
+	return run;
+}
+
+// Convolving must give exactly the same spikes as firing directly, with
+// every scheduler and propagation.
+void TestFft::testConvolution()
+{
+	TEST_SUB;
+	testSchedules(convolution(Automaton::FFT_NEVER), { convolution(Automaton::FFT_ALWAYS) });
+}
+
+// Nothing is convolved unless asked for. Once it is, a large matrix on a
+// busy layer is convolved automatically, a small one is not, and a matrix
+// larger than the layers never is.
+void TestFft::testAutomatic()
+{
+	TEST_SUB;
+	const int SIZE = 64;
+	Automaton automaton;
+	TEST_EQUAL(automaton.fftPolicy(), Automaton::FFT_NEVER);
+	automaton.setFftPolicy(Automaton::FFT_AUTO);
+	automaton.setNetworkType("Life");
+	automaton.setSize(SIZE, SIZE);
+	auto layer = automaton.createLayer();
+	auto large = automaton.createSynapse();
+	large->setSource(layer);
+	large->setTarget(layer);
+	large->setSize(31, 31);
+	auto small = automaton.createSynapse();
+	small->setSource(layer);
+	small->setTarget(layer);
+	small->setSize(3, 3);
+	for (int cell = 0; cell < SIZE * SIZE; cell += 2)
+	{
+		layer->inject(cell % SIZE, cell / SIZE, 3.0f);
+	}
+	automaton.tick();
+	automaton.tick();
+	TEST_EQUAL(automaton.convolvedSynapseCount(), 1);
+
+	automaton.setFftPolicy(Automaton::FFT_ALWAYS);
+	large->setSize(SIZE + 1, 3);
+	automaton.tick();
+	TEST_EQUAL(automaton.convolvedSynapseCount(), 1);
+}
@@ -0,0 +1,28 @@
+#ifndef TEST_FFT_H
+#define TEST_FFT_H
+
+#include "Test.h"
+
+#include "NeuronSim/Automaton.h"
+
+class TestFft : public Test
+{
+public:
+	TestFft();
+	~TestFft();
+
+	std::string name() { return "Fft"; }
+	void run();
+
+private:
+	void testTransforms();
+	void testConvolution();
+	void testAutomatic();
+
+	// A small automaton of two Life layers, with a mix of delays, matrix
+	// sizes and a shunting matrix, which checks on every tick that every
+	// matrix is convolved if and only if the policy is FFT_ALWAYS.
+	LifeRun convolution(Automaton::FftPolicy policy);
+};
+
+#endif
@@ -1,5 +1,6 @@
 #include "TestNet.h"
 
+#include <algorithm>
 #include <memory>
 
 #include "NeuronSim/Cell.h"
@@ -37,15 +38,17 @@ public:
 
 	static std::string name() { return "test"; }
 	static const ConfigPresets & presets();
-	void tick();
+	void tickRows(int rowBegin, int rowEnd) override;
 	std::string typeName() { return name(); }
 	void setConfig(const ConfigSet & config) {}
 	ConfigSet getConfig() { ConfigSet config; return config; }
 	const ConfigPresets & getPresets();
 	void paintState(uint32_t * image);
 
-	NeuronTest & operator[](int index) { return mNeurons[index]; }
-	NeuronTest & at(int col, int row) { return mNeurons[row * mWidth + col]; }
+	NeuronTest operator[](int index) { return neuron(index); }
+	NeuronTest at(int col, int row) { return neuron(row * mWidth + col); }
+	void setTest(int index, int test) { field(&NeuronTest::test)[index] = test; }
+	void setTest(int col, int row, int test) { setTest(row * mWidth + col, test); }
 };
 
 static inline float hashColRow(int col, int row) { return float(col + 10 * row); }
@@ -89,11 +92,11 @@ void TestNet::run()
 	TEST_EQUAL(net->at(10, 12).test, TEST_INIT);
 	TEST_EQUAL(net->at(3, 1).input, 0.0f);
 	TEST_EQUAL(net->at(10, 12).input, 0.0f);
-	TEST_EQUAL(net->at(12, 11).firing, false);
-	TEST_EQUAL(net->at(15, 13).firing, false);
+	TEST_EQUAL(net->firing(12, 11), false);
+	TEST_EQUAL(net->firing(15, 13), false);
 
 	// top left corner fire with wrap around:
-	net->at(0, 0).test = FIRE_ONCE;
+	net->setTest(0, 0, FIRE_ONCE);
 	net->tick();
 	net->fireSpikes(&synapses, &spikeTrain);
 	spikeTrain.tick();
@@ -148,7 +151,7 @@ void TestNet::run()
 	net->clear();
 	int sizer = 7;
 	int sizec = 6;
-	net->at(width - sizec + size / 2, height - sizer + size / 2).test = FIRE_ONCE;
+	net->setTest(width - sizec + size / 2, height - sizer + size / 2, FIRE_ONCE);
 	net->tick();
 	net->fireSpikes(&synapses, &spikeTrain);
 	spikeTrain.tick();
@@ -198,6 +201,107 @@ void TestNet::run()
 	{
 		TEST_LOG("Logging entire net:\n" << *net);
 	}
+
+	testGather();
+	testFiringBits();
+}
+
+// Gathering must deliver exactly the same input as scattering, including
+// around the corners. The weights are small integers so the order in which
+// they are summed makes no difference.
+void TestNet::testGather()
+{
+	TEST_SUB;
+	const int width = 16;
+	const int height = 20;
+	const int size = 9;
+	auto net = make_shared<TestNetLayer>(width, height);
+	SynapseMatrix synapses(this);
+	synapses.setSize(size, size);
+	for (int rr = 0; rr < size; ++rr)
+	{
+		for (int cc = 0; cc < size; ++cc)
+		{
+			synapses.synapse(cc, rr)->delay = (cc + rr) % 3;
+			synapses.synapse(cc, rr)->weight = hashColRow(cc, rr);
+		}
+	}
+	synapses.setTarget(net);
+	synapses.setSource(net);
+	SpikeTrain scatter(net, net, synapses.maximumDelay(), false);
+	SpikeTrain gather(net, net, synapses.maximumDelay(), false);
+
+	vector<float> inputs[2];
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		net->clear();
+		for (auto cell : { 0, width - 1, width * height - 1, 5 * width + 7, 6 * width + 7, 17 * width + 2 })
+		{
+			net->setTest(cell, FIRE_ONCE);
+		}
+		net->tick();
+		if (pass == 0)
+		{
+			net->fireSpikes(&synapses, &scatter);
+		}
+		else
+		{
+			net->gatherSpikes(&synapses, &gather, 0, height / 2);
+			net->gatherSpikes(&synapses, &gather, height / 2, height);
+		}
+		for (int delay = 0; delay <= int(synapses.maximumDelay()); ++delay)
+		{
+			(pass == 0 ? scatter : gather).tick();
+			for (int cell = 0; cell < width * height; ++cell)
+			{
+				inputs[pass].push_back((*net)[cell].input);
+			}
+			net->clear();
+		}
+	}
+	TEST(inputs[0] == inputs[1]);
+}
+
+// The firing flags are packed 64 to a word, with each row starting a new
+// word. Neurons either side of the word boundaries must fire, count and
+// paint correctly.
+void TestNet::testFiringBits()
+{
+	TEST_SUB;
+	const int width = 130;
+	const int height = 3;
+	auto net = make_shared<TestNetLayer>(width, height);
+	SynapseMatrix synapses(this);
+	synapses.setSize(1, 1);
+	synapses.synapse(0, 0)->delay = 0;
+	synapses.synapse(0, 0)->weight = 1.0f;
+	synapses.setTarget(net);
+	synapses.setSource(net);
+	SpikeTrain spikeTrain(net, net, 0, false);
+
+	const vector<int> cols = { 0, 63, 64, 127, 128, 129 };
+	for (int col : cols)
+	{
+		net->setTest(col, 1, FIRE_ONCE);
+	}
+	net->setTest(width - 1, height - 1, FIRE_ONCE);
+	net->tick();
+	TEST_EQUAL(net->firingCount(), int(cols.size()) + 1);
+
+	vector<uint32_t> image(width * height);
+	net->paintSpikes(&image[0]);
+	net->fireSpikes(&synapses, &spikeTrain);
+	spikeTrain.tick();
+	for (int index = 0; index < width * height; ++index)
+	{
+		bool expect = (index == width * height - 1) ||
+			(index / width == 1 && find(cols.begin(), cols.end(), index % width) != cols.end());
+		TEST_EQUAL((*net)[index].input, expect ? 1.0f : 0.0f);
+		TEST_EQUAL(image[index], expect ? 0xFFFFFFFF : 0xFF000000);
+	}
+
+	net->tick();
+	TEST_EQUAL(net->firingCount(), 0);
 }
 
 const ConfigPresets & TestNetLayer::getPresets()
@@ -215,27 +319,25 @@ const ConfigPresets & TestNetLayer::presets()
 	return presets;
 }
 
-void TestNetLayer::tick()
+void TestNetLayer::tickRows(int rowBegin, int rowEnd)
 {
-	auto neuron = &at(0, 0);
-	for (int rr = 0; rr < mHeight; ++rr)
+	auto test = field(&NeuronTest::test);
+	updateRows(rowBegin, rowEnd, [&](int index)
 	{
-		for (int cc = 0; cc < mWidth; ++cc)
+		bool firing = (test[index] == FIRE_ONCE);
+		if (firing)
 		{
-			neuron->firing = (neuron->test == FIRE_ONCE);
-			if (neuron->firing)
-			{
-				neuron->test = REST;
-			}
-			++neuron;
+			test[index] = REST;
 		}
-	}
+		return firing;
+	});
 }
 
 void TestNetLayer::paintState(uint32_t * image)
 {
-	for (auto & neuron : mNeurons)
+	auto test = field(&NeuronTest::test);
+	for (int index = 0; index < mWidth * mHeight; ++index)
 	{
-		*image++ = neuron.test;
+		*image++ = test[index];
 	}
 }
@@ -15,6 +15,8 @@ public:
 	void run();
 
 private:
+	void testGather();
+	void testFiringBits();
 	void synapseMatrixChanged(SynapseMatrix * matrix) override {}
 };
 
@@ -2,9 +2,12 @@
 
 #include <chrono>
 #include <ctime>
+#include <sstream>
 
 #include "NeuronSim/Layer.h"
 #include "NeuronSim/Life.h"
+#include "NeuronSim/NeuronStorage.h"
+#include "NeuronSim/Simd.h"
 #include "NeuronSim/SynapseMatrix.h"
 
 using namespace std;
@@ -35,10 +38,24 @@ void TestPerformance::run()
 	performance("Data/Saves/performance2.neuron");
 }
 
+// Runs the same automaton with each of the schedulers so that their
+// results can be compared.
 void TestPerformance::performance(const std::filesystem::path file)
+{
+	stringstream pool;
+	pool << "thread pool (" << mAutomaton->threadCount() << " threads)";
+	stringstream fused;
+	fused << "fused thread pool (" << mAutomaton->threadCount() << " threads)";
+	performance(file, Automaton::SCHEDULER_THREAD_PER_LAYER, "thread per layer");
+	performance(file, Automaton::SCHEDULER_POOL, pool.str());
+	performance(file, Automaton::SCHEDULER_FUSED, fused.str());
+}
+
+void TestPerformance::performance(const std::filesystem::path file, Automaton::Scheduler scheduler, const std::string & schedulerName)
 {
 	// Load the performance automaton
 	mAutomaton->load(file);
+	mAutomaton->setScheduler(scheduler);
 
 	// Run 10 frames to get going
 	for (int startup = 0; startup < 10; ++startup)
@@ -64,25 +81,41 @@ void TestPerformance::performance(const std::filesystem::path file)
 	// For optimization purposes this test case should still be used, but
 	// the results of a profiler should be taken in preference to the time
 	// reported by this loop.
+	// Wall clock time is reported as well, since that is what the schedulers
+	// are trying to reduce; the CPU time includes every worker thread.
 	auto clockStart = clock();
+	auto wallStart = chrono::steady_clock::now();
 
-	for (int tick = 0; tick < numTicks; ++tick)
-	{
-		mAutomaton->tick();
-	}
+	mAutomaton->tickN(numTicks);
 
+	auto wallEnd = chrono::steady_clock::now();
 	auto clockEnd = clock();
 	auto cpuTime = 1000.0 * (clockEnd - clockStart) / CLOCKS_PER_SEC;
+	auto wallTime = chrono::duration<double, milli>(wallEnd - wallStart).count();
+	// The state bytes are the least a tick can move, so this is the memory
+	// bandwidth the tick would need if every phase streamed them just once.
+	// A scheduler which goes over them once per phase needs several times it.
+	uint64_t stateBytes = mAutomaton->tickStateBytes();
+	double bandwidth = double(stateBytes) * numTicks / (wallTime / 1000.0) / (1024.0 * 1024.0 * 1024.0);
 
 	TEST_LOG("Automaton: " << file);
+	TEST_LOG("Scheduler: " << schedulerName);
+	TEST_LOG("Storage: " << (NEURON_STORAGE_SOA ? "structure of arrays" : "array of structures"));
+	TEST_LOG("SIMD: " << simdLevelName(simdLevel()));
 	TEST_LOG(numTicks << " performance ticks");
 	TEST_LOG(numLayers << " layers");
 	TEST_LOG(numNeurons << " neurons");
 	TEST_LOG(numSynapses << " synapses");
 	TEST_LOG("  CPU time           : " << cpuTime << " ms");
 	TEST_LOG("  CPU time per tick  : " << (cpuTime / numTicks) << " ms");
+	TEST_LOG("  Wall time          : " << wallTime << " ms");
+	TEST_LOG("  Wall time per tick : " << (wallTime / numTicks) << " ms");
 	TEST_LOG("  Neurons per second : " << numNeurons * numTicks * 1000u / cpuTime);
 	TEST_LOG("  Synapses per second: " << numSynapses * numTicks * 1000u / cpuTime);
+	TEST_LOG("  State per tick     : " << stateBytes / 1024 << " KB");
+	TEST_LOG("  State bandwidth    : " << bandwidth << " GB/s");
+	TEST_LOG("  Sparse spike trains: " << mAutomaton->sparseSpikeTrainCount() << " of " << mAutomaton->spikeTrainCount());
+	TEST_LOG("  Train mode switches: " << mAutomaton->spikeTrainModeSwitches());
 
 	TEST(true); // Give the tester logic something to keep it happy.
 }
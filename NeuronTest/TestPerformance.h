@@ -23,6 +23,7 @@ public:
 
 private:
 	void performance(const std::filesystem::path file);
+	void performance(const std::filesystem::path file, Automaton::Scheduler scheduler, const std::string & schedulerName);
 
 private:
 	std::unique_ptr<Automaton> mAutomaton;
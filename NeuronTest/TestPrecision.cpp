@@ -0,0 +1,333 @@
+#include "TestPrecision.h"
+
+#include <cmath>
+#include <limits>
+
+#include "NeuronSim/Layer.h"
+#include "NeuronSim/Life.h"
+#include "NeuronSim/LinearLif.h"
+#include "NeuronSim/NeuronStorage.h"
+#include "NeuronSim/Precision.h"
+#include "NeuronSim/Spike.h"
+#include "NeuronSim/SpikeTrain.h"
+#include "NeuronSim/SynapseMatrix.h"
+
+using namespace std;
+
+// Long enough for the rounding errors to have compounded through several
+// generations of spikes in every layer.
+static const int numTicks(2000);
+// The largest relative difference in the total number of spikes fired that
+// a reduced precision may make over the run.
+static const double maxFiringDrift(0.1);
+// The weights of the bundled saves are whole numbers, which every precision
+// holds exactly, so they are also run with weights scaled by this to make
+// them round.
+static const float weightScale(1.01f);
+
+static const Precision reducedPrecisions[] = { PRECISION_HALF, PRECISION_BFLOAT16, PRECISION_FIXED16 };
+
+static const char * precisionName(Precision precision)
+{
+	switch (precision)
+	{
+	case PRECISION_HALF:
+		return "half";
+	case PRECISION_BFLOAT16:
+		return "bfloat16";
+	case PRECISION_FIXED16:
+		return "fixed16";
+	case PRECISION_FLOAT:
+	default:
+		return "float";
+	}
+}
+
+template <typename Packing>
+static float roundTrip(float value)
+{
+	return Packing::unpack(Packing::pack(value));
+}
+
+TestPrecision::TestPrecision()
+{
+	mAutomaton = make_unique<Automaton>();
+}
+
+TestPrecision::~TestPrecision()
+{
+}
+
+void TestPrecision::run()
+{
+	Test::run();
+
+	testPackings();
+	testSpikeTrain();
+	testSetPrecision();
+	testNeuronState();
+	testAccuracy("Data/Saves/performance.neuron", 1.0f, false);
+	testAccuracy("Data/Saves/performance.neuron", weightScale, false);
+	// The first performance save is of linear leaky integrators, which have
+	// one packed field, and the second of Izhikevich neurons, which have two.
+	// With whole number weights and a leak of a half, the potentials of the
+	// first often pass their threshold by less than a reduced precision can
+	// hold, so rounding them stops most of the neurons firing at all, and it
+	// is only compared with its weights scaled.
+	testAccuracy("Data/Saves/performance.neuron", weightScale, true);
+	testAccuracy("Data/Saves/performance2.neuron", 1.0f, true);
+}
+
+// Values each format holds exactly come back unchanged, ties round to even
+// and values out of range saturate in the way of each format.
+void TestPrecision::testPackings()
+{
+	TEST_SUB;
+	typedef Packing<PRECISION_HALF> Half;
+	typedef Packing<PRECISION_BFLOAT16> BFloat16;
+	typedef Packing<PRECISION_FIXED16> Fixed16;
+
+	for (float value : { 0.0f, 1.0f, -2.5f, 0.125f, 100.25f })
+	{
+		TEST_EQUAL(roundTrip<Half>(value), value);
+		TEST_EQUAL(roundTrip<Fixed16>(value), value);
+	}
+	for (float value : { 0.0f, 1.0f, -2.5f, 0.125f, ldexp(1.0f, 100) })
+	{
+		TEST_EQUAL(roundTrip<BFloat16>(value), value);
+	}
+
+	// Half
+	TEST_EQUAL(roundTrip<Half>(65504.0f), 65504.0f);
+	TEST_EQUAL(roundTrip<Half>(1.0e6f), numeric_limits<float>::infinity());
+	TEST_EQUAL(roundTrip<Half>(-1.0e6f), -numeric_limits<float>::infinity());
+	TEST_EQUAL(roundTrip<Half>(ldexp(1.0f, -24)), ldexp(1.0f, -24));
+	TEST_EQUAL(roundTrip<Half>(ldexp(3.0f, -20)), ldexp(3.0f, -20));
+	TEST_EQUAL(roundTrip<Half>(1.0f + ldexp(1.0f, -11)), 1.0f);
+	TEST_EQUAL(roundTrip<Half>(1.0f + ldexp(3.0f, -11)), 1.0f + ldexp(1.0f, -9));
+	TEST(std::isnan(roundTrip<Half>(numeric_limits<float>::quiet_NaN())));
+
+	// BFloat16
+	TEST_EQUAL(roundTrip<BFloat16>(1.0f + ldexp(1.0f, -8)), 1.0f);
+	TEST_EQUAL(roundTrip<BFloat16>(1.0f + ldexp(3.0f, -8)), 1.0f + ldexp(1.0f, -6));
+	TEST_EQUAL(roundTrip<BFloat16>(1.0f + ldexp(1.0f, -9)), 1.0f);
+	TEST(std::isnan(roundTrip<BFloat16>(numeric_limits<float>::quiet_NaN())));
+
+	// Fixed16
+	TEST_EQUAL(roundTrip<Fixed16>(1.0f / 512.0f), 0.0f);
+	TEST_EQUAL(roundTrip<Fixed16>(3.0f / 512.0f), 4.0f / 512.0f);
+	TEST_EQUAL(roundTrip<Fixed16>(-0.3f), -77.0f / 256.0f);
+	TEST_EQUAL(roundTrip<Fixed16>(200.0f), 32767.0f / 256.0f);
+	TEST_EQUAL(roundTrip<Fixed16>(-200.0f), -128.0f);
+}
+
+// With weights every precision holds exactly, a dense train delivers the
+// same potentials at each of them, through each of the ways of firing.
+void TestPrecision::testSpikeTrain()
+{
+	TEST_SUB;
+	const int size = 8;
+	const int delay = 3;
+	Spike spike;
+	spike.setSpike(Spike::SHAPE_SQUARE, 2);
+	float weights[size] = { 0.5f, -0.25f, 1.0f, 0.0f, 2.0f, 0.125f, -1.5f, 0.75f };
+	WeightRun runs[] = { { 3, 4, weights }, { 2 * size + 1, size - 2, weights + 2 } };
+
+	vector<vector<float>> expected;
+	for (Precision precision : { PRECISION_FLOAT, PRECISION_HALF, PRECISION_BFLOAT16, PRECISION_FIXED16 })
+	{
+		auto layer = make_shared<Life>(size, size);
+		SpikeTrain proc(layer, layer, delay, false);
+		proc.setPrecision(precision);
+		// Enough spikes to make the train dense
+		for (int cell = 0; cell < size * size; ++cell)
+		{
+			proc.fire(spike, cell, 0.5f, 0);
+		}
+		proc.tick();
+		TEST_EQUAL(proc.mode(), SpikeTrain::MODE_DENSE);
+		TEST_EQUAL(proc.precision(), precision);
+
+		proc.fire(spike, 9, 1.5f, 1);
+		proc.fireWeights(spike, size * 4, size, weights, 0);
+		proc.fireRuns(spike, runs, 2, 2);
+		vector<float> inputs;
+		for (int tick = 0; tick <= delay + 1; ++tick)
+		{
+			layer->clear();
+			proc.tick();
+			for (int cell = 0; cell < size * size; ++cell)
+			{
+				inputs.push_back(layer->field(&NeuronLife::input)[cell]);
+			}
+		}
+		expected.push_back(inputs);
+	}
+	for (int pp = 1; pp < int(expected.size()); ++pp)
+	{
+		TEST(expected[pp] == expected[0]);
+	}
+}
+
+// Spikes in transit are kept when the precision changes.
+void TestPrecision::testSetPrecision()
+{
+	TEST_SUB;
+	const int size = 8;
+	auto layer = make_shared<Life>(size, size);
+	SpikeTrain proc(layer, layer, 4, false);
+	Spike spike;
+	spike.setSpike(Spike::SHAPE_SQUARE, 1);
+	for (int cell = 0; cell < size * size; ++cell)
+	{
+		proc.fire(spike, cell, 1.0f, 1);
+	}
+	proc.tick();
+	TEST_EQUAL(proc.mode(), SpikeTrain::MODE_DENSE);
+
+	proc.fire(spike, 3, 1.5f, 1);
+	proc.fire(spike, 5, 0.3f, 2);
+	proc.setPrecision(PRECISION_HALF);
+	proc.setPrecision(PRECISION_FIXED16);
+	proc.setPrecision(PRECISION_FLOAT);
+
+	auto input = layer->field(&NeuronLife::input);
+	layer->clear();
+	proc.tick();
+	TEST_EQUAL(input[3], 1.0f);
+	layer->clear();
+	proc.tick();
+	TEST_EQUAL(input[3], 1.5f);
+	layer->clear();
+	proc.tick();
+	TEST(fabs(input[5] - 0.3f) <= 1.0f / 512.0f);
+}
+
+// Packed fields hold what their precision can, are widened while the layer
+// ticks and only then, and the inputs which spikes arrive in stay at full
+// precision. The neurons are kept when the precision changes.
+void TestPrecision::testNeuronState()
+{
+	TEST_SUB;
+	if (!NEURON_STORAGE_SOA)
+	{
+		TEST_LOG("Neuron state is only packed when stored as a structure of arrays");
+		return;
+	}
+	typedef Packing<PRECISION_FIXED16> Fixed16;
+	LinearLif layer(8, 8);
+	TEST_EQUAL(layer.neuronBytes(), int(sizeof(NeuronLif)));
+	layer.setPrecision(PRECISION_FIXED16);
+	TEST_EQUAL(layer.precision(), PRECISION_FIXED16);
+	TEST_EQUAL(layer.neuronBytes(), int(sizeof(NeuronLif) - sizeof(uint16_t)));
+
+	NeuronLif neuron;
+	neuron.potential = 0.3f;
+	neuron.input = 0.3f;
+	layer.setNeuron(5, neuron);
+	TEST_EQUAL(layer.neuron(5).potential, 77.0f / 256.0f);
+	TEST_EQUAL(layer.neuron(5).input, 0.3f);
+	bool threw = false;
+	try
+	{
+		layer.field(&NeuronLif::potential);
+	}
+	catch (const runtime_error &)
+	{
+		threw = true;
+	}
+	TEST(threw);
+
+	layer.tick();
+	float potential = Fixed16::unpack(Fixed16::pack(77.0f / 256.0f * 0.99f + 0.3f));
+	TEST_EQUAL(layer.neuron(5).potential, potential);
+	TEST_EQUAL(layer.neuron(5).input, 0.0f);
+	TEST_EQUAL(layer.neuron(6).potential, 0.0f);
+
+	layer.setPrecision(PRECISION_FLOAT);
+	TEST_EQUAL(layer.neuronBytes(), int(sizeof(NeuronLif)));
+	TEST_EQUAL(layer.field(&NeuronLif::potential)[5], potential);
+	layer.setPrecision(PRECISION_HALF);
+	LinearLif copy(layer);
+	TEST_EQUAL(copy.precision(), PRECISION_HALF);
+	TEST_EQUAL(copy.neuron(5).potential, Packing<PRECISION_HALF>::unpack(Packing<PRECISION_HALF>::pack(potential)));
+}
+
+vector<vector<int>> TestPrecision::runSave(const filesystem::path & file, float scale, Precision precision, Precision neuronPrecision)
+{
+	mAutomaton->load(file);
+	for (auto & synapses : mAutomaton->synapses())
+	{
+		Synapse * synapse = synapses->begin();
+		for (int ss = 0; ss < synapses->width() * synapses->height(); ++ss)
+		{
+			synapse[ss].weight *= scale;
+		}
+		synapses->compile();
+	}
+	mAutomaton->setPrecision(precision);
+	mAutomaton->setNeuronPrecision(neuronPrecision);
+	auto & layers = mAutomaton->layers();
+	vector<vector<int>> firing(layers.size(), vector<int>(numTicks));
+	for (int tick = 0; tick < numTicks; ++tick)
+	{
+		mAutomaton->tick();
+		for (int ll = 0; ll < int(layers.size()); ++ll)
+		{
+			firing[ll][tick] = layers[ll]->firingCount();
+		}
+	}
+	return firing;
+}
+
+// The networks are chaotic, so individual spikes soon differ once any
+// potential is rounded. What should be kept is the activity of each layer,
+// so the number of spikes fired is compared layer by layer.
+void TestPrecision::testAccuracy(const filesystem::path & file, float scale, bool neurons)
+{
+	TEST_SUB;
+	auto reference = runSave(file, scale, PRECISION_FLOAT, PRECISION_FLOAT);
+	uint64_t stateBytes = mAutomaton->tickStateBytes();
+	TEST_LOG("Automaton: " << file);
+	TEST_LOG("Weights scaled by " << scale);
+	TEST_LOG(numTicks << " ticks");
+	TEST_LOG("Reduced: " << (neurons ? "neuron state" : "spike frames"));
+	for (Precision precision : reducedPrecisions)
+	{
+		auto firing = neurons ? runSave(file, scale, PRECISION_FLOAT, precision) : runSave(file, scale, precision, PRECISION_FLOAT);
+		int divergence = numTicks;
+		double worstDrift = 0.0;
+		double worstError = 0.0;
+		for (int ll = 0; ll < int(firing.size()); ++ll)
+		{
+			double expectTotal = 0.0;
+			double total = 0.0;
+			double error = 0.0;
+			for (int tick = 0; tick < numTicks; ++tick)
+			{
+				expectTotal += reference[ll][tick];
+				total += firing[ll][tick];
+				error += abs(firing[ll][tick] - reference[ll][tick]);
+				if (firing[ll][tick] != reference[ll][tick])
+				{
+					divergence = min(divergence, tick);
+				}
+			}
+			if (expectTotal > 0.0)
+			{
+				worstDrift = max(worstDrift, fabs(total - expectTotal) / expectTotal);
+				worstError = max(worstError, error / expectTotal);
+			}
+			else
+			{
+				TEST_EQUAL(total, 0.0);
+			}
+		}
+		TEST_LOG("Precision: " << precisionName(precision));
+		TEST_LOG("  First difference   : tick " << divergence);
+		TEST_LOG("  Worst firing drift : " << worstDrift * 100.0 << " %");
+		TEST_LOG("  Worst tick error   : " << worstError * 100.0 << " %");
+		TEST_LOG("  State per tick     : " << mAutomaton->tickStateBytes() / 1024 << " KB, " << stateBytes / 1024 << " KB at full precision");
+		TEST(worstDrift <= maxFiringDrift);
+	}
+}
@@ -0,0 +1,42 @@
+#ifndef TEST_PRECISION_H
+#define TEST_PRECISION_H
+
+#include "Test.h"
+
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+#include "NeuronSim/Automaton.h"
+
+// Checks the reduced precisions spike frames and neuron state can be stored
+// at, and measures how far the bundled saves drift from their behaviour at
+// full precision.
+class TestPrecision : public Test
+{
+public:
+	TestPrecision();
+	~TestPrecision();
+
+	std::string name() { return "Precision"; }
+	void run();
+
+private:
+	void testPackings();
+	void testSpikeTrain();
+	void testSetPrecision();
+	void testNeuronState();
+	// Compare a save at each reduced precision with it at full precision,
+	// reducing the precision of the state of the neurons if neurons is true
+	// and of the spike frames otherwise
+	void testAccuracy(const std::filesystem::path & file, float scale, bool neurons);
+
+	// Run a save, with its weights multiplied by scale, for a number of ticks
+	// and return the number of neurons which fired in each layer on each tick
+	std::vector<std::vector<int>> runSave(const std::filesystem::path & file, float scale, Precision precision, Precision neuronPrecision);
+
+private:
+	std::unique_ptr<Automaton> mAutomaton;
+};
+
+#endif
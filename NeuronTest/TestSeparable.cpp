@@ -0,0 +1,276 @@
+#include "TestSeparable.h"
+
+#include <cmath>
+#include <map>
+
+#include "NeuronSim/Layer.h"
+#include "NeuronSim/Separable.h"
+#include "NeuronSim/Spike.h"
+
+using namespace std;
+
+// Adds up everything fired at each neuron, separately for each delay
+class TotalSpiker : public Spiker
+{
+public:
+	void fire(const Spike & spike, int index, float weight, int delay) override
+	{
+		auto & totals = mTotals[delay];
+		totals.resize(max(totals.size(), size_t(index) + 1));
+		totals[index] += weight;
+	}
+	map<int, vector<float>> mTotals;
+};
+
+TestSeparable::TestSeparable()
+{
+}
+
+TestSeparable::~TestSeparable()
+{
+}
+
+void TestSeparable::run()
+{
+	Test::run();
+
+	testDecomposition();
+	testFiring();
+	testAutomaton();
+}
+
+void TestSeparable::testDecomposition()
+{
+	TEST_SUB;
+	const int WIDTH = 9;
+	const int HEIGHT = 7;
+	SynapseMatrix synapses(this);
+	synapses.setSize(WIDTH, HEIGHT);
+
+	// A Gaussian is exactly one term
+	auto gauss = [](int offset, float sigma) { return exp(-float(offset * offset) / (2.0f * sigma * sigma)); };
+	for (int row = 0; row < HEIGHT; ++row)
+	{
+		for (int col = 0; col < WIDTH; ++col)
+		{
+			synapses.synapse(col, row)->weight = 0.5f * gauss(row - HEIGHT / 2, 1.5f) * gauss(col - WIDTH / 2, 2.0f);
+		}
+	}
+	synapses.compile();
+	TEST_EQUAL(int(synapses.separable().terms().size()), 1);
+	TEST(synapses.separable().error() < 1e-6f);
+	float largest = 0.0f;
+	for (int row = 0; row < HEIGHT; ++row)
+	{
+		for (int col = 0; col < WIDTH; ++col)
+		{
+			auto & term = synapses.separable().terms()[0];
+			largest = max(largest, fabs(term.column[row] * term.row[col] - synapses.synapse(col, row)->weight));
+		}
+	}
+	TEST(largest < 1e-6f);
+
+	// Delays split the weights into separate terms, and rings of equal delay
+	// are not separable
+	synapses.setDelay(SynapseMatrix::DELAY_ONE);
+	TEST_EQUAL(int(synapses.separable().terms().size()), 1);
+	TEST_EQUAL(int(synapses.separable().terms()[0].delay), 1);
+	synapses.setDelay(SynapseMatrix::DELAY_LINEAR);
+	TEST(synapses.separable().empty());
+	synapses.setDelay(SynapseMatrix::DELAY_NONE);
+
+	// Turning the decomposition off
+	synapses.setSeparableTolerance(0.0f);
+	TEST(synapses.separable().empty());
+	synapses.setSeparableTolerance(1e-6f);
+	TEST(!synapses.separable().empty());
+
+	// A difference of Gaussians is two terms
+	for (int row = 0; row < HEIGHT; ++row)
+	{
+		for (int col = 0; col < WIDTH; ++col)
+		{
+			synapses.synapse(col, row)->weight = gauss(row - HEIGHT / 2, 1.0f) * gauss(col - WIDTH / 2, 1.0f) -
+				0.5f * gauss(row - HEIGHT / 2, 2.0f) * gauss(col - WIDTH / 2, 3.0f);
+		}
+	}
+	TEST(!synapses.isCompiled());
+	synapses.compile();
+	TEST(synapses.isCompiled());
+	TEST_EQUAL(int(synapses.separable().terms().size()), 2);
+	TEST(synapses.separable().error() < 1e-6f);
+
+	// The Game of Life neighbourhood is not worth decomposing, and neither
+	// are random weights
+	uint32_t life[] = { 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0xFF, 0xFF, 0xFF, 0xFF };
+	synapses.loadImage(life, 3, 3, 1.0f);
+	TEST(synapses.separable().empty());
+	synapses.setSize(WIDTH, HEIGHT);
+	uint32_t hash = 1;
+	for (int index = 0; index < WIDTH * HEIGHT; ++index)
+	{
+		hash = hash * 1664525 + 1013904223;
+		synapses.begin()[index].weight = float(hash >> 8) / float(1 << 24) - 0.5f;
+	}
+	synapses.compile();
+	TEST(synapses.separable().empty());
+
+	// Gaussian images are only separable to within the 8 bit rounding of
+	// their pixels
+	const int SIZE = 15;
+	vector<uint32_t> image(SIZE * SIZE);
+	for (int row = 0; row < SIZE; ++row)
+	{
+		for (int col = 0; col < SIZE; ++col)
+		{
+			image[row * SIZE + col] = uint32_t(lround(255.0f * gauss(row - SIZE / 2, 3.0f) * gauss(col - SIZE / 2, 3.0f)));
+		}
+	}
+	synapses.loadImage(&image[0], SIZE, SIZE, 1.0f);
+	TEST(synapses.separable().empty());
+	synapses.setSeparableTolerance(1e-2f);
+	TEST(!synapses.separable().empty());
+	TEST(synapses.separable().terms().size() <= 2);
+	TEST(synapses.separable().error() <= 1e-2f);
+}
+
+// Fire a busy layer through a decomposition, both from source rows and into
+// target rows, and compare with adding up every synapse directly.
+void TestSeparable::testFiring()
+{
+	TEST_SUB;
+	const int WIDTH = 70;
+	const int HEIGHT = 12;
+	const int MATRIX_WIDTH = 15;
+	const int MATRIX_HEIGHT = 8;
+	vector<Synapse> synapses(MATRIX_WIDTH * MATRIX_HEIGHT);
+	for (int row = 0; row < MATRIX_HEIGHT; ++row)
+	{
+		for (int col = 0; col < MATRIX_WIDTH; ++col)
+		{
+			float weight = float(1 + row % 3) * (col < 7 ? float(col - 3) : float(col & 3) - 1.5f);
+			synapses[row * MATRIX_WIDTH + col] = Synapse(weight, col < 7 ? 0 : 2);
+		}
+	}
+	Separable separable;
+	TEST(separable.decompose(&synapses[0], MATRIX_WIDTH, MATRIX_HEIGHT, 1e-6f));
+
+	int words = (WIDTH + 63) / 64;
+	vector<uint64_t> firing(words * HEIGHT);
+	map<int, vector<float>> expect;
+	uint32_t hash = 7;
+	for (int row = 0; row < HEIGHT; ++row)
+	{
+		for (int col = 0; col < WIDTH; ++col)
+		{
+			hash = hash * 1664525 + 1013904223;
+			if ((hash >> 16) % 3 == 0)
+			{
+				continue;
+			}
+			firing[row * words + col / 64] |= uint64_t(1) << (col % 64);
+			for (int sr = 0; sr < MATRIX_HEIGHT; ++sr)
+			{
+				for (int sc = 0; sc < MATRIX_WIDTH; ++sc)
+				{
+					int tr = (row + sr - MATRIX_HEIGHT / 2 + HEIGHT) % HEIGHT;
+					int tc = (col + sc - MATRIX_WIDTH / 2 + WIDTH) % WIDTH;
+					const Synapse & synapse = synapses[sr * MATRIX_WIDTH + sc];
+					expect[synapse.delay].resize(WIDTH * HEIGHT);
+					expect[synapse.delay][tr * WIDTH + tc] += synapse.weight;
+				}
+			}
+		}
+	}
+
+	auto compare = [&](TotalSpiker & spiker)
+	{
+		float error = 0.0f;
+		for (auto & delay : expect)
+		{
+			auto & totals = spiker.mTotals[delay.first];
+			totals.resize(WIDTH * HEIGHT);
+			for (int index = 0; index < WIDTH * HEIGHT; ++index)
+			{
+				error = max(error, fabs(totals[index] - delay.second[index]));
+			}
+		}
+		return error < 1e-3f && spiker.mTotals.size() == expect.size();
+	};
+
+	// Firing bands of rows, and gathering into bands of rows, which overlap
+	// the edges of the layer
+	Spike spike;
+	TotalSpiker scattered;
+	TotalSpiker gathered;
+	for (int rowBegin = 0; rowBegin < HEIGHT; rowBegin += 6)
+	{
+		int rowEnd = min(HEIGHT, rowBegin + 6);
+		TEST(separable.fire(spike, &scattered, &firing[0], WIDTH, HEIGHT,
+			rowBegin, rowEnd, rowBegin - MATRIX_HEIGHT / 2, rowEnd + MATRIX_HEIGHT - 1 - MATRIX_HEIGHT / 2));
+		TEST(separable.fire(spike, &gathered, &firing[0], WIDTH, HEIGHT,
+			rowBegin - (MATRIX_HEIGHT - 1) + MATRIX_HEIGHT / 2, rowEnd + MATRIX_HEIGHT / 2, rowBegin, rowEnd));
+	}
+	TEST(compare(scattered));
+	TEST(compare(gathered));
+}
+
+Test::LifeRun TestSeparable::decomposition(float tolerance)
+{
+	// The weights are exact in binary, and the decomposition of the
+	// separable matrix reproduces them exactly, so every total is the same
+	// however it is added up.
+	const int WIDTH = 48;
+	const int HEIGHT = 30;
+	LifeRun run;
+	run.width = WIDTH;
+	run.height = HEIGHT;
+	run.build = [tolerance](Automaton & automaton)
+	{
+		automaton.setFftPolicy(Automaton::FFT_NEVER);
+		auto layer = automaton.createLayer();
+
+		const float column[] = { 0.125f, 0.25f, 0.5f, 1.0f, 0.5f, 0.25f, 0.125f };
+		const float row[] = { 0.25f, -0.25f, 0.5f, -0.5f, 0.75f, -0.75f, 1.0f, 0.0f, 1.0f, -0.75f, 0.75f, -0.5f, 0.5f, -0.25f, 0.25f };
+		auto separable = automaton.createSynapse();
+		separable->setSource(layer);
+		separable->setTarget(layer);
+		separable->setSize(15, 7);
+		separable->setDelay(SynapseMatrix::DELAY_ONE);
+		for (int sr = 0; sr < 7; ++sr)
+		{
+			for (int sc = 0; sc < 15; ++sc)
+			{
+				separable->synapse(sc, sr)->weight = 0.25f * column[sr] * row[sc];
+			}
+		}
+		separable->setSeparableTolerance(tolerance);
+
+		uint32_t life[] = { 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0xFF, 0xFF, 0xFF, 0xFF };
+		auto neighbours = automaton.createSynapse();
+		neighbours->setSource(layer);
+		neighbours->setTarget(layer);
+		neighbours->loadImage(life, 3, 3, 1.0f);
+	};
+	run.before = [](Automaton & automaton, int tick)
+	{
+		for (int cell = tick % 2; cell < WIDTH * HEIGHT; cell += 2 + tick % 3)
+		{
+			automaton.layers()[0]->inject(cell % WIDTH, cell / WIDTH, 2.5f);
+		}
+	};
+	// The separable matrix is the first one created
+	run.after = [this, tolerance](Automaton & automaton, int)
+	{
+		TEST_EQUAL(int(automaton.synapses()[0]->separable().terms().size()), tolerance > 0.0f ? 1 : 0);
+	};
+	return run;
+}
+
+// Firing through the decomposition must give exactly the same spikes as
+// firing directly, with every scheduler and propagation.
+void TestSeparable::testAutomaton()
+{
+	TEST_SUB;
+	testSchedules(decomposition(0.0f), { decomposition(1e-6f) });
+}
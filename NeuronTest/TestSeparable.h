@@ -0,0 +1,30 @@
+#ifndef TEST_SEPARABLE_H
+#define TEST_SEPARABLE_H
+
+#include "Test.h"
+
+#include "NeuronSim/Automaton.h"
+#include "NeuronSim/SynapseMatrix.h"
+
+class TestSeparable : public Test, public SynapseMatrix::Listener
+{
+public:
+	TestSeparable();
+	~TestSeparable();
+
+	std::string name() { return "Separable"; }
+	void run();
+
+private:
+	void testDecomposition();
+	void testFiring();
+	void testAutomaton();
+	void synapseMatrixChanged(SynapseMatrix * matrix) override {}
+
+	// A Life layer with a separable and a non separable matrix, kept busy
+	// with injected spikes, which checks on every tick that the separable
+	// matrix is decomposed if and only if the tolerance allows it.
+	LifeRun decomposition(float tolerance);
+};
+
+#endif
@@ -0,0 +1,157 @@
+#include "TestSimd.h"
+
+#include <cmath>
+#include <random>
+
+#include "NeuronSim/ConfigSet.h"
+#include "NeuronSim/Izhikevich.h"
+#include "NeuronSim/Kumar.h"
+#include "NeuronSim/Life.h"
+#include "NeuronSim/LinearLif.h"
+#include "NeuronSim/NeuronLif.h"
+#include "NeuronSim/Simd.h"
+#include "NeuronSim/TrueNorth.h"
+
+using namespace std;
+
+// An odd size, so that every row ends in a partial vector and a partial
+// word of firing flags.
+static const int WIDTH(83);
+static const int HEIGHT(7);
+static const int STEPS(20);
+
+TestSimd::TestSimd()
+{
+}
+
+TestSimd::~TestSimd()
+{
+}
+
+void TestSimd::run()
+{
+	Test::run();
+
+	testLevels();
+	testModels();
+	testTrueNorthModes();
+
+	setSimdLevel(supportedSimdLevel());
+}
+
+// The level can be lowered for comparisons but never raised beyond what the
+// CPU supports.
+void TestSimd::testLevels()
+{
+	TEST_SUB;
+	SimdLevel supported = supportedSimdLevel();
+	TEST_LOG("Supported: " << simdLevelName(supported));
+	TEST_EQUAL(simdLevel(), supported);
+	setSimdLevel(SIMD_SCALAR);
+	TEST_EQUAL(simdLevel(), SIMD_SCALAR);
+	setSimdLevel(SIMD_AVX512);
+	TEST_EQUAL(simdLevel(), supported);
+}
+
+template <typename Model, typename Neuron>
+void TestSimd::compareModel(Model & scalar, Model & simd, const vector<float Neuron::*> & fields, bool hasShunt, float inputScale, float tolerance)
+{
+	for (int level = SIMD_AVX2; level <= supportedSimdLevel(); ++level)
+	{
+		mt19937 random(1234);
+		uniform_real_distribution<float> inputs(-0.25f * inputScale, inputScale);
+		uniform_real_distribution<float> shunts(1.0f, 2.0f);
+		int mismatches = 0;
+		for (int step = 0; step < STEPS; ++step)
+		{
+			// Both layers start each step from the scalar state, so that the
+			// tolerance does not compound from step to step.
+			for (int index = 0; index < WIDTH * HEIGHT; ++index)
+			{
+				Neuron neuron = scalar.neuron(index);
+				neuron.input = inputs(random);
+				if (hasShunt)
+				{
+					neuron.shunt = shunts(random);
+				}
+				scalar.setNeuron(index, neuron);
+				simd.setNeuron(index, neuron);
+			}
+			setSimdLevel(SIMD_SCALAR);
+			scalar.tickRows(0, HEIGHT);
+			setSimdLevel(SimdLevel(level));
+			simd.tickRows(0, HEIGHT);
+
+			for (int index = 0; index < WIDTH * HEIGHT; ++index)
+			{
+				Neuron left = scalar.neuron(index);
+				Neuron right = simd.neuron(index);
+				bool match = left.firing == right.firing;
+				for (auto field : fields)
+				{
+					float difference = fabs(left.*field - right.*field);
+					match = match && (left.*field == right.*field || difference <= tolerance * max(1.0f, fabs(left.*field)));
+				}
+				mismatches += match ? 0 : 1;
+			}
+		}
+		TEST_LOG(scalar.typeName() << " " << simdLevelName(SimdLevel(level)) << " mismatches: " << mismatches);
+		TEST_EQUAL(mismatches, 0);
+	}
+}
+
+// Every model gives exactly the same results as its scalar version, apart
+// from Kumar which uses an approximate vector exp.
+void TestSimd::testModels()
+{
+	TEST_SUB;
+	{
+		Life scalar(WIDTH, HEIGHT);
+		Life simd(WIDTH, HEIGHT);
+		compareModel<Life, NeuronLife>(scalar, simd, { &NeuronLife::input, &NeuronLife::shunt }, true, 5.0f, 0.0f);
+	}
+	{
+		LinearLif scalar(WIDTH, HEIGHT);
+		LinearLif simd(WIDTH, HEIGHT);
+		compareModel<LinearLif, NeuronLif>(scalar, simd, { &NeuronLif::input, &NeuronLif::shunt, &NeuronLif::potential }, true, 2.0f, 0.0f);
+	}
+	{
+		Izhikevich scalar(WIDTH, HEIGHT);
+		Izhikevich simd(WIDTH, HEIGHT);
+		compareModel<Izhikevich, NeuronIzhikevich>(scalar, simd, { &NeuronIzhikevich::input, &NeuronIzhikevich::shunt, &NeuronIzhikevich::v, &NeuronIzhikevich::u }, true, 20.0f, 0.0f);
+	}
+	{
+		Kumar scalar(WIDTH, HEIGHT);
+		Kumar simd(WIDTH, HEIGHT);
+		compareModel<Kumar, NeuronKumar>(scalar, simd, { &NeuronKumar::input, &NeuronKumar::v, &NeuronKumar::u }, false, 1.0f, 1e-5f);
+	}
+}
+
+// TrueNorth chooses between several reset behaviours, which the SIMD
+// versions implement with blends.
+void TestSimd::testTrueNorthModes()
+{
+	TEST_SUB;
+	for (int leakReversal = 0; leakReversal < 2; ++leakReversal)
+	{
+		for (int resetOrSaturate = 0; resetOrSaturate < 2; ++resetOrSaturate)
+		{
+			for (int resetMode = 0; resetMode < 3; ++resetMode)
+			{
+				TrueNorth scalar(WIDTH, HEIGHT);
+				ConfigSet config = scalar.getConfig();
+				config["leak_reversal"] = leakReversal;
+				config["leak_weight"] = -0.5f;
+				config["positive_threshold"] = 4.0f;
+				config["negative_threshold"] = 3.0f;
+				config["reset_voltage"] = 1.0f;
+				config["reset_or_saturate"] = resetOrSaturate;
+				config["reset_mode"] = resetMode;
+				scalar.setConfig(config);
+				TrueNorth simd(WIDTH, HEIGHT);
+				simd.setConfig(config);
+				compareModel<TrueNorth, NeuronTrueNorth>(scalar, simd, { &NeuronTrueNorth::input, &NeuronTrueNorth::v }, false, 4.0f, 0.0f);
+			}
+		}
+	}
+}
@@ -0,0 +1,29 @@
+#ifndef TEST_SIMD_H
+#define TEST_SIMD_H
+
+#include "Test.h"
+
+#include <vector>
+
+class TestSimd : public Test
+{
+public:
+	TestSimd();
+	~TestSimd();
+
+	std::string name() { return "Simd"; }
+	void run();
+
+private:
+	void testLevels();
+	void testModels();
+	void testTrueNorthModes();
+
+	// Tick two copies of a layer from the same random states, one with the
+	// scalar implementation and one with each of the SIMD implementations,
+	// and check they agree to within a relative tolerance on every field.
+	template <typename Model, typename Neuron>
+	void compareModel(Model & scalar, Model & simd, const std::vector<float Neuron::*> & fields, bool hasShunt, float inputScale, float tolerance);
+};
+
+#endif
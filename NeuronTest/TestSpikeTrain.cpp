@@ -2,6 +2,10 @@
 
 #include "NeuronSim/SpikeTrain.h"
 #include "NeuronSim/Life.h"
+#include "NeuronSim/Spike.h"
+
+#include <cmath>
+#include <vector>
 
 using namespace std;
 
@@ -21,13 +25,24 @@ void TestSpikeTrain::run()
 	testSpike();
 	testClear();
 	testCircularBuffer();
+	testSegment();
+	testRuns();
+	testModes();
+	testFireAhead();
+	testSetDelay();
+	testChannels();
+	testAbsorb();
+	testPieces();
+	testLaneBytes();
+	testTrace();
+	testDenseLanes();
 }
 
 // Fires a spike and verifies that the spike is received by the target
 // in the expected manner and time.
 void TestSpikeTrain::testSpike()
 {
-	mLayer->begin()->input = 0.0f;
+	mLayer->field(&NeuronLife::input)[0] = 0.0f;
 	float expected[] = { 0.0f, 0.5f / 1.5f, 2.0f / 1.5f, 2.5f / 1.5f, 2.5f / 1.5f };
 
 	SpikeTrain proc(mLayer, mLayer, 4, false);
@@ -37,7 +52,7 @@ void TestSpikeTrain::testSpike()
 
 	for (auto expect : expected)
 	{
-		TEST_APPROX_EQUAL(mLayer->begin()->input, expect);
+		TEST_APPROX_EQUAL(mLayer->neuron(0).input, expect);
 		proc.tick();
 	}
 }
@@ -45,7 +60,7 @@ void TestSpikeTrain::testSpike()
 // Checks that spikes are removed when the processor is cleared
 void TestSpikeTrain::testClear()
 {
-	mLayer->begin()->input = 0.0f;
+	mLayer->field(&NeuronLife::input)[0] = 0.0f;
 	float expected[] = { 0.0f, 0.0f, 0.0f };
 
 	SpikeTrain proc(mLayer, mLayer, 4, false);
@@ -56,7 +71,7 @@ void TestSpikeTrain::testClear()
 
 	for (auto expect : expected)
 	{
-		TEST_APPROX_EQUAL(mLayer->begin()->input, expect);
+		TEST_APPROX_EQUAL(mLayer->neuron(0).input, expect);
 		proc.tick();
 	}
 }
@@ -66,7 +81,7 @@ void TestSpikeTrain::testClear()
 // Verify that old spikes do not "resurrect".
 void TestSpikeTrain::testCircularBuffer()
 {
-	mLayer->begin()->input = 0.0f;
+	mLayer->field(&NeuronLife::input)[0] = 0.0f;
 	float expect[] = { 0.0f, 0.25f, 1.0f, 1.75f, 2.0f, 2.0f };
 
 	const int frameSize(10);
@@ -85,11 +100,598 @@ void TestSpikeTrain::testCircularBuffer()
 	}
 
 	// Fire a spike that wraps around the buffer
-	mLayer->begin()->input = 0.0f;
+	mLayer->field(&NeuronLife::input)[0] = 0.0f;
 	proc.fire(spike, 0, 1.0f, 0);
-	for (int tt = 0; tt < sizeof(expect) / sizeof(float); ++tt)
+	for (int tt = 0; tt < int(sizeof(expect) / sizeof(float)); ++tt)
+	{
+		TEST_APPROX_EQUAL(mLayer->neuron(0).input, expect[tt]);
+		proc.tick();
+	}
+}
+
+// Firing a segment of synapses must have exactly the same effect as firing
+// each synapse individually, including when the delays vary along the
+// segment and the spikes wrap around the end of the buffer.
+void TestSpikeTrain::testSegment()
+{
+	const int width = 8;
+	auto layer = make_shared<Life>(width, 1);
+	Spike spike;
+	spike.setSpike(Spike::SHAPE_TRIANGLE, 3);
+	Synapse synapses[width - 2];
+	for (int ii = 0; ii < width - 2; ++ii)
+	{
+		synapses[ii] = Synapse(float(ii + 1), ii / 2);
+	}
+
+	vector<float> inputs[2];
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		SpikeTrain proc(layer, layer, 6, false);
+		for (int tt = 0; tt < 4; ++tt)
+		{
+			proc.tick();
+		}
+		for (int ii = 0; ii < width - 2; ++ii)
+		{
+			if (pass == 0)
+			{
+				proc.fire(spike, ii + 1, synapses[ii].weight, synapses[ii].delay);
+			}
+		}
+		if (pass == 1)
+		{
+			proc.fireSegment(spike, 1, width - 2, synapses);
+		}
+		for (int tt = 0; tt < 7; ++tt)
+		{
+			layer->clear();
+			proc.tick();
+			for (int index = 0; index < width; ++index)
+			{
+				inputs[pass].push_back(layer->neuron(index).input);
+			}
+		}
+	}
+	TEST(inputs[0] == inputs[1]);
+}
+
+// Firing several runs with one delay must have exactly the same effect as
+// firing each synapse individually, in rows of both sparse and dense trains,
+// and so must firing the same runs with their weights as codes.
+void TestSpikeTrain::testRuns()
+{
+	const int width = 8;
+	const int height = 3;
+	auto layer = make_shared<Life>(width, height);
+	Spike spike;
+	spike.setSpike(Spike::SHAPE_TRIANGLE, 3);
+	const float weights[] = { 1.0f, -2.0f, 3.0f, 0.0f, 5.0f, 6.0f };
+	const WeightRun runs[] = { { 1, 3, weights }, { width + 6, 2, weights + 3 }, { 2 * width, 1, weights + 5 } };
+	const CompactScale scale = { 0.5f, 128 };
+	const uint8_t codes[] = { 130, 124, 134, 128, 138, 140 };
+	const CodeRun codeRuns[] = { { 1, 3, codes }, { width + 6, 2, codes + 3 }, { 2 * width, 1, codes + 5 } };
+
+	for (bool busy : { false, true })
+	{
+		vector<float> inputs[3];
+		for (int pass = 0; pass < 3; ++pass)
+		{
+			SpikeTrain proc(layer, layer, 6, false);
+			for (int tt = 0; tt < 4; ++tt)
+			{
+				proc.tick();
+			}
+			if (busy)
+			{
+				for (int cell = 0; cell < width * height; ++cell)
+				{
+					proc.fire(spike, cell, 1.0f, 1);
+				}
+				proc.tick();
+			}
+			TEST_EQUAL(proc.mode(), busy ? SpikeTrain::MODE_DENSE : SpikeTrain::MODE_SPARSE);
+			if (pass == 0)
+			{
+				for (auto & run : runs)
+				{
+					for (int ii = 0; ii < run.count; ++ii)
+					{
+						proc.fire(spike, run.index + ii, run.weights[ii], 2);
+					}
+				}
+			}
+			else if (pass == 1)
+			{
+				proc.fireRuns(spike, runs, 3, 2);
+			}
+			else
+			{
+				proc.fireCodes(spike, codeRuns, 3, 2, scale);
+			}
+			for (int tt = 0; tt < 7; ++tt)
+			{
+				layer->clear();
+				proc.tick();
+				for (int index = 0; index < width * height; ++index)
+				{
+					inputs[pass].push_back(layer->neuron(index).input);
+				}
+			}
+		}
+		TEST(inputs[0] == inputs[1]);
+		TEST(inputs[0] == inputs[2]);
+	}
+}
+
+// A busy train must change to dense frames, and back to sparse events once
+// it has been quiet for long enough, without losing any spikes on the way.
+void TestSpikeTrain::testModes()
+{
+	const int size = 8;
+	const int depth = 4;
+	auto layer = make_shared<Life>(size, size);
+	SpikeTrain proc(layer, layer, depth - 1, false);
+	Spike spike;
+	spike.setSpike(Spike::SHAPE_SQUARE, 1);
+	TEST_EQUAL(proc.mode(), SpikeTrain::MODE_SPARSE);
+
+	// One spike in flight for every neuron is well over the threshold
+	for (int cell = 0; cell < size * size; ++cell)
+	{
+		proc.fire(spike, cell, 1.0f, 1);
+	}
+	proc.fire(spike, 3, 2.0f, 2);
+	proc.tick();
+	TEST_EQUAL(proc.mode(), SpikeTrain::MODE_DENSE);
+	TEST_EQUAL(proc.modeSwitches(), 1);
+
+	layer->clear();
+	proc.tick();
+	TEST_EQUAL(layer->neuron(0).input, 1.0f);
+	TEST_EQUAL(layer->neuron(size * size - 1).input, 1.0f);
+
+	// Quiet for a whole trip around the buffer
+	layer->clear();
+	for (int tt = 0; tt < depth; ++tt)
+	{
+		proc.tick();
+	}
+	TEST_EQUAL(proc.mode(), SpikeTrain::MODE_SPARSE);
+	TEST_EQUAL(proc.modeSwitches(), 2);
+	TEST_EQUAL(layer->neuron(3).input, 2.0f);
+	TEST_EQUAL(layer->neuron(4).input, 0.0f);
+
+	proc.fire(spike, 5, 1.5f, 0);
+	layer->clear();
+	proc.tick();
+	TEST_EQUAL(layer->neuron(5).input, 1.5f);
+}
+
+// Spikes fired ahead of delivering the current frame must arrive at the same
+// times as spikes fired after it, even with the longest delay the train
+// holds, whether the train is sparse or busy enough to become dense.
+void TestSpikeTrain::testFireAhead()
+{
+	const int size = 8;
+	const int delay = 2;
+	const int duration = 2;
+	Spike spike;
+	spike.setSpike(Spike::SHAPE_SQUARE, duration);
+	for (int cells : { 3, size * size })
+	{
+		vector<float> inputs[2];
+		for (int pass = 0; pass < 2; ++pass)
+		{
+			auto layer = make_shared<Life>(size, size);
+			SpikeTrain proc(layer, layer, delay + duration - 1, false);
+			if (pass == 1)
+			{
+				proc.fireAhead();
+			}
+			else
+			{
+				proc.deliver(0, size);
+				proc.advance();
+			}
+			for (int cell = 0; cell < cells; ++cell)
+			{
+				proc.fire(spike, cell, float(cell + 1), cell % (delay + 1));
+			}
+			if (pass == 1)
+			{
+				proc.deliver(0, size);
+				proc.advance();
+			}
+			// Nothing fired can have been in the frame delivered first
+			for (int cell = 0; cell < size * size; ++cell)
+			{
+				inputs[pass].push_back(layer->neuron(cell).input);
+			}
+			for (int tt = 0; tt <= delay + duration; ++tt)
+			{
+				layer->clear();
+				proc.tick();
+				for (int cell = 0; cell < size * size; ++cell)
+				{
+					inputs[pass].push_back(layer->neuron(cell).input);
+				}
+			}
+		}
+		TEST(inputs[0] == inputs[1]);
+	}
+}
+
+// Changing the delay of a train must leave the spikes in transit arriving at
+// the same times as in a train made long enough to begin with, whether the
+// delay grows or shrinks, and whether the train is sparse or dense.
+void TestSpikeTrain::testSetDelay()
+{
+	const int size = 8;
+	const int delay = 4;
+	Spike spike;
+	spike.setSpike(Spike::SHAPE_SQUARE, 1);
+	for (int cells : { 3, size * size })
+	{
+		vector<float> inputs[2];
+		for (int pass = 0; pass < 2; ++pass)
+		{
+			auto layer = make_shared<Life>(size, size);
+			SpikeTrain proc(layer, layer, pass == 0 ? delay : 1, false);
+			for (int cell = 0; cell < cells; ++cell)
+			{
+				proc.fire(spike, cell, float(cell + 1), cell % 2);
+			}
+			layer->clear();
+			proc.tick();
+			inputs[pass].push_back(layer->neuron(0).input);
+			if (pass == 1)
+			{
+				proc.setDelay(delay);
+			}
+			for (int cell = 0; cell < cells; ++cell)
+			{
+				proc.fire(spike, cell, float(cell + 2), cell % (delay + 1));
+			}
+			if (pass == 1)
+			{
+				// Frames holding spikes delay + 1 ticks away must be kept
+				proc.setDelay(1);
+			}
+			for (int tt = 0; tt <= delay + 1; ++tt)
+			{
+				layer->clear();
+				proc.tick();
+				for (int cell = 0; cell < size * size; ++cell)
+				{
+					inputs[pass].push_back(layer->neuron(cell).input);
+				}
+			}
+		}
+		TEST(inputs[0] == inputs[1]);
+	}
+}
+
+// A merged train must deliver the spikes fired through it to the inputs of
+// its target, and those fired through shunts() to the shunts, just as a pair
+// of trains would, whether the train is sparse or dense.
+void TestSpikeTrain::testChannels()
+{
+	const int size = 8;
+	const int delay = 2;
+	Spike spike;
+	spike.setSpike(Spike::SHAPE_SQUARE, 1);
+	for (int cells : { 3, size * size })
+	{
+		vector<float> received[2];
+		for (int pass = 0; pass < 2; ++pass)
+		{
+			auto layer = make_shared<Life>(size, size);
+			SpikeTrain inputs(layer, layer, delay, false);
+			SpikeTrain shunts(layer, layer, delay, true);
+			SpikeTrain merged(layer, delay, true);
+			TEST_EQUAL(merged.channels(), 2);
+			Spiker * inputSpiker = pass == 0 ? static_cast<Spiker *>(&inputs) : &merged;
+			Spiker * shuntSpiker = pass == 0 ? static_cast<Spiker *>(&shunts) : merged.shunts();
+			for (int cell = 0; cell < cells; ++cell)
+			{
+				inputSpiker->fire(spike, cell, float(cell + 1), cell % (delay + 1));
+				shuntSpiker->fire(spike, size * size - 1 - cell, 0.25f * (cell + 1), cell % delay);
+			}
+			float weights[3] = { 0.5f, 0.25f, 0.75f };
+			shuntSpiker->fireWeights(spike, size, 3, weights, 1);
+			for (int tt = 0; tt <= delay; ++tt)
+			{
+				layer->clear();
+				if (pass == 0)
+				{
+					inputs.tick();
+					shunts.tick();
+				}
+				else
+				{
+					merged.tick();
+				}
+				for (int cell = 0; cell < size * size; ++cell)
+				{
+					received[pass].push_back(layer->neuron(cell).input);
+					received[pass].push_back(layer->neuron(cell).shunt);
+				}
+			}
+		}
+		TEST(received[0] == received[1]);
+	}
+	auto layer = make_shared<Life>(size, size);
+	SpikeTrain merged(layer, delay, false);
+	TEST_EQUAL(merged.channels(), 1);
+	TEST(merged.shunts() == nullptr);
+}
+
+// Spikes in transit along a pair of trains must arrive at the same times
+// once they have been absorbed into a merged train, whether either train is
+// sparse or dense.
+void TestSpikeTrain::testAbsorb()
+{
+	const int size = 8;
+	const int delay = 3;
+	Spike spike;
+	spike.setSpike(Spike::SHAPE_SQUARE, 1);
+	for (int cells : { 3, size * size })
+	{
+		for (bool dense : { false, true })
+		{
+			vector<float> received[2];
+			for (int pass = 0; pass < 2; ++pass)
+			{
+				auto layer = make_shared<Life>(size, size);
+				SpikeTrain inputs(layer, layer, delay, false);
+				SpikeTrain shunts(layer, layer, delay, true);
+				SpikeTrain merged(layer, 1, true);
+				if (dense)
+				{
+					// Enough spikes for every train to become dense
+					for (int cell = 0; cell < size * size; ++cell)
+					{
+						inputs.fire(spike, cell, 1.0f, 0);
+						shunts.fire(spike, cell, 1.0f, 0);
+						merged.fire(spike, cell, 1.0f, 0);
+						merged.shunts()->fire(spike, cell, 1.0f, 0);
+					}
+					layer->clear();
+					inputs.tick();
+					shunts.tick();
+					merged.tick();
+				}
+				for (int cell = 0; cell < cells; ++cell)
+				{
+					inputs.fire(spike, cell, float(cell + 1), cell % (delay + 1));
+					shunts.fire(spike, cell, 0.5f * (cell + 1), (cell + 1) % (delay + 1));
+				}
+				if (pass == 1)
+				{
+					merged.absorb(inputs);
+					merged.absorb(shunts);
+				}
+				for (int tt = 0; tt <= delay; ++tt)
+				{
+					layer->clear();
+					if (pass == 0)
+					{
+						inputs.tick();
+						shunts.tick();
+					}
+					else
+					{
+						merged.tick();
+					}
+					for (int cell = 0; cell < size * size; ++cell)
+					{
+						received[pass].push_back(layer->neuron(cell).input);
+						received[pass].push_back(layer->neuron(cell).shunt);
+					}
+				}
+			}
+			TEST(received[0] == received[1]);
+		}
+	}
+}
+
+// Spikes of every shape must deliver exactly the same potentials whether
+// the train starts out sparse or dense, including spikes which are still in
+// the lane when the train changes mode, and nothing at all once the last of
+// them has ended. The potentials must also follow the shape of the spike.
+void TestSpikeTrain::testPieces()
+{
+	const int size = 4;
+	const int cells = size * size;
+	const int delay = 2;
+	Spike busy;
+	busy.setSpike(Spike::SHAPE_SQUARE, 1);
+	for (auto shape : { Spike::SHAPE_SQUARE, Spike::SHAPE_TRIANGLE, Spike::SHAPE_EXPONENTIAL })
+	{
+		for (int duration : { 3, 8, 20 })
+		{
+			Spike spike;
+			spike.setSpike(shape, duration);
+			const int firing = 3 * duration;
+			const int ended = firing + delay + duration - 1;
+			const int ticks = ended + 2 * duration;
+			vector<float> received[2];
+			bool matches = true;
+			bool silent = true;
+			for (int pass = 0; pass < 2; ++pass)
+			{
+				auto layer = make_shared<Life>(size, size);
+				SpikeTrain proc(layer, layer, delay + duration - 1, false);
+				// Enough spikes for the train to become dense, which have all
+				// been delivered before the ones being compared are fired
+				for (int fired = 0; pass == 1 && fired < 3 * cells; ++fired)
+				{
+					proc.fire(busy, fired % cells, 1.0f, 1);
+				}
+				proc.tick();
+				proc.tick();
+				TEST_EQUAL(proc.mode(), pass == 0 ? SpikeTrain::MODE_SPARSE : SpikeTrain::MODE_DENSE);
+				vector<float> expected(size_t(ticks) * cells, 0.0f);
+				for (int tt = 0; tt < ticks; ++tt)
+				{
+					// Every cell fires on one tick, which makes the train dense
+					int count = (tt >= firing) ? 0 : (tt == duration) ? cells : 2;
+					for (int fired = 0; fired < count; ++fired)
+					{
+						int cell = (tt + fired * 5) % cells;
+						float weight = 0.5f + 0.25f * fired;
+						proc.fire(spike, cell, weight, delay);
+						for (int offset = 0; offset < duration; ++offset)
+						{
+							expected[size_t(tt + delay + offset) * cells + cell] += weight * spike.potential(offset);
+						}
+					}
+					layer->clear();
+					proc.tick();
+					for (int cell = 0; cell < cells; ++cell)
+					{
+						float input = layer->neuron(cell).input;
+						received[pass].push_back(input);
+						matches = matches && approxEqual(input, expected[size_t(tt) * cells + cell]);
+						silent = silent && (tt < ended || input == 0.0f);
+					}
+				}
+				TEST(proc.empty());
+				TEST(duration < 20 || proc.modeSwitches() > 0);
+			}
+			TEST(received[0] == received[1]);
+			TEST(matches);
+			TEST(silent);
+		}
+	}
+}
+
+// The memory a sparse train holds for a square or exponential spike must not
+// depend on how long the spike is.
+void TestSpikeTrain::testLaneBytes()
+{
+	const int size = 4;
+	for (auto shape : { Spike::SHAPE_SQUARE, Spike::SHAPE_EXPONENTIAL })
+	{
+		vector<uint64_t> bytes;
+		for (int duration : { 40, 320 })
+		{
+			auto layer = make_shared<Life>(size, size);
+			Spike spike;
+			spike.setSpike(shape, duration);
+			SpikeTrain proc(layer, layer, duration - 1, false);
+			proc.fire(spike, 5, 1.0f, 0);
+			bytes.push_back(proc.bytes());
+			TEST_EQUAL(proc.mode(), SpikeTrain::MODE_SPARSE);
+		}
+		TEST_EQUAL(bytes[0], bytes[1]);
+	}
+}
+
+// Long exponential spikes decay in the lanes, and must deliver their
+// potentials to within the rounding of the potentials as floats, in both
+// modes, and nothing at all once the last of them has ended.
+void TestSpikeTrain::testTrace()
+{
+	const int size = 4;
+	const int cells = size * size;
+	const int delay = 1;
+	// Relative to the total of the potentials a neuron receives
+	const float TOLERANCE = 1.0e-6f;
+	Spike busy;
+	busy.setSpike(Spike::SHAPE_SQUARE, 1);
+	for (int duration : { 40, 400 })
+	{
+		Spike spike;
+		spike.setSpike(Spike::SHAPE_EXPONENTIAL, duration);
+		const int firing = duration / 2;
+		const int ended = firing + delay + duration - 1;
+		for (int pass = 0; pass < 2; ++pass)
+		{
+			auto layer = make_shared<Life>(size, size);
+			SpikeTrain proc(layer, layer, delay + duration - 1, false);
+			for (int fired = 0; pass == 1 && fired < (delay + duration) * cells / 8; ++fired)
+			{
+				proc.fire(busy, fired % cells, 1.0f, 1);
+			}
+			proc.tick();
+			proc.tick();
+			TEST_EQUAL(proc.mode(), pass == 0 ? SpikeTrain::MODE_SPARSE : SpikeTrain::MODE_DENSE);
+			vector<double> expected(size_t(ended + 2) * cells, 0.0);
+			vector<double> magnitude(expected.size(), 0.0);
+			bool matches = true;
+			bool silent = true;
+			for (int tt = 0; tt < ended + 2; ++tt)
+			{
+				for (int fired = 0; tt < firing && fired < 3; ++fired)
+				{
+					int cell = (tt * 7 + fired * 5) % cells;
+					float weight = (fired == 1) ? -0.75f : 0.5f + 0.125f * (tt % 5);
+					proc.fire(spike, cell, weight, delay);
+					for (int offset = 0; offset < duration; ++offset)
+					{
+						size_t index = size_t(tt + delay + offset) * cells + cell;
+						expected[index] += weight * spike.potential(offset);
+						magnitude[index] += fabs(weight * spike.potential(offset));
+					}
+				}
+				layer->clear();
+				proc.tick();
+				for (int cell = 0; cell < cells; ++cell)
+				{
+					double input = layer->neuron(cell).input;
+					size_t index = size_t(tt) * cells + cell;
+					matches = matches && fabs(input - expected[index]) <= TOLERANCE * magnitude[index];
+					silent = silent && (tt < ended || input == 0.0);
+				}
+			}
+			TEST(matches);
+			TEST(silent);
+			TEST(proc.empty());
+		}
+	}
+}
+
+// A dense train must keep long pieces of spikes in its lanes rather than its
+// frames, so it becomes sparse again as if they were not there, and still
+// delivers all of them.
+void TestSpikeTrain::testDenseLanes()
+{
+	const int size = 4;
+	const int cells = size * size;
+	const int duration = 40;
+	auto layer = make_shared<Life>(size, size);
+	Spike busy;
+	busy.setSpike(Spike::SHAPE_SQUARE, 1);
+	Spike spike;
+	spike.setSpike(Spike::SHAPE_SQUARE, duration);
+	SpikeTrain proc(layer, layer, duration - 1, false);
+	for (int fired = 0; fired < 5 * cells; ++fired)
+	{
+		proc.fire(busy, fired % cells, 1.0f, 1);
+	}
+	proc.tick();
+	proc.tick();
+	TEST_EQUAL(proc.mode(), SpikeTrain::MODE_DENSE);
+	for (int cell = 0; cell < cells; ++cell)
+	{
+		proc.fire(spike, cell, 0.5f, 0);
+	}
+	bool delivered = true;
+	for (int tt = 0; tt < duration; ++tt)
 	{
-		TEST_APPROX_EQUAL(mLayer->begin()->input, expect[tt]);
+		layer->clear();
 		proc.tick();
+		for (int cell = 0; cell < cells; ++cell)
+		{
+			delivered = delivered && layer->neuron(cell).input == 0.5f;
+		}
 	}
+	TEST(delivered);
+	TEST_EQUAL(proc.mode(), SpikeTrain::MODE_SPARSE);
+	layer->clear();
+	proc.tick();
+	TEST(proc.empty());
+	TEST_EQUAL(layer->neuron(0).input, 0.0f);
 }
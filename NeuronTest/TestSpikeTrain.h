@@ -18,6 +18,17 @@ private:
 	void testSpike();
 	void testClear();
 	void testCircularBuffer();
+	void testSegment();
+	void testRuns();
+	void testModes();
+	void testFireAhead();
+	void testSetDelay();
+	void testChannels();
+	void testAbsorb();
+	void testPieces();
+	void testLaneBytes();
+	void testTrace();
+	void testDenseLanes();
 
 private:
 	std::shared_ptr<Life> mLayer;
@@ -0,0 +1,400 @@
+#include "TestStencil.h"
+
+#include <cmath>
+#include <map>
+
+#include "NeuronSim/Layer.h"
+#include "NeuronSim/Spike.h"
+#include "NeuronSim/Stencil.h"
+
+using namespace std;
+
+// Adds up everything fired at each neuron, separately for each delay
+class StencilSpiker : public Spiker
+{
+public:
+	void fire(const Spike & spike, int index, float weight, int delay) override
+	{
+		auto & totals = mTotals[delay];
+		totals.resize(max(totals.size(), size_t(index) + 1));
+		totals[index] += weight;
+	}
+	map<int, vector<float>> mTotals;
+};
+
+TestStencil::TestStencil()
+{
+}
+
+TestStencil::~TestStencil()
+{
+}
+
+void TestStencil::run()
+{
+	Test::run();
+
+	testBuild();
+	testFiring();
+	testFixed();
+	testAutomaton();
+	testCompact();
+}
+
+void TestStencil::testBuild()
+{
+	TEST_SUB;
+	// Zero weights split the runs, and so do changes of delay, and the runs
+	// are grouped by delay
+	const int WIDTH = 5;
+	const int HEIGHT = 3;
+	vector<Synapse> synapses(WIDTH * HEIGHT, Synapse(0.0f));
+	synapses[1] = Synapse(1.0f, 0);
+	synapses[2] = Synapse(2.0f, 0);
+	synapses[3] = Synapse(3.0f, 1);
+	synapses[10] = Synapse(4.0f, 0);
+	synapses[12] = Synapse(5.0f, 0);
+	synapses[13] = Synapse(6.0f, 0);
+	Stencil stencil;
+	stencil.build(&synapses[0], WIDTH, HEIGHT);
+	TEST_EQUAL(stencil.synapseCount(), WIDTH * HEIGHT);
+	TEST_EQUAL(stencil.activeSynapses(), 6);
+	TEST(fabs(stencil.prunedFraction() - 0.6f) < 1e-6f);
+	TEST_EQUAL(int(stencil.buckets().size()), 2);
+	TEST_EQUAL(int(stencil.runs().size()), 4);
+	TEST_EQUAL(stencil.buckets()[0].delay, 0);
+	TEST_EQUAL(stencil.buckets()[0].runEnd, 3);
+	TEST_EQUAL(stencil.buckets()[1].delay, 1);
+	TEST_EQUAL(stencil.buckets()[1].runBegin, 3);
+	TEST_EQUAL(stencil.runs()[0].rowOffset, -1);
+	TEST_EQUAL(stencil.runs()[0].colOffset, -1);
+	TEST_EQUAL(stencil.runs()[0].count, 2);
+	TEST_EQUAL(stencil.runs()[1].rowOffset, 1);
+	TEST_EQUAL(stencil.runs()[1].colOffset, -2);
+	TEST_EQUAL(stencil.runs()[2].colOffset, 0);
+	TEST_EQUAL(stencil.runs()[2].count, 2);
+	TEST_EQUAL(stencil.weights()[stencil.runs()[2].weights + 1], 6.0f);
+	TEST_EQUAL(stencil.runs()[3].rowOffset, -1);
+	TEST_EQUAL(stencil.runs()[3].colOffset, 1);
+	TEST_EQUAL(stencil.weights()[stencil.runs()[3].weights], 3.0f);
+
+	// The matrix knows when its weights have changed since it was compiled
+	SynapseMatrix matrix(this);
+	matrix.setSize(WIDTH, HEIGHT);
+	TEST(matrix.isCompiled());
+	TEST_EQUAL(matrix.stencil().activeSynapses(), WIDTH * HEIGHT);
+	TEST_EQUAL(int(matrix.stencil().runs().size()), HEIGHT);
+	for (int index = 0; index < WIDTH * HEIGHT; ++index)
+	{
+		matrix.begin()[index].weight = index == 7 ? 1.0f : 0.0f;
+	}
+	TEST(!matrix.isCompiled());
+	matrix.compile();
+	TEST(matrix.isCompiled());
+	TEST_EQUAL(matrix.stencil().activeSynapses(), 1);
+	matrix.setDelay(SynapseMatrix::DELAY_ONE);
+	TEST(matrix.isCompiled());
+	TEST_EQUAL(matrix.stencil().buckets()[0].delay, 1);
+}
+
+// Fire a layer through a stencil, with targets wrapping around every edge,
+// and compare with firing every synapse directly. Each firing neuron fires
+// at most once at each target, in the same order, so the totals are exact.
+// Gathering adds them up in a different order, but the weights are small
+// multiples of 0.5, which add up exactly in any order.
+void TestStencil::testFiring()
+{
+	TEST_SUB;
+	const int MATRIX_WIDTH = 11;
+	uint32_t hash = 3;
+	// As tall as the layer, so that every row wraps, and short enough for
+	// some rows of the layer to be interior rows
+	for (int matrixHeight : { LAYER_HEIGHT, 5 })
+	{
+		vector<Synapse> synapses(MATRIX_WIDTH * matrixHeight, Synapse(0.0f));
+		for (auto & synapse : synapses)
+		{
+			hash = hash * 1664525 + 1013904223;
+			if ((hash >> 16) % 3 != 0)
+			{
+				synapse = Synapse(float((hash >> 20) % 16) - 7.5f, (hash >> 12) % 3 == 0 ? 1 : 0);
+			}
+		}
+		compareFiring(synapses, MATRIX_WIDTH, matrixHeight, hash);
+	}
+}
+
+// The kernels specialised for small matrices must fire exactly the same
+// spikes as the general ones.
+void TestStencil::testFixed()
+{
+	TEST_SUB;
+	uint32_t hash = 5;
+	for (int size : { 1, 3, 5 })
+	{
+		vector<Synapse> synapses(size * size, Synapse(0.0f));
+		for (auto & synapse : synapses)
+		{
+			hash = hash * 1664525 + 1013904223;
+			if ((hash >> 16) % 4 != 0)
+			{
+				synapse = Synapse(float((hash >> 20) % 16) - 7.5f, 1);
+			}
+		}
+		synapses[0] = Synapse(1.0f, 1);
+		compareFiring(synapses, size, size, hash);
+	}
+}
+
+void TestStencil::compareFiring(const vector<Synapse> & synapses, int matrixWidth, int matrixHeight, uint32_t & hash)
+{
+	const int WIDTH = LAYER_WIDTH;
+	const int HEIGHT = LAYER_HEIGHT;
+	Stencil stencil;
+	stencil.build(&synapses[0], matrixWidth, matrixHeight);
+
+	int words = (WIDTH + 63) / 64;
+	vector<uint64_t> firing(words * HEIGHT);
+	StencilSpiker expect;
+	for (int row = 0; row < HEIGHT; ++row)
+	{
+		for (int col = 0; col < WIDTH; ++col)
+		{
+			hash = hash * 1664525 + 1013904223;
+			if ((hash >> 16) % 4 != 0)
+			{
+				continue;
+			}
+			firing[row * words + col / 64] |= uint64_t(1) << (col % 64);
+			for (int sr = 0; sr < matrixHeight; ++sr)
+			{
+				for (int sc = 0; sc < matrixWidth; ++sc)
+				{
+					int tr = (row + sr - matrixHeight / 2 + HEIGHT) % HEIGHT;
+					int tc = (col + sc - matrixWidth / 2 + WIDTH) % WIDTH;
+					const Synapse & synapse = synapses[sr * matrixWidth + sc];
+					if (synapse.weight != 0.0f)
+					{
+						expect.fire(Spike(), tr * WIDTH + tc, synapse.weight, synapse.delay);
+					}
+				}
+			}
+		}
+	}
+	// Firing zero weights makes no difference to the totals, only to how
+	// many of them there are
+	auto fullSize = [&](StencilSpiker & spiker)
+	{
+		for (auto & delay : spiker.mTotals)
+		{
+			delay.second.resize(WIDTH * HEIGHT);
+		}
+		return spiker.mTotals;
+	};
+
+	// Firing before and after preparing for the size of the layer
+	Spike spike;
+	for (bool prepared : { false, true })
+	{
+		if (prepared)
+		{
+			stencil.prepare(WIDTH, HEIGHT);
+		}
+		TEST_EQUAL(stencil.isPrepared(WIDTH, HEIGHT), prepared);
+		StencilSpiker fired;
+		for (int rowBegin = 0; rowBegin < HEIGHT; rowBegin += 5)
+		{
+			stencil.fire(spike, &fired, &firing[0], WIDTH, HEIGHT, rowBegin, min(HEIGHT, rowBegin + 5));
+		}
+		TEST(fullSize(fired) == fullSize(expect));
+	}
+
+	StencilSpiker gathered;
+	for (int rowBegin = 0; rowBegin < HEIGHT; rowBegin += 5)
+	{
+		stencil.gather(spike, &gathered, &firing[0], WIDTH, HEIGHT, rowBegin, min(HEIGHT, rowBegin + 5));
+	}
+	TEST(fullSize(gathered) == fullSize(expect));
+
+	// Preparation survives building the stencil again
+	stencil.build(&synapses[0], matrixWidth, matrixHeight);
+	TEST(stencil.isPrepared(WIDTH, HEIGHT));
+}
+
+Test::LifeRun TestStencil::ring(bool compile)
+{
+	const int WIDTH = 40;
+	const int HEIGHT = 24;
+	const int SIZE = 9;
+	LifeRun run;
+	run.width = WIDTH;
+	run.height = HEIGHT;
+	run.build = [compile](Automaton & automaton)
+	{
+		automaton.setFftPolicy(Automaton::FFT_NEVER);
+		auto layer = automaton.createLayer();
+
+		auto ring = automaton.createSynapse();
+		ring->setSource(layer);
+		ring->setTarget(layer);
+		ring->setSize(SIZE, SIZE);
+		ring->setDelay(SynapseMatrix::DELAY_LINEAR);
+		for (int sr = 0; sr < SIZE; ++sr)
+		{
+			for (int sc = 0; sc < SIZE; ++sc)
+			{
+				int radius = int(lround(sqrt(double((sr - SIZE / 2) * (sr - SIZE / 2) + (sc - SIZE / 2) * (sc - SIZE / 2)))));
+				ring->synapse(sc, sr)->weight = radius == 3 ? 0.25f : (radius == 4 ? -0.125f : 0.0f);
+			}
+		}
+		if (compile)
+		{
+			ring->compile();
+		}
+
+		uint32_t life[] = { 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0xFF, 0xFF, 0xFF, 0xFF };
+		auto neighbours = automaton.createSynapse();
+		neighbours->setSource(layer);
+		neighbours->setTarget(layer);
+		neighbours->loadImage(life, 3, 3, 1.0f);
+	};
+	run.before = [](Automaton & automaton, int tick)
+	{
+		for (int cell = tick % 3; cell < WIDTH * HEIGHT; cell += 3 + tick % 4)
+		{
+			automaton.layers()[0]->inject(cell % WIDTH, cell / WIDTH, 2.5f);
+		}
+	};
+	// The ring is the first matrix created
+	run.after = [this, compile](Automaton & automaton, int)
+	{
+		TEST(automaton.synapses()[0]->isCompiled() == compile);
+	};
+	return run;
+}
+
+// Firing through the stencil must give exactly the same spikes as firing
+// a matrix directly, which happens when it has changed since it was compiled.
+void TestStencil::testAutomaton()
+{
+	TEST_SUB;
+	testSchedules(ring(false), { ring(true), ring(false) });
+}
+
+vector<vector<uint32_t>> TestStencil::runCompact(SynapseMatrix::Encoding encoding, int width, vector<float> & weights)
+{
+	const int HEIGHT = 10;
+	const int SIZE = 9;
+	Automaton automaton;
+	automaton.setFftPolicy(Automaton::FFT_NEVER);
+	automaton.setSynapseEncoding(encoding);
+	automaton.setNetworkType("Life");
+	automaton.setSize(width, HEIGHT);
+	auto layer = automaton.createLayer();
+
+	auto ring = automaton.createSynapse();
+	ring->setSource(layer);
+	ring->setTarget(layer);
+	ring->setSize(SIZE, SIZE);
+	ring->setDelay(SynapseMatrix::DELAY_LINEAR);
+	for (int sr = 0; sr < SIZE; ++sr)
+	{
+		for (int sc = 0; sc < SIZE; ++sc)
+		{
+			int radius = int(lround(sqrt(double((sr - SIZE / 2) * (sr - SIZE / 2) + (sc - SIZE / 2) * (sc - SIZE / 2)))));
+			float weight = radius == 3 ? 0.25f : (radius == 4 ? -0.125f : 0.0f);
+			ring->synapse(sc, sr)->weight = weights.empty() ? weight : weights[sr * SIZE + sc];
+		}
+	}
+	ring->compile();
+	TEST_EQUAL(ring->encoding(), encoding);
+	TEST_EQUAL(ring->isCompact(), encoding == SynapseMatrix::ENCODING_COMPACT);
+	TEST(ring->isCompiled());
+	weights.clear();
+	for (int ss = 0; ss < SIZE * SIZE; ++ss)
+	{
+		weights.push_back(ring->firedSynapses()[ss].weight);
+	}
+
+	vector<vector<uint32_t>> images;
+	for (int tick = 0; tick < 12; ++tick)
+	{
+		for (int cell = tick % 3; cell < width * HEIGHT; cell += 2 + tick % 3)
+		{
+			layer->inject(cell % width, cell / width, 2.5f);
+		}
+		automaton.tick();
+		vector<uint32_t> image(width * HEIGHT);
+		layer->paintSpikes(&image[0]);
+		images.push_back(image);
+	}
+	return images;
+}
+
+// Compact synapses hold the weights of an 8 bit image exactly, keep zero
+// weights at zero, and fire the same spikes as the weights they decode to,
+// whether through the stencil or directly, while the synapses themselves
+// keep their full precision.
+void TestStencil::testCompact()
+{
+	TEST_SUB;
+	const int SIZE = 16;
+	vector<uint32_t> pixels(SIZE * SIZE);
+	for (int pp = 0; pp < SIZE * SIZE; ++pp)
+	{
+		pixels[pp] = pp % 256 * 0x010101;
+	}
+	SynapseMatrix image(this);
+	image.setEncoding(SynapseMatrix::ENCODING_COMPACT);
+	image.loadImage(&pixels[0], SIZE, SIZE, 2.0f);
+	TEST(image.isCompact());
+	TEST_EQUAL(image.compactScale().zero, 0);
+	const Stencil & stencil = image.stencil();
+	TEST(stencil.weights().empty());
+	TEST_EQUAL(stencil.activeSynapses(), SIZE * SIZE - 1);
+	for (int pp = 1; pp < SIZE * SIZE; ++pp)
+	{
+		TEST_EQUAL(int(stencil.codes()[pp - 1]), pp % 256);
+		TEST(fabs(image.firedSynapses()[pp].weight - 2.0f * float(pp % 256) / 255.0f) < 1.0e-5f);
+	}
+
+	// Signed weights are stored about a zero of 128, only the compiled
+	// weights are quantised, and compiling again changes nothing
+	SynapseMatrix sign(this, 3, 1);
+	sign.synapse(0, 0)->weight = -1.0f;
+	sign.synapse(1, 0)->weight = 0.0f;
+	sign.synapse(2, 0)->weight = 0.3f;
+	sign.setEncoding(SynapseMatrix::ENCODING_COMPACT);
+	TEST_EQUAL(sign.compactScale().zero, 128);
+	TEST_EQUAL(int(sign.stencil().codes()[0]), 1);
+	TEST_EQUAL(int(sign.stencil().codes()[1]), 128 + 38);
+	TEST_EQUAL(sign.synapse(2, 0)->weight, 0.3f);
+	float middle = sign.firedSynapses()[2].weight;
+	TEST(middle != 0.3f);
+	TEST(fabs(middle - 0.3f) < 0.5f / 127.0f);
+	TEST(sign.isCompiled());
+	sign.compile();
+	TEST_EQUAL(int(sign.stencil().codes()[1]), 128 + 38);
+	TEST_EQUAL(sign.firedSynapses()[2].weight, middle);
+
+	// A change which quantises to the same code is still a change once the
+	// weights are stored as floats again
+	sign.synapse(2, 0)->weight = 0.3001f;
+	TEST(sign.isCompiled());
+	sign.setEncoding(SynapseMatrix::ENCODING_FLOAT);
+	TEST(!sign.isCompact());
+	TEST_EQUAL(sign.firedSynapses()[2].weight, 0.3001f);
+	TEST_EQUAL(sign.stencil().weights()[1], 0.3001f);
+
+	// Firing through the stencil and directly, for a matrix larger than the
+	// layer, gives the same spikes as the quantised weights stored as floats
+	for (int width : { 12, 8 })
+	{
+		vector<float> weights;
+		auto compact = runCompact(SynapseMatrix::ENCODING_COMPACT, width, weights);
+		// The outer ring does not round exactly
+		TEST(fabs(weights[1 * 9 + 4] - 0.25f) < 1.0e-6f);
+		TEST(weights[4] != -0.125f);
+		TEST(runCompact(SynapseMatrix::ENCODING_FLOAT, width, weights) == compact);
+	}
+}
@@ -0,0 +1,47 @@
+#ifndef TEST_STENCIL_H
+#define TEST_STENCIL_H
+
+#include "Test.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "NeuronSim/Automaton.h"
+#include "NeuronSim/SynapseMatrix.h"
+
+class TestStencil : public Test, public SynapseMatrix::Listener
+{
+public:
+	TestStencil();
+	~TestStencil();
+
+	std::string name() { return "Stencil"; }
+	void run();
+
+private:
+	void testBuild();
+	void testFiring();
+	void testFixed();
+	void testAutomaton();
+	void testCompact();
+	void synapseMatrixChanged(SynapseMatrix * matrix) override {}
+
+	// The size of the layer compareFiring fires
+	static const int LAYER_WIDTH = 70;
+	static const int LAYER_HEIGHT = 12;
+	// Fire and gather a busy layer through a stencil built from the synapses,
+	// and test that the spikes are the same as firing each synapse directly
+	void compareFiring(const std::vector<Synapse> & synapses, int matrixWidth, int matrixHeight, uint32_t & hash);
+
+	// A Life layer with a mostly empty ring of synapses, which checks on
+	// every tick that the ring is compiled if and only if compile is set.
+	// Otherwise it is never compiled, so it has to be fired directly.
+	LifeRun ring(bool compile);
+	// Run a Life layer smaller than its ring of synapses, so that the matrix
+	// is always fired directly, with the synapses stored in the encoding.
+	// The weights the ring ends up with are returned in weights, and are
+	// used instead of the ring if weights is not empty to begin with.
+	std::vector<std::vector<uint32_t>> runCompact(SynapseMatrix::Encoding encoding, int width, std::vector<float> & weights);
+};
+
+#endif
@@ -0,0 +1,309 @@
+#include "TestThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <numeric>
+#include <vector>
+
+#include "NeuronSim/Automaton.h"
+#include "NeuronSim/Layer.h"
+#include "NeuronSim/SynapseMatrix.h"
+#include "NeuronSim/ThreadPool.h"
+
+using namespace std;
+
+TestThreadPool::TestThreadPool()
+{
+}
+
+TestThreadPool::~TestThreadPool()
+{
+}
+
+void TestThreadPool::run()
+{
+	Test::run();
+
+	testEveryTaskRuns();
+	testRepeatedBatches();
+	testException();
+	testGraph();
+	testBusyTimes();
+	testSchedulersMatch();
+	testBalancing();
+}
+
+// Every index in a batch must be executed exactly once, whatever the
+// number of threads.
+void TestThreadPool::testEveryTaskRuns()
+{
+	TEST_SUB;
+	for (int threads = 1; threads <= 4; ++threads)
+	{
+		ThreadPool pool(threads);
+		TEST_EQUAL(pool.threadCount(), threads);
+		for (int count : { 0, 1, 3, 100 })
+		{
+			vector<atomic<int>> counts(count);
+			for (auto & value : counts)
+			{
+				value = 0;
+			}
+			pool.run(count, [&counts](int index) { counts[index]++; });
+			bool once = true;
+			for (auto & value : counts)
+			{
+				once = once && (value == 1);
+			}
+			TEST(once);
+		}
+	}
+}
+
+// Lots of small batches in succession, which is how the automaton uses the
+// pool, must not lose or repeat tasks.
+void TestThreadPool::testRepeatedBatches()
+{
+	TEST_SUB;
+	ThreadPool pool(4);
+	atomic<int> total(0);
+	for (int batch = 0; batch < 1000; ++batch)
+	{
+		pool.run(batch % 7, [&total](int index) { total += index + 1; });
+	}
+	int expect = 0;
+	for (int batch = 0; batch < 1000; ++batch)
+	{
+		int count = batch % 7;
+		expect += count * (count + 1) / 2;
+	}
+	TEST_EQUAL(int(total), expect);
+
+	pool.setThreadCount(2);
+	TEST_EQUAL(pool.threadCount(), 2);
+	total = 0;
+	pool.run(10, [&total](int index) { total += 1; });
+	TEST_EQUAL(int(total), 10);
+}
+
+// An exception thrown by a task is passed back to the caller of run after
+// the rest of the batch has completed.
+void TestThreadPool::testException()
+{
+	TEST_SUB;
+	ThreadPool pool(3);
+	atomic<int> total(0);
+	bool caught = false;
+	try
+	{
+		pool.run(20, [&total](int index)
+		{
+			if (index == 5)
+			{
+				throw runtime_error("task failed");
+			}
+			++total;
+		});
+	}
+	catch (const runtime_error &)
+	{
+		caught = true;
+	}
+	TEST(caught);
+	TEST_EQUAL(int(total), 19);
+}
+
+// Every task of a graph must run exactly once, and never before every task
+// it waits for has finished, whatever the number of threads.
+void TestThreadPool::testGraph()
+{
+	TEST_SUB;
+	const int COUNT = 200;
+	ThreadPool::Graph graph;
+	graph.waits.assign(COUNT, 0);
+	graph.successors.assign(COUNT, {});
+	for (int task = 0; task < COUNT; ++task)
+	{
+		// A few tasks wait for nothing, and the rest for up to three earlier
+		// tasks each
+		for (int edge = 0; edge < task % 4; ++edge)
+		{
+			int before = (task * 7 + edge * 13) % task;
+			graph.successors[before].push_back(task);
+			++graph.waits[task];
+		}
+	}
+	for (int threads = 1; threads <= 4; ++threads)
+	{
+		ThreadPool pool(threads);
+		for (int batch = 0; batch < 20; ++batch)
+		{
+			atomic<int> clock(0);
+			vector<atomic<int>> started(COUNT);
+			vector<atomic<int>> finished(COUNT);
+			vector<atomic<int>> counts(COUNT);
+			for (int task = 0; task < COUNT; ++task)
+			{
+				counts[task] = 0;
+			}
+			pool.run(graph, [&](int index)
+			{
+				started[index] = clock++;
+				counts[index]++;
+				finished[index] = clock++;
+			});
+			bool once = true;
+			bool ordered = true;
+			for (int task = 0; task < COUNT; ++task)
+			{
+				once = once && (counts[task] == 1);
+				for (auto successor : graph.successors[task])
+				{
+					ordered = ordered && (finished[task] < started[successor]);
+				}
+			}
+			TEST(once);
+			TEST(ordered);
+		}
+	}
+}
+
+// The time spent in tasks is counted for each thread, so one long task
+// among several short ones leaves the busiest thread well above the mean.
+void TestThreadPool::testBusyTimes()
+{
+	TEST_SUB;
+	const int THREADS = 4;
+	ThreadPool pool(THREADS);
+	pool.resetBusyTimes();
+	pool.run(THREADS, [](int index)
+	{
+		if (index == 0)
+		{
+			this_thread::sleep_for(chrono::milliseconds(20));
+		}
+	});
+	auto times = pool.busyTimes();
+	TEST_EQUAL(int(times.size()), THREADS);
+	double total = accumulate(times.begin(), times.end(), 0.0);
+	double busiest = *max_element(times.begin(), times.end());
+	TEST(busiest >= 20.0);
+	TEST(busiest * THREADS / total > 2.0);
+
+	pool.resetBusyTimes();
+	times = pool.busyTimes();
+	TEST_EQUAL(accumulate(times.begin(), times.end(), 0.0), 0.0);
+}
+
+// The pooled scheduler must produce exactly the same spikes as the thread
+// per layer scheduler, even though it splits the layers into bands, and
+// gathering spikes must produce the same spikes as scattering them.
+void TestThreadPool::testSchedulersMatch()
+{
+	TEST_SUB;
+	const int SIZE = 64;
+	const Automaton::Scheduler schedulers[] =
+	{
+		Automaton::SCHEDULER_THREAD_PER_LAYER,
+		Automaton::SCHEDULER_POOL,
+		Automaton::SCHEDULER_FUSED
+	};
+	vector<vector<uint32_t>> images[6];
+	for (int pass = 0; pass < 6; ++pass)
+	{
+		Automaton automaton;
+		automaton.setScheduler(schedulers[pass % 3]);
+		automaton.setPropagation((pass / 3) ? Automaton::PROPAGATION_GATHER : Automaton::PROPAGATION_SCATTER);
+		automaton.setThreadCount(3);
+		automaton.setNetworkType("Life");
+		automaton.setSize(SIZE, SIZE);
+		auto layer1 = automaton.createLayer();
+		auto layer2 = automaton.createLayer();
+		uint32_t syn[] =
+		{
+			0xFF, 0xFF, 0xFF,
+			0xFF, 0x80, 0xFF,
+			0xFF, 0xFF, 0xFF,
+		};
+		for (auto source : { layer1, layer2 })
+		{
+			auto synapse = automaton.createSynapse();
+			synapse->setSource(source);
+			synapse->setTarget(source == layer1 ? layer2 : layer1);
+			synapse->loadImage(syn, 3, 3, 1.0f);
+		}
+		for (int cell = 0; cell < SIZE * SIZE; cell += 3)
+		{
+			layer1->inject(cell % SIZE, cell / SIZE, 3.0f);
+		}
+		automaton.tickN(10);
+		for (auto layer : automaton.layers())
+		{
+			vector<uint32_t> image(SIZE * SIZE);
+			layer->paintSpikes(&image[0]);
+			images[pass].push_back(image);
+		}
+	}
+	for (int pass = 1; pass < 6; ++pass)
+	{
+		TEST(images[0] == images[pass]);
+	}
+}
+
+// Splitting the layers into bands by activity must give exactly the same
+// spikes as splitting them by rows, as one layer becomes much busier than
+// the others and the bands are split again. Bands are split by rows unless
+// asked otherwise.
+void TestThreadPool::testBalancing()
+{
+	TEST_SUB;
+	const int SIZE = 64;
+	vector<vector<uint32_t>> images[2];
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		Automaton automaton;
+		TEST_EQUAL(automaton.balancing(), Automaton::BALANCE_BY_ROWS);
+		automaton.setBalancing(pass ? Automaton::BALANCE_BY_ACTIVITY : Automaton::BALANCE_BY_ROWS);
+		automaton.setThreadCount(3);
+		automaton.setNetworkType("Life");
+		automaton.setSize(SIZE, SIZE);
+		auto busy = automaton.createLayer();
+		auto quiet = automaton.createLayer();
+		uint32_t syn[] =
+		{
+			0xFF, 0xFF, 0xFF,
+			0xFF, 0x80, 0xFF,
+			0xFF, 0xFF, 0xFF,
+		};
+		for (auto target : { busy, quiet })
+		{
+			auto synapse = automaton.createSynapse();
+			synapse->setSource(busy);
+			synapse->setTarget(target);
+			synapse->loadImage(syn, 3, 3, 1.0f);
+		}
+		for (int tick = 0; tick < 10; ++tick)
+		{
+			if (tick == 3)
+			{
+				for (int cell = 0; cell < SIZE * SIZE; cell += 3)
+				{
+					busy->inject(cell % SIZE, cell / SIZE, 3.0f);
+				}
+			}
+			automaton.tick();
+			TEST(automaton.imbalance() >= 1.0f);
+			for (auto layer : automaton.layers())
+			{
+				vector<uint32_t> image(SIZE * SIZE);
+				layer->paintSpikes(&image[0]);
+				images[pass].push_back(image);
+			}
+		}
+		automaton.setScheduler(Automaton::SCHEDULER_THREAD_PER_LAYER);
+		automaton.tick();
+		TEST_EQUAL(automaton.imbalance(), 0.0f);
+	}
+	TEST(images[0] == images[1]);
+}
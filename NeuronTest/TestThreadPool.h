@@ -0,0 +1,25 @@
+#ifndef TEST_THREAD_POOL_H
+#define TEST_THREAD_POOL_H
+
+#include "Test.h"
+
+class TestThreadPool : public Test
+{
+public:
+	TestThreadPool();
+	~TestThreadPool();
+
+	std::string name() { return "ThreadPool"; }
+	void run();
+
+private:
+	void testEveryTaskRuns();
+	void testRepeatedBatches();
+	void testException();
+	void testGraph();
+	void testBusyTimes();
+	void testSchedulersMatch();
+	void testBalancing();
+};
+
+#endif
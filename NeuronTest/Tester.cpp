@@ -4,12 +4,18 @@
 
 #include "TestAutomaton.h"
 #include "TestConfigs.h"
+#include "TestFft.h"
 #include "TestLife.h"
 #include "TestMat33f.h"
 #include "TestNet.h"
 #include "TestPerformance.h"
+#include "TestPrecision.h"
+#include "TestSeparable.h"
+#include "TestSimd.h"
 #include "TestSpikeTrain.h"
 #include "TestStability.h"
+#include "TestStencil.h"
+#include "TestThreadPool.h"
 #include "TestVec3f.h"
 
 using namespace std;
@@ -19,10 +25,16 @@ Tester::Tester()
 	mTests.push_back([] { return make_shared<TestVec3f>(); });
 	mTests.push_back([] { return make_shared<TestMat33f>(); });
 	mTests.push_back([] { return make_shared<TestConfigs>(); });
+	mTests.push_back([] { return make_shared<TestThreadPool>(); });
 	mTests.push_back([] { return make_shared<TestSpikeTrain>(); });
+	mTests.push_back([] { return make_shared<TestSimd>(); });
+	mTests.push_back([] { return make_shared<TestFft>(); });
+	mTests.push_back([] { return make_shared<TestSeparable>(); });
+	mTests.push_back([] { return make_shared<TestStencil>(); });
 	mTests.push_back([] { return make_shared<TestNet>(); });
 	mTests.push_back([] { return make_shared<TestAutomaton>(); });
 	mTests.push_back([] { return make_shared<TestLife>(); });
+	mTests.push_back([] { return make_shared<TestPrecision>(); });
 	mTests.push_back([] { return make_shared<TestStability>(); });
 	mTests.push_back([] { return make_shared<TestPerformance>(); });
 }
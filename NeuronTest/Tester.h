@@ -15,6 +15,9 @@ public:
 	~Tester();
 
 	void run();
+	// Returns true if no test in the last run failed a check. Exceptions are
+	// reported but not counted, since they mostly come from missing data.
+	bool passed() const { return mFails == 0; }
 
 private:
 	std::vector<std::function<std::shared_ptr<Test>()>> mTests;